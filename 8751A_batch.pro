@@ -0,0 +1,31 @@
+QT       += core network sql
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Headless batch runner. Shares the instrument driver with the GUI but pulls in no widgets or charts.
+
+SOURCES += \
+    batchmain.cpp \
+    batchrunner.cpp \
+    hp8751a.cpp \
+    impedancekernels.cpp \
+    limitengine.cpp \
+    loopgainmetrics.cpp \
+    prologixgpib.cpp \
+    resultstore.cpp
+
+HEADERS += \
+    batchrunner.h \
+    hp8751a.h \
+    impedancekernels.h \
+    limitengine.h \
+    loopgainmetrics.h \
+    prologixgpib.h \
+    resultstore.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,14 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Times SweepEnvelope and checks the phase envelope at the ±180° wrap. No instrument needed.
+
+SOURCES += \
+    bench/envelope_bench.cpp \
+    sweepenvelope.cpp
+
+HEADERS += \
+    sweepenvelope.h
@@ -0,0 +1,11 @@
+CONFIG += c++17 console
+CONFIG -= app_bundle qt
+
+# Compares the AVX2 impedance kernels with the scalar reference and times both. Does not depend on Qt.
+
+SOURCES += \
+    bench/kernel_bench.cpp \
+    impedancekernels.cpp
+
+HEADERS += \
+    impedancekernels.h
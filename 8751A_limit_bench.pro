@@ -0,0 +1,18 @@
+QT       += core network
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Times LimitEngine and compares its AVX2 check with the scalar one. No instrument needed.
+
+SOURCES += \
+    bench/limit_bench.cpp \
+    impedancekernels.cpp \
+    limitengine.cpp \
+    loopgainmetrics.cpp
+
+HEADERS += \
+    impedancekernels.h \
+    limitengine.h \
+    loopgainmetrics.h
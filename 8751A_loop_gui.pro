@@ -1,4 +1,4 @@
-QT       += core gui network charts
+QT       += core gui network charts concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -10,28 +10,78 @@ CONFIG += c++17
 
 SOURCES += \
     calibratedialog.cpp \
+    callibrary.cpp \
+    circuitfit.cpp \
+    controlserver.cpp \
+    cwmonitordialog.cpp \
+    fixturedeembedding.cpp \
+    fixturedialog.cpp \
+    frequencyplanner.cpp \
     hp8751a.cpp \
     impedance.cpp \
+    impedancekernels.cpp \
+    impedanceviews.cpp \
+    limitengine.cpp \
     loopgain.cpp \
+    loopgainmetrics.cpp \
     main.cpp \
     networksettingsdialog.cpp \
+    oneportcal.cpp \
+    plannerdialog.cpp \
     prologixgpib.cpp \
-    startdialog.cpp
+    refinement.cpp \
+    segmenteditor.cpp \
+    startdialog.cpp \
+    stripbuffer.cpp \
+    sweepaverager.cpp \
+    sweepenvelope.cpp \
+    sweepshm.cpp \
+    tracemath.cpp \
+    tracestore.cpp \
+    zoomchartview.cpp \
+    zoomsweep.cpp
 
 HEADERS += \
     calibratedialog.h \
+    callibrary.h \
+    circuitfit.h \
+    controlserver.h \
+    cwmonitordialog.h \
+    fixturedeembedding.h \
+    fixturedialog.h \
+    frequencyplanner.h \
     hp8751a.h \
     impedance.h \
+    impedancekernels.h \
+    impedanceviews.h \
+    limitengine.h \
     loopgain.h \
+    loopgainmetrics.h \
     networksettingsdialog.h \
+    oneportcal.h \
+    plannerdialog.h \
     prologixgpib.h \
-    startdialog.h
+    refinement.h \
+    segmenteditor.h \
+    startdialog.h \
+    stripbuffer.h \
+    sweepaverager.h \
+    sweepenvelope.h \
+    sweepshm.h \
+    tracemath.h \
+    tracestore.h \
+    zoomchartview.h \
+    zoomsweep.h
 
 FORMS += \
     calibratedialog.ui \
+    cwmonitordialog.ui \
+    fixturedialog.ui \
     impedance.ui \
     loopgain.ui \
     networksettingsdialog.ui \
+    plannerdialog.ui \
+    segmenteditor.ui \
     startdialog.ui
 
 # Default rules for deployment.
@@ -39,6 +89,9 @@ qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
+# shm_open() lives in librt on older glibc
+unix:!macx: LIBS += -lrt
+
 RESOURCES += \
     res.qrc
 
@@ -0,0 +1,14 @@
+CONFIG += c++17 console
+CONFIG -= app_bundle qt
+
+# Throughput benchmark of the shared memory sweep ring (sweepshm). Does not depend on Qt.
+
+LIBS += -lpthread
+unix:!macx: LIBS += -lrt
+
+SOURCES += \
+    bench/shm_bench.cpp \
+    sweepshm.cpp
+
+HEADERS += \
+    sweepshm.h
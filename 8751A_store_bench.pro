@@ -0,0 +1,15 @@
+QT       += core sql
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Fills a result database in a temporary directory and times the queries of the batch tool.
+
+SOURCES += \
+    bench/store_bench.cpp \
+    resultstore.cpp
+
+HEADERS += \
+    loopgainmetrics.h \
+    resultstore.h
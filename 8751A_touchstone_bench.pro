@@ -0,0 +1,20 @@
+QT       += core network
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Imports Touchstone files into a fixture store in a temporary directory and times the import.
+
+SOURCES += \
+    bench/touchstone_bench.cpp \
+    fixturedeembedding.cpp \
+    impedancekernels.cpp \
+    tracemath.cpp \
+    tracestore.cpp
+
+HEADERS += \
+    fixturedeembedding.h \
+    impedancekernels.h \
+    tracemath.h \
+    tracestore.h
@@ -0,0 +1,141 @@
+#include "batchrunner.h"
+#include "resultstore.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QSysInfo>
+#include <QDebug>
+
+// Print the distribution of one metric in the result database
+static int run_query(ResultStore &store, const QString &metricName, const ResultStore::filter_t &filter)
+{
+    ResultStore::metric_t metric;
+    double frequency;
+    if (!ResultStore::parse_metric(metricName, metric, frequency)) {
+        qCritical().noquote() << "Unknown metric" << metricName;
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QVector<double> values;
+    int passed;
+    int checked;
+    QString error;
+    if (!store.values(metric, frequency, filter, values, error) || !store.yield(filter, passed, checked, error)) {
+        qCritical().noquote() << error;
+        return 1;
+    }
+    ResultStore::summary_t s = ResultStore::summarize(values);
+    qint64 elapsed = timer.elapsed();
+
+    qInfo().noquote() << QString("%1: %2 values").arg(metricName).arg(s.count);
+    if (s.count) {
+        qInfo().noquote() << QString("mean %1, stddev %2").arg(s.mean, 0, 'g', 6).arg(s.stddev, 0, 'g', 4);
+        qInfo().noquote() << QString("min %1, p5 %2, median %3, p95 %4, max %5")
+                             .arg(s.min, 0, 'g', 6).arg(s.p5, 0, 'g', 6).arg(s.median, 0, 'g', 6)
+                             .arg(s.p95, 0, 'g', 6).arg(s.max, 0, 'g', 6);
+    }
+    if (checked) {
+        qInfo().noquote() << QString("yield %1/%2").arg(passed).arg(checked);
+    }
+    qInfo().noquote() << QString("query took %1 ms").arg(elapsed);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("8751A_batch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless batch measurements with the HP 8751A");
+    parser.addHelpOption();
+    parser.addPositionalArgument("jobfile", "JSON file listing the sweeps to run");
+    QCommandLineOption configOption({"c", "config"}, "Network settings file.", "file", "config.ini");
+    QCommandLineOption outputOption({"o", "output"}, "Directory for the result files.", "dir", ".");
+    QCommandLineOption databaseOption({"d", "database"}, "Result database, created if it doesn't exist.", "file");
+    QCommandLineOption serialOption({"s", "serial"}, "Serial number of the DUT.", "serial");
+    QCommandLineOption lotOption({"l", "lot"}, "Lot of the DUT.", "lot");
+    QCommandLineOption stationOption("station", "Name of the test station (default: [Station] Name in the config or the host name).", "name");
+    QCommandLineOption queryOption({"q", "query"}, "Print the distribution of a metric in the database instead of measuring: "
+                                   "phase_margin, gain_margin, crossover, phase_crossover, magnitude@<Hz> or phase@<Hz>. "
+                                   "Serial, lot, station, --profile, --job, --from and --to select the rows.", "metric");
+    QCommandLineOption profileOption("profile", "Query: loopgain or impedance.", "profile");
+    QCommandLineOption jobOption("job", "Query: job name.", "name");
+    QCommandLineOption fromOption("from", "Query: first date (ISO 8601).", "date");
+    QCommandLineOption toOption("to", "Query: last date (ISO 8601).", "date");
+    parser.addOption(configOption);
+    parser.addOption(outputOption);
+    parser.addOption(databaseOption);
+    parser.addOption(serialOption);
+    parser.addOption(lotOption);
+    parser.addOption(stationOption);
+    parser.addOption(queryOption);
+    parser.addOption(profileOption);
+    parser.addOption(jobOption);
+    parser.addOption(fromOption);
+    parser.addOption(toOption);
+    parser.process(a);
+
+    ResultStore store;
+    if (parser.isSet(databaseOption)) {
+        QString error;
+        if (!store.open(parser.value(databaseOption), error)) {
+            qCritical().noquote() << error;
+            return 1;
+        }
+    }
+
+    if (parser.isSet(queryOption)) {
+        if (!store.is_open()) {
+            qCritical().noquote() << "A query needs a database";
+            return 1;
+        }
+        ResultStore::filter_t filter;
+        filter.serial = parser.value(serialOption);
+        filter.lot = parser.value(lotOption);
+        filter.station = parser.value(stationOption);
+        filter.profile = parser.value(profileOption);
+        filter.job = parser.value(jobOption);
+        filter.from = QDateTime::fromString(parser.value(fromOption), Qt::ISODate);
+        filter.to = QDateTime::fromString(parser.value(toOption), Qt::ISODate);
+        return run_query(store, parser.value(queryOption), filter);
+    }
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+
+    BatchRunner runner;
+    if (!runner.read_settings(parser.value(configOption))) {
+        qCritical().noquote() << "Could not read" << parser.value(configOption);
+        return 1;
+    }
+
+    QString error;
+    if (!runner.load_jobs(parser.positionalArguments().first(), error)) {
+        qCritical().noquote() << error;
+        return 1;
+    }
+    runner.set_output_dir(parser.value(outputOption));
+
+    if (store.is_open()) {
+        ResultStore::record_t identity;
+        identity.serial = parser.value(serialOption);
+        identity.lot = parser.value(lotOption);
+        identity.station = parser.value(stationOption);
+        if (identity.station.isEmpty()) {
+            QSettings settings(parser.value(configOption), QSettings::IniFormat);
+            identity.station = settings.value("Station/Name", QSysInfo::machineHostName()).toString();
+        }
+        runner.set_store(&store, identity);
+    }
+
+    QObject::connect(&runner, &BatchRunner::finished, &a, &QCoreApplication::exit, Qt::QueuedConnection);
+    runner.start();
+
+    return a.exec();
+}
@@ -0,0 +1,513 @@
+#include "batchrunner.h"
+#include <QSettings>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTimer>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+
+BatchRunner::BatchRunner(QObject *parent) : QObject(parent)
+{
+    currentJob = -1;
+    functionValid = false;
+    currentFunction = FUNC_LOOPGAIN;
+    settleTime = 0;
+    failedJobs = 0;
+    outputDir = ".";
+
+    gpib = new PrologixGPIB(this);
+    QObject::connect(gpib, &PrologixGPIB::stateChanged, this, &BatchRunner::gpib_state);
+    QObject::connect(gpib, &PrologixGPIB::disconnected, this, [=] {
+        abort("Connection lost!");
+    });
+}
+
+bool BatchRunner::read_settings(const QString &fileName)
+{
+    if (!QFile::exists(fileName)) {
+        return false;
+    }
+
+    QSettings settings(fileName, QSettings::IniFormat);
+    addr.setAddress(settings.value("Network/IP-Address").toString());
+    port = settings.value("Network/Port").toUInt();
+    gpibId = settings.value("Network/GPIB-ID").toUInt();
+    return true;
+}
+
+bool BatchRunner::load_jobs(const QString &fileName, QString &errorString)
+{
+    /* Job file layout (JSON, jobs are executed in file order):
+     * {
+     *     "settle_ms": 0,
+     *     "sweeps": [
+     *         {"name": "wide", "function": "loopgain", "start": 10, "stop": 10000000,
+     *          "points": 201, "ifbw": "1k", "averaging": 4, "power": -20,
+     *          "atten_r": false, "atten_a": false, "unwrap": false},
+     *         {"name": "check", "function": "loopgain", "ifbw": "1k",
+     *          "spots": [{"frequency": 1000, "magnitude": [20, 30], "phase": [-120, -60]},
+     *                    {"frequency": 20000}]},
+     *         {"name": "dut", "function": "loopgain", "start": 10, "stop": 1000000, "mask": "dut_mask.json"}
+     *     ]
+     * }
+     * Only start and stop are mandatory, everything else falls back to the GUI defaults.
+     * Spot jobs measure only the listed frequencies with a list sweep instead of start and stop.
+     * The limits are optional [min, max] pairs in dB and degrees.
+     * A mask checks every sweep against limit lines and a golden trace, see limitengine.h.
+     * Its path is relative to the job file.
+     */
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        errorString = QString("Could not open job file %1").arg(fileName);
+        return false;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (doc.isNull()) {
+        errorString = QString("Job file: %1").arg(parseError.errorString());
+        return false;
+    }
+
+    QJsonObject root = doc.object();
+    settleTime = root.value("settle_ms").toInt(0);
+
+    QJsonArray sweeps = root.value("sweeps").toArray();
+    if (sweeps.isEmpty()) {
+        errorString = "Job file contains no sweeps";
+        return false;
+    }
+
+    jobs.clear();
+    for (int i = 0; i < sweeps.size(); i++) {
+        QJsonObject obj = sweeps.at(i).toObject();
+        job_t job;
+
+        job.name = obj.value("name").toString(QString("sweep%1").arg(i + 1));
+
+        QString function = obj.value("function").toString("loopgain").toLower();
+        if (function == "loopgain") {
+            job.function = FUNC_LOOPGAIN;
+        } else if (function == "impedance") {
+            job.function = FUNC_IMPEDANCE;
+        } else {
+            errorString = QString("%1: unknown function \"%2\"").arg(job.name, function);
+            return false;
+        }
+
+        const bool spotJob = obj.contains("spots");
+        if (!spotJob && (!obj.contains("start") || !obj.contains("stop"))) {
+            errorString = QString("%1: start and stop frequency are required").arg(job.name);
+            return false;
+        }
+
+        job.param.fStart = obj.value("start").toDouble();
+        job.param.fStop = obj.value("stop").toDouble();
+        job.param.points = obj.value("points").toInt(201);
+        job.param.power = obj.value("power").toInt(-20);
+        job.param.clearPowerTrip = true;
+        job.param.attenR = obj.value("atten_r").toBool(false);
+        job.param.attenA = obj.value("atten_a").toBool(false);
+        job.param.unwrapPhase = obj.value("unwrap").toBool(false);
+
+        if (!parse_ifbw(obj.value("ifbw").toVariant().toString(), job.param.ifbw)) {
+            errorString = QString("%1: invalid IF bandwidth").arg(job.name);
+            return false;
+        }
+
+        quint16 averFact = obj.value("averaging").toInt(0);
+        job.param.avgEn = averFact > 1;
+        job.param.averFact = job.param.avgEn ? averFact : 1;
+
+        if (job.function == FUNC_IMPEDANCE) {
+            // The impedance window does not offer averaging either
+            job.param.avgEn = false;
+            job.param.averFact = 1;
+        }
+
+        if (spotJob) {
+            if (!parse_spots(obj.value("spots").toArray(), job, errorString)) {
+                return false;
+            }
+        } else if (job.param.fStart == 0 || job.param.fStop <= job.param.fStart) {
+            errorString = QString("%1: invalid frequency range").arg(job.name);
+            return false;
+        }
+
+        if (obj.contains("mask")) {
+            QString maskFile = obj.value("mask").toString();
+            if (QFileInfo(maskFile).isRelative()) {
+                maskFile = QFileInfo(fileName).dir().filePath(maskFile);
+            }
+            QString maskError;
+            if (!job.limits.load(maskFile, maskError)) {
+                errorString = QString("%1: %2").arg(job.name, maskError);
+                return false;
+            }
+        }
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+bool BatchRunner::parse_spots(const QJsonArray &array, job_t &job, QString &errorString)
+{
+    job.spots.clear();
+    for (const QJsonValue &value : array) {
+        QJsonObject obj = value.toObject();
+        spot_t spot;
+        spot.frequency = obj.value("frequency").toDouble();
+        if (spot.frequency <= 0) {
+            errorString = QString("%1: spot without valid frequency").arg(job.name);
+            return false;
+        }
+        if (!parse_limit(obj.value("magnitude"), spot.magnitudeLimit, spot.magnitudeMin, spot.magnitudeMax) ||
+            !parse_limit(obj.value("phase"), spot.phaseLimit, spot.phaseMin, spot.phaseMax)) {
+            errorString = QString("%1: limits at %2 Hz must be [min, max]").arg(job.name).arg(spot.frequency);
+            return false;
+        }
+        job.spots.append(spot);
+    }
+    if (job.spots.isEmpty() || job.spots.size() > HP8751A::MAX_POINTS) {
+        errorString = QString("%1: 1 to %2 spots are required").arg(job.name).arg(HP8751A::MAX_POINTS);
+        return false;
+    }
+
+    // The segments of the list sweep have to be ascending
+    std::sort(job.spots.begin(), job.spots.end(), [](const spot_t &a, const spot_t &b) {
+        return a.frequency < b.frequency;
+    });
+
+    // One segment with a single point per spot frequency
+    job.param.sweepType = HP8751A::SWEEP_LIST;
+    job.param.segments.clear();
+    for (const spot_t &spot : job.spots) {
+        quint32 f = std::round(spot.frequency);
+        if (!job.param.segments.isEmpty() && job.param.segments.last().fStart == f) {
+            errorString = QString("%1: duplicate spot frequency %2 Hz").arg(job.name).arg(f);
+            return false;
+        }
+        job.param.segments.append({f, f, 1, job.param.ifbw});
+    }
+    return true;
+}
+
+bool BatchRunner::parse_limit(const QJsonValue &value, bool &enabled, double &min, double &max)
+{
+    enabled = false;
+    min = 0;
+    max = 0;
+    if (value.isUndefined() || value.isNull()) {
+        return true;
+    }
+    QJsonArray limit = value.toArray();
+    if (limit.size() != 2 || !limit.at(0).isDouble() || !limit.at(1).isDouble()) {
+        return false;
+    }
+    enabled = true;
+    min = limit.at(0).toDouble();
+    max = limit.at(1).toDouble();
+    return min <= max;
+}
+
+void BatchRunner::set_store(ResultStore *store, const ResultStore::record_t &identity)
+{
+    this->store = store;
+    this->identity = identity;
+}
+
+void BatchRunner::set_output_dir(const QString &dir)
+{
+    outputDir = dir;
+    QDir().mkpath(outputDir);
+}
+
+void BatchRunner::start()
+{
+    hp = new HP8751A(gpib, gpibId, this);
+    QObject::connect(hp, &HP8751A::instrument_identification, this, &BatchRunner::instrument_identification);
+    QObject::connect(hp, &HP8751A::instrument_initialized, this, &BatchRunner::instrument_initialized);
+    QObject::connect(hp, &HP8751A::set_parameters_finished, this, &BatchRunner::set_parameters_finished);
+    QObject::connect(hp, &HP8751A::new_data, this, &BatchRunner::new_data);
+    QObject::connect(hp, &HP8751A::response_timeout, this, &BatchRunner::response_timeout);
+
+    qInfo().noquote() << QString("Connecting to %1:%2...").arg(addr.toString()).arg(port);
+    gpib->init(addr, port);
+}
+
+void BatchRunner::gpib_state(QAbstractSocket::SocketState state)
+{
+    switch (state) {
+    case QAbstractSocket::UnconnectedState:
+        if (currentJob < 0) {
+            abort("Could not connect to instrument!");
+        }
+        break;
+    case QAbstractSocket::ConnectedState:
+        hp->identify();
+        break;
+    default:
+        break;
+    }
+}
+
+void BatchRunner::instrument_identification(QString idn)
+{
+    if (!idn.contains("8751A")) {
+        abort("Instrument not found!");
+        return;
+    }
+    qInfo().noquote() << "Instrument found:" << idn.trimmed();
+    next_job();
+}
+
+void BatchRunner::instrument_initialized()
+{
+    hp->set_instrument_parameters(jobs.at(currentJob).param);
+}
+
+void BatchRunner::set_parameters_finished()
+{
+    // Only give the DUT time to settle if the job file asks for it
+    if (settleTime) {
+        QTimer::singleShot(settleTime, hp, &HP8751A::request_sweep);
+    } else {
+        hp->request_sweep();
+    }
+}
+
+void BatchRunner::new_data(HP8751A::instrument_data_t data)
+{
+    job_t &job = jobs[currentJob];
+    if (!job.spots.isEmpty()) {
+        bool pass;
+        if (!check_spots(job, data, pass)) {
+            abort(QString("%1: could not write result file").arg(job.name));
+            return;
+        }
+        pass &= check_mask(job, data);
+        if (!pass) {
+            failedJobs++;
+        }
+        if (!store_result(job, data, true, pass)) {
+            return;
+        }
+        qInfo().noquote() << QString("[%1/%2] %3 %4 in %5 ms")
+                             .arg(currentJob + 1).arg(jobs.size()).arg(job.name).arg(pass ? "PASS" : "FAIL").arg(jobTimer.elapsed());
+        next_job();
+        return;
+    }
+    if (!write_csv(job, data)) {
+        abort(QString("%1: could not write result file").arg(job.name));
+        return;
+    }
+    const bool pass = check_mask(job, data);
+    if (!pass) {
+        failedJobs++;
+    }
+    if (!store_result(job, data, job.limits.active(), pass)) {
+        return;
+    }
+    qInfo().noquote() << QString("[%1/%2] %3 done in %4 ms")
+                         .arg(currentJob + 1).arg(jobs.size()).arg(job.name).arg(jobTimer.elapsed());
+    next_job();
+}
+
+bool BatchRunner::store_result(const job_t &job, const HP8751A::instrument_data_t &data, bool hasVerdict, bool pass)
+{
+    if (!store) {
+        return true;
+    }
+    ResultStore::record_t record = identity;
+    record.profile = job.function == FUNC_LOOPGAIN ? "loopgain" : "impedance";
+    record.job = job.name;
+    record.timestamp = QDateTime::currentDateTimeUtc();
+    record.hasVerdict = hasVerdict;
+    record.pass = pass;
+    record.hasMetrics = job.function == FUNC_LOOPGAIN && job.spots.isEmpty();
+    if (record.hasMetrics) {
+        record.metrics = LoopgainMetrics::compute(data.stimulus.constData(), data.channel1.constData(),
+                                                  data.channel2.constData(), data.stimulus.size());
+    }
+    record.trace = QFileInfo(result_file(job)).absoluteFilePath();
+    // Spot values are stored with the requested frequency so queries can match them exactly
+    for (int i = 0; i < job.spots.size() && i < data.stimulus.size(); i++) {
+        record.spots.append({job.spots.at(i).frequency, data.channel1.at(i), data.channel2.at(i)});
+    }
+
+    QString errorString;
+    if (!store->add(record, errorString)) {
+        abort(QString("%1: %2").arg(job.name, errorString));
+        return false;
+    }
+    return true;
+}
+
+void BatchRunner::response_timeout()
+{
+    abort("No response from instrument!");
+}
+
+void BatchRunner::next_job()
+{
+    currentJob++;
+    if (currentJob >= jobs.size()) {
+        gpib->disconnect(this);
+        gpib->deinit();
+        // Distinguish failed limit checks from errors
+        emit finished(failedJobs ? 2 : 0);
+        return;
+    }
+
+    const job_t &job = jobs.at(currentJob);
+    jobTimer.start();
+
+    // Only rebuild the measurement function when it changes between jobs
+    if (functionValid && job.function == currentFunction) {
+        hp->set_instrument_parameters(job.param);
+        return;
+    }
+
+    currentFunction = job.function;
+    functionValid = true;
+    if (job.function == FUNC_LOOPGAIN) {
+        hp->init_function(HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_PHAS);
+    } else {
+        hp->init_function(HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_PHAS);
+    }
+}
+
+void BatchRunner::abort(const QString &reason)
+{
+    qCritical().noquote() << reason;
+    // Prevent further callbacks from the instrument
+    if (hp) {
+        hp->disconnect(this);
+    }
+    gpib->disconnect(this);
+    gpib->deinit();
+    emit finished(1);
+}
+
+QString BatchRunner::result_file(const job_t &job)
+{
+    return QString("%1/%2_%3.csv").arg(outputDir).arg(currentJob + 1, 3, 10, QChar('0')).arg(job.name);
+}
+
+bool BatchRunner::write_csv(const job_t &job, const HP8751A::instrument_data_t &data)
+{
+    QString fileName = result_file(job);
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream out(&file);
+
+    //Write header
+    out << "Frequency [Hz],Magnitude [dB],Phase [deg],complex number\r\n";
+
+    // Calculate complex number from magnitude and phase
+    for (int i = 0; i < data.stimulus.size(); i++) {
+        double magnitudeLin = std::pow(10, data.channel1.at(i) / 20);
+        double phaseRadian = data.channel2.at(i) * M_PI / 180;
+        double a = magnitudeLin * std::cos(phaseRadian);
+        double b = magnitudeLin * std::sin(phaseRadian);
+        out << QString("%1,%2,%3,%4%5%6j\r\n").arg(data.stimulus.at(i), 0, 'E').arg(data.channel1.at(i), 0, 'E')
+                   .arg(data.channel2.at(i), 0, 'E').arg(a, 0, 'E').arg(b > 0 ? "+" : "").arg(b, 0, 'E');
+    }
+
+    file.close();
+    return true;
+}
+
+bool BatchRunner::check_spots(const job_t &job, const HP8751A::instrument_data_t &data, bool &pass)
+{
+    QString fileName = result_file(job);
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream out(&file);
+
+    out << "Frequency [Hz],Magnitude [dB],Phase [deg],Result\r\n";
+
+    // The list sweep returns the spots in ascending order, one point each
+    pass = data.stimulus.size() == job.spots.size();
+    for (int i = 0; i < job.spots.size() && i < data.stimulus.size(); i++) {
+        const spot_t &spot = job.spots.at(i);
+        double magnitude = data.channel1.at(i);
+        double phase = data.channel2.at(i);
+        bool ok = true;
+        if (spot.magnitudeLimit && (magnitude < spot.magnitudeMin || magnitude > spot.magnitudeMax)) {
+            ok = false;
+        }
+        if (spot.phaseLimit) {
+            // The limits may be given on any 360° branch
+            double wrapped = LimitEngine::wrap_phase(phase, LimitEngine::phase_center(spot.phaseMin, spot.phaseMax));
+            if (wrapped < spot.phaseMin || wrapped > spot.phaseMax) {
+                ok = false;
+            }
+        }
+        pass &= ok;
+        out << QString("%1,%2,%3,%4\r\n").arg(data.stimulus.at(i), 0, 'E').arg(magnitude, 0, 'E').arg(phase, 0, 'E')
+                   .arg(ok ? "PASS" : "FAIL");
+        if (!ok) {
+            qInfo().noquote() << QString("    %1 Hz: %2 dB, %3 deg out of limits").arg(spot.frequency).arg(magnitude, 0, 'f', 2).arg(phase, 0, 'f', 1);
+        }
+    }
+
+    file.close();
+    return true;
+}
+
+bool BatchRunner::parse_ifbw(const QString &str, HP8751A::ifbw_t &ifbw)
+{
+    QString s = str.toLower().remove("hz").trimmed();
+    if (s.isEmpty() || s == "auto") {
+        ifbw = HP8751A::IFBW_AUTO;
+    } else if (s == "2") {
+        ifbw = HP8751A::IFBW_2HZ;
+    } else if (s == "20") {
+        ifbw = HP8751A::IFBW_20HZ;
+    } else if (s == "200") {
+        ifbw = HP8751A::IFBW_200HZ;
+    } else if (s == "1000" || s == "1k") {
+        ifbw = HP8751A::IFBW_1KHZ;
+    } else if (s == "4000" || s == "4k") {
+        ifbw = HP8751A::IFBW_4KHZ;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool BatchRunner::check_mask(job_t &job, const HP8751A::instrument_data_t &data)
+{
+    if (!job.limits.active()) {
+        return true;
+    }
+    const LimitEngine::verdict_t verdict = job.limits.evaluate(data);
+    const char *traces[LimitEngine::TRACE_COUNT] = {"magnitude", "phase"};
+    QString text = QString("%1: mask %2").arg(job.name, verdict.pass ? "PASS" : "FAIL");
+    if (verdict.firstIndex >= 0) {
+        text += QString(", first failure at %1 Hz (%2)").arg(verdict.firstFrequency).arg(traces[verdict.firstTrace]);
+    }
+    if (std::isfinite(verdict.worstDeviation)) {
+        text += QString(", worst deviation %1 at %2 Hz (%3)")
+                .arg(verdict.worstDeviation, 0, 'f', 2).arg(verdict.worstFrequency).arg(traces[verdict.worstTrace]);
+    }
+    if (verdict.marginFail) {
+        text += ", stability margin below limit";
+    }
+    qInfo().noquote() << text;
+    return verdict.pass;
+}
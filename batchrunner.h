@@ -0,0 +1,101 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <prologixgpib.h>
+#include "hp8751a.h"
+#include "limitengine.h"
+#include "resultstore.h"
+
+class BatchRunner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BatchRunner(QObject *parent = nullptr);
+
+    enum function_t {
+        FUNC_LOOPGAIN,
+        FUNC_IMPEDANCE
+    };
+
+    // One frequency of a spot job with optional limits
+    struct spot_t {
+        double frequency;
+        bool magnitudeLimit;
+        double magnitudeMin;
+        double magnitudeMax;
+        bool phaseLimit;
+        double phaseMin;
+        double phaseMax;
+    };
+
+    struct job_t {
+        QString name;
+        function_t function;
+        HP8751A::instrument_parameters_t param;
+        QVector<spot_t> spots; // Ascending, only for spot jobs. The list sweep has one point per spot.
+        LimitEngine limits; // Inactive without a mask
+    };
+
+    // Read network settings from the same ini file the GUI uses
+    bool read_settings(const QString &fileName);
+
+    // Parse the job file. Returns false and fills errorString on failure
+    bool load_jobs(const QString &fileName, QString &errorString);
+
+    void set_output_dir(const QString &dir);
+
+    // Add every result to the store. identity holds serial, lot and station of the DUT.
+    void set_store(ResultStore *store, const ResultStore::record_t &identity);
+
+    // Connect to the instrument and run all jobs back to back
+    void start();
+
+private:
+    PrologixGPIB *gpib = nullptr;
+    HP8751A *hp = nullptr;
+    QHostAddress addr;
+    quint16 port;
+    quint16 gpibId;
+
+    QVector<job_t> jobs;
+    qint32 currentJob;
+    bool functionValid;
+    function_t currentFunction;
+    quint32 settleTime; // ms between parameter update and sweep
+    QString outputDir;
+    QElapsedTimer jobTimer;
+    int failedJobs;
+    ResultStore *store = nullptr;
+    ResultStore::record_t identity;
+
+    void gpib_state(QAbstractSocket::SocketState state);
+    void instrument_identification(QString idn);
+    void instrument_initialized();
+    void set_parameters_finished();
+    void new_data(HP8751A::instrument_data_t data);
+    void response_timeout();
+
+    void next_job();
+    void abort(const QString &reason);
+    QString result_file(const job_t &job);
+    bool write_csv(const job_t &job, const HP8751A::instrument_data_t &data);
+    bool check_spots(const job_t &job, const HP8751A::instrument_data_t &data, bool &pass);
+    bool check_mask(job_t &job, const HP8751A::instrument_data_t &data);
+    bool store_result(const job_t &job, const HP8751A::instrument_data_t &data, bool hasVerdict, bool pass);
+
+    static bool parse_spots(const QJsonArray &array, job_t &job, QString &errorString);
+    static bool parse_limit(const QJsonValue &value, bool &enabled, double &min, double &max);
+
+    static bool parse_ifbw(const QString &str, HP8751A::ifbw_t &ifbw);
+
+signals:
+    void finished(int exitCode);
+};
+
+#endif // BATCHRUNNER_H
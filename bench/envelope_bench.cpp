@@ -0,0 +1,81 @@
+// Times SweepEnvelope and checks the phase envelope of sweeps that jitter around ±180°, over the whole
+// run and with a window. Returns 1 if a band spreads over the wrap. Usage: 8751A_envelope_bench [points] [sweeps]
+
+#include "../sweepenvelope.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// Jitter of the phase in degrees. Wrapped bands would be 360° wide, unwrapped ones a few times the jitter.
+static const double JITTER = 1.0;
+static const double MAX_WIDTH = 20 * JITTER;
+
+// Widest min/max and ±σ band of the envelope and the largest distance of its mean from center
+static bool check(const char *name, const SweepEnvelope &envelope, double center)
+{
+    QVector<float> min, max, sigmaLower, sigmaUpper;
+    envelope.bands(min, max, sigmaLower, sigmaUpper);
+    double range = 0;
+    double sigma = 0;
+    double offset = 0;
+    for (int i = 0; i < min.size(); i++) {
+        range = std::max(range, double(max.at(i) - min.at(i)));
+        sigma = std::max(sigma, double(sigmaUpper.at(i) - sigmaLower.at(i)) / 2);
+        double mean = (sigmaLower.at(i) + sigmaUpper.at(i)) / 2;
+        offset = std::max(offset, std::fabs(std::remainder(mean - center, 360.0)));
+    }
+    bool ok = !min.isEmpty() && range < MAX_WIDTH && sigma < 3 * JITTER && offset < 3 * JITTER;
+    std::printf("%-24s min/max %6.2f deg, sigma %5.2f deg, mean off by %5.3f deg%s\n",
+                name, range, sigma, offset, ok ? "" : " (WRONG)");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const int points = argc > 1 ? std::atoi(argv[1]) : 801;
+    const int sweeps = argc > 2 ? std::atoi(argv[2]) : 1000;
+    if (points < 1 || sweeps < 2) {
+        std::fprintf(stderr, "Usage: 8751A_envelope_bench [points] [sweeps]\n");
+        return 1;
+    }
+
+    // Phase as the instrument reports it (-180..180), every point jittering around the wrap
+    std::mt19937 generator(1);
+    std::normal_distribution<double> jitter(0, JITTER);
+    QVector<float> stimulus(points);
+    for (int i = 0; i < points; i++) {
+        stimulus[i] = 10 * std::pow(10.0, 5.0 * i / std::max(1, points - 1));
+    }
+    QVector<QVector<float>> phase(sweeps, QVector<float>(points));
+    for (QVector<float> &sweep : phase) {
+        for (int i = 0; i < points; i++) {
+            sweep[i] = std::remainder(180 + jitter(generator), 360.0);
+        }
+    }
+
+    SweepEnvelope run;
+    SweepEnvelope window;
+    window.set_window(16);
+    QElapsedTimer timer;
+    timer.start();
+    for (const QVector<float> &sweep : phase) {
+        run.add_phase(stimulus, sweep);
+    }
+    double runUs = timer.nsecsElapsed() / 1000.0 / sweeps;
+    timer.restart();
+    for (const QVector<float> &sweep : phase) {
+        window.add_phase(stimulus, sweep);
+    }
+    double windowUs = timer.nsecsElapsed() / 1000.0 / sweeps;
+
+    bool ok = check("whole run", run, 180);
+    ok &= check("window of 16", window, 180);
+    std::printf("%d points, %d sweeps: add_phase %.2f us per sweep, with a window of 16 %.2f us\n",
+                points, sweeps, runUs, windowUs);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,263 @@
+// Checks the AVX2 implementations of the zkernels against the scalar ones and times both.
+// Returns 1 if an output differs by more than the tolerance or is not finite.
+// Usage: 8751A_kernel_bench [points] [iterations]
+
+#include "../impedancekernels.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static const char *const NAMES[] = {
+    "resistance", "reactance", "inductance", "capacitance", "quality",
+    "dissipation", "esr", "conductance", "susceptance"
+};
+static constexpr int OUTPUTS = sizeof(NAMES) / sizeof(NAMES[0]);
+
+struct buffers_t {
+    std::vector<float> data[OUTPUTS];
+    zkernels::outputs_t out;
+
+    explicit buffers_t(std::size_t n)
+    {
+        for (std::vector<float> &d : data) {
+            d.resize(n);
+        }
+        out = {data[0].data(), data[1].data(), data[2].data(), data[3].data(), data[4].data(),
+               data[5].data(), data[6].data(), data[7].data(), data[8].data()};
+    }
+};
+
+// Largest error of a complex output relative to the magnitude of the scalar result, -1 if a value is not finite
+static double complex_error(const std::vector<float> &scalarRe, const std::vector<float> &scalarIm,
+                            const std::vector<float> &re, const std::vector<float> &im)
+{
+    double worst = 0;
+    for (std::size_t i = 0; i < re.size(); i++) {
+        if (!std::isfinite(re[i]) || !std::isfinite(im[i])) {
+            return -1;
+        }
+        double magnitude = std::hypot(scalarRe[i], scalarIm[i]);
+        double error = std::hypot(double(re[i]) - scalarRe[i], double(im[i]) - scalarIm[i]) / std::fmax(magnitude, 1e-30);
+        worst = std::fmax(worst, error);
+    }
+    return worst;
+}
+
+template<typename F>
+static double time_us(int iterations, F kernel)
+{
+    bench_clock::time_point start = bench_clock::now();
+    for (int n = 0; n < iterations; n++) {
+        kernel();
+    }
+    return std::chrono::duration<double>(bench_clock::now() - start).count() / iterations * 1e6;
+}
+
+static bool report(const char *kernel, double error, double tolerance, double scalarUs, double dispatchedUs)
+{
+    bool good = error >= 0 && error < tolerance;
+    std::printf("%-24s scalar %7.2f us, dispatched %7.2f us, max error %.3g%s\n", kernel, scalarUs,
+                dispatchedUs, error, good ? "" : " (DIFFERS)");
+    return good;
+}
+
+int main(int argc, char *argv[])
+{
+    std::size_t points = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1601;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    // Log sweep with impedances over many decades, including the corner cases X = 0, R = 0 and Z = 0
+    std::mt19937 rng(8751);
+    std::uniform_real_distribution<float> decade(-3.0f, 6.0f);
+    std::uniform_real_distribution<float> angle(-3.14159265f, 3.14159265f);
+    std::vector<float> frequency(points), re(points), im(points);
+    for (std::size_t i = 0; i < points; i++) {
+        frequency[i] = 5.0f * std::pow(10.0f, 8.0f * i / (points - 1));
+        float mag = std::pow(10.0f, decade(rng));
+        float phi = angle(rng);
+        re[i] = mag * std::cos(phi);
+        im[i] = mag * std::sin(phi);
+        switch (i % 16) {
+        case 3: im[i] = 0; break;
+        case 7: re[i] = 0; break;
+        case 11: re[i] = 0; im[i] = 0; break;
+        case 13: im[i] = -0.0f; re[i] = -re[i]; break;
+        default: break;
+        }
+    }
+
+    bool ok = true;
+    for (zkernels::model_t model : {zkernels::MODEL_SERIES, zkernels::MODEL_PARALLEL}) {
+        buffers_t scalar(points), dispatched(points);
+        zkernels::derive_scalar(frequency.data(), re.data(), im.data(), points, model, scalar.out);
+        zkernels::derive(frequency.data(), re.data(), im.data(), points, model, dispatched.out);
+
+        for (int k = 0; k < OUTPUTS; k++) {
+            double worst = 0;
+            std::size_t worstIndex = 0;
+            int nonFinite = 0;
+            for (std::size_t i = 0; i < points; i++) {
+                float a = scalar.data[k][i];
+                float b = dispatched.data[k][i];
+                if (!std::isfinite(a) || !std::isfinite(b)) {
+                    nonFinite++;
+                    continue;
+                }
+                // The AVX2 path multiplies by 1 / |Z|^2 and uses FMA, so allow a few ulp
+                double error = std::fabs(double(a) - b) / std::fmax(std::fabs(double(a)), 1e-30);
+                if (error > worst) {
+                    worst = error;
+                    worstIndex = i;
+                }
+            }
+            bool good = worst < 1e-5 && nonFinite == 0;
+            ok = ok && good;
+            if (!good) {
+                std::printf("%s %-12s max relative error %.3g at point %zu, %d not finite\n",
+                            model == zkernels::MODEL_SERIES ? "series  " : "parallel", NAMES[k],
+                            worst, worstIndex, nonFinite);
+            }
+        }
+    }
+    std::printf("AVX2 %s, outputs %s\n", zkernels::has_avx2() ? "used" : "not available",
+                ok ? "match the scalar implementation" : "DIFFER");
+
+    buffers_t out(points);
+    double best[2] = {1e9, 1e9};
+    for (int pass = 0; pass < 2; pass++) {
+        bench_clock::time_point start = bench_clock::now();
+        for (int n = 0; n < iterations; n++) {
+            if (pass == 0) {
+                zkernels::derive_scalar(frequency.data(), re.data(), im.data(), points, zkernels::MODEL_SERIES, out.out);
+            } else {
+                zkernels::derive(frequency.data(), re.data(), im.data(), points, zkernels::MODEL_SERIES, out.out);
+            }
+        }
+        best[pass] = std::chrono::duration<double>(bench_clock::now() - start).count() / iterations * 1e6;
+    }
+    std::printf("derive, %zu points: scalar %.2f us, dispatched %.2f us\n", points, best[0], best[1]);
+
+    // Reflection coefficients inside the unit circle and error terms of a typical fixture
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<float> gammaRe(points), gammaIm(points);
+    std::vector<float> e00Re(points), e00Im(points), e11Re(points), e11Im(points), e10e01Re(points), e10e01Im(points);
+    for (std::size_t i = 0; i < points; i++) {
+        float mag = std::fabs(unit(rng));
+        float phi = angle(rng);
+        gammaRe[i] = mag * std::cos(phi);
+        gammaIm[i] = mag * std::sin(phi);
+        e00Re[i] = 0.05f * unit(rng);
+        e00Im[i] = 0.05f * unit(rng);
+        e11Re[i] = 0.1f * unit(rng);
+        e11Im[i] = 0.1f * unit(rng);
+        e10e01Re[i] = 0.9f * std::cos(phi / 4);
+        e10e01Im[i] = 0.9f * std::sin(phi / 4);
+    }
+    const zkernels::error_terms_t terms = {e00Re.data(), e00Im.data(), e11Re.data(), e11Im.data(),
+                                           e10e01Re.data(), e10e01Im.data()};
+    std::vector<float> scalarRe(points), scalarIm(points), outRe(points), outIm(points);
+
+    zkernels::one_port_correct_scalar(gammaRe.data(), gammaIm.data(), terms, scalarRe.data(), scalarIm.data(), points);
+    zkernels::one_port_correct(gammaRe.data(), gammaIm.data(), terms, outRe.data(), outIm.data(), points);
+    double error = complex_error(scalarRe, scalarIm, outRe, outIm);
+    ok &= report("one_port_correct", error, 1e-5,
+                 time_us(iterations, [&] {
+                     zkernels::one_port_correct_scalar(gammaRe.data(), gammaIm.data(), terms, outRe.data(), outIm.data(), points);
+                 }),
+                 time_us(iterations, [&] {
+                     zkernels::one_port_correct(gammaRe.data(), gammaIm.data(), terms, outRe.data(), outIm.data(), points);
+                 }));
+
+    zkernels::reflection_to_impedance_scalar(gammaRe.data(), gammaIm.data(), 50, scalarRe.data(), scalarIm.data(), points);
+    zkernels::reflection_to_impedance(gammaRe.data(), gammaIm.data(), 50, outRe.data(), outIm.data(), points);
+    error = complex_error(scalarRe, scalarIm, outRe, outIm);
+    ok &= report("reflection_to_impedance", error, 1e-5,
+                 time_us(iterations, [&] {
+                     zkernels::reflection_to_impedance_scalar(gammaRe.data(), gammaIm.data(), 50, outRe.data(), outIm.data(), points);
+                 }),
+                 time_us(iterations, [&] {
+                     zkernels::reflection_to_impedance(gammaRe.data(), gammaIm.data(), 50, outRe.data(), outIm.data(), points);
+                 }));
+
+    // Trace math of the reflection coefficients with the tracking term
+    typedef void (*trace_math_t)(const float *, const float *, const float *, const float *, float *, float *, std::size_t);
+    const struct {
+        const char *name;
+        trace_math_t scalar;
+        trace_math_t dispatched;
+    } traceMath[] = {
+        {"complex_divide", zkernels::complex_divide_scalar, zkernels::complex_divide},
+        {"complex_subtract", zkernels::complex_subtract_scalar, zkernels::complex_subtract},
+        {"complex_multiply", zkernels::complex_multiply_scalar, zkernels::complex_multiply}
+    };
+    for (const auto &kernel : traceMath) {
+        kernel.scalar(gammaRe.data(), gammaIm.data(), e10e01Re.data(), e10e01Im.data(), scalarRe.data(), scalarIm.data(), points);
+        kernel.dispatched(gammaRe.data(), gammaIm.data(), e10e01Re.data(), e10e01Im.data(), outRe.data(), outIm.data(), points);
+        error = complex_error(scalarRe, scalarIm, outRe, outIm);
+        ok &= report(kernel.name, error, 1e-5,
+                     time_us(iterations, [&] {
+                         kernel.scalar(gammaRe.data(), gammaIm.data(), e10e01Re.data(), e10e01Im.data(), outRe.data(), outIm.data(), points);
+                     }),
+                     time_us(iterations, [&] {
+                         kernel.dispatched(gammaRe.data(), gammaIm.data(), e10e01Re.data(), e10e01Im.data(), outRe.data(), outIm.data(), points);
+                     }));
+    }
+
+    // Polar conversions: magnitudes over 300 dB, unwrapped phases over several turns and the special points of
+    // rect_to_polar (origin with signed zeros, negative real axis, subnormal and huge values)
+    std::vector<float> db(points), deg(points);
+    for (std::size_t i = 0; i < points; i++) {
+        db[i] = 150.0f * unit(rng);
+        deg[i] = 1000.0f * unit(rng);
+    }
+    zkernels::polar_to_rect_scalar(db.data(), deg.data(), scalarRe.data(), scalarIm.data(), points);
+    zkernels::polar_to_rect(db.data(), deg.data(), outRe.data(), outIm.data(), points);
+    error = complex_error(scalarRe, scalarIm, outRe, outIm);
+    ok &= report("polar_to_rect", error, 1e-5,
+                 time_us(iterations, [&] {
+                     zkernels::polar_to_rect_scalar(db.data(), deg.data(), outRe.data(), outIm.data(), points);
+                 }),
+                 time_us(iterations, [&] {
+                     zkernels::polar_to_rect(db.data(), deg.data(), outRe.data(), outIm.data(), points);
+                 }));
+
+    const float special[][2] = {{0, 0}, {-0.0f, 0}, {0, -0.0f}, {-0.0f, -0.0f}, {-1, 0}, {-1, -0.0f}, {1e-40f, -1e-40f},
+                                {-3e-39f, 2e-45f}, {1e18f, -1e18f}, {0, 1}, {0, -1}, {-2, 1e-7f}, {-2, -1e-7f}, {1, 1}};
+    std::vector<float> polarRe = scalarRe, polarIm = scalarIm;
+    for (std::size_t i = 0; i < points; i++) {
+        if (i % 8 == 5) {
+            const float *point = special[(i / 8) % (sizeof(special) / sizeof(special[0]))];
+            polarRe[i] = point[0];
+            polarIm[i] = point[1];
+        }
+    }
+    std::vector<float> scalarDb(points), scalarDeg(points);
+    zkernels::rect_to_polar_scalar(polarRe.data(), polarIm.data(), scalarDb.data(), scalarDeg.data(), points);
+    zkernels::rect_to_polar(polarRe.data(), polarIm.data(), db.data(), deg.data(), points);
+    // Absolute errors: dB and degrees. Infinite magnitudes of the origin have to match exactly.
+    double worst = 0;
+    for (std::size_t i = 0; i < points; i++) {
+        double dbError = std::isinf(scalarDb[i]) && scalarDb[i] == db[i] ? 0 : std::fabs(double(db[i]) - scalarDb[i]);
+        double degError = std::fabs(double(deg[i]) - scalarDeg[i]);
+        if (!(dbError <= 1e-4 && degError <= 1e-4)) {
+            std::printf("rect_to_polar %g%+gj: %g dB %g deg, scalar %g dB %g deg\n", polarRe[i], polarIm[i],
+                        db[i], deg[i], scalarDb[i], scalarDeg[i]);
+        }
+        worst = std::fmax(worst, std::fmax(dbError, degError));
+    }
+    ok &= report("rect_to_polar (dB, deg)", std::isnan(worst) ? -1 : worst, 1e-4,
+                 time_us(iterations, [&] {
+                     zkernels::rect_to_polar_scalar(polarRe.data(), polarIm.data(), db.data(), deg.data(), points);
+                 }),
+                 time_us(iterations, [&] {
+                     zkernels::rect_to_polar(polarRe.data(), polarIm.data(), db.data(), deg.data(), points);
+                 }));
+
+    return ok ? 0 : 1;
+}
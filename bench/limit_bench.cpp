@@ -0,0 +1,98 @@
+// Times the limit check of LimitEngine and checks the AVX2 path against the scalar one and the phase wrap.
+// Returns 1 if a check fails. Usage: 8751A_limit_bench [points] [iterations]
+
+#include "../limitengine.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static double time_us(QElapsedTimer &timer, int iterations)
+{
+    return timer.nsecsElapsed() / 1000.0 / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const int points = argc > 1 ? std::atoi(argv[1]) : 801;
+    const int iterations = argc > 2 ? std::atoi(argv[2]) : 100000;
+
+    // Loop gain like sweep from 10 Hz to 1 MHz, phase as the instrument reports it (-180..180)
+    HP8751A::instrument_data_t data;
+    data.stimulus.resize(points);
+    data.channel1.resize(points);
+    data.channel2.resize(points);
+    for (int i = 0; i < points; i++) {
+        double f = 10 * std::pow(10.0, 5.0 * i / (points - 1));
+        data.stimulus[i] = f;
+        data.channel1[i] = 40 - 20 * std::log10(f / 100 + 1);
+        data.channel2[i] = std::remainder(-90 - 120 * std::log10(f) / 6, 360.0);
+    }
+
+    LimitEngine::mask_t mask;
+    mask.upper[LimitEngine::TRACE_CHANNEL1] = {{10, 45}, {1e6, 0}};
+    mask.lower[LimitEngine::TRACE_CHANNEL1] = {{10, 35}, {1e3, 15}};
+    // Unwrapped phase. The sweep ends at +150° as reported, -210° unwrapped, and only passes if wrapped.
+    mask.upper[LimitEngine::TRACE_CHANNEL2] = {{10, -50}, {1e6, -50}};
+    mask.lower[LimitEngine::TRACE_CHANNEL2] = {{10, -250}, {1e6, -250}};
+    mask.tolerance[LimitEngine::TRACE_CHANNEL1] = 0;
+    mask.tolerance[LimitEngine::TRACE_CHANNEL2] = 0;
+    mask.phaseMarginLimit = false;
+    mask.phaseMarginMin = 0;
+    mask.gainMarginLimit = false;
+    mask.gainMarginMin = 0;
+    LimitEngine engine;
+    engine.set_mask(mask);
+
+    bool ok = true;
+
+    LimitEngine::verdict_t verdict = engine.evaluate(data);
+    if (!verdict.pass) {
+        std::printf("Wrapped phase failed an unwrapped mask at %g Hz\n", verdict.firstFrequency);
+        ok = false;
+    }
+
+    // Same answer from both implementations, also with failing points
+    const QVector<float> &lower = engine.lower(LimitEngine::TRACE_CHANNEL1);
+    const QVector<float> &upper = engine.upper(LimitEngine::TRACE_CHANNEL1);
+    QVector<float> y = data.channel1;
+    y[points / 3] += 30;
+    y[points / 2] -= 40;
+    float worst[2];
+    int worstIndex[2];
+    int first[2];
+    first[0] = LimitEngine::check_scalar(y.constData(), lower.constData(), upper.constData(), points, worst[0], worstIndex[0]);
+    first[1] = LimitEngine::check(y.constData(), lower.constData(), upper.constData(), points, worst[1], worstIndex[1]);
+    if (first[0] != first[1] || worst[0] != worst[1] || worstIndex[0] != worstIndex[1]) {
+        std::printf("check() differs from check_scalar(): first %d/%d, worst %g/%g at %d/%d\n",
+                    first[0], first[1], worst[0], worst[1], worstIndex[0], worstIndex[1]);
+        ok = false;
+    }
+
+    QElapsedTimer timer;
+    volatile int sink = 0;
+    timer.start();
+    for (int n = 0; n < iterations; n++) {
+        sink += LimitEngine::check_scalar(y.constData(), lower.constData(), upper.constData(), points, worst[0], worstIndex[0]);
+    }
+    double scalar = time_us(timer, iterations);
+    timer.start();
+    for (int n = 0; n < iterations; n++) {
+        sink += LimitEngine::check(y.constData(), lower.constData(), upper.constData(), points, worst[1], worstIndex[1]);
+    }
+    double dispatched = time_us(timer, iterations);
+    timer.start();
+    for (int n = 0; n < iterations; n++) {
+        sink += engine.evaluate(data).pass;
+    }
+    double evaluate = time_us(timer, iterations);
+    (void) sink;
+
+    std::printf("%d points: check_scalar %.2f us, check %.2f us, evaluate (2 traces, phase wrap) %.2f us\n",
+                points, scalar, dispatched, evaluate);
+    std::printf("Checks %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// Throughput of the shared memory sweep ring: one writer publishes sweeps as fast as it can while a reader
+// follows the newest sweep and copies it out. Usage: 8751A_shm_bench [points] [slots] [sweeps]
+
+#include "../sweepshm.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t points = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1601;
+    uint32_t slots = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+    uint32_t sweeps = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 200000;
+    const std::string name = "/hp8751a_shm_bench";
+
+    sweepshm::Writer writer;
+    if (!writer.open(name, slots, points)) {
+        std::fprintf(stderr, "Could not create %s\n", name.c_str());
+        return 1;
+    }
+    sweepshm::Reader reader;
+    if (!reader.open(name)) {
+        std::fprintf(stderr, "Could not open %s\n", name.c_str());
+        return 1;
+    }
+
+    std::vector<float> stimulus(points), channel1(points), channel2(points);
+    for (uint32_t i = 0; i < points; i++) {
+        stimulus[i] = 10e3f + i;
+        channel1[i] = -float(i) / points;
+        channel2[i] = float(i) / points;
+    }
+    const float scaleRef[4] = {10, 0, 45, 0};
+    sweepshm::parameters_t params = {};
+    params.points = points;
+
+    // Writer alone
+    bench_clock::time_point start = bench_clock::now();
+    for (uint32_t n = 0; n < sweeps; n++) {
+        writer.publish(stimulus.data(), channel1.data(), channel2.data(), points, scaleRef, params);
+    }
+    double elapsed = seconds_since(start);
+    double bytes = 3.0 * points * sizeof(float);
+    std::printf("publish:        %9.0f sweeps/s  %6.2f GB/s  %6.2f us/sweep\n",
+                sweeps / elapsed, sweeps * bytes / elapsed / 1e9, elapsed / sweeps * 1e6);
+
+    // Reader alone: map the newest sweep, copy it out and check the lock
+    std::vector<float> out(3 * std::size_t(points));
+    start = bench_clock::now();
+    uint64_t reads = 0;
+    for (uint32_t n = 0; n < sweeps; n++) {
+        sweepshm::view_t view;
+        if (!reader.acquire_latest(view)) {
+            continue;
+        }
+        std::memcpy(out.data(), view.stimulus, view.points * sizeof(float));
+        std::memcpy(out.data() + points, view.channel1, view.points * sizeof(float));
+        std::memcpy(out.data() + 2 * std::size_t(points), view.channel2, view.points * sizeof(float));
+        reads += reader.valid(view);
+    }
+    elapsed = seconds_since(start);
+    std::printf("copy out:       %9.0f sweeps/s  %6.2f GB/s  %6.2f us/sweep\n",
+                reads / elapsed, reads * bytes / elapsed / 1e9, elapsed / reads * 1e6);
+
+    // Writer and reader concurrently, needs a second core to be meaningful. The reader copies the newest sweep out and checks it afterwards.
+    std::atomic<bool> done(false);
+    uint64_t copied = 0, torn = 0, busy = 0;
+    std::thread consumer([&]() {
+        uint64_t last = 0;
+        while (!done.load(std::memory_order_relaxed)) {
+            uint64_t latest = reader.latest();
+            if (latest == last) {
+                continue;
+            }
+            sweepshm::view_t view;
+            if (!reader.acquire(latest, view)) {
+                busy++;
+                continue;
+            }
+            std::memcpy(out.data(), view.stimulus, view.points * sizeof(float));
+            std::memcpy(out.data() + points, view.channel1, view.points * sizeof(float));
+            std::memcpy(out.data() + 2 * std::size_t(points), view.channel2, view.points * sizeof(float));
+            if (!reader.valid(view)) {
+                torn++;
+                continue;
+            }
+            copied++;
+            last = latest;
+        }
+    });
+
+    uint64_t first = writer.sequence();
+    start = bench_clock::now();
+    for (uint32_t n = 0; n < sweeps; n++) {
+        writer.publish(stimulus.data(), channel1.data(), channel2.data(), points, scaleRef, params);
+    }
+    elapsed = seconds_since(start);
+    done = true;
+    consumer.join();
+    uint64_t published = writer.sequence() - first;
+    std::printf("with reader:    %9.0f sweeps/s  %6.2f GB/s  %6.2f us/sweep\n",
+                published / elapsed, published * bytes / elapsed / 1e9, elapsed / published * 1e6);
+    std::printf("reader copied:  %9llu sweeps, %llu torn, %llu slot busy\n",
+                (unsigned long long) copied, (unsigned long long) torn, (unsigned long long) busy);
+
+    reader.close();
+    writer.close();
+    return 0;
+}
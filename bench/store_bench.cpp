@@ -0,0 +1,112 @@
+// Fills a ResultStore in a temporary directory and times the queries of the batch tool on it.
+// Returns 1 if a query fails or returns the wrong number of rows.
+// Usage: 8751A_store_bench [rows] [lots] [iterations]
+
+#include "../resultstore.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+static const double SPOT_FREQUENCIES[] = {1e3, 1e4, 1e5};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const int rows = argc > 1 ? std::atoi(argv[1]) : 50000;
+    const int lots = argc > 2 ? std::atoi(argv[2]) : 50;
+    const int iterations = argc > 3 ? std::atoi(argv[3]) : 20;
+    if (rows < 1 || lots < 1 || iterations < 1) {
+        std::fprintf(stderr, "Usage: 8751A_store_bench [rows] [lots] [iterations]\n");
+        return 1;
+    }
+
+    QTemporaryDir dir;
+    ResultStore store;
+    QString errorString;
+    if (!dir.isValid() || !store.open(dir.filePath("results.sqlite"), errorString)) {
+        std::fprintf(stderr, "%s\n", qPrintable(errorString));
+        return 1;
+    }
+
+    // One row per unit as the batch tool adds them, lots are measured one after the other
+    QElapsedTimer timer;
+    timer.start();
+    const QDateTime start = QDateTime::currentDateTimeUtc();
+    for (int i = 0; i < rows; i++) {
+        ResultStore::record_t record;
+        record.serial = QString("SN%1").arg(i, 6, 10, QChar('0'));
+        record.lot = QString("LOT%1").arg(i * lots / rows);
+        record.station = QString("ST%1").arg(i % 4);
+        record.profile = "loopgain";
+        record.job = "bench";
+        record.timestamp = start.addSecs(i);
+        record.hasVerdict = true;
+        record.pass = i % 20 != 0;
+        record.hasMetrics = true;
+        record.metrics.crossoverValid = true;
+        record.metrics.crossoverFrequency = 20e3 + i % 1000;
+        record.metrics.phaseMargin = 45 + (i % 200) / 10.0;
+        record.metrics.phaseCrossoverValid = true;
+        record.metrics.phaseCrossoverFrequency = 150e3 + i % 1000;
+        record.metrics.gainMargin = 10 + (i % 100) / 10.0;
+        record.trace = dir.filePath(QString("traces/%1.csv").arg(record.serial));
+        for (double frequency : SPOT_FREQUENCIES) {
+            record.spots.append({frequency, 40 - frequency / 1e4, -90 - frequency / 1e3});
+        }
+        if (!store.add(record, errorString)) {
+            std::fprintf(stderr, "%s\n", qPrintable(errorString));
+            return 1;
+        }
+    }
+    std::printf("%d rows, %d lots: add %.3f ms per row\n", rows, lots, timer.nsecsElapsed() / 1e6 / rows);
+
+    // The lot in the middle, its size follows from the assignment above
+    ResultStore::filter_t filter;
+    const int lot = lots / 2;
+    filter.lot = QString("LOT%1").arg(lot);
+    int expected = 0;
+    for (int i = 0; i < rows; i++) {
+        expected += i * lots / rows == lot;
+    }
+
+    bool ok = true;
+    auto run = [&](const char *name, const std::function<bool(int &)> &query) {
+        int count = 0;
+        timer.restart();
+        for (int i = 0; i < iterations; i++) {
+            if (!query(count)) {
+                std::fprintf(stderr, "%s: %s\n", name, qPrintable(errorString));
+                ok = false;
+                return;
+            }
+        }
+        double ms = timer.nsecsElapsed() / 1e6 / iterations;
+        std::printf("%-24s %8.3f ms, %d rows%s\n", name, ms, count, count == expected ? "" : " (WRONG)");
+        ok &= count == expected;
+    };
+    run("phase_margin of a lot", [&](int &count) {
+        QVector<double> values;
+        bool success = store.values(ResultStore::METRIC_PHASE_MARGIN, 0, filter, values, errorString);
+        ResultStore::summarize(values);
+        count = values.size();
+        return success;
+    });
+    run("magnitude@1e4 of a lot", [&](int &count) {
+        QVector<double> values;
+        bool success = store.values(ResultStore::METRIC_SPOT_MAGNITUDE, 1e4, filter, values, errorString);
+        ResultStore::summarize(values);
+        count = values.size();
+        return success;
+    });
+    run("yield of a lot", [&](int &count) {
+        int passed;
+        return store.yield(filter, passed, count, errorString);
+    });
+
+    store.close();
+    return ok ? 0 : 1;
+}
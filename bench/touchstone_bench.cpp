@@ -0,0 +1,149 @@
+// Imports Touchstone files into a fixture store in a temporary directory: records wrapped over two lines,
+// the noise block of Touchstone 1 and an incomplete last record, then times the import of a long file.
+// Returns 1 if a file is imported wrong. Usage: 8751A_touchstone_bench [points]
+
+#include "../fixturedeembedding.h"
+#include "../tracestore.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+typedef std::complex<double> cplx;
+
+static bool write_file(const QString &fileName, const QString &contents)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream(&file) << contents;
+    return true;
+}
+
+// Imports contents and compares the stored fixture with the expected frequencies and S21 in RI
+static bool check(const char *name, const QString &contents, const QVector<double> &frequency, const QVector<cplx> &s21)
+{
+    QString errorString;
+    const QString fileName = QString("%1.s2p").arg(name);
+    bool ok = write_file(fileName, contents) && FixtureDeembedding::import_touchstone(fileName, name, errorString);
+    QVector<double> storedFrequency;
+    QVector<cplx> storedS21;
+    ok = ok && TraceStore::load_trace("deembedding", name, storedFrequency, storedS21);
+    ok = ok && storedFrequency == frequency && storedS21.size() == s21.size();
+    for (int i = 0; ok && i < s21.size(); i++) {
+        ok = std::abs(storedS21.at(i) - s21.at(i)) < 1e-9;
+    }
+    std::printf("%-28s %d points%s %s\n", name, storedFrequency.size(), ok ? "" : " (WRONG)", qPrintable(errorString));
+    return ok;
+}
+
+// Imports contents and expects an error
+static bool check_error(const char *name, const QString &contents)
+{
+    QString errorString;
+    const QString fileName = QString("%1.s2p").arg(name);
+    bool ok = write_file(fileName, contents) && !FixtureDeembedding::import_touchstone(fileName, name, errorString);
+    std::printf("%-28s %s%s\n", name, qPrintable(errorString), ok ? "" : " (WRONG)");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const int points = argc > 1 ? std::atoi(argv[1]) : 10001;
+    if (points < 2) {
+        std::fprintf(stderr, "Usage: 8751A_touchstone_bench [points]\n");
+        return 1;
+    }
+
+    // The store lives in the working directory
+    const QString workingDir = QDir::currentPath();
+    QTemporaryDir dir;
+    if (!dir.isValid() || !QDir::setCurrent(dir.path())) {
+        std::fprintf(stderr, "Could not create a temporary directory\n");
+        return 1;
+    }
+
+    const QVector<double> frequency = {1e6, 2e6, 3e6};
+    const QVector<cplx> s21 = {cplx(0.9, -0.1), cplx(0.8, -0.2), cplx(0.7, -0.3)};
+    bool ok = true;
+
+    // Every record as 5 + 4 values, the 5 values of a record look like a noise line
+    ok &= check("wrapped records",
+                "# MHz S RI R 50\n"
+                "1 0.1 0.0 0.9 -0.1\n"
+                "  0.9 -0.1 0.1 0.0\n"
+                "2 0.1 0.0 0.8 -0.2\n"
+                "  0.8 -0.2 0.1 0.0\n"
+                "3 0.1 0.0 0.7 -0.3\n"
+                "  0.7 -0.3 0.1 0.0\n",
+                frequency, s21);
+
+    // The noise block starts again at a lower frequency, with five values per line
+    ok &= check("wrapped records with noise",
+                "! Comment\n"
+                "# MHz S RI R 50\n"
+                "1 0.1 0.0 0.9 -0.1\n"
+                "  0.9 -0.1 0.1 0.0\n"
+                "2 0.1 0.0 0.8 -0.2 ! Comment\n"
+                "  0.8 -0.2 0.1 0.0\n"
+                "3 0.1 0.0 0.7 -0.3\n"
+                "  0.7 -0.3 0.1 0.0\n"
+                "1 1.5 0.5 10 0.3\n"
+                "3 1.8 0.6 20 0.3\n",
+                frequency, s21);
+
+    // One record per line, the noise block starts at the last frequency
+    ok &= check("records with noise",
+                "# MHz S RI R 50\n"
+                "1 0.1 0.0 0.9 -0.1 0.9 -0.1 0.1 0.0\n"
+                "2 0.1 0.0 0.8 -0.2 0.8 -0.2 0.1 0.0\n"
+                "3 0.1 0.0 0.7 -0.3 0.7 -0.3 0.1 0.0\n"
+                "3 1.8 0.6 20 0.3\n",
+                frequency, s21);
+
+    ok &= check_error("incomplete last record",
+                      "# MHz S RI R 50\n"
+                      "1 0.1 0.0 0.9 -0.1 0.9 -0.1 0.1 0.0\n"
+                      "2 0.1 0.0 0.8 -0.2\n");
+    ok &= check_error("incomplete record before end",
+                      "[Version] 2.0\n"
+                      "# MHz S RI R 50\n"
+                      "[Number of Ports] 2\n"
+                      "[Network Data]\n"
+                      "1 0.1 0.0 0.9 -0.1 0.9 -0.1 0.1 0.0\n"
+                      "2 0.1 0.0 0.8 -0.2\n"
+                      "[End]\n");
+
+    // Long file in dB/angle, wrapped as above
+    QString contents = "# Hz S DB R 50\n";
+    for (int i = 0; i < points; i++) {
+        double f = 1e3 * std::pow(10.0, 6.0 * i / (points - 1));
+        contents += QString("%1 -40 0 -0.5 %2\n  -0.5 %2 -40 0\n").arg(f, 0, 'g', 15).arg(-f / 1e7, 0, 'g', 15);
+    }
+    if (!write_file("long.s2p", contents)) {
+        std::fprintf(stderr, "Could not write long.s2p\n");
+        return 1;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    QString errorString;
+    bool imported = FixtureDeembedding::import_touchstone("long.s2p", "long", errorString);
+    double ms = timer.nsecsElapsed() / 1e6;
+    QVector<double> longFrequency;
+    QVector<cplx> longS21;
+    imported = imported && TraceStore::load_trace("deembedding", "long", longFrequency, longS21) && longFrequency.size() == points;
+    std::printf("%d points: import %.1f ms%s %s\n", points, ms, imported ? "" : " (WRONG)", qPrintable(errorString));
+    ok &= imported;
+
+    // Leave the temporary directory, so it can be removed
+    QDir::setCurrent(workingDir);
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "calibratedialog.h"
 #include "ui_calibratedialog.h"
+#include "callibrary.h"
 
 CalibrateDialog::CalibrateDialog(HP8751A *hp, QWidget *parent)
     : QDialog(parent)
@@ -10,7 +11,35 @@ CalibrateDialog::CalibrateDialog(HP8751A *hp, QWidget *parent)
     ui->lStatus->setText("Updating parameters...");
     disable_gui();
     this->hp = hp;
-    QObject::connect(hp, &HP8751A::cal_done, this, &CalibrateDialog::cal_done);
+    calInitialized = false;
+    calRestored = false;
+    hostPending = false;
+    QObject::connect(hp, &HP8751A::cal_std_done, this, &CalibrateDialog::cal_std_done);
+    QObject::connect(hp, &HP8751A::cal_plan_done, this, &CalibrateDialog::cal_plan_done);
+    QObject::connect(hp, &HP8751A::new_data, this, &CalibrateDialog::new_data);
+    QObject::connect(hp, &HP8751A::cal_restored, this, [=] {
+        calRestored = true;
+        QDialog::accept();
+    });
+
+    update_fixtures();
+}
+
+void CalibrateDialog::update_fixtures()
+{
+    QString current = ui->fixture->currentText();
+    ui->fixture->clear();
+    if (host_correction()) {
+        ui->fixture->addItems(OnePortCal::stored_fixtures());
+    } else {
+        ui->fixture->addItems(CalLibrary::fixtures());
+    }
+    ui->fixture->setCurrentText(current);
+}
+
+QString CalibrateDialog::fixture_name() const
+{
+    return ui->fixture->currentText().trimmed();
 }
 
 CalibrateDialog::~CalibrateDialog()
@@ -21,62 +50,187 @@ CalibrateDialog::~CalibrateDialog()
 void CalibrateDialog::init()
 {
     enable_gui();
-    hp->init_cal();
+    // The instrument calibration is only started when it is used
+    if (!host_correction() && !calInitialized) {
+        hp->init_cal();
+        calInitialized = true;
+    }
 }
 
-void CalibrateDialog::on_btnOpen_clicked()
+bool CalibrateDialog::host_correction() const
 {
-    if (hp) {
-        hp->measure_cal_std(HP8751A::CAL_OPEN);
-        ui->lStatus->setText("Sweeping...");
-        lastCalStd = HP8751A::CAL_OPEN;
-        disable_gui();
+    return ui->hostCorrection->isChecked();
+}
+
+void CalibrateDialog::accept()
+{
+    if (host_correction() && !hostCal.is_valid()) {
+        QString fixture = fixture_name();
+        if (fixture.isEmpty()) {
+            ui->lStatus->setText("Enter a fixture name!");
+            return;
+        }
+        if (hostRaw[HP8751A::CAL_OPEN].isEmpty() || hostRaw[HP8751A::CAL_SHORT].isEmpty() || hostRaw[HP8751A::CAL_LOAD].isEmpty()) {
+            ui->lStatus->setText("Measure all standards first!");
+            return;
+        }
+        if (!hostCal.compute(fixture, hostFrequency, hostRaw[HP8751A::CAL_OPEN], hostRaw[HP8751A::CAL_SHORT], hostRaw[HP8751A::CAL_LOAD])) {
+            ui->lStatus->setText("Sweep changed between standards!");
+            return;
+        }
+        if (!hostCal.save()) {
+            ui->lStatus->setText("Could not write calibration file!");
+        }
     }
+    QDialog::accept();
 }
 
-void CalibrateDialog::on_btnShort_clicked()
+void CalibrateDialog::measure(HP8751A::cal_std_t cal)
 {
-    if (hp) {
-        hp->measure_cal_std(HP8751A::CAL_SHORT);
+    if (!hp) {
+        return;
+    }
+
+    if (host_correction()) {
+        // Regular sweep without refinement, the raw data is captured in new_data()
+        hp->set_refinement(nullptr, 0);
+        hostPending = true;
+        lastCalStd = cal;
+        hostTimer.start();
+        hp->request_sweep();
         ui->lStatus->setText("Sweeping...");
-        lastCalStd = HP8751A::CAL_SHORT;
         disable_gui();
+        return;
     }
+
+    // The sequencer queues the standard if another one is still being measured,
+    // so the other buttons stay available
+    hp->measure_cal_std(cal, ui->calAverages->value());
+    std_label(cal)->setStyleSheet("");
+    std_button(cal)->setEnabled(false);
+    ui->btnUseStored->setEnabled(false);
+    ui->buttonBox->setEnabled(false);
+    ui->lStatus->setText("Measuring...");
+}
+
+void CalibrateDialog::new_data(HP8751A::instrument_data_t data)
+{
+    if (!hostPending) {
+        return;
+    }
+    hostPending = false;
+
+    // All standards have to be measured on the same grid
+    if (hostFrequency != data.stimulus) {
+        for (QVector<float> &raw : hostRaw) {
+            raw.clear();
+        }
+        ui->lOpen->setStyleSheet("");
+        ui->lShort->setStyleSheet("");
+        ui->lLoad->setStyleSheet("");
+        hostFrequency = data.stimulus;
+    }
+    hostRaw[lastCalStd] = data.raw;
+    cal_std_done(lastCalStd, hostTimer.elapsed());
+    cal_plan_done();
+}
+
+void CalibrateDialog::on_btnOpen_clicked()
+{
+    measure(HP8751A::CAL_OPEN);
+}
+
+void CalibrateDialog::on_btnShort_clicked()
+{
+    measure(HP8751A::CAL_SHORT);
 }
 
 void CalibrateDialog::on_btnLoad_clicked()
 {
-    if (hp) {
-        hp->measure_cal_std(HP8751A::CAL_LOAD);
-        ui->lStatus->setText("Sweeping...");
-        lastCalStd = HP8751A::CAL_LOAD;
-        disable_gui();
+    measure(HP8751A::CAL_LOAD);
+}
+
+void CalibrateDialog::on_btnUseStored_clicked()
+{
+    if (host_correction()) {
+        if (hostCal.load(fixture_name())) {
+            QDialog::accept();
+        } else {
+            ui->lStatus->setText("No stored calibration!");
+        }
+        return;
     }
+
+    // Instrument calibration: only valid for the same frequency plan and IFBW
+    HP8751A::instrument_parameters_t param;
+    hp->get_parameters(param);
+    HP8751A::cal_coefficients_t coefficients;
+    if (!CalLibrary::find(fixture_name(), param, coefficients)) {
+        ui->lStatus->setText("No stored calibration for this sweep!");
+        return;
+    }
+    disable_gui();
+    ui->lStatus->setText("Uploading calibration...");
+    hp->write_cal_coefficients(coefficients);
 }
 
-void CalibrateDialog::cal_done()
+void CalibrateDialog::on_hostCorrection_toggled(bool checked)
 {
-    enable_gui();
-    switch (lastCalStd) {
-    case HP8751A::CAL_OPEN:
-        ui->lOpen->setStyleSheet("color: green;");
-        break;
+    update_fixtures();
+    ui->calAverages->setEnabled(!checked);
+    hp->set_raw_data(checked);
+    if (!checked && !calInitialized) {
+        hp->init_cal();
+        calInitialized = true;
+    }
+}
+
+QPushButton *CalibrateDialog::std_button(HP8751A::cal_std_t cal)
+{
+    switch (cal) {
+    case HP8751A::CAL_SHORT:
+        return ui->btnShort;
+    case HP8751A::CAL_LOAD:
+        return ui->btnLoad;
+    default:
+        return ui->btnOpen;
+    }
+}
+
+QLabel *CalibrateDialog::std_label(HP8751A::cal_std_t cal)
+{
+    switch (cal) {
     case HP8751A::CAL_SHORT:
-        ui->lShort->setStyleSheet("color: green;");
-        break;
+        return ui->lShort;
     case HP8751A::CAL_LOAD:
-        ui->lLoad->setStyleSheet("color: green;");
-        break;
+        return ui->lLoad;
     default:
-        break;
+        return ui->lOpen;
     }
 }
 
+void CalibrateDialog::cal_std_done(HP8751A::cal_std_t cal, qint64 ms)
+{
+    // The standard can be swapped now, the next one may already be queued
+    std_label(cal)->setStyleSheet("color: green;");
+    std_label(cal)->setToolTip(QString("Measured in %1 s").arg(ms / 1000.0, 0, 'f', 1));
+    std_button(cal)->setEnabled(true);
+    ui->lStatus->setText(QString("%1 done in %2 s").arg(std_label(cal)->text()).arg(ms / 1000.0, 0, 'f', 1));
+}
+
+void CalibrateDialog::cal_plan_done()
+{
+    QString status = ui->lStatus->text();
+    enable_gui();
+    ui->lStatus->setText(status);
+}
+
 void CalibrateDialog::disable_gui()
 {
     ui->btnOpen->setEnabled(false);
     ui->btnShort->setEnabled(false);
     ui->btnLoad->setEnabled(false);
+    ui->btnUseStored->setEnabled(false);
     ui->buttonBox->setEnabled(false);
 }
 
@@ -86,6 +240,7 @@ void CalibrateDialog::enable_gui()
     ui->btnOpen->setEnabled(true);
     ui->btnShort->setEnabled(true);
     ui->btnLoad->setEnabled(true);
+    ui->btnUseStored->setEnabled(true);
     ui->buttonBox->setEnabled(true);
 }
 
@@ -2,7 +2,11 @@
 #define CALIBRATEDIALOG_H
 
 #include <QDialog>
+#include <QPushButton>
+#include <QLabel>
+#include <QElapsedTimer>
 #include "hp8751a.h"
+#include "oneportcal.h"
 
 namespace Ui {
 class CalibrateDialog;
@@ -17,6 +21,18 @@ public:
     ~CalibrateDialog();
     void init();
 
+    // True if the host-side correction was selected. calibration() is valid after the dialog was accepted.
+    bool host_correction() const;
+    const OnePortCal &calibration() const { return hostCal; }
+
+    QString fixture_name() const;
+
+    // True if a stored instrument calibration was uploaded instead of measuring the standards
+    bool restored() const { return calRestored; }
+
+public slots:
+    void accept() override;
+
 private slots:
     void on_btnOpen_clicked();
 
@@ -24,13 +40,31 @@ private slots:
 
     void on_btnLoad_clicked();
 
+    void on_btnUseStored_clicked();
+
+    void on_hostCorrection_toggled(bool checked);
+
 private:
     Ui::CalibrateDialog *ui;
     HP8751A *hp = nullptr;
-    void cal_done();
+    void cal_std_done(HP8751A::cal_std_t cal, qint64 ms);
+    void cal_plan_done();
     void disable_gui();
     void enable_gui();
+    void measure(HP8751A::cal_std_t cal);
+    QPushButton *std_button(HP8751A::cal_std_t cal);
+    QLabel *std_label(HP8751A::cal_std_t cal);
+    QElapsedTimer hostTimer;
+    void new_data(HP8751A::instrument_data_t data);
     HP8751A::cal_std_t lastCalStd;
+
+    bool calInitialized;
+    bool calRestored;
+    void update_fixtures();
+    bool hostPending;
+    OnePortCal hostCal;
+    QVector<float> hostFrequency;
+    QVector<float> hostRaw[3]; // Open, short, load
 };
 
 
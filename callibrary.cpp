@@ -0,0 +1,101 @@
+#include "callibrary.h"
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+static const char *LIBRARY_DIR = "calibrations/instrument";
+
+QString CalLibrary::key(const QString &fixture, const HP8751A::instrument_parameters_t &param)
+{
+    if (param.sweepType == HP8751A::SWEEP_LIST) {
+        QString key = QString("%1|list").arg(fixture);
+        for (const HP8751A::segment_t &segment : param.segments) {
+            key.append(QString("|%1-%2-%3-%4").arg(segment.fStart).arg(segment.fStop).arg(segment.points).arg(segment.ifbw));
+        }
+        return key;
+    }
+    return QString("%1|%2|%3|%4|%5").arg(fixture).arg(param.fStart).arg(param.fStop).arg(param.points).arg(param.ifbw);
+}
+
+QString CalLibrary::file_name(const QString &key)
+{
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QString("%1/%2.json").arg(LIBRARY_DIR, QString(hash));
+}
+
+bool CalLibrary::store(const QString &fixture, const HP8751A::instrument_parameters_t &param,
+                       const HP8751A::cal_coefficients_t &coefficients)
+{
+    if (fixture.isEmpty() || coefficients.arrays.isEmpty() || !QDir().mkpath(LIBRARY_DIR)) {
+        return false;
+    }
+
+    QJsonArray arrays;
+    for (const QByteArray &array : coefficients.arrays) {
+        arrays.append(QString(array.toBase64()));
+    }
+
+    QJsonObject root;
+    root["fixture"] = fixture;
+    root["key"] = key(fixture, param);
+    root["start"] = (qint64)param.fStart;
+    root["stop"] = (qint64)param.fStop;
+    root["points"] = param.points;
+    root["ifbw"] = param.ifbw;
+    root["created"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    root["arrays"] = arrays;
+
+    QFile file(file_name(key(fixture, param)));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+bool CalLibrary::find(const QString &fixture, const HP8751A::instrument_parameters_t &param,
+                      HP8751A::cal_coefficients_t &coefficients)
+{
+    QFile file(file_name(key(fixture, param)));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+
+    // Guard against hash collisions and hand edited files
+    if (root["key"].toString() != key(fixture, param)) {
+        return false;
+    }
+
+    QJsonArray arrays = root["arrays"].toArray();
+    if (arrays.size() != HP8751A::CAL_COEF_ONE_PORT) {
+        return false;
+    }
+    coefficients.arrays.clear();
+    for (const QJsonValue &array : arrays) {
+        coefficients.arrays.append(QByteArray::fromBase64(array.toString().toLatin1()));
+    }
+    return true;
+}
+
+QStringList CalLibrary::fixtures()
+{
+    QStringList fixtures;
+    QDir dir(LIBRARY_DIR);
+    for (const QString &entry : dir.entryList({"*.json"}, QDir::Files)) {
+        QFile file(dir.filePath(entry));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        QString fixture = QJsonDocument::fromJson(file.readAll()).object()["fixture"].toString();
+        if (!fixture.isEmpty() && !fixtures.contains(fixture)) {
+            fixtures.append(fixture);
+        }
+    }
+    fixtures.sort();
+    return fixtures;
+}
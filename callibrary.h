@@ -0,0 +1,30 @@
+#ifndef CALLIBRARY_H
+#define CALLIBRARY_H
+
+#include <QString>
+#include <QStringList>
+#include "hp8751a.h"
+
+/* Library of instrument calibration coefficients.
+ * A calibration is only valid for the frequency plan and IF bandwidth it was measured with, so the
+ * entries are keyed by fixture, start, stop, number of points and IFBW, or by the segments of a
+ * list sweep. Stored in calibrations/instrument next to config.ini.
+ */
+class CalLibrary
+{
+public:
+    static QString key(const QString &fixture, const HP8751A::instrument_parameters_t &param);
+
+    static bool store(const QString &fixture, const HP8751A::instrument_parameters_t &param,
+                      const HP8751A::cal_coefficients_t &coefficients);
+    static bool find(const QString &fixture, const HP8751A::instrument_parameters_t &param,
+                     HP8751A::cal_coefficients_t &coefficients);
+
+    // Fixtures with at least one stored calibration
+    static QStringList fixtures();
+
+private:
+    static QString file_name(const QString &key);
+};
+
+#endif // CALLIBRARY_H
@@ -0,0 +1,446 @@
+#include "circuitfit.h"
+#include <QtConcurrent>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+typedef std::complex<double> cplx;
+
+static const cplx J(0, 1);
+
+CircuitFit::data_t CircuitFit::make_data(const float *frequency, const float *re, const float *im, int points)
+{
+    data_t data;
+    data.omega.resize(points);
+    data.z.resize(points);
+    for (int i = 0; i < points; i++) {
+        data.omega[i] = 2 * M_PI * frequency[i];
+        data.z[i] = cplx(re[i], im[i]);
+    }
+    return data;
+}
+
+QString CircuitFit::name(topology_t topology)
+{
+    switch (topology) {
+    case TOPO_SERIES_RC:
+        return "R - C";
+    case TOPO_SERIES_RL:
+        return "R - L";
+    case TOPO_SERIES_RLC:
+        return "R - L - C";
+    case TOPO_PARALLEL_RC:
+        return "R || C";
+    case TOPO_PARALLEL_RL:
+        return "R || L";
+    case TOPO_PARALLEL_RLC:
+        return "R || L || C";
+    case TOPO_INDUCTOR:
+        return "(R - L) || C";
+    default:
+        return "";
+    }
+}
+
+int CircuitFit::param_count(topology_t topology)
+{
+    switch (topology) {
+    case TOPO_SERIES_RLC:
+    case TOPO_PARALLEL_RLC:
+    case TOPO_INDUCTOR:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+QString CircuitFit::param_name(topology_t topology, int param)
+{
+    if (param == 0) {
+        return "R";
+    }
+    switch (topology) {
+    case TOPO_SERIES_RC:
+    case TOPO_PARALLEL_RC:
+        return "C";
+    case TOPO_SERIES_RL:
+    case TOPO_PARALLEL_RL:
+        return "L";
+    default:
+        return param == 1 ? "L" : "C";
+    }
+}
+
+void CircuitFit::model(topology_t topology, const double *p, double w, cplx &z, cplx *dz)
+{
+    // z is the model impedance, dz[k] the analytic derivative dZ/dp[k].
+    // Parallel topologies are computed via the admittance: dZ/dp = -Z^2 * dY/dp
+    switch (topology) {
+    case TOPO_SERIES_RC:
+        z = p[0] + 1.0 / (J * w * p[1]);
+        dz[0] = 1.0;
+        dz[1] = -1.0 / (J * w * p[1] * p[1]);
+        break;
+
+    case TOPO_SERIES_RL:
+        z = p[0] + J * w * p[1];
+        dz[0] = 1.0;
+        dz[1] = J * w;
+        break;
+
+    case TOPO_SERIES_RLC:
+        z = p[0] + J * w * p[1] + 1.0 / (J * w * p[2]);
+        dz[0] = 1.0;
+        dz[1] = J * w;
+        dz[2] = -1.0 / (J * w * p[2] * p[2]);
+        break;
+
+    case TOPO_PARALLEL_RC: {
+        cplx y = 1.0 / p[0] + J * w * p[1];
+        z = 1.0 / y;
+        dz[0] = z * z / (p[0] * p[0]);
+        dz[1] = -z * z * J * w;
+        break;
+    }
+
+    case TOPO_PARALLEL_RL: {
+        cplx y = 1.0 / p[0] + 1.0 / (J * w * p[1]);
+        z = 1.0 / y;
+        dz[0] = z * z / (p[0] * p[0]);
+        dz[1] = z * z / (J * w * p[1] * p[1]);
+        break;
+    }
+
+    case TOPO_PARALLEL_RLC: {
+        cplx y = 1.0 / p[0] + 1.0 / (J * w * p[1]) + J * w * p[2];
+        z = 1.0 / y;
+        dz[0] = z * z / (p[0] * p[0]);
+        dz[1] = z * z / (J * w * p[1] * p[1]);
+        dz[2] = -z * z * J * w;
+        break;
+    }
+
+    case TOPO_INDUCTOR: {
+        cplx zs = p[0] + J * w * p[1];
+        cplx y = 1.0 / zs + J * w * p[2];
+        z = 1.0 / y;
+        cplx zz = z * z / (zs * zs);
+        dz[0] = zz;
+        dz[1] = zz * J * w;
+        dz[2] = -z * z * J * w;
+        break;
+    }
+
+    default:
+        z = 0;
+        break;
+    }
+}
+
+std::complex<double> CircuitFit::evaluate(topology_t topology, const double *params, double omega)
+{
+    cplx z;
+    cplx dz[MAX_PARAMS];
+    model(topology, params, omega, z, dz);
+    return z;
+}
+
+double CircuitFit::cost(topology_t topology, const data_t &data, const double *params)
+{
+    double sum = 0;
+    cplx z;
+    cplx dz[MAX_PARAMS];
+    for (int i = 0; i < data.z.size(); i++) {
+        model(topology, params, data.omega.at(i), z, dz);
+        sum += std::norm(z - data.z.at(i)) / std::norm(data.z.at(i));
+    }
+    return sum;
+}
+
+CircuitFit::result_t CircuitFit::fit(topology_t topology, const data_t &data, const double *start)
+{
+    /* Levenberg-Marquardt on the relative complex error e = (Zmodel - Zmeas) / |Zmeas|.
+     * The parameters are fitted as t = ln(p). This keeps them positive and makes the problem
+     * well conditioned although R, L and C differ by many orders of magnitude. dZ/dt = p * dZ/dp.
+     */
+    const int m = param_count(topology);
+    const int n = data.z.size();
+
+    result_t result;
+    result.valid = false;
+    result.topology = topology;
+    result.iterations = 0;
+    result.rmsError = std::numeric_limits<double>::max();
+    for (int k = 0; k < MAX_PARAMS; k++) {
+        result.params[k] = k < m ? start[k] : 0;
+    }
+    if (n < m) {
+        return result;
+    }
+
+    double p[MAX_PARAMS];
+    for (int k = 0; k < m; k++) {
+        p[k] = start[k] > 0 ? start[k] : 1;
+    }
+
+    double currentCost = cost(topology, data, p);
+    if (!std::isfinite(currentCost)) {
+        return result;
+    }
+
+    double lambda = 1e-3;
+    const int maxIterations = 200;
+    int iter;
+    for (iter = 0; iter < maxIterations; iter++) {
+        // Normal equations A = J^T J, g = J^T e, accumulated directly without storing J
+        double A[MAX_PARAMS][MAX_PARAMS] = {};
+        double g[MAX_PARAMS] = {};
+        cplx z;
+        cplx dz[MAX_PARAMS];
+        for (int i = 0; i < n; i++) {
+            model(topology, p, data.omega.at(i), z, dz);
+            double weight = 1.0 / std::abs(data.z.at(i));
+            cplx e = (z - data.z.at(i)) * weight;
+            cplx jac[MAX_PARAMS];
+            for (int k = 0; k < m; k++) {
+                jac[k] = dz[k] * p[k] * weight;
+                g[k] += jac[k].real() * e.real() + jac[k].imag() * e.imag();
+            }
+            for (int k = 0; k < m; k++) {
+                for (int l = k; l < m; l++) {
+                    A[k][l] += jac[k].real() * jac[l].real() + jac[k].imag() * jac[l].imag();
+                }
+            }
+        }
+        for (int k = 0; k < m; k++) {
+            for (int l = 0; l < k; l++) {
+                A[k][l] = A[l][k];
+            }
+        }
+
+        bool accepted = false;
+        double step[MAX_PARAMS] = {};
+        double newCost = currentCost;
+        double pNew[MAX_PARAMS];
+        while (lambda < 1e12) {
+            // Solve (A + lambda * diag(A)) step = -g with Gaussian elimination
+            double M[MAX_PARAMS][MAX_PARAMS + 1];
+            for (int k = 0; k < m; k++) {
+                for (int l = 0; l < m; l++) {
+                    M[k][l] = A[k][l];
+                }
+                M[k][k] += lambda * (A[k][k] + 1e-12);
+                M[k][m] = -g[k];
+            }
+            bool singular = false;
+            for (int col = 0; col < m; col++) {
+                int pivot = col;
+                for (int row = col + 1; row < m; row++) {
+                    if (std::fabs(M[row][col]) > std::fabs(M[pivot][col])) {
+                        pivot = row;
+                    }
+                }
+                if (std::fabs(M[pivot][col]) < 1e-300) {
+                    singular = true;
+                    break;
+                }
+                if (pivot != col) {
+                    for (int l = 0; l <= m; l++) {
+                        std::swap(M[col][l], M[pivot][l]);
+                    }
+                }
+                for (int row = col + 1; row < m; row++) {
+                    double f = M[row][col] / M[col][col];
+                    for (int l = col; l <= m; l++) {
+                        M[row][l] -= f * M[col][l];
+                    }
+                }
+            }
+            if (singular) {
+                lambda *= 4;
+                continue;
+            }
+            for (int k = m - 1; k >= 0; k--) {
+                double sum = M[k][m];
+                for (int l = k + 1; l < m; l++) {
+                    sum -= M[k][l] * step[l];
+                }
+                step[k] = sum / M[k][k];
+            }
+
+            for (int k = 0; k < m; k++) {
+                // Limit the step to a factor of e^5 per iteration
+                step[k] = std::max(-5.0, std::min(5.0, step[k]));
+                pNew[k] = p[k] * std::exp(step[k]);
+            }
+            newCost = cost(topology, data, pNew);
+            if (std::isfinite(newCost) && newCost < currentCost) {
+                accepted = true;
+                lambda = std::max(lambda / 3, 1e-12);
+                break;
+            }
+            lambda *= 4;
+        }
+
+        if (!accepted) {
+            break; // No further improvement possible
+        }
+
+        double improvement = currentCost - newCost;
+        double maxStep = 0;
+        for (int k = 0; k < m; k++) {
+            p[k] = pNew[k];
+            maxStep = std::max(maxStep, std::fabs(step[k]));
+        }
+        currentCost = newCost;
+
+        if (improvement < 1e-12 * currentCost || maxStep < 1e-10) {
+            break;
+        }
+    }
+
+    result.valid = true;
+    result.iterations = iter;
+    result.rmsError = std::sqrt(currentCost / n);
+    for (int k = 0; k < m; k++) {
+        result.params[k] = p[k];
+    }
+    return result;
+}
+
+void CircuitFit::estimate(topology_t topology, const data_t &data, double *params)
+{
+    const int n = data.z.size();
+    const double wLow = data.omega.first();
+    const double wHigh = data.omega.last();
+    const double zLow = std::abs(data.z.first());
+    const double zHigh = std::abs(data.z.last());
+
+    // R: smallest resistive part for series, largest magnitude for parallel circuits
+    double rMin = std::numeric_limits<double>::max();
+    double zMax = 0;
+    for (int i = 0; i < n; i++) {
+        double r = std::fabs(data.z.at(i).real());
+        if (r > 0 && r < rMin) {
+            rMin = r;
+        }
+        zMax = std::max(zMax, std::abs(data.z.at(i)));
+    }
+    if (rMin == std::numeric_limits<double>::max()) {
+        rMin = 1;
+    }
+
+    double r;
+    double l;
+    double c;
+    switch (topology) {
+    case TOPO_PARALLEL_RC:
+    case TOPO_PARALLEL_RL:
+    case TOPO_PARALLEL_RLC:
+        // Inductive at low, capacitive at high frequencies
+        r = zMax;
+        l = zLow / wLow;
+        c = 1.0 / (wHigh * zHigh);
+        break;
+    case TOPO_INDUCTOR:
+        r = std::fabs(data.z.first().real()) > 0 ? std::fabs(data.z.first().real()) : rMin;
+        l = std::max(std::fabs(data.z.first().imag()) / wLow, zLow / wLow);
+        c = 1.0 / (wHigh * zHigh);
+        break;
+    default:
+        // Capacitive at low, inductive at high frequencies
+        r = rMin;
+        l = zHigh / wHigh;
+        c = 1.0 / (wLow * zLow);
+        break;
+    }
+
+    params[0] = r;
+    switch (topology) {
+    case TOPO_SERIES_RC:
+    case TOPO_PARALLEL_RC:
+        params[1] = c;
+        break;
+    case TOPO_SERIES_RL:
+    case TOPO_PARALLEL_RL:
+        params[1] = l;
+        break;
+    default:
+        params[1] = l;
+        params[2] = c;
+        break;
+    }
+
+    for (int k = 0; k < param_count(topology); k++) {
+        if (!std::isfinite(params[k]) || params[k] <= 0) {
+            params[k] = 1;
+        }
+    }
+}
+
+QFuture<CircuitFit::result_t> CircuitFit::fit_multistart(topology_t topology, const data_t &data)
+{
+    struct start_t {
+        double params[MAX_PARAMS];
+    };
+
+    const int m = param_count(topology);
+    double guess[MAX_PARAMS] = {1, 1, 1};
+    if (!data.z.isEmpty()) {
+        estimate(topology, data, guess);
+    }
+
+    // Grid of start values, every parameter 0.1x, 1x and 10x of the estimate
+    const double factors[] = {0.1, 1, 10};
+    QVector<start_t> starts;
+    int combinations = 1;
+    for (int k = 0; k < m; k++) {
+        combinations *= 3;
+    }
+    for (int c = 0; c < combinations; c++) {
+        start_t start;
+        int idx = c;
+        for (int k = 0; k < MAX_PARAMS; k++) {
+            start.params[k] = k < m ? guess[k] * factors[idx % 3] : 0;
+            idx /= 3;
+        }
+        starts.push_back(start);
+    }
+
+    // The runs outlive this call, data is captured by value (implicitly shared)
+    std::function<result_t(const start_t &)> run = [topology, data](const start_t &start) {
+        return fit(topology, data, start.params);
+    };
+    return QtConcurrent::mapped(starts, run);
+}
+
+CircuitFit::result_t CircuitFit::best(const QFuture<result_t> &future)
+{
+    const QList<result_t> results = future.results();
+    if (results.isEmpty()) {
+        result_t none = {};
+        none.valid = false;
+        return none;
+    }
+
+    result_t best = results.first();
+    for (const result_t &r : results) {
+        if (r.valid && (!best.valid || r.rmsError < best.rmsError)) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+bool CircuitFit::refit(const result_t &previous, const data_t &data, result_t &result)
+{
+    if (!previous.valid) {
+        result = previous;
+        return false;
+    }
+
+    result = fit(previous.topology, data, previous.params);
+    // The DUT changed too much for a local refinement, start over
+    return result.valid && result.rmsError <= std::max(2 * previous.rmsError, 0.05);
+}
@@ -0,0 +1,69 @@
+#ifndef CIRCUITFIT_H
+#define CIRCUITFIT_H
+
+#include <QFuture>
+#include <QString>
+#include <QVector>
+#include <complex>
+
+// Levenberg-Marquardt fit of equivalent circuits to a measured complex impedance
+class CircuitFit
+{
+public:
+    enum topology_t {
+        TOPO_SERIES_RC,     // R - C
+        TOPO_SERIES_RL,     // R - L
+        TOPO_SERIES_RLC,    // R - L - C, capacitor with ESR and ESL
+        TOPO_PARALLEL_RC,   // R || C
+        TOPO_PARALLEL_RL,   // R || L
+        TOPO_PARALLEL_RLC,  // R || L || C
+        TOPO_INDUCTOR,      // (R - L) || C, inductor with winding capacitance
+        TOPO_COUNT
+    };
+
+    static constexpr int MAX_PARAMS = 3;
+
+    struct result_t {
+        bool valid;
+        topology_t topology;
+        double params[MAX_PARAMS]; // Ordered R, L, C, only the ones the topology uses
+        double rmsError; // RMS of the relative complex error
+        int iterations;
+    };
+
+    struct data_t {
+        QVector<double> omega;
+        QVector<std::complex<double>> z;
+    };
+
+    // Convert a sweep (frequency in Hz, real and imaginary part of Z) to fit data
+    static data_t make_data(const float *frequency, const float *re, const float *im, int points);
+
+    static QString name(topology_t topology);
+    static int param_count(topology_t topology);
+    // Name of the n-th parameter of a topology ("R", "L" or "C")
+    static QString param_name(topology_t topology, int param);
+
+    // Impedance of the model at angular frequency omega
+    static std::complex<double> evaluate(topology_t topology, const double *params, double omega);
+
+    // Single LM run from the given start values
+    static result_t fit(topology_t topology, const data_t &data, const double *start);
+
+    // LM runs from a grid of start values around an estimate from the data, executed on the
+    // global thread pool without blocking the caller. Pick the result with best() when the future finished.
+    static QFuture<result_t> fit_multistart(topology_t topology, const data_t &data);
+    static result_t best(const QFuture<result_t> &future);
+
+    // Refine a previous solution with a single LM run. Returns false if the previous solution does not
+    // fit the new data any more and a multi-start fit is needed.
+    static bool refit(const result_t &previous, const data_t &data, result_t &result);
+
+private:
+    static void model(topology_t topology, const double *params, double omega,
+                      std::complex<double> &z, std::complex<double> *dz);
+    static double cost(topology_t topology, const data_t &data, const double *params);
+    static void estimate(topology_t topology, const data_t &data, double *params);
+};
+
+#endif // CIRCUITFIT_H
@@ -0,0 +1,563 @@
+#include "controlserver.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QDataStream>
+#include <QtEndian>
+
+/* Protocol:
+ * Clients send JSON-RPC 2.0 requests, one per line.
+ * Everything the server sends is framed as [u8 type][u32 length, little endian][payload]:
+ *  'J': JSON-RPC response, UTF-8
+ *  'S': Sweep frame (subscribers only), little endian:
+ *       u32 sequence, u32 points, f32 channel1Scale, f32 channel1RefVal, f32 channel2Scale, f32 channel2RefVal,
+ *       f32 stimulus[points], f32 channel1[points], f32 channel2[points]
+ * Subscribers which fall behind lose their oldest queued sweeps. Gaps in the sequence number tell them so.
+ * One instrument request is processed at a time and only answered by its own result. Requests from other
+ * clients and requests while a window of the GUI uses the instrument fail with code -32001.
+ */
+
+ControlServer::ControlServer(HP8751A *hp, QObject *parent) : QObject(parent)
+{
+    this->hp = hp;
+    queueDepth = 4;
+    sequence = 0;
+
+    params.fStart = 10;
+    params.fStop = 10000000;
+    params.points = 201;
+    params.power = -20;
+    params.clearPowerTrip = true;
+    params.attenR = false;
+    params.attenA = false;
+    params.ifbw = HP8751A::IFBW_AUTO;
+    params.unwrapPhase = false;
+    params.avgEn = false;
+    params.averFact = 1;
+
+    server = new QLocalServer(this);
+    QObject::connect(server, &QLocalServer::newConnection, this, &ControlServer::new_connection);
+
+    active.request = REQ_NONE;
+    active.socket = nullptr;
+
+    QObject::connect(hp, &HP8751A::new_data, this, &ControlServer::publish_sweep);
+    QObject::connect(hp, &HP8751A::instrument_identification, this, [=](QString idn) {
+        if (active.request == REQ_IDENTIFY) {
+            finish(idn.trimmed());
+        }
+    });
+    QObject::connect(hp, &HP8751A::instrument_initialized, this, [=] {
+        if (active.request == REQ_INIT) {
+            finish(true);
+        }
+    });
+    QObject::connect(hp, &HP8751A::set_parameters_finished, this, [=] {
+        if (active.request == REQ_PARAMETERS) {
+            finish(true);
+        }
+    });
+    QObject::connect(hp, &HP8751A::sweep_cancelled, this, [=] {
+        if (active.request == REQ_SWEEP) {
+            if (active.socket) {
+                send_result(active.socket, active.cancelId, true);
+            }
+            fail("Sweep cancelled");
+        }
+    });
+    QObject::connect(hp, &HP8751A::cal_std_done, this, [=] (HP8751A::cal_std_t cal, qint64 ms) {
+        // Only the standard this request measures answers it
+        if (active.request == REQ_CAL && cal == active.standard) {
+            finish(QJsonObject{{"ms", ms}});
+        }
+    });
+    QObject::connect(hp, &HP8751A::cal_plan_done, this, [=] {
+        if (active.request == REQ_CAL_PLAN) {
+            finish(true);
+        }
+    });
+    QObject::connect(hp, &HP8751A::response_timeout, this, [=] {
+        if (active.request != REQ_NONE) {
+            fail("No response from instrument");
+        }
+    });
+}
+
+ControlServer::~ControlServer()
+{
+    close();
+}
+
+bool ControlServer::listen(const QString &name)
+{
+    // Remove a stale socket file left behind by a crashed instance
+    QLocalServer::removeServer(name);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    return server->listen(name);
+}
+
+void ControlServer::close()
+{
+    server->close();
+    for (const client_t &client : clients) {
+        client.socket->disconnect(this);
+        client.socket->abort();
+        client.socket->deleteLater();
+    }
+    clients.clear();
+}
+
+void ControlServer::set_queue_depth(int depth)
+{
+    queueDepth = qMax(1, depth);
+}
+
+void ControlServer::new_connection()
+{
+    while (server->hasPendingConnections()) {
+        QLocalSocket *socket = server->nextPendingConnection();
+        clients.push_back({socket, QByteArray(), false, QQueue<QByteArray>(), 0});
+
+        QObject::connect(socket, &QLocalSocket::readyRead, this, [=] {read_client(socket);});
+        QObject::connect(socket, &QLocalSocket::bytesWritten, this, [=] {flush_client(socket);});
+        QObject::connect(socket, &QLocalSocket::disconnected, this, [=] {client_disconnected(socket);});
+    }
+}
+
+void ControlServer::read_client(QLocalSocket *socket)
+{
+    client_t *client = find_client(socket);
+    if (!client) {
+        return;
+    }
+
+    client->rxBuffer.append(socket->readAll());
+
+    // Requests are newline delimited
+    QVector<QByteArray> lines;
+    int idx;
+    while ((idx = client->rxBuffer.indexOf('\n')) >= 0) {
+        lines.push_back(client->rxBuffer.left(idx).trimmed());
+        client->rxBuffer.remove(0, idx + 1);
+    }
+
+    // handle_request() may modify the client list, so don't touch client below this point
+    for (const QByteArray &line : lines) {
+        if (line.isEmpty()) {
+            continue;
+        }
+        QJsonParseError parseError;
+        QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+        if (doc.isNull() || !doc.isObject()) {
+            send_error(socket, QJsonValue::Null, -32700, "Parse error");
+            continue;
+        }
+        handle_request(socket, doc.object());
+    }
+}
+
+void ControlServer::client_disconnected(QLocalSocket *socket)
+{
+    for (int i = 0; i < clients.size(); i++) {
+        if (clients.at(i).socket == socket) {
+            clients.remove(i);
+            break;
+        }
+    }
+
+    // The instrument finishes the request anyway, it stays claimed until then
+    if (active.socket == socket) {
+        active.socket = nullptr;
+    }
+
+    socket->deleteLater();
+}
+
+void ControlServer::flush_client(QLocalSocket *socket)
+{
+    client_t *client = find_client(socket);
+    if (!client) {
+        return;
+    }
+
+    // Keep at most one sweep frame in the socket buffer. Everything else waits in the bounded queue.
+    if (!client->sweepQueue.isEmpty() && socket->bytesToWrite() == 0) {
+        socket->write(client->sweepQueue.dequeue());
+    }
+}
+
+ControlServer::client_t *ControlServer::find_client(QLocalSocket *socket)
+{
+    for (client_t &client : clients) {
+        if (client.socket == socket) {
+            return &client;
+        }
+    }
+    return nullptr;
+}
+
+void ControlServer::handle_request(QLocalSocket *socket, const QJsonObject &request)
+{
+    QJsonValue id = request.value("id");
+    QString method = request.value("method").toString();
+    QJsonObject param = request.value("params").toObject();
+
+    if (method.isEmpty()) {
+        send_error(socket, id, -32600, "Invalid request");
+        return;
+    }
+
+    if (method == "identify") {
+        if (!begin(socket, id, REQ_IDENTIFY)) {
+            return;
+        }
+        hp->identify();
+
+    } else if (method == "init_function") {
+        QString function = param.value("function").toString();
+        if (function != "loopgain" && function != "impedance") {
+            send_error(socket, id, -32602, "function must be \"loopgain\" or \"impedance\"");
+            return;
+        }
+        if (!begin(socket, id, REQ_INIT)) {
+            return;
+        }
+        if (function == "loopgain") {
+            hp->init_function(HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_PHAS);
+        } else {
+            hp->init_function(HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_PHAS);
+        }
+
+    } else if (method == "set_parameters") {
+        QString error;
+        if (!parse_parameters(param, error)) {
+            send_error(socket, id, -32602, error);
+            return;
+        }
+        if (!begin(socket, id, REQ_PARAMETERS)) {
+            return;
+        }
+        hp->set_instrument_parameters(params);
+
+    } else if (method == "sweep") {
+        if (!hp->sweep_done()) {
+            send_error(socket, id, -32001, "Instrument is busy");
+            return;
+        }
+        if (!begin(socket, id, REQ_SWEEP)) {
+            return;
+        }
+        hp->request_sweep();
+
+    } else if (method == "cancel") {
+        // Only the sweep of the same client, never one of the GUI or of another client
+        if (active.request != REQ_SWEEP || active.socket != socket) {
+            send_error(socket, id, -32001, "No sweep of this client to cancel");
+            return;
+        }
+        active.cancelId = id;
+        hp->request_cancel();
+
+    } else if (method == "cal_init") {
+        if (!claim_once(socket, id)) {
+            return;
+        }
+        hp->init_cal();
+        send_result(socket, id, true);
+
+    } else if (method == "cal_measure") {
+        QString standard = param.value("standard").toString();
+        HP8751A::cal_std_t cal;
+        if (standard == "open") {
+            cal = HP8751A::CAL_OPEN;
+        } else if (standard == "short") {
+            cal = HP8751A::CAL_SHORT;
+        } else if (standard == "load") {
+            cal = HP8751A::CAL_LOAD;
+        } else {
+            send_error(socket, id, -32602, "standard must be \"open\", \"short\" or \"load\"");
+            return;
+        }
+        if (!begin(socket, id, REQ_CAL)) {
+            return;
+        }
+        active.standard = cal;
+        hp->measure_cal_std(cal, qBound(1, param.value("averages").toInt(1), 999));
+
+    } else if (method == "cal_plan") {
+        // Whole sequence in one request, answered when the last standard is done
+        QVector<HP8751A::cal_step_t> plan;
+        quint16 averages = qBound(1, param.value("averages").toInt(1), 999);
+        for (const QJsonValue &value : param.value("standards").toArray()) {
+            QString standard = value.toString();
+            if (standard == "open") {
+                plan.push_back({HP8751A::CAL_OPEN, averages});
+            } else if (standard == "short") {
+                plan.push_back({HP8751A::CAL_SHORT, averages});
+            } else if (standard == "load") {
+                plan.push_back({HP8751A::CAL_LOAD, averages});
+            } else {
+                send_error(socket, id, -32602, "standards must be a list of \"open\", \"short\" or \"load\"");
+                return;
+            }
+        }
+        if (plan.isEmpty()) {
+            send_error(socket, id, -32602, "standards must not be empty");
+            return;
+        }
+        if (!begin(socket, id, REQ_CAL_PLAN)) {
+            return;
+        }
+        hp->run_cal_plan(plan);
+
+    } else if (method == "cal_done") {
+        if (!claim_once(socket, id)) {
+            return;
+        }
+        hp->set_cal_done();
+        send_result(socket, id, true);
+
+    } else if (method == "subscribe" || method == "unsubscribe") {
+        client_t *client = find_client(socket);
+        if (!client) {
+            return;
+        }
+        client->subscribed = (method == "subscribe");
+        if (!client->subscribed) {
+            client->sweepQueue.clear();
+        }
+        send_result(socket, id, QJsonObject{{"sequence", static_cast<qint64>(sequence)},
+                                            {"dropped", static_cast<qint64>(client->dropped)}});
+
+    } else {
+        send_error(socket, id, -32601, "Method not found");
+    }
+}
+
+bool ControlServer::parse_parameters(const QJsonObject &obj, QString &error)
+{
+    // Missing keys keep their previous value
+    HP8751A::instrument_parameters_t p = params;
+
+    if (obj.contains("start")) {
+        p.fStart = obj.value("start").toDouble();
+    }
+    if (obj.contains("stop")) {
+        p.fStop = obj.value("stop").toDouble();
+    }
+    if (obj.contains("points")) {
+        p.points = obj.value("points").toInt();
+    }
+    if (obj.contains("power")) {
+        p.power = obj.value("power").toInt();
+    }
+    if (obj.contains("atten_r")) {
+        p.attenR = obj.value("atten_r").toBool();
+    }
+    if (obj.contains("atten_a")) {
+        p.attenA = obj.value("atten_a").toBool();
+    }
+    if (obj.contains("unwrap")) {
+        p.unwrapPhase = obj.value("unwrap").toBool();
+    }
+    if (obj.contains("averaging")) {
+        int averFact = obj.value("averaging").toInt();
+        p.avgEn = averFact > 1;
+        p.averFact = p.avgEn ? averFact : 1;
+    }
+    if (obj.contains("ifbw")) {
+        QString ifbw = obj.value("ifbw").toVariant().toString().toLower();
+        if (ifbw == "auto") {
+            p.ifbw = HP8751A::IFBW_AUTO;
+        } else if (ifbw == "2") {
+            p.ifbw = HP8751A::IFBW_2HZ;
+        } else if (ifbw == "20") {
+            p.ifbw = HP8751A::IFBW_20HZ;
+        } else if (ifbw == "200") {
+            p.ifbw = HP8751A::IFBW_200HZ;
+        } else if (ifbw == "1000" || ifbw == "1k") {
+            p.ifbw = HP8751A::IFBW_1KHZ;
+        } else if (ifbw == "4000" || ifbw == "4k") {
+            p.ifbw = HP8751A::IFBW_4KHZ;
+        } else {
+            error = "Invalid IF bandwidth";
+            return false;
+        }
+    }
+
+    if (p.fStart == 0 || p.fStop <= p.fStart) {
+        error = "Invalid frequency range";
+        return false;
+    }
+    if (p.points < 2) {
+        error = "Invalid number of points";
+        return false;
+    }
+
+    p.clearPowerTrip = true;
+    params = p;
+    return true;
+}
+
+void ControlServer::send_result(QLocalSocket *socket, const QJsonValue &id, const QJsonValue &result)
+{
+    if (id.isUndefined()) {
+        return; // Notification, no response expected
+    }
+    QJsonObject resp{{"jsonrpc", "2.0"}, {"id", id}, {"result", result}};
+    send_frame(socket, FRAME_JSON, QJsonDocument(resp).toJson(QJsonDocument::Compact));
+}
+
+void ControlServer::send_error(QLocalSocket *socket, const QJsonValue &id, int code, const QString &message)
+{
+    if (id.isUndefined()) {
+        return;
+    }
+    QJsonObject err{{"code", code}, {"message", message}};
+    QJsonObject resp{{"jsonrpc", "2.0"}, {"id", id}, {"error", err}};
+    send_frame(socket, FRAME_JSON, QJsonDocument(resp).toJson(QJsonDocument::Compact));
+}
+
+void ControlServer::send_frame(QLocalSocket *socket, frame_type_t type, const QByteArray &payload)
+{
+    QByteArray frame;
+    frame.reserve(payload.size() + 5);
+    frame.append(static_cast<char>(type));
+    quint32 length = qToLittleEndian<quint32>(payload.size());
+    frame.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    frame.append(payload);
+
+    if (type == FRAME_JSON) {
+        // Responses are small and must never be dropped
+        socket->write(frame);
+        return;
+    }
+
+    client_t *client = find_client(socket);
+    if (!client) {
+        return;
+    }
+    if (client->sweepQueue.size() >= queueDepth) {
+        client->sweepQueue.dequeue();
+        client->dropped++;
+    }
+    client->sweepQueue.enqueue(frame);
+    flush_client(socket);
+}
+
+bool ControlServer::begin(QLocalSocket *socket, const QJsonValue &id, request_t request)
+{
+    if (active.request != REQ_NONE) {
+        send_error(socket, id, -32001, "Instrument is busy with another request");
+        return false;
+    }
+    if (!hp->claim(this)) {
+        send_error(socket, id, -32001, "Instrument is in use by the GUI");
+        return false;
+    }
+    active.request = request;
+    active.socket = socket;
+    active.id = id;
+    active.cancelId = QJsonValue::Undefined;
+    return true;
+}
+
+bool ControlServer::claim_once(QLocalSocket *socket, const QJsonValue &id)
+{
+    if (active.request != REQ_NONE) {
+        send_error(socket, id, -32001, "Instrument is busy with another request");
+        return false;
+    }
+    // The commands are queued in order, a following request of the GUI can't overtake them
+    if (hp->claimed_by_other(this)) {
+        send_error(socket, id, -32001, "Instrument is in use by the GUI");
+        return false;
+    }
+    return true;
+}
+
+void ControlServer::finish(const QJsonValue &result)
+{
+    active_t done = active;
+    active.request = REQ_NONE;
+    active.socket = nullptr;
+    hp->release(this);
+    if (done.socket) {
+        send_result(done.socket, done.id, result);
+    }
+}
+
+void ControlServer::fail(const QString &message)
+{
+    active_t done = active;
+    active.request = REQ_NONE;
+    active.socket = nullptr;
+    hp->release(this);
+    if (done.socket) {
+        send_error(done.socket, done.id, -32000, message);
+    }
+}
+
+void ControlServer::publish_sweep(HP8751A::instrument_data_t data)
+{
+    if (data.partial) {
+        // Zoom chunks are not sweeps of their own
+        return;
+    }
+    sequence++;
+
+    if (active.request == REQ_SWEEP) {
+        finish(QJsonObject{{"sequence", static_cast<qint64>(sequence)}, {"points", data.stimulus.size()}});
+    }
+
+    bool anySubscriber = false;
+    for (const client_t &client : clients) {
+        anySubscriber |= client.subscribed;
+    }
+    if (!anySubscriber) {
+        return;
+    }
+
+    // Pack once, share the payload between all subscribers
+    QByteArray payload = pack_sweep(data);
+    QVector<QLocalSocket*> subscribers;
+    for (const client_t &client : clients) {
+        if (client.subscribed) {
+            subscribers.push_back(client.socket);
+        }
+    }
+    for (QLocalSocket *socket : subscribers) {
+        send_frame(socket, FRAME_SWEEP, payload);
+    }
+}
+
+QByteArray ControlServer::pack_sweep(const HP8751A::instrument_data_t &data)
+{
+    quint32 points = data.stimulus.size();
+    QByteArray payload;
+    payload.reserve(24 + 3 * points * sizeof(float));
+
+    {
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setByteOrder(QDataStream::LittleEndian);
+        out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+        out << sequence << points;
+        out << data.channel1Scale << data.channel1RefVal << data.channel2Scale << data.channel2RefVal;
+    }
+
+    // The arrays are copied as they are. The instrument sends FORM5 data little endian which
+    // is also the host byte order we unpack it in.
+    auto appendArray = [&](const QVector<float> &array) {
+        if (static_cast<quint32>(array.size()) == points) {
+            payload.append(reinterpret_cast<const char*>(array.constData()), points * sizeof(float));
+        } else {
+            QVector<float> padded = array;
+            padded.resize(points);
+            payload.append(reinterpret_cast<const char*>(padded.constData()), points * sizeof(float));
+        }
+    };
+    appendArray(data.stimulus);
+    appendArray(data.channel1);
+    appendArray(data.channel2);
+
+    return payload;
+}
@@ -0,0 +1,93 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QQueue>
+#include <QVector>
+#include "hp8751a.h"
+
+class ControlServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ControlServer(HP8751A *hp, QObject *parent = nullptr);
+    ~ControlServer();
+
+    // Listen on a local socket (Unix domain socket / named pipe)
+    bool listen(const QString &name);
+    void close();
+
+    // Number of sweep frames each subscriber may have queued before the oldest one is dropped
+    void set_queue_depth(int depth);
+
+private:
+    HP8751A *hp = nullptr;
+    QLocalServer *server = nullptr;
+
+    enum frame_type_t : quint8 {
+        FRAME_JSON = 'J',
+        FRAME_SWEEP = 'S'
+    };
+
+    struct client_t {
+        QLocalSocket *socket;
+        QByteArray rxBuffer;
+        bool subscribed;
+        QQueue<QByteArray> sweepQueue;
+        quint32 dropped;
+    };
+
+    // Instrument requests. One is in progress at a time, the instrument is claimed until its result arrives.
+    enum request_t {
+        REQ_NONE,
+        REQ_IDENTIFY,
+        REQ_INIT,
+        REQ_PARAMETERS,
+        REQ_SWEEP,
+        REQ_CAL,
+        REQ_CAL_PLAN
+    };
+
+    struct active_t {
+        request_t request;
+        QLocalSocket *socket; // nullptr after the client disconnected, the result is dropped
+        QJsonValue id;
+        QJsonValue cancelId; // Cancel request of the same client, answered when the sweep is cancelled
+        HP8751A::cal_std_t standard; // REQ_CAL
+    };
+
+    QVector<client_t> clients;
+    int queueDepth;
+    quint32 sequence;
+
+    HP8751A::instrument_parameters_t params;
+
+    active_t active;
+    bool begin(QLocalSocket *socket, const QJsonValue &id, request_t request);
+    bool claim_once(QLocalSocket *socket, const QJsonValue &id); // For commands without asynchronous result
+    void finish(const QJsonValue &result);
+    void fail(const QString &message);
+
+    void new_connection();
+    void read_client(QLocalSocket *socket);
+    void client_disconnected(QLocalSocket *socket);
+    void flush_client(QLocalSocket *socket);
+    client_t *find_client(QLocalSocket *socket);
+
+    void handle_request(QLocalSocket *socket, const QJsonObject &request);
+    bool parse_parameters(const QJsonObject &obj, QString &error);
+
+    void send_result(QLocalSocket *socket, const QJsonValue &id, const QJsonValue &result);
+    void send_error(QLocalSocket *socket, const QJsonValue &id, int code, const QString &message);
+    void send_frame(QLocalSocket *socket, frame_type_t type, const QByteArray &payload);
+
+    void publish_sweep(HP8751A::instrument_data_t data);
+    QByteArray pack_sweep(const HP8751A::instrument_data_t &data);
+
+};
+
+#endif // CONTROLSERVER_H
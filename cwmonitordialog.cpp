@@ -0,0 +1,239 @@
+#include "cwmonitordialog.h"
+#include "ui_cwmonitordialog.h"
+#include <cmath>
+
+CwMonitorDialog::CwMonitorDialog(HP8751A *hp, const HP8751A::instrument_parameters_t &param, QWidget *parent)
+    : QDialog(parent)
+    , ui(new Ui::CwMonitorDialog)
+{
+    ui->setupUi(this);
+    this->hp = hp;
+    current = param;
+    state = STATE_IDLE;
+    closeRequested = false;
+    lastTime = 0;
+    rateSamples = 0;
+
+    // Start at the center of the span of the window
+    ui->cwFrequency->setValue(std::round(std::sqrt((double)param.fStart * param.fStop)));
+    ui->cwIfbw->setCurrentIndex(param.ifbw == HP8751A::IFBW_AUTO ? HP8751A::IFBW_4KHZ : param.ifbw);
+    ui->btnStop->setEnabled(false);
+
+    plotTimer = new QTimer(this);
+    plotTimer->setSingleShot(true);
+    QObject::connect(plotTimer, &QTimer::timeout, this, &CwMonitorDialog::plot);
+
+    QObject::connect(hp, &HP8751A::set_parameters_finished, this, &CwMonitorDialog::set_parameters_finished);
+    QObject::connect(hp, &HP8751A::new_data, this, &CwMonitorDialog::new_data);
+    QObject::connect(hp, &HP8751A::sweep_cancelled, this, &CwMonitorDialog::sweep_cancelled);
+    QObject::connect(hp, &HP8751A::response_timeout, this, &CwMonitorDialog::response_timeout);
+    QObject::connect(ui->history, QOverload<int>::of(&QSpinBox::valueChanged), this, &CwMonitorDialog::plot);
+
+    init_plot();
+}
+
+CwMonitorDialog::~CwMonitorDialog()
+{
+    delete ui;
+}
+
+void CwMonitorDialog::init_plot()
+{
+    magnitude = new QLineSeries();
+    magnitude->setName("Magnitude");
+    phase = new QLineSeries();
+    phase->setName("Phase");
+
+    chart = new QChart();
+    chart->addSeries(magnitude);
+    chart->addSeries(phase);
+
+    axisX = new QValueAxis();
+    axisX->setTitleText("Time / s");
+    axisX->setLabelFormat("%.1f");
+    chart->addAxis(axisX, Qt::AlignBottom);
+    magnitude->attachAxis(axisX);
+    phase->attachAxis(axisX);
+
+    axisY = new QValueAxis();
+    axisY->setTitleText("Magnitude / dB");
+    chart->addAxis(axisY, Qt::AlignLeft);
+    magnitude->attachAxis(axisY);
+
+    axisYPhase = new QValueAxis();
+    axisYPhase->setTitleText("Phase / °");
+    chart->addAxis(axisYPhase, Qt::AlignRight);
+    phase->attachAxis(axisYPhase);
+
+    chartView = new QChartView(chart);
+    QVBoxLayout *layout = new QVBoxLayout(ui->chart);
+    layout->addWidget(chartView);
+}
+
+void CwMonitorDialog::set_running(bool running)
+{
+    ui->btnStart->setEnabled(!running);
+    ui->btnStop->setEnabled(running);
+    ui->cwFrequency->setEnabled(!running);
+    ui->cwPoints->setEnabled(!running);
+    ui->cwIfbw->setEnabled(!running);
+}
+
+void CwMonitorDialog::on_btnStart_clicked()
+{
+    if (state != STATE_IDLE) {
+        return;
+    }
+
+    HP8751A::instrument_parameters_t param = current;
+    param.sweepType = HP8751A::SWEEP_CW_TIME;
+    param.segments.clear();
+    param.fStart = ui->cwFrequency->value();
+    param.fStop = param.fStart;
+    param.points = ui->cwPoints->currentText().toUInt();
+    param.ifbw = static_cast<HP8751A::ifbw_t>(ui->cwIfbw->currentIndex());
+    param.avgEn = false;
+    param.averFact = 1;
+    param.clearPowerTrip = false;
+
+    // Free run reads the plain sweeps, the window sets its refinement again before the next sweep
+    hp->set_refinement(nullptr, 0);
+    history.clear();
+    lastTime = 0;
+    state = STATE_PARAMETERS;
+    set_running(true);
+    ui->btnStop->setEnabled(false);
+    ui->lStatus->setText("Updating parameters...");
+    hp->set_instrument_parameters(param);
+}
+
+void CwMonitorDialog::set_parameters_finished()
+{
+    if (state != STATE_PARAMETERS) {
+        return;
+    }
+    if (!hp->start_stream()) {
+        state = STATE_IDLE;
+        set_running(false);
+        ui->lStatus->setText("Free run is not possible with the current settings");
+        return;
+    }
+    state = STATE_STREAM;
+    ui->btnStop->setEnabled(true);
+    ui->lStatus->setText("Monitoring...");
+    clock.start();
+    rateTimer.start();
+    rateSamples = 0;
+}
+
+void CwMonitorDialog::new_data(HP8751A::instrument_data_t data)
+{
+    const int points = data.stimulus.size();
+    if (state != STATE_STREAM || points == 0 || data.channel1.size() != points || data.channel2.size() != points) {
+        return;
+    }
+
+    // The sweep ended when its data was copied, the stimulus gives the time of the points within it.
+    // Readout jitter must not move a sweep before the end of the previous one.
+    double spacing = points > 1 ? (data.stimulus.last() - data.stimulus.first()) / (points - 1) : 0;
+    double start = clock.elapsed() / 1000.0 - data.stimulus.last();
+    start = qMax(start, lastTime + spacing - data.stimulus.first());
+    for (int i = 0; i < points; i++) {
+        history.append(start + data.stimulus.at(i), data.channel1.at(i), data.channel2.at(i));
+    }
+    lastTime = start + data.stimulus.last();
+
+    rateSamples += points;
+    if (rateTimer.elapsed() >= 1000) {
+        ui->lRate->setText(QString("%1 points/s").arg(rateSamples * 1000.0 / rateTimer.elapsed(), 0, 'f', 0));
+        rateSamples = 0;
+        rateTimer.restart();
+    }
+
+    // Plot the latest state at most every PLOT_INTERVAL_MS, sweeps in between only go to the history
+    if (!plotTimer->isActive()) {
+        plotTimer->start(PLOT_INTERVAL_MS);
+    }
+}
+
+void CwMonitorDialog::plot()
+{
+    if (history.size() == 0) {
+        return;
+    }
+    const double tStop = history.last_time();
+    const double tStart = tStop - ui->history->value();
+    // Two points per pixel column are enough for min and max
+    const int buckets = qMax(1, (int)chart->plotArea().width());
+
+    QVector<QPointF> magnitudePoints;
+    QVector<QPointF> phasePoints;
+    history.decimate(tStart, tStop + 1e-9, buckets, magnitudePoints, phasePoints);
+    magnitude->replace(magnitudePoints);
+    phase->replace(phasePoints);
+    axisX->setRange(qMax(0.0, tStart), qMax(tStop, (double)ui->history->value()));
+
+    auto fit = [](QValueAxis *axis, const QVector<QPointF> &points) {
+        if (points.isEmpty()) {
+            return;
+        }
+        double min = points.first().y();
+        double max = min;
+        for (const QPointF &p : points) {
+            min = qMin(min, p.y());
+            max = qMax(max, p.y());
+        }
+        double margin = qMax(0.1 * (max - min), 0.05);
+        axis->setRange(min - margin, max + margin);
+    };
+    fit(axisY, magnitudePoints);
+    fit(axisYPhase, phasePoints);
+}
+
+void CwMonitorDialog::on_btnStop_clicked()
+{
+    if (state != STATE_STREAM) {
+        return;
+    }
+    state = STATE_STOPPING;
+    ui->btnStop->setEnabled(false);
+    ui->lStatus->setText("Stopping...");
+    hp->request_cancel();
+}
+
+void CwMonitorDialog::sweep_cancelled()
+{
+    if (state != STATE_STOPPING) {
+        return;
+    }
+    state = STATE_IDLE;
+    set_running(false);
+    plot();
+    ui->lStatus->setText("Stopped.");
+    if (closeRequested) {
+        QDialog::reject();
+    }
+}
+
+void CwMonitorDialog::response_timeout()
+{
+    if (state == STATE_IDLE) {
+        return;
+    }
+    state = STATE_IDLE;
+    set_running(false);
+    ui->lStatus->setText("No response from instrument!");
+}
+
+void CwMonitorDialog::reject()
+{
+    // The free run has to be stopped before the window takes over the instrument again
+    if (state == STATE_STREAM || state == STATE_STOPPING) {
+        closeRequested = true;
+        on_btnStop_clicked();
+        return;
+    }
+    if (state == STATE_IDLE) {
+        QDialog::reject();
+    }
+}
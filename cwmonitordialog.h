@@ -0,0 +1,76 @@
+#ifndef CWMONITORDIALOG_H
+#define CWMONITORDIALOG_H
+
+#include <QDialog>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QtCharts>
+#include "hp8751a.h"
+#include "stripbuffer.h"
+
+namespace Ui {
+class CwMonitorDialog;
+}
+
+// Magnitude and phase at one frequency over time. The instrument runs CW time sweeps in free run,
+// every sweep is appended to a rolling history which is plotted as strip chart.
+class CwMonitorDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    // param are the current settings of the window, used for source and receiver
+    explicit CwMonitorDialog(HP8751A *hp, const HP8751A::instrument_parameters_t &param, QWidget *parent = nullptr);
+    ~CwMonitorDialog();
+
+    static constexpr int PLOT_INTERVAL_MS = 50;
+
+public slots:
+    void reject() override;
+
+private slots:
+    void on_btnStart_clicked();
+    void on_btnStop_clicked();
+
+private:
+    Ui::CwMonitorDialog *ui;
+    HP8751A *hp = nullptr;
+    HP8751A::instrument_parameters_t current;
+
+    enum state_t {
+        STATE_IDLE,
+        STATE_PARAMETERS,
+        STATE_STREAM,
+        STATE_STOPPING
+    };
+    state_t state;
+    bool closeRequested;
+
+    StripBuffer history;
+    QElapsedTimer clock; // Host time of the samples, started with the run
+    double lastTime;
+
+    // Sample rate shown below the chart
+    qint64 rateSamples;
+    QElapsedTimer rateTimer;
+
+    QChart *chart = nullptr;
+    QChartView *chartView = nullptr;
+    QLineSeries *magnitude = nullptr;
+    QLineSeries *phase = nullptr;
+    QValueAxis *axisX = nullptr;
+    QValueAxis *axisY = nullptr;
+    QValueAxis *axisYPhase = nullptr;
+    QTimer *plotTimer = nullptr;
+
+    void init_plot();
+    void plot();
+    void set_running(bool running);
+
+    void set_parameters_finished();
+    void new_data(HP8751A::instrument_data_t data);
+    void sweep_cancelled();
+    void response_timeout();
+};
+
+#endif // CWMONITORDIALOG_H
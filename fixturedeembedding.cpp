@@ -0,0 +1,323 @@
+#include "fixturedeembedding.h"
+#include "impedancekernels.h"
+#include "tracemath.h"
+#include "tracestore.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <cmath>
+
+typedef std::complex<double> cplx;
+
+static const char *FIXTURE_DIR = "deembedding";
+static const double DEG_TO_RAD = M_PI / 180.0;
+
+FixtureDeembedding::FixtureDeembedding()
+{
+    portDelay = 0;
+    phaseOffset = 0;
+    gridValid = false;
+}
+
+bool FixtureDeembedding::import_touchstone(const QString &fileName, const QString &name, QString &errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        errorString = QString("Could not open %1").arg(fileName);
+        return false;
+    }
+
+    // Defaults of the format: GHz, magnitude/angle
+    enum {FMT_MA, FMT_DB, FMT_RI} format = FMT_MA;
+    double unit = 1e9;
+    bool optionLine = false;
+    int s21Column = 3; // N11 N21 N12 N22, Touchstone 2 can swap N21 and N12
+
+    QVector<double> frequency;
+    QVector<cplx> s21;
+    QVector<double> values; // A record of 9 values may span several lines
+    int recordLine = 0; // Line the record in values starts on
+    QTextStream in(&file);
+    for (int lineNumber = 1; !in.atEnd(); lineNumber++) {
+        QString line = in.readLine().section('!', 0, 0).simplified();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        if (line.startsWith('[')) {
+            QString keyword = line.section(']', 0, 0).mid(1).trimmed().toLower();
+            QString value = line.section(']', 1).trimmed().toLower();
+            if (keyword == "number of ports" && value != "2") {
+                errorString = QString("%1 is not a two-port").arg(QFileInfo(fileName).fileName());
+                return false;
+            } else if (keyword == "two-port data order") {
+                s21Column = value == "12_21" ? 5 : 3;
+            } else if (keyword == "noise data" || keyword == "end") {
+                break;
+            }
+            continue;
+        }
+
+        if (line.startsWith('#')) {
+            // Only the first option line counts
+            if (optionLine) {
+                continue;
+            }
+            optionLine = true;
+            const QStringList options = line.mid(1).toLower().simplified().split(' ');
+            for (const QString &option : options) {
+                if (option == "hz") {
+                    unit = 1;
+                } else if (option == "khz") {
+                    unit = 1e3;
+                } else if (option == "mhz") {
+                    unit = 1e6;
+                } else if (option == "ghz") {
+                    unit = 1e9;
+                } else if (option == "ma") {
+                    format = FMT_MA;
+                } else if (option == "db") {
+                    format = FMT_DB;
+                } else if (option == "ri") {
+                    format = FMT_RI;
+                } else if (option == "y" || option == "z" || option == "h" || option == "g") {
+                    errorString = "Only S-parameters are supported";
+                    return false;
+                }
+                // The reference resistance doesn't matter for the transfer
+            }
+            continue;
+        }
+
+        const QStringList tokens = line.split(' ');
+        const bool recordStart = values.isEmpty();
+        for (const QString &token : tokens) {
+            bool ok;
+            values.append(token.toDouble(&ok));
+            if (!ok) {
+                errorString = QString("Line %1: invalid number %2").arg(lineNumber).arg(token);
+                return false;
+            }
+        }
+        // Touchstone 1 appends the noise parameters, their first frequency is not above the last one of the network data
+        if (recordStart && !frequency.isEmpty() && values.first() * unit <= frequency.last()) {
+            values.clear();
+            break;
+        }
+        if (recordStart) {
+            recordLine = lineNumber;
+        }
+        while (values.size() >= 9) {
+            const double f = values.at(0) * unit;
+            const double a = values.at(s21Column);
+            const double b = values.at(s21Column + 1);
+            if (!frequency.isEmpty() && f <= frequency.last()) {
+                errorString = QString("Line %1: frequencies must be ascending").arg(lineNumber);
+                return false;
+            }
+            frequency.append(f);
+            if (format == FMT_RI) {
+                s21.append(cplx(a, b));
+            } else {
+                s21.append(std::polar(format == FMT_DB ? std::pow(10.0, a / 20.0) : a, b * DEG_TO_RAD));
+            }
+            values.remove(0, 9);
+            recordLine = lineNumber;
+        }
+    }
+
+    if (!values.isEmpty()) {
+        errorString = QString("Line %1: incomplete record, %2 of 9 values").arg(recordLine).arg(values.size());
+        return false;
+    }
+    if (frequency.isEmpty()) {
+        errorString = QString("%1 contains no two-port data").arg(QFileInfo(fileName).fileName());
+        return false;
+    }
+    if (!save_model(name, QFileInfo(fileName).fileName(), frequency, s21)) {
+        errorString = QString("Could not store fixture %1").arg(name);
+        return false;
+    }
+    return true;
+}
+
+bool FixtureDeembedding::capture(const QString &name, const HP8751A::instrument_data_t &data)
+{
+    const int points = data.stimulus.size();
+    if (name.isEmpty() || points == 0 || data.channel1.size() != points || data.channel2.size() != points) {
+        return false;
+    }
+
+    // With both probes on the same node, the sweep is the transfer of the A path relative to the R path
+    QVector<double> frequency(points);
+    QVector<cplx> s21(points);
+    for (int i = 0; i < points; i++) {
+        frequency[i] = data.stimulus.at(i);
+        s21[i] = std::polar(std::pow(10.0, data.channel1.at(i) / 20.0), data.channel2.at(i) * DEG_TO_RAD);
+    }
+    return save_model(name, "measured", frequency, s21);
+}
+
+bool FixtureDeembedding::save_model(const QString &name, const QString &source, const QVector<double> &frequency,
+                                    const QVector<cplx> &s21)
+{
+    QJsonObject root;
+    root["source"] = source;
+    return TraceStore::save_trace(FIXTURE_DIR, name, root, frequency, s21);
+}
+
+bool FixtureDeembedding::load_model(const QString &name, model_t &model)
+{
+    if (!TraceStore::load_trace(FIXTURE_DIR, name, model.frequency, model.s21)) {
+        return false;
+    }
+    model.gridValid = false;
+    return true;
+}
+
+bool FixtureDeembedding::remove(const QString &name)
+{
+    return TraceStore::remove(FIXTURE_DIR, name);
+}
+
+QStringList FixtureDeembedding::stored_fixtures()
+{
+    return TraceStore::stored(FIXTURE_DIR);
+}
+
+bool FixtureDeembedding::set_stages(const QVector<stage_t> &stages, QString &errorString)
+{
+    QVector<model_t> loaded;
+    for (const stage_t &stage : stages) {
+        // Always from the store, a fixture may have been imported again under the same name
+        model_t model;
+        if (!load_model(stage.name, model)) {
+            errorString = QString("Could not load fixture %1").arg(stage.name);
+            return false;
+        }
+        model.stage = stage;
+        loaded.append(model);
+    }
+    models = loaded;
+    gridValid = false;
+    return true;
+}
+
+QVector<FixtureDeembedding::stage_t> FixtureDeembedding::stages() const
+{
+    QVector<stage_t> stages;
+    for (const model_t &model : models) {
+        stages.append(model.stage);
+    }
+    return stages;
+}
+
+void FixtureDeembedding::set_delay(double seconds)
+{
+    if (seconds != portDelay) {
+        portDelay = seconds;
+        gridValid = false;
+    }
+}
+
+double FixtureDeembedding::min_frequency() const
+{
+    double f = 0;
+    for (const model_t &model : models) {
+        f = qMax(f, model.frequency.first());
+    }
+    return f;
+}
+
+double FixtureDeembedding::max_frequency() const
+{
+    double f = models.isEmpty() ? 0 : models.first().frequency.last();
+    for (const model_t &model : models) {
+        f = qMin(f, model.frequency.last());
+    }
+    return f;
+}
+
+bool FixtureDeembedding::prepare_model(model_t &model, const QVector<float> &grid)
+{
+    if (model.gridValid && grid == model.grid) {
+        return true;
+    }
+
+    model.gridValid = false;
+    if (!TraceStore::covers(model.frequency, grid)) {
+        return false;
+    }
+    TraceStore::interpolate(model.frequency, model.s21, grid, model.gridRe, model.gridIm);
+
+    model.grid = grid;
+    model.gridValid = true;
+    return true;
+}
+
+bool FixtureDeembedding::prepare(const QVector<float> &grid)
+{
+    if (gridValid && grid == this->grid) {
+        return true;
+    }
+
+    gridValid = false;
+    for (model_t &model : models) {
+        if (!prepare_model(model, grid)) {
+            return false;
+        }
+    }
+
+    // The sweep is A/R: a fixture in the A path is divided out, one in the R path multiplied back
+    const int points = grid.size();
+    correctionRe.fill(1, points);
+    correctionIm.fill(0, points);
+    for (const model_t &model : models) {
+        if (model.stage.path == PATH_TEST) {
+            zkernels::complex_divide(correctionRe.constData(), correctionIm.constData(), model.gridRe.constData(),
+                                     model.gridIm.constData(), correctionRe.data(), correctionIm.data(), points);
+        } else {
+            zkernels::complex_multiply(correctionRe.constData(), correctionIm.constData(), model.gridRe.constData(),
+                                       model.gridIm.constData(), correctionRe.data(), correctionIm.data(), points);
+        }
+    }
+    phaseOffset = points ? std::atan2(correctionIm.first(), correctionRe.first()) / DEG_TO_RAD : 0;
+
+    // The port extension adds back the phase the delay took: +360 f tau
+    if (portDelay != 0) {
+        for (int i = 0; i < points; i++) {
+            const cplx value = cplx(correctionRe.at(i), correctionIm.at(i)) * std::polar(1.0, 2 * M_PI * grid.at(i) * portDelay);
+            correctionRe[i] = value.real();
+            correctionIm[i] = value.imag();
+        }
+        phaseOffset += points ? 360.0 * grid.first() * portDelay : 0;
+    }
+
+    this->grid = grid;
+    gridValid = true;
+    return true;
+}
+
+bool FixtureDeembedding::apply(HP8751A::instrument_data_t &data, bool unwrap)
+{
+    const int points = data.stimulus.size();
+    if (!is_active() || data.channel1.size() != points || data.channel2.size() != points || !prepare(data.stimulus)) {
+        return false;
+    }
+
+    const float phaseStart = points ? data.channel2.first() : 0;
+    re.resize(points);
+    im.resize(points);
+    zkernels::polar_to_rect(data.channel1.constData(), data.channel2.constData(), re.data(), im.data(), points);
+    zkernels::complex_multiply(re.constData(), im.constData(), correctionRe.constData(), correctionIm.constData(),
+                               re.data(), im.data(), points);
+    zkernels::rect_to_polar(re.constData(), im.constData(), data.channel1.data(), data.channel2.data(), points);
+
+    if (unwrap) {
+        TraceMath::unwrap_phase(data.channel2, phaseStart + phaseOffset);
+    }
+    // The autoscale values of the instrument belong to the data before the correction
+    TraceMath::autoscale(data.channel1, data.channel1Scale, data.channel1RefVal);
+    TraceMath::autoscale(data.channel2, data.channel2Scale, data.channel2RefVal);
+    return true;
+}
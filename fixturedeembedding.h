@@ -0,0 +1,90 @@
+#ifndef FIXTUREDEEMBEDDING_H
+#define FIXTUREDEEMBEDDING_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <complex>
+#include "hp8751a.h"
+
+/* Host-side de-embedding of the loop gain fixture: injection transformer, probe preamps and cables.
+ * Every fixture is a two-port stored by name in the deembedding directory next to config.ini, imported
+ * from Touchstone or measured with both probes on the same node. The loop gain is the ratio A/R, so a
+ * fixture in the A path divides the sweep by its S21 and one in the R path multiplies it. A port extension
+ * removes the delay of the A path in addition.
+ * Each fixture is interpolated once per grid and all of them are folded into one correction, so a sweep
+ * costs one complex multiplication per point no matter how many fixtures are active.
+ */
+class FixtureDeembedding
+{
+public:
+    FixtureDeembedding();
+
+    // Same order as the entries of the path combo boxes
+    enum path_t {
+        PATH_TEST,     // Receiver A
+        PATH_REFERENCE // Receiver R
+    };
+
+    struct stage_t {
+        QString name;
+        path_t path;
+    };
+
+    // Fixture store, models in deembedding/<name>.json
+    static bool import_touchstone(const QString &fileName, const QString &name, QString &errorString);
+    static bool capture(const QString &name, const HP8751A::instrument_data_t &data);
+    static bool remove(const QString &name);
+    static QStringList stored_fixtures();
+
+    // Fixtures to remove from every sweep, loaded from the store
+    bool set_stages(const QVector<stage_t> &stages, QString &errorString);
+    QVector<stage_t> stages() const;
+
+    // Port extension of the A path in seconds
+    void set_delay(double seconds);
+    double delay() const { return portDelay; }
+
+    bool is_active() const { return !models.isEmpty() || portDelay != 0; }
+    double min_frequency() const;
+    double max_frequency() const;
+
+    // Remove the fixtures from channel1 (dB) and channel2 (degrees) of the sweep. Returns false and leaves
+    // the data untouched if the grid exceeds the range of a fixture. With unwrap, the phase continues from
+    // the phase of the sweep plus the removed phase.
+    bool apply(HP8751A::instrument_data_t &data, bool unwrap);
+
+private:
+    struct model_t {
+        stage_t stage;
+        QVector<double> frequency;
+        QVector<std::complex<double>> s21;
+
+        // S21 on the grid of the last preparation
+        QVector<float> grid;
+        QVector<float> gridRe;
+        QVector<float> gridIm;
+        bool gridValid;
+    };
+    QVector<model_t> models;
+    double portDelay;
+
+    // All fixtures and the port extension on the current grid
+    QVector<float> grid;
+    QVector<float> correctionRe;
+    QVector<float> correctionIm;
+    double phaseOffset; // Removed phase at the first point, unwrapped
+    bool gridValid;
+    bool prepare(const QVector<float> &grid);
+    static bool prepare_model(model_t &model, const QVector<float> &grid);
+
+    // Scratch buffers, keep their allocation between sweeps
+    QVector<float> re;
+    QVector<float> im;
+
+    static bool load_model(const QString &name, model_t &model);
+    static bool save_model(const QString &name, const QString &source, const QVector<double> &frequency,
+                           const QVector<std::complex<double>> &s21);
+};
+
+#endif // FIXTUREDEEMBEDDING_H
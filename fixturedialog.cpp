@@ -0,0 +1,140 @@
+#include "fixturedialog.h"
+#include "ui_fixturedialog.h"
+#include "tracestore.h"
+#include <QComboBox>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <algorithm>
+
+enum column_t {
+    COL_NAME,
+    COL_PATH
+};
+
+FixtureDialog::FixtureDialog(const HP8751A::instrument_data_t &lastSweep, QWidget *parent)
+    : QDialog(parent)
+    , ui(new Ui::FixtureDialog)
+{
+    ui->setupUi(this);
+    ui->table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    this->lastSweep = lastSweep;
+    ui->btnCapture->setEnabled(!lastSweep.stimulus.isEmpty());
+    update_list({});
+}
+
+FixtureDialog::~FixtureDialog()
+{
+    delete ui;
+}
+
+void FixtureDialog::set_stages(const QVector<FixtureDeembedding::stage_t> &stages)
+{
+    update_list(stages);
+}
+
+QVector<FixtureDeembedding::stage_t> FixtureDialog::stages() const
+{
+    QVector<FixtureDeembedding::stage_t> stages;
+    for (int row = 0; row < ui->table->rowCount(); row++) {
+        QTableWidgetItem *item = ui->table->item(row, COL_NAME);
+        if (item->checkState() != Qt::Checked) {
+            continue;
+        }
+        FixtureDeembedding::stage_t stage;
+        stage.name = item->text();
+        stage.path = static_cast<FixtureDeembedding::path_t>(static_cast<QComboBox*>(ui->table->cellWidget(row, COL_PATH))->currentIndex());
+        stages.append(stage);
+    }
+    return stages;
+}
+
+void FixtureDialog::update_list(const QVector<FixtureDeembedding::stage_t> &stages)
+{
+    ui->table->setRowCount(0);
+    for (const QString &name : FixtureDeembedding::stored_fixtures()) {
+        auto stage = std::find_if(stages.cbegin(), stages.cend(), [&](const FixtureDeembedding::stage_t &s) {
+            return s.name == name;
+        });
+        int row = ui->table->rowCount();
+        ui->table->insertRow(row);
+
+        QTableWidgetItem *item = new QTableWidgetItem(name);
+        item->setFlags(Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsUserCheckable);
+        item->setCheckState(stage != stages.cend() ? Qt::Checked : Qt::Unchecked);
+        ui->table->setItem(row, COL_NAME, item);
+
+        // Same order as FixtureDeembedding::path_t
+        QComboBox *path = new QComboBox();
+        path->addItems({"A (test)", "R (reference)"});
+        path->setCurrentIndex(stage != stages.cend() ? stage->path : FixtureDeembedding::PATH_TEST);
+        ui->table->setCellWidget(row, COL_PATH, path);
+    }
+}
+
+QString FixtureDialog::ask_name(const QString &suggestion)
+{
+    bool ok;
+    QString name = QInputDialog::getText(this, "Store fixture", "Name of the fixture:", QLineEdit::Normal,
+                                         suggestion, &ok).trimmed();
+    // The name is the file name in the fixture store
+    name = TraceStore::valid_name(name);
+    if (!ok || name.isEmpty()) {
+        return QString();
+    }
+    if (FixtureDeembedding::stored_fixtures().contains(name)
+            && QMessageBox::question(this, "Store fixture", QString("Replace fixture %1?").arg(name)) != QMessageBox::Yes) {
+        return QString();
+    }
+    return name;
+}
+
+void FixtureDialog::on_btnImport_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Import fixture"), "", tr("Touchstone files (*.s2p *.ts)"));
+    if (fileName.isEmpty()) {
+        return;
+    }
+    QString name = ask_name(QFileInfo(fileName).completeBaseName());
+    if (name.isEmpty()) {
+        return;
+    }
+    QString errorString;
+    if (!FixtureDeembedding::import_touchstone(fileName, name, errorString)) {
+        QMessageBox::warning(this, "Import fixture", errorString);
+        return;
+    }
+    QVector<FixtureDeembedding::stage_t> selected = stages();
+    selected.append({name, FixtureDeembedding::PATH_TEST});
+    update_list(selected);
+}
+
+void FixtureDialog::on_btnCapture_clicked()
+{
+    QString name = ask_name("probes");
+    if (name.isEmpty()) {
+        return;
+    }
+    if (!FixtureDeembedding::capture(name, lastSweep)) {
+        QMessageBox::warning(this, "Store fixture", "Could not store the fixture!");
+        return;
+    }
+    QVector<FixtureDeembedding::stage_t> selected = stages();
+    selected.append({name, FixtureDeembedding::PATH_TEST});
+    update_list(selected);
+}
+
+void FixtureDialog::on_btnRemove_clicked()
+{
+    int row = ui->table->currentRow();
+    if (row < 0) {
+        return;
+    }
+    QString name = ui->table->item(row, COL_NAME)->text();
+    if (QMessageBox::question(this, "Remove fixture", QString("Delete fixture %1?").arg(name)) != QMessageBox::Yes) {
+        return;
+    }
+    FixtureDeembedding::remove(name);
+    update_list(stages());
+}
@@ -0,0 +1,40 @@
+#ifndef FIXTUREDIALOG_H
+#define FIXTUREDIALOG_H
+
+#include <QDialog>
+#include "hp8751a.h"
+#include "fixturedeembedding.h"
+
+namespace Ui {
+class FixtureDialog;
+}
+
+// Selects the fixtures to de-embed and the receiver path of each. Fixtures are imported from Touchstone
+// files or taken from the last sweep measured with both probes on the same node.
+class FixtureDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit FixtureDialog(const HP8751A::instrument_data_t &lastSweep, QWidget *parent = nullptr);
+    ~FixtureDialog();
+
+    void set_stages(const QVector<FixtureDeembedding::stage_t> &stages);
+    QVector<FixtureDeembedding::stage_t> stages() const;
+
+private slots:
+    void on_btnImport_clicked();
+
+    void on_btnCapture_clicked();
+
+    void on_btnRemove_clicked();
+
+private:
+    Ui::FixtureDialog *ui;
+    HP8751A::instrument_data_t lastSweep; // Not corrected
+
+    void update_list(const QVector<FixtureDeembedding::stage_t> &stages);
+    QString ask_name(const QString &suggestion);
+};
+
+#endif // FIXTUREDIALOG_H
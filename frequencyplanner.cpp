@@ -0,0 +1,285 @@
+#include "frequencyplanner.h"
+#include <algorithm>
+#include <cmath>
+
+static const HP8751A::ifbw_t CANDIDATES[] = {
+    HP8751A::IFBW_4KHZ,
+    HP8751A::IFBW_1KHZ,
+    HP8751A::IFBW_200HZ,
+    HP8751A::IFBW_20HZ,
+    HP8751A::IFBW_2HZ
+};
+
+static double wrap_phase(double deg)
+{
+    return deg - 360.0 * std::round(deg / 360.0);
+}
+
+static double median(QVector<double> values)
+{
+    if (values.isEmpty()) {
+        return 0;
+    }
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values.at(values.size() / 2);
+}
+
+FrequencyPlanner::FrequencyPlanner()
+{
+    probeIfbw = HP8751A::IFBW_1KHZ;
+    pointOverhead = 0;
+    unmet = 0;
+    clear();
+}
+
+void FrequencyPlanner::clear()
+{
+    frequency.clear();
+    magnitudeMean.clear();
+    magnitudeM2.clear();
+    phaseMean.clear();
+    phaseM2.clear();
+    phaseFirst.clear();
+    regionList.clear();
+    probes = 0;
+    probeMs = 0;
+}
+
+bool FrequencyPlanner::add_probe(const QVector<float> &stimulus, const QVector<float> &magnitude, const QVector<float> &phase, qint64 ms)
+{
+    const int points = stimulus.size();
+    if (points < 3 || magnitude.size() != points || phase.size() != points) {
+        return false;
+    }
+    if (probes == 0) {
+        frequency = stimulus;
+        phaseFirst = phase;
+        magnitudeMean.fill(0, points);
+        magnitudeM2.fill(0, points);
+        phaseMean.fill(0, points);
+        phaseM2.fill(0, points);
+    } else if (stimulus != frequency) {
+        return false;
+    }
+
+    // Welford's update per point. The phase is taken relative to the first probe,
+    // so noise around ±180° does not show up as a 360° jump.
+    probes++;
+    probeMs += ms;
+    for (int i = 0; i < points; i++) {
+        double x = magnitude.at(i);
+        double delta = x - magnitudeMean.at(i);
+        magnitudeMean[i] += delta / probes;
+        magnitudeM2[i] += delta * (x - magnitudeMean.at(i));
+
+        x = phaseFirst.at(i) + wrap_phase(phase.at(i) - phaseFirst.at(i));
+        delta = x - phaseMean.at(i);
+        phaseMean[i] += delta / probes;
+        phaseM2[i] += delta * (x - phaseMean.at(i));
+    }
+    return true;
+}
+
+double FrequencyPlanner::bandwidth(HP8751A::ifbw_t ifbw)
+{
+    switch (ifbw) {
+    case HP8751A::IFBW_2HZ:
+        return 2;
+    case HP8751A::IFBW_20HZ:
+        return 20;
+    case HP8751A::IFBW_200HZ:
+        return 200;
+    case HP8751A::IFBW_1KHZ:
+        return 1000;
+    case HP8751A::IFBW_4KHZ:
+        return 4000;
+    default:
+        return 0;
+    }
+}
+
+double FrequencyPlanner::max_bandwidth(double frequency)
+{
+    // Keep the IF filter well below the stimulus, similar to the automatic bandwidth
+    return qBound(2.0, frequency / 5, 4000.0);
+}
+
+double FrequencyPlanner::point_time(double frequency, double bandwidth) const
+{
+    if (bandwidth <= 0) {
+        bandwidth = max_bandwidth(frequency);
+    }
+    return 1.0 / bandwidth + pointOverhead;
+}
+
+double FrequencyPlanner::curvature(const QVector<float> &frequency, const QVector<double> &trace, int first, int last)
+{
+    // Three point average first, the second difference amplifies the remaining noise
+    double largest = 0;
+    for (int i = first + 2; i <= last - 2; i++) {
+        double x0 = std::log10(frequency.at(i - 1));
+        double x1 = std::log10(frequency.at(i));
+        double x2 = std::log10(frequency.at(i + 1));
+        double y0 = (trace.at(i - 2) + trace.at(i - 1) + trace.at(i)) / 3;
+        double y1 = (trace.at(i - 1) + trace.at(i) + trace.at(i + 1)) / 3;
+        double y2 = (trace.at(i) + trace.at(i + 1) + trace.at(i + 2)) / 3;
+        if (x2 <= x0) {
+            continue;
+        }
+        double d2 = 2 * ((y2 - y1) / (x2 - x1) - (y1 - y0) / (x1 - x0)) / (x2 - x0);
+        largest = qMax(largest, std::fabs(d2));
+    }
+    return largest;
+}
+
+bool FrequencyPlanner::analyse(HP8751A::ifbw_t probeIfbw)
+{
+    regionList.clear();
+    if (probes < 2 || bandwidth(probeIfbw) <= 0 || frequency.first() <= 0) {
+        return false;
+    }
+    this->probeIfbw = probeIfbw;
+    const int points = frequency.size();
+
+    // Time per point which is not explained by the IF filter, e.g. source settling and data transfer
+    double sweepSeconds = probeMs / 1000.0 / probes;
+    pointOverhead = qMax(0.0, sweepSeconds / points - 1.0 / bandwidth(probeIfbw));
+
+    // The instrument may return the phase wrapped, the curvature needs a continuous trace
+    QVector<double> phaseTrace = phaseMean;
+    for (int i = 1; i < points; i++) {
+        phaseTrace[i] = phaseTrace.at(i - 1) + wrap_phase(phaseTrace.at(i) - phaseTrace.at(i - 1));
+    }
+
+    int first = 0;
+    while (first < points - 1) {
+        region_t region;
+        region.fStart = frequency.at(first);
+        double decadeEnd = (double)frequency.at(first) * 10;
+        int last = first + 1;
+        while (last < points - 1 && frequency.at(last) < decadeEnd) {
+            last++;
+        }
+        // Avoid a short remainder at the end of the span
+        if (points - 1 - last < 5) {
+            last = points - 1;
+        }
+        region.fStop = frequency.at(last);
+
+        QVector<double> magnitudeStd;
+        QVector<double> phaseStd;
+        for (int i = first; i <= last; i++) {
+            magnitudeStd.append(std::sqrt(magnitudeM2.at(i) / (probes - 1)));
+            phaseStd.append(std::sqrt(phaseM2.at(i) / (probes - 1)));
+        }
+        region.magnitudeNoise = median(magnitudeStd);
+        region.phaseNoise = median(phaseStd);
+        region.magnitudeCurvature = curvature(frequency, magnitudeMean, first, last);
+        region.phaseCurvature = curvature(frequency, phaseTrace, first, last);
+        regionList.append(region);
+
+        first = last;
+    }
+    return !regionList.isEmpty();
+}
+
+QVector<HP8751A::segment_t> FrequencyPlanner::plan(const target_t &target) const
+{
+    QVector<HP8751A::segment_t> segments;
+    unmet = 0;
+    const double probeBandwidth = bandwidth(probeIfbw);
+    int total = 0;
+
+    for (const region_t &region : regionList) {
+        HP8751A::segment_t segment;
+        segment.fStart = region.fStart;
+        segment.fStop = region.fStop;
+
+        // Noise voltage scales with the square root of the bandwidth
+        segment.ifbw = HP8751A::IFBW_2HZ;
+        bool met = false;
+        for (HP8751A::ifbw_t candidate : CANDIDATES) {
+            double bw = bandwidth(candidate);
+            if (bw > max_bandwidth(region.fStart) && candidate != HP8751A::IFBW_2HZ) {
+                continue;
+            }
+            double scale = std::sqrt(bw / probeBandwidth);
+            if (region.magnitudeNoise * scale <= target.magnitudeDb && region.phaseNoise * scale <= target.phaseDeg) {
+                segment.ifbw = candidate;
+                met = true;
+                break;
+            }
+        }
+        if (!met) {
+            unmet++;
+        }
+
+        // Linear interpolation error between two points h decades apart is h² / 8 * curvature
+        double h = 1.0 / MIN_POINTS_PER_DECADE;
+        if (region.magnitudeCurvature > 0) {
+            h = qMin(h, std::sqrt(8 * target.magnitudeDb / region.magnitudeCurvature));
+        }
+        if (region.phaseCurvature > 0) {
+            h = qMin(h, std::sqrt(8 * target.phaseDeg / region.phaseCurvature));
+        }
+
+        // The points of a list segment are linearly spaced, so the first interval is the widest in decades.
+        // The region is split into segments of at most MAX_SEGMENT_RATIO, which keeps the density close to a
+        // log sweep, and each segment gets enough points for its first interval to stay within h.
+        const double span = (double)region.fStop / region.fStart;
+        const int pieces = qMax(1, (int)std::ceil(std::log(span) / std::log(MAX_SEGMENT_RATIO) - 1e-9));
+        for (int piece = 0; piece < pieces; piece++) {
+            HP8751A::segment_t part = segment;
+            part.fStart = piece == 0 ? region.fStart : segments.last().fStop;
+            part.fStop = piece == pieces - 1 ? region.fStop : (quint32)std::lround(region.fStart * std::pow(span, (piece + 1.0) / pieces));
+            double ratio = (double)part.fStop / part.fStart;
+            part.points = qBound(2, (int)std::ceil((ratio - 1) / (std::pow(10, h) - 1) - 1e-9) + 1, HP8751A::MAX_POINTS);
+            total += part.points;
+            segments.append(part);
+        }
+    }
+
+    // Thin out evenly if the instrument cannot take all points
+    if (total > HP8751A::MAX_POINTS) {
+        double scale = (double)HP8751A::MAX_POINTS / total;
+        for (HP8751A::segment_t &segment : segments) {
+            segment.points = qMax(2, (int)std::floor(segment.points * scale));
+        }
+    }
+    return segments;
+}
+
+double FrequencyPlanner::segment_time(const HP8751A::segment_t &segment, bool logSpacing) const
+{
+    double seconds = 0;
+    const double step = segment.points < 2 ? 0 : logSpacing
+            ? std::log10((double)segment.fStop / segment.fStart) / (segment.points - 1)
+            : ((double)segment.fStop - segment.fStart) / (segment.points - 1);
+    for (int i = 0; i < segment.points; i++) {
+        double f = logSpacing ? segment.fStart * std::pow(10, i * step) : segment.fStart + i * step;
+        seconds += point_time(f, bandwidth(segment.ifbw));
+    }
+    return seconds;
+}
+
+double FrequencyPlanner::sweep_time(const QVector<HP8751A::segment_t> &segments) const
+{
+    // List segments are linearly spaced
+    double seconds = 0;
+    for (const HP8751A::segment_t &segment : segments) {
+        seconds += segment_time(segment, false);
+    }
+    return seconds;
+}
+
+double FrequencyPlanner::sweep_time(const HP8751A::instrument_parameters_t &param) const
+{
+    if (param.sweepType == HP8751A::SWEEP_LIST && !param.segments.isEmpty()) {
+        return sweep_time(param.segments);
+    }
+    if (param.fStart == 0 || param.fStop <= param.fStart) {
+        return 0;
+    }
+    HP8751A::segment_t segment = {param.fStart, param.fStop, param.points, param.ifbw};
+    return segment_time(segment, true);
+}
@@ -0,0 +1,79 @@
+#ifndef FREQUENCYPLANNER_H
+#define FREQUENCYPLANNER_H
+
+#include <QVector>
+#include "hp8751a.h"
+
+// Proposes a list sweep from repeated probe sweeps. The scatter between the probes gives the noise
+// per decade, the mean trace gives the curvature. Every decade gets the widest IF bandwidth that still
+// meets the target uncertainty and as many points as linear interpolation between them needs. List segments
+// are linearly spaced, so a decade is split into segments of at most 2:1, each sized by its first interval.
+class FrequencyPlanner
+{
+public:
+    struct target_t {
+        double magnitudeDb; // Allowed standard deviation and interpolation error of the magnitude
+        double phaseDeg; // Allowed standard deviation and interpolation error of the phase
+    };
+
+    struct region_t {
+        quint32 fStart;
+        quint32 fStop;
+        double magnitudeNoise; // Standard deviation at the probe bandwidth in dB
+        double phaseNoise; // Standard deviation at the probe bandwidth in °
+        double magnitudeCurvature; // Largest second derivative over log10(f) in dB/decade²
+        double phaseCurvature; // Largest second derivative over log10(f) in °/decade²
+    };
+
+    FrequencyPlanner();
+
+    // Drop all probes
+    void clear();
+
+    // Add one probe sweep. All probes must use the same stimulus.
+    bool add_probe(const QVector<float> &stimulus, const QVector<float> &magnitude, const QVector<float> &phase, qint64 ms);
+
+    int probe_count() const { return probes; }
+
+    // Split the probed span into decades and estimate noise and curvature of each
+    bool analyse(HP8751A::ifbw_t probeIfbw);
+
+    const QVector<region_t> &regions() const { return regionList; }
+
+    // Cheapest list sweep that meets the target, limited to HP8751A::MAX_POINTS
+    QVector<HP8751A::segment_t> plan(const target_t &target) const;
+
+    // Regions where even the narrowest bandwidth misses the target, valid after plan()
+    int unmet_regions() const { return unmet; }
+
+    // Predicted duration of a sweep in seconds, based on the time per point measured with the probes
+    double sweep_time(const QVector<HP8751A::segment_t> &segments) const;
+    double sweep_time(const HP8751A::instrument_parameters_t &param) const;
+
+    static double bandwidth(HP8751A::ifbw_t ifbw);
+
+private:
+    static constexpr int MIN_POINTS_PER_DECADE = 10;
+    static constexpr double MAX_SEGMENT_RATIO = 2; // fStop / fStart of a planned segment
+
+    QVector<float> frequency;
+    QVector<double> magnitudeMean;
+    QVector<double> magnitudeM2;
+    QVector<double> phaseMean;
+    QVector<double> phaseM2;
+    QVector<float> phaseFirst; // Phase of the first probe, the others are unwrapped against it
+    int probes;
+    qint64 probeMs;
+
+    HP8751A::ifbw_t probeIfbw;
+    double pointOverhead; // Seconds per point on top of the IF filter settling
+    QVector<region_t> regionList;
+    mutable int unmet;
+
+    static double max_bandwidth(double frequency);
+    static double curvature(const QVector<float> &frequency, const QVector<double> &trace, int first, int last);
+    double point_time(double frequency, double bandwidth) const;
+    double segment_time(const HP8751A::segment_t &segment, bool logSpacing) const;
+};
+
+#endif // FREQUENCYPLANNER_H
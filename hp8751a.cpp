@@ -1,4 +1,7 @@
 #include "hp8751a.h"
+#include "impedancekernels.h"
+#include <QCryptographicHash>
+#include <cmath>
 
 HP8751A::HP8751A(PrologixGPIB *gpib, quint16 gpibId, QObject *parent) : QObject(parent)
 {
@@ -10,12 +13,53 @@ HP8751A::HP8751A(PrologixGPIB *gpib, quint16 gpibId, QObject *parent) : QObject(
     respTimer->setSingleShot(true);
     QObject::connect(respTimer, &QTimer::timeout, this, &HP8751A::resp_timeout);
     nextCmd = true;
+    rawData = false;
+    data.sequence = 0;
+    refinePoints = 0;
+    refineIndex = -1;
+    pipelined = false;
+    pipelineRunning = false;
+    memorySweep = false;
+    stimulusValid = false;
+    stream = false;
+    streamScaled = false;
+    set_channel_functions(PORT_AR, CONV_OFF, FMT_LOGM, PORT_AR, CONV_OFF, FMT_PHAS);
 
     sendCmdTimer = new QTimer(this);
     sendCmdTimer->setInterval(1);
     QObject::connect(sendCmdTimer, &QTimer::timeout, this, &HP8751A::send_timer_timeout);
 
+    calBusy = false;
+    calAveraged = false;
+    partialSweep = false;
+
+    currentProfile = PROFILE_NONE;
+    for (profile_state_t &profile : profiles) {
+        profile.saved = false;
+    }
+
     init_statemachine_sweep();
+    init_statemachine_cal();
+}
+
+bool HP8751A::claim(const void *user)
+{
+    if (claimed_by_other(user)) {
+        return false;
+    }
+    if (claimant != user) {
+        claimant = user;
+        emit claim_changed();
+    }
+    return true;
+}
+
+void HP8751A::release(const void *user)
+{
+    if (claimant == user && user) {
+        claimant = nullptr;
+        emit claim_changed();
+    }
 }
 
 void HP8751A::identify()
@@ -23,10 +67,10 @@ void HP8751A::identify()
     enqueue_cmd(CMD_IDENTIFY, "*IDN?", -1, CMD_TYPE_QUERY);
 }
 
-void HP8751A::init_function(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2)
+QString HP8751A::function_commands(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2)
 {
     QString commands;
-    commands.append("LOGFREQ;"); // log sweep
+    // The sweep type is part of the parameters
     commands.append("DUACON;"); // activate dual channel
     commands.append("SPLDON;"); // activate split display
     commands.append("HOLD;"); // Stop sweep
@@ -38,20 +82,116 @@ void HP8751A::init_function(input_port_t portCh1, conversion_t convCh1, format_t
     commands.append(port_to_string(portCh2) + ";"); // Select meas function
     commands.append(conversion_to_string(convCh2) + ";"); // Select conversion
     commands.append(format_to_string(fmtCh2)); // Select format
+    return commands;
+}
+
+void HP8751A::set_channel_functions(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2)
+{
+    channelPort[0] = portCh1;
+    channelConv[0] = convCh1;
+    channelFmt[0] = fmtCh1;
+    channelPort[1] = portCh2;
+    channelConv[1] = convCh2;
+    channelFmt[1] = fmtCh2;
+}
+
+void HP8751A::init_function(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2)
+{
+    currentProfile = PROFILE_NONE;
+    set_channel_functions(portCh1, convCh1, fmtCh1, portCh2, convCh2, fmtCh2);
+    send_function(function_commands(portCh1, convCh1, fmtCh1, portCh2, convCh2, fmtCh2));
+}
+
+void HP8751A::init_profile(profile_t profile, input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2)
+{
+    currentProfile = profile;
+    set_channel_functions(portCh1, convCh1, fmtCh1, portCh2, convCh2, fmtCh2);
+    QString commands = function_commands(portCh1, convCh1, fmtCh1, portCh2, convCh2, fmtCh2);
+    QByteArray hash = state_hash(commands);
+    const profile_state_t &state = profiles[profile];
+
+    if (hash != functionHash && state.saved && state.functionHash == hash) {
+        // One recall restores function and parameters of the last use
+        enqueue_cmd(CMD_RECALL_PROFILE, QString("RECA%1").arg(profile_register(profile)), (qint8)profile, CMD_TYPE_COMMAND);
+        return;
+    }
+    send_function(commands);
+}
+
+void HP8751A::send_function(const QString &commands)
+{
+    QByteArray hash = state_hash(commands);
+    if (hash == functionHash) {
+        // Instrument is already set up for this function
+        QTimer::singleShot(0, this, [=] {
+            emit instrument_initialized();
+        });
+        return;
+    }
+    pendingFunctionHash = hash;
     enqueue_cmd(CMD_INIT_FUNCTION, commands, -1, CMD_TYPE_COMMAND);
 }
 
+QByteArray HP8751A::state_hash(const QString &commands)
+{
+    return QCryptographicHash::hash(commands.toLatin1(), QCryptographicHash::Sha1);
+}
+
+int HP8751A::profile_register(profile_t profile)
+{
+    // Internal state registers 1 to 5, SAVE<n> and RECA<n>. Not to be confused with SAV1, SAV2 and SAVC,
+    // which complete a calibration.
+    return profile + 1;
+}
+
+void HP8751A::save_profile()
+{
+    if (currentProfile == PROFILE_NONE) {
+        return;
+    }
+    enqueue_cmd(CMD_SAVE_PROFILE, QString("SAVE%1").arg(profile_register(currentProfile)), (qint8)currentProfile, CMD_TYPE_COMMAND);
+}
+
 void HP8751A::set_instrument_parameters(instrument_parameters_t param)
 {
-    this->params = param;
     QString commands;
-    commands.append(QString("STAR %1;").arg(param.fStart));
-    commands.append(QString("STOP %1;").arg(param.fStop));
-    commands.append(QString("POIN %1;").arg(param.points));
-    commands.append(QString("POWE %1;").arg(param.power));
-    if (param.clearPowerTrip) {
-        commands.append("CLEPTRIP;");
+    if (param.sweepType == SWEEP_LIST && !param.segments.isEmpty()) {
+        // Rebuild the list table. Every segment has its own span, points and IFBW,
+        // the instrument returns all segments as one trace.
+        param.fStart = param.segments.first().fStart;
+        param.fStop = param.segments.first().fStop;
+        param.points = 0;
+        commands.append("EDITLIST;CLEL;");
+        for (const segment_t &segment : param.segments) {
+            commands.append("SADD;");
+            commands.append(QString("STAR %1;").arg(segment.fStart));
+            commands.append(QString("STOP %1;").arg(segment.fStop));
+            commands.append(QString("POIN %1;").arg(segment.points));
+            commands.append(ifbw_to_string(segment.ifbw) + ";");
+            commands.append("SDON;");
+            param.fStart = qMin(param.fStart, segment.fStart);
+            param.fStop = qMax(param.fStop, segment.fStop);
+            param.points += segment.points;
+        }
+        commands.append("EDITDONE;LISFREQ;");
+    } else if (param.sweepType == SWEEP_CW_TIME) {
+        param.fStop = param.fStart;
+        param.segments.clear();
+        commands.append("CWTIME;");
+        commands.append(QString("CWFREQ %1;").arg(param.fStart));
+        commands.append(QString("POIN %1;").arg(param.points));
+        commands.append(ifbw_to_string(param.ifbw) + ";");
+    } else {
+        param.sweepType = SWEEP_LOG;
+        commands.append("LOGFREQ;");
+        commands.append(QString("STAR %1;").arg(param.fStart));
+        commands.append(QString("STOP %1;").arg(param.fStop));
+        commands.append(QString("POIN %1;").arg(param.points));
+        commands.append(ifbw_to_string(param.ifbw) + ";");
     }
+    this->params = param;
+
+    commands.append(QString("POWE %1;").arg(param.power));
     if (param.attenR) {
         commands.append("ATTIR20DB;");
     } else {
@@ -62,7 +202,6 @@ void HP8751A::set_instrument_parameters(instrument_parameters_t param)
     } else {
         commands.append("ATTIA0DB;");
     }
-    commands.append(ifbw_to_string(params.ifbw) + ";");
 
     commands.append("CHAN2;");
 
@@ -81,12 +220,45 @@ void HP8751A::set_instrument_parameters(instrument_parameters_t param)
         commands.append("CHAN1;AVEROFF;CHAN2;AVEROFF");
     }
 
+    QByteArray hash = state_hash(commands);
+    if (hash == paramHash && !functionHash.isEmpty()) {
+        // Nothing changed. Only a power trip has to be cleared.
+        if (param.clearPowerTrip) {
+            pendingParamHash = hash;
+            enqueue_cmd(CMD_SET_PARAMETERS, "CLEPTRIP", -1, CMD_TYPE_COMMAND);
+        } else {
+            QTimer::singleShot(0, this, [=] {
+                emit set_parameters_finished();
+            });
+        }
+        return;
+    }
+
+    if (param.clearPowerTrip) {
+        commands.prepend("CLEPTRIP;");
+    }
+    if (pipelineRunning) {
+        // Don't let the sweep started by the pipeline run into the new settings
+        commands.prepend("HOLD;");
+        pipelineRunning = false;
+    }
+    stimulusValid = false;
+    pendingParamHash = hash;
     enqueue_cmd(CMD_SET_PARAMETERS, commands, -1, CMD_TYPE_COMMAND);
 }
 
 void HP8751A::request_sweep()
 {
     QTimer::singleShot(0, this, [=] {
+        partialSweep = false;
+        emit sig_start_sweep(QPrivateSignal());
+    });
+}
+
+void HP8751A::request_partial_sweep()
+{
+    QTimer::singleShot(0, this, [=] {
+        partialSweep = true;
         emit sig_start_sweep(QPrivateSignal());
     });
 }
@@ -108,6 +280,50 @@ void HP8751A::get_data(instrument_data_t &data)
     data = this->data;
 }
 
+void HP8751A::set_raw_data(bool enable)
+{
+    rawData = enable;
+    if (!enable) {
+        data.raw.clear();
+    }
+}
+
+void HP8751A::set_refinement(refine_fn_t finder, quint16 points)
+{
+    refineFinder = finder;
+    refinePoints = qBound<quint16>(2, points, MAX_POINTS);
+}
+
+void HP8751A::set_pipelined(bool enable)
+{
+    pipelined = enable;
+    if (!enable && pipelineRunning) {
+        pipelineRunning = false;
+        enqueue_cmd(CMD_STOP_PIPELINE, "HOLD", -1, CMD_TYPE_COMMAND);
+    }
+}
+
+bool HP8751A::start_stream()
+{
+    if (rawData || refineFinder || !memory_readout_possible()) {
+        return false;
+    }
+    stream = true;
+    streamScaled = false;
+    request_sweep();
+    return true;
+}
+
+bool HP8751A::streaming()
+{
+    return stream;
+}
+
+void HP8751A::get_parameters(instrument_parameters_t &param)
+{
+    param = this->params;
+}
+
 void HP8751A::init_cal()
 {
     QString commands;
@@ -116,56 +332,136 @@ void HP8751A::init_cal()
     enqueue_cmd(CMD_INIT_CAL, commands, -1, CMD_TYPE_COMMAND);
 }
 
-void HP8751A::measure_cal_std(cal_std_t cal)
+void HP8751A::measure_cal_std(cal_std_t cal, quint16 averages)
 {
+    run_cal_plan({{cal, averages}});
+}
+
+void HP8751A::run_cal_plan(const QVector<cal_step_t> &plan)
+{
+    if (plan.isEmpty()) {
+        return;
+    }
+    calQueue.append(plan);
+    if (!calBusy) {
+        calBusy = true;
+        QTimer::singleShot(0, this, [=] {
+            emit sig_cal_next(QPrivateSignal());
+        });
+    }
+}
+
+bool HP8751A::cal_busy()
+{
+    return calBusy;
+}
+
+void HP8751A::start_cal_step()
+{
+    const cal_step_t &step = calQueue.first();
     QString commands;
-    commands.append(QString("CLASS11%1;").arg(cal_std_to_class(cal)));
+    // Every step sets the averaging it asks for, neither the window's averaging nor the factor of an
+    // earlier step may carry over. The standard is measured with the averaging factor number of sweeps.
+    if (step.averages > 1) {
+        commands.append(QString("CHAN1;AVERFACT %1;AVERON;AVERREST;").arg(step.averages));
+    } else {
+        commands.append("CHAN1;AVEROFF;");
+    }
+    calAveraged = true;
+    commands.append(QString("CLASS11%1").arg(cal_std_to_class(step.standard)));
+    calTimer.start();
     enqueue_cmd(CMD_MEAS_CAL_STD, commands, -1, CMD_TYPE_COMMAND);
+}
 
-    QStateMachine *smPollHold = new QStateMachine(this);
-    QState *sPollHold = new QState();
-    QState *sHold = new QState();
-
-    QObject::connect(sPollHold, &QState::entered, this, &HP8751A::poll_hold);
-    sPollHold->addTransition(this, &HP8751A::responseOK, sHold);
-    sPollHold->addTransition(this, &HP8751A::responseNOK, sPollHold);
+void HP8751A::finish_cal_step()
+{
+    cal_step_t step = calQueue.takeFirst();
+    emit cal_std_done(step.standard, calTimer.elapsed());
 
-    QObject::connect(sHold, &QState::entered, this, [=] {
-        emit cal_done();
-        smPollHold->stop();
-        sPollHold->deleteLater();
-        sHold->deleteLater();
-        smPollHold->deleteLater();
-    });
+    if (!calQueue.isEmpty()) {
+        emit sig_cal_next(QPrivateSignal());
+        return;
+    }
 
-    smPollHold->addState(sPollHold);
-    smPollHold->addState(sHold);
-    smPollHold->setInitialState(sPollHold);
-    smPollHold->start();
+    if (calAveraged) {
+        calAveraged = false;
+        QString commands;
+        if (params.avgEn) {
+            commands.append(QString("CHAN1;AVERFACT %1;AVERON").arg(params.averFact));
+        } else {
+            commands.append("CHAN1;AVEROFF");
+        }
+        enqueue_cmd(CMD_CAL_RESTORE_AVERAGING, commands, -1, CMD_TYPE_COMMAND);
+    }
+    emit sig_cal_finished(QPrivateSignal());
 }
 
 void HP8751A::set_cal_done()
 {
     QString commands;
-    commands.append("SAV1;");
+    commands.append("SAV1;"); // Completes the one-port calibration, no state register involved
     commands.append("CORRON");
     enqueue_cmd(CMD_SET_CAL_DONE, commands, -1, CMD_TYPE_COMMAND);
+    // The profile register has to contain the new calibration as well
+    save_profile();
+}
+
+void HP8751A::read_cal_coefficients()
+{
+    calCoefficients.arrays.resize(CAL_COEF_ONE_PORT);
+    for (int i = 0; i < CAL_COEF_ONE_PORT; i++) {
+        enqueue_cmd(CMD_GET_CAL_COEF, QString("CHAN1;FORM5;OUTPCALC%1?").arg(i + 1, 2, 10, QChar('0')), (qint8)i, CMD_TYPE_QUERY);
+    }
+}
+
+void HP8751A::write_cal_coefficients(const cal_coefficients_t &coefficients)
+{
+    // The cal type has to be selected before the arrays are accepted, SAVC completes the calibration
+    enqueue_cmd(CMD_INIT_CAL, QString("CHAN1;CALI%1").arg(cal_type_to_string(CAL_TYPE_S111)), -1, CMD_TYPE_COMMAND);
+    for (int i = 0; i < coefficients.arrays.size(); i++) {
+        const QByteArray &block = coefficients.arrays.at(i);
+        QString header = QString("FORM5;INPUCALC%1 #6%2").arg(i + 1, 2, 10, QChar('0')).arg(block.size(), 6, 10, QChar('0'));
+        enqueue_binary(CMD_PUT_CAL_COEF, header, block);
+    }
+    enqueue_cmd(CMD_RESTORE_CAL, "SAVC;CORRON", -1, CMD_TYPE_COMMAND);
+    save_profile();
 }
 
 void HP8751A::start_sweep()
 {
-    QString commands;
-    if (this->params.avgEn) {
-        commands.append(QString("NUMG %1").arg(this->params.averFact));
-    } else {
-        commands.append("SING");
+    if (pipelineRunning) {
+        // Started right after the previous sweep, only wait for it to finish
+        pipelineRunning = false;
+        QTimer::singleShot(0, this, [=] {
+            emit responseOK(QPrivateSignal());
+        });
+        return;
     }
 
-    enqueue_cmd(CMD_START_SWEEP, commands, -1, CMD_TYPE_COMMAND);
+    enqueue_cmd(CMD_START_SWEEP, sweep_command(), -1, CMD_TYPE_COMMAND);
+}
+
+QString HP8751A::sweep_command() const
+{
+    if (params.avgEn) {
+        return QString("NUMG %1").arg(params.averFact);
+    }
+    return "SING";
 }
 
 void HP8751A::cancel_sweep()
 {
+    pipelineRunning = false;
+    if (stream) {
+        // HOLD also stops the sweep the free run started last
+        stream = false;
+        memorySweep = false;
+    }
+    if (refineIndex >= 0) {
+        // The instrument is left at the span of the refinement sweep
+        refineIndex = -1;
+        paramHash.clear();
+    }
     enqueue_cmd(CMD_CANCEL_SWEEP, "HOLD", -1, CMD_TYPE_COMMAND);
 }
 
@@ -176,6 +472,15 @@ void HP8751A::poll_hold()
 
 void HP8751A::fit_trace()
 {
+    if (refineIndex >= 0 || (stream && streamScaled)) {
+        // Refinement sweeps keep the scale of the regular sweep, the free run the scale of its first sweep
+        QTimer::singleShot(0, this, [=] {
+            emit responseOK(QPrivateSignal());
+        });
+        return;
+    }
+    streamScaled = stream;
+
     QString commands;
     commands.append("CHAN1;");
     commands.append("AUTO;");
@@ -194,6 +499,13 @@ void HP8751A::fit_trace()
 
 void HP8751A::get_stimulus()
 {
+    if (stimulusValid) {
+        // The frequencies only change with the parameters
+        QTimer::singleShot(0, this, [=] {
+            emit responseOK(QPrivateSignal());
+        });
+        return;
+    }
     QString commands;
     commands.append("FORM5;OUTPSTIM?");
     enqueue_cmd(CMD_GET_STIMULUS, commands, -1, CMD_TYPE_QUERY);
@@ -205,11 +517,216 @@ void HP8751A::get_channel_data(quint8 channel)
     if (channel > 1) {
         channel = 1;
     }
+    if (memorySweep) {
+        get_memory_data(channel);
+        return;
+    }
     commands.append(QString("CHAN%1;").arg(channel + 1));
     commands.append("FORM5;OUTPFORM?");
     enqueue_cmd(CMD_GET_DATA, commands, (qint8)channel, CMD_TYPE_QUERY);
 }
 
+bool HP8751A::shared_memory()
+{
+    return channelPort[0] == channelPort[1] && channelConv[0] == channelConv[1];
+}
+
+bool HP8751A::pipeline_possible()
+{
+    if (!(pipelined || stream) || rawData || refineFinder) {
+        return false;
+    }
+    return memory_readout_possible();
+}
+
+bool HP8751A::memory_readout_possible()
+{
+    // Formats the host can compute from the complex memory trace
+    for (int channel = 0; channel < 2; channel++) {
+        if (channelConv[channel] != CONV_OFF && channelConv[channel] != CONV_Z_REFL) {
+            return false;
+        }
+    }
+    if (channelFmt[0] != FMT_LOGM && channelFmt[0] != FMT_PHAS) {
+        return false;
+    }
+    return true;
+}
+
+void HP8751A::store_and_restart()
+{
+    memorySweep = pipeline_possible();
+    if (!memorySweep) {
+        QTimer::singleShot(0, this, [=] {
+            emit responseOK(QPrivateSignal());
+        });
+        return;
+    }
+
+    // Copy the finished sweep to the memory trace and start the next one before reading out
+    QString commands = "CHAN1;DATI;";
+    if (!shared_memory()) {
+        commands.append("CHAN2;DATI;CHAN1;");
+    }
+    commands.append(sweep_command());
+    pipelineRunning = true;
+    enqueue_cmd(CMD_STORE_RESTART, commands, -1, CMD_TYPE_COMMAND);
+}
+
+void HP8751A::get_memory_data(quint8 channel)
+{
+    if (channel == 1 && shared_memory()) {
+        // Already formatted from the memory trace of channel 1
+        QTimer::singleShot(0, this, [=] {
+            emit responseOK(QPrivateSignal());
+        });
+        return;
+    }
+    enqueue_cmd(CMD_GET_MEMORY, QString("CHAN%1;FORM5;OUTPMEMO?").arg(channel + 1), (qint8)channel, CMD_TYPE_QUERY);
+}
+
+void HP8751A::unpack_memory(const QByteArray &resp, quint8 channel)
+{
+    // The memory trace holds the complex data before conversion and formatting
+    const int points = resp.size() / (2 * sizeof(float));
+    QVector<float> re(points);
+    QVector<float> im(points);
+    const float *values = reinterpret_cast<const float*>(resp.constData());
+    for (int i = 0; i < points; i++) {
+        re[i] = values[2 * i];
+        im[i] = values[2 * i + 1];
+    }
+    if (channelConv[channel] == CONV_Z_REFL) {
+        zkernels::reflection_to_impedance(re.constData(), im.constData(), 50.0f, re.data(), im.data(), points);
+    }
+    QVector<float> magnitude(points);
+    QVector<float> phase(points);
+    zkernels::rect_to_polar(re.constData(), im.constData(), magnitude.data(), phase.data(), points);
+
+    for (int c = 0; c < 2; c++) {
+        if (c != channel && !shared_memory()) {
+            continue;
+        }
+        // Channel 2 is set to the phase format by the parameters
+        format_t fmt = c == 0 ? channelFmt[0] : (params.unwrapPhase ? FMT_EXPP : FMT_PHAS);
+        QVector<float> &trace = c == 0 ? data.channel1 : data.channel2;
+        if (fmt == FMT_LOGM) {
+            trace = magnitude;
+            continue;
+        }
+        trace = phase;
+        if (fmt == FMT_EXPP) {
+            for (int i = 1; i < points; i++) {
+                trace[i] = trace.at(i - 1) + std::remainder(trace.at(i) - trace.at(i - 1), 360.0f);
+            }
+        }
+    }
+}
+
+void HP8751A::get_raw_data()
+{
+    // Raw data of channel 1 before error correction and format conversion
+    enqueue_cmd(CMD_GET_RAW, "CHAN1;FORM5;OUTPRAW1?", -1, CMD_TYPE_QUERY);
+}
+
+void HP8751A::refine_step()
+{
+    if (refineIndex < 0) {
+        // Regular sweep done, find the spans worth a closer look
+        refineSpans.clear();
+        if (refineFinder && params.sweepType == SWEEP_LOG) {
+            refineSpans = refineFinder(data);
+        }
+        if (refineSpans.isEmpty()) {
+            QTimer::singleShot(0, this, [=] {
+                emit sig_refine_done(QPrivateSignal());
+            });
+            return;
+        }
+        refineData = data;
+        refineIndex = 0;
+    } else {
+        merge_span(data);
+        refineIndex++;
+    }
+
+    if (refineIndex < refineSpans.size()) {
+        const span_t &span = refineSpans.at(refineIndex);
+        stimulusValid = false;
+        enqueue_cmd(CMD_SET_SPAN, QString("STAR %1;STOP %2;POIN %3").arg(span.fStart).arg(span.fStop).arg(refinePoints), -1, CMD_TYPE_COMMAND);
+        return;
+    }
+
+    // Back to the regular sweep, so the parameters known to be set stay valid
+    data = refineData;
+    refineIndex = -1;
+    stimulusValid = false;
+    enqueue_cmd(CMD_RESTORE_SPAN, QString("STAR %1;STOP %2;POIN %3").arg(params.fStart).arg(params.fStop).arg(params.points), -1, CMD_TYPE_COMMAND);
+}
+
+void HP8751A::merge_span(const instrument_data_t &span)
+{
+    const int points = span.stimulus.size();
+    if (points == 0 || span.channel1.size() != points || span.channel2.size() != points) {
+        return;
+    }
+    const float fStart = span.stimulus.first();
+    const float fStop = span.stimulus.last();
+    const bool raw = refineData.raw.size() == 2 * refineData.stimulus.size() && span.raw.size() == 2 * points;
+
+    // An unwrapped phase starts from its own reference in every span, align it to the regular sweep
+    float phaseOffset = 0;
+    if (params.unwrapPhase) {
+        for (int i = 0; i < refineData.stimulus.size(); i++) {
+            if (refineData.stimulus.at(i) >= fStart) {
+                phaseOffset = 360.0f * std::round((refineData.channel2.at(i) - span.channel2.first()) / 360.0f);
+                break;
+            }
+        }
+    }
+
+    instrument_data_t merged = refineData;
+    merged.stimulus.clear();
+    merged.channel1.clear();
+    merged.channel2.clear();
+    merged.raw.clear();
+
+    // Both traces are ascending, the points of the span replace the ones it covers
+    int i = 0;
+    const int n = refineData.stimulus.size();
+    for (; i < n && refineData.stimulus.at(i) < fStart; i++) {
+        merged.stimulus.append(refineData.stimulus.at(i));
+        merged.channel1.append(refineData.channel1.at(i));
+        merged.channel2.append(refineData.channel2.at(i));
+        if (raw) {
+            merged.raw.append(refineData.raw.at(2 * i));
+            merged.raw.append(refineData.raw.at(2 * i + 1));
+        }
+    }
+    for (int k = 0; k < points; k++) {
+        merged.stimulus.append(span.stimulus.at(k));
+        merged.channel1.append(span.channel1.at(k));
+        merged.channel2.append(span.channel2.at(k) + phaseOffset);
+        if (raw) {
+            merged.raw.append(span.raw.at(2 * k));
+            merged.raw.append(span.raw.at(2 * k + 1));
+        }
+    }
+    for (; i < n; i++) {
+        if (refineData.stimulus.at(i) <= fStop) {
+            continue;
+        }
+        merged.stimulus.append(refineData.stimulus.at(i));
+        merged.channel1.append(refineData.channel1.at(i));
+        merged.channel2.append(refineData.channel2.at(i));
+        if (raw) {
+            merged.raw.append(refineData.raw.at(2 * i));
+            merged.raw.append(refineData.raw.at(2 * i + 1));
+        }
+    }
+    refineData = merged;
+}
+
 void HP8751A::unpack_stimulus(const QByteArray &resp)
 {
     data.stimulus.clear();
@@ -240,6 +757,15 @@ void HP8751A::unpack_channel(const QByteArray &resp, quint8 channel)
     }
 }
 
+void HP8751A::unpack_raw(const QByteArray &resp)
+{
+    const int values = resp.size() / sizeof(float);
+    data.raw.resize(values);
+    for (int i = 0; i < values; i++) {
+        data.raw[i] = *(reinterpret_cast<const float*>(resp.constData() + 4 * i));
+    }
+}
+
 QString HP8751A::port_to_string(input_port_t port)
 {
     switch (port) {
@@ -393,7 +919,10 @@ void HP8751A::gpib_response(QByteArray resp)
     }
 
     if (cmdQueue.first().cmd == CMD_GET_DATA ||
-        cmdQueue.first().cmd == CMD_GET_STIMULUS) {
+        cmdQueue.first().cmd == CMD_GET_STIMULUS ||
+        cmdQueue.first().cmd == CMD_GET_RAW ||
+        cmdQueue.first().cmd == CMD_GET_MEMORY ||
+        cmdQueue.first().cmd == CMD_GET_CAL_COEF) {
 
         bytesReceived += resp.size();
 
@@ -441,6 +970,15 @@ void HP8751A::resp_timeout()
 {
     qDebug() << "TIMEOUT";
 
+    // The state of the instrument is unknown now, send everything again next time
+    functionHash.clear();
+    paramHash.clear();
+    refineIndex = -1;
+    pipelineRunning = false;
+    stimulusValid = false;
+    stream = false;
+    memorySweep = false;
+
     emit response_timeout();
     cmdQueue.pop_front();
     nextCmd = true;
@@ -474,6 +1012,10 @@ void HP8751A::send_timer_timeout()
         cmd_queue_t next = cmdQueue.first();
         if (next.type == CMD_TYPE_COMMAND) {
             send_command(next.cmdString);
+        } else if (next.type == CMD_TYPE_BINARY) {
+            if (gpib) {
+                gpib->send_binary(gpibId, next.cmdString, next.block, ";*OPC?");
+            }
         } else {
             query_command(next.cmdString);
         }
@@ -489,9 +1031,12 @@ void HP8751A::init_statemachine_sweep()
     QState *sStartSweep = new QState();
     QState *sPollHold = new QState();
     QState *sFitTrace = new QState();
+    QState *sStoreRestart = new QState();
     QState *sGetStimulus = new QState();
     QState *sGetTrace1 = new QState();
     QState *sGetTrace2 = new QState();
+    QState *sGetRaw = new QState();
+    QState *sRefine = new QState();
     QState *sHold = new QState();
     QState *sStop = new QState();
 
@@ -510,9 +1055,13 @@ void HP8751A::init_statemachine_sweep()
 
     QObject::connect(sFitTrace, &QState::entered, this, &HP8751A::fit_trace);
     QObject::connect(sFitTrace, &QState::entered, this, &HP8751A::retrieving_data);
-    sFitTrace->addTransition(this, &HP8751A::responseOK, sGetStimulus);
+    sFitTrace->addTransition(this, &HP8751A::responseOK, sStoreRestart);
     sFitTrace->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
 
+    QObject::connect(sStoreRestart, &QState::entered, this, &HP8751A::store_and_restart);
+    sStoreRestart->addTransition(this, &HP8751A::responseOK, sGetStimulus);
+    sStoreRestart->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
+
     QObject::connect(sGetStimulus, &QState::entered, this, &HP8751A::get_stimulus);
     sGetStimulus->addTransition(this, &HP8751A::responseOK, sGetTrace1);
     sGetStimulus->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
@@ -522,35 +1071,131 @@ void HP8751A::init_statemachine_sweep()
     sGetTrace1->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
 
     QObject::connect(sGetTrace2, &QState::entered, this, [=] {get_channel_data(1);});
-    sGetTrace2->addTransition(this, &HP8751A::responseOK, sStop);
+    sGetTrace2->addTransition(this, &HP8751A::responseOK, sGetRaw);
     sGetTrace2->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
 
+    QObject::connect(sGetRaw, &QState::entered, this, [=] {
+        if (rawData) {
+            get_raw_data();
+        } else {
+            QTimer::singleShot(0, this, [=] {
+                emit responseOK(QPrivateSignal());
+            });
+        }
+    });
+    sGetRaw->addTransition(this, &HP8751A::responseOK, sRefine);
+    sGetRaw->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
+
+    // Either sets the span of the next refinement sweep or restores the regular one
+    QObject::connect(sRefine, &QState::entered, this, &HP8751A::refine_step);
+    sRefine->addTransition(this, &HP8751A::responseOK, sStartSweep);
+    sRefine->addTransition(this, &HP8751A::sig_refine_done, sStop);
+    sRefine->addTransition(this, &HP8751A::sig_cancel_sweep, sHold);
+
     QObject::connect(sHold, &QState::entered, this, &HP8751A::cancel_sweep);
     QObject::connect(sHold, &QState::exited, this, &HP8751A::sweep_cancelled);
     sHold->addTransition(this, &HP8751A::responseOK, sIdle);
 
-    QObject::connect(sStop, &QState::entered, this, [=] {emit new_data(this->data);});
-    sStop->addTransition(sStop, &QState::entered, sIdle);
+    // The free run goes on with the sweep the pipeline already started
+    QObject::connect(sStop, &QState::entered, this, [=] {
+        this->data.sequence++;
+        this->data.partial = partialSweep;
+        emit new_data(this->data);
+        if (stream) {
+            emit sig_next_sweep(QPrivateSignal());
+        } else {
+            emit sig_sweep_finished(QPrivateSignal());
+        }
+    });
+    sStop->addTransition(this, &HP8751A::sig_next_sweep, sStartSweep);
+    sStop->addTransition(this, &HP8751A::sig_sweep_finished, sIdle);
+
+    // Nothing is sent again after a timeout, the next request starts over
+    for (QState *state : {sStartSweep, sPollHold, sFitTrace, sStoreRestart, sGetStimulus, sGetTrace1, sGetTrace2, sGetRaw, sRefine}) {
+        state->addTransition(this, &HP8751A::response_timeout, sIdle);
+    }
 
     smSweep->addState(sIdle);
     smSweep->addState(sStartSweep);
     smSweep->addState(sPollHold);
     smSweep->addState(sFitTrace);
+    smSweep->addState(sStoreRestart);
     smSweep->addState(sGetStimulus);
     smSweep->addState(sGetTrace1);
     smSweep->addState(sGetTrace2);
+    smSweep->addState(sGetRaw);
+    smSweep->addState(sRefine);
     smSweep->addState(sHold);
     smSweep->addState(sStop);
     smSweep->setInitialState(sIdle);
     smSweep->start();
 }
 
+void HP8751A::init_statemachine_cal()
+{
+    // One persistent sequencer for all standards. Completion is detected with HOLD? like a normal sweep.
+    QStateMachine *smCal = new QStateMachine(this);
+    QState *sCalIdle = new QState();
+    QState *sCalMeasure = new QState();
+    QState *sCalPollHold = new QState();
+    QState *sCalStdDone = new QState();
+
+    QObject::connect(sCalIdle, &QState::entered, this, [=] {
+        if (!calQueue.isEmpty()) {
+            // Queued by run_cal_plan() after the last step finished but before this state was entered.
+            // calBusy is still set, so run_cal_plan() did not start it.
+            QTimer::singleShot(0, this, [=] {
+                emit sig_cal_next(QPrivateSignal());
+            });
+            return;
+        }
+        if (calBusy) {
+            calBusy = false;
+            emit cal_plan_done();
+        }
+    });
+    sCalIdle->addTransition(this, &HP8751A::sig_cal_next, sCalMeasure);
+
+    QObject::connect(sCalMeasure, &QState::entered, this, &HP8751A::start_cal_step);
+    sCalMeasure->addTransition(this, &HP8751A::calOK, sCalPollHold);
+    sCalMeasure->addTransition(this, &HP8751A::response_timeout, sCalIdle);
+
+    QObject::connect(sCalPollHold, &QState::entered, this, [=] {
+        enqueue_cmd(CMD_CAL_POLL_HOLD, "HOLD?", -1, CMD_TYPE_QUERY);
+    });
+    sCalPollHold->addTransition(this, &HP8751A::calOK, sCalStdDone);
+    sCalPollHold->addTransition(this, &HP8751A::calNOK, sCalPollHold);
+    sCalPollHold->addTransition(this, &HP8751A::response_timeout, sCalIdle);
+
+    QObject::connect(sCalStdDone, &QState::entered, this, &HP8751A::finish_cal_step);
+    sCalStdDone->addTransition(this, &HP8751A::sig_cal_next, sCalMeasure);
+    sCalStdDone->addTransition(this, &HP8751A::sig_cal_finished, sCalIdle);
+
+    // Drop the rest of the plan after a timeout
+    QObject::connect(this, &HP8751A::response_timeout, this, [=] {
+        calQueue.clear();
+    });
+
+    smCal->addState(sCalIdle);
+    smCal->addState(sCalMeasure);
+    smCal->addState(sCalPollHold);
+    smCal->addState(sCalStdDone);
+    smCal->setInitialState(sCalIdle);
+    smCal->start();
+}
+
 void HP8751A::enqueue_cmd(command_t cmd, QString cmdString, qint8 channel, cmd_type_t type)
 {
     cmdQueue.push_back({cmd, cmdString, channel, type});
     sendCmdTimer->start();
 }
 
+void HP8751A::enqueue_binary(command_t cmd, QString cmdString, const QByteArray &block)
+{
+    cmdQueue.push_back({cmd, cmdString, -1, CMD_TYPE_BINARY, block});
+    sendCmdTimer->start();
+}
+
 void HP8751A::instrument_response(command_t cmd, QByteArray resp, qint8 channel)
 {
     switch (cmd) {
@@ -559,18 +1204,47 @@ void HP8751A::instrument_response(command_t cmd, QByteArray resp, qint8 channel)
         break;
 
     case CMD_INIT_FUNCTION:
+        functionHash = pendingFunctionHash;
+        paramHash.clear(); // The formats set by the parameters were overwritten
         emit instrument_initialized();
         break;
 
     case CMD_SET_PARAMETERS:
+        paramHash = pendingParamHash;
+        if (currentProfile != PROFILE_NONE) {
+            const profile_state_t &state = profiles[currentProfile];
+            if (!state.saved || state.functionHash != functionHash || state.paramHash != paramHash) {
+                save_profile();
+            }
+        }
         emit set_parameters_finished();
         break;
 
+    case CMD_SAVE_PROFILE:
+        // The channel parameter carries the profile
+        profiles[channel].saved = true;
+        profiles[channel].functionHash = functionHash;
+        profiles[channel].paramHash = paramHash;
+        break;
+
+    case CMD_RECALL_PROFILE:
+        stimulusValid = false;
+        functionHash = profiles[channel].functionHash;
+        paramHash = profiles[channel].paramHash;
+        emit instrument_initialized();
+        break;
+
     case CMD_START_SWEEP:
     case CMD_CANCEL_SWEEP:
+    case CMD_SET_SPAN:
+    case CMD_STORE_RESTART:
         emit responseOK(QPrivateSignal());
         break;
 
+    case CMD_RESTORE_SPAN:
+        emit sig_refine_done(QPrivateSignal());
+        break;
+
     case CMD_POLL_HOLD:
         if (resp == "0") {
             emit responseNOK(QPrivateSignal());
@@ -593,6 +1267,7 @@ void HP8751A::instrument_response(command_t cmd, QByteArray resp, qint8 channel)
 
     case HP8751A::CMD_GET_STIMULUS:
         unpack_stimulus(resp);
+        stimulusValid = true;
         emit responseOK(QPrivateSignal());
         break;
 
@@ -601,6 +1276,39 @@ void HP8751A::instrument_response(command_t cmd, QByteArray resp, qint8 channel)
         emit responseOK(QPrivateSignal());
         break;
 
+    case HP8751A::CMD_GET_MEMORY:
+        unpack_memory(resp, channel);
+        emit responseOK(QPrivateSignal());
+        break;
+
+    case HP8751A::CMD_GET_RAW:
+        unpack_raw(resp);
+        emit responseOK(QPrivateSignal());
+        break;
+
+    case HP8751A::CMD_MEAS_CAL_STD:
+        emit calOK(QPrivateSignal());
+        break;
+
+    case HP8751A::CMD_CAL_POLL_HOLD:
+        if (resp == "0") {
+            emit calNOK(QPrivateSignal());
+        } else {
+            emit calOK(QPrivateSignal());
+        }
+        break;
+
+    case HP8751A::CMD_GET_CAL_COEF:
+        calCoefficients.arrays[channel] = resp;
+        if (channel == CAL_COEF_ONE_PORT - 1) {
+            emit cal_coefficients(calCoefficients);
+        }
+        break;
+
+    case HP8751A::CMD_RESTORE_CAL:
+        emit cal_restored();
+        break;
+
     default:
         break;
     }
@@ -7,6 +7,8 @@
 #include <QVector>
 #include <QStateMachine>
 #include <QState>
+#include <QElapsedTimer>
+#include <functional>
 
 class HP8751A : public QObject
 {
@@ -68,6 +70,22 @@ public:
         CAL_ARBI
     };
 
+    enum sweep_type_t {
+        SWEEP_LOG, // Logarithmic sweep from fStart to fStop
+        SWEEP_LIST, // List sweep, the segments define frequency, points and IFBW
+        SWEEP_CW_TIME // Fixed frequency fStart swept over time, the stimulus is the time since the start of the sweep in s
+    };
+
+    // One segment of a list sweep. The segments must be ascending and must not overlap.
+    struct segment_t {
+        quint32 fStart;
+        quint32 fStop;
+        quint16 points;
+        HP8751A::ifbw_t ifbw;
+    };
+
+    static constexpr int MAX_POINTS = 1601; // Also the limit for the sum of all segments
+
     struct instrument_parameters_t {
         quint32 fStart; // Start frequency
         quint32 fStop; // Stop frequency
@@ -80,6 +98,8 @@ public:
         bool unwrapPhase; // Phase is always channel 2
         bool avgEn; // Enable averaging
         quint16 averFact; // Averaging factor
+        sweep_type_t sweepType = SWEEP_LOG;
+        QVector<segment_t> segments; // Only used for SWEEP_LIST. fStart, fStop and points are set from the segments.
     };
 
     struct instrument_data_t {
@@ -90,19 +110,68 @@ public:
         float channel1RefVal;
         float channel2Scale;
         float channel2RefVal;
+        quint32 sequence; // Incremented with every completed sweep
+        QVector<float> raw; // Uncorrected reflection coefficient as interleaved real and imaginary parts, only with set_raw_data(true)
+        bool partial = false; // Only a part of a measurement, see request_partial_sweep()
+    };
+
+    // Measurement profiles with their own instrument save/recall register
+    enum profile_t {
+        PROFILE_NONE = -1,
+        PROFILE_LOOPGAIN,
+        PROFILE_IMPEDANCE,
+        PROFILE_COUNT
     };
 
+    // One step of a calibration plan
+    struct cal_step_t {
+        cal_std_t standard;
+        quint16 averages; // Sweeps averaged for this standard, 1 = no averaging
+    };
+
+    // Error coefficient arrays of the one-port calibration as FORM5 payload, in the order of OUTPCALC01..03
+    struct cal_coefficients_t {
+        QVector<QByteArray> arrays;
+    };
+
+    static constexpr int CAL_COEF_ONE_PORT = 3;
+
+    // Span of a refinement sweep
+    struct span_t {
+        quint32 fStart;
+        quint32 fStop;
+    };
+
+    // Returns the spans of a completed sweep which are swept again with more points
+    typedef std::function<QVector<HP8751A::span_t>(const HP8751A::instrument_data_t &)> refine_fn_t;
+
+    // The windows and remote clients share the instrument. A user claims it for a sequence of commands
+    // and releases it when the results are in, the other users are refused in between. Emits claim_changed().
+    bool claim(const void *user);
+    void release(const void *user);
+    bool claimed_by(const void *user) const { return claimant == user; }
+    bool claimed_by_other(const void *user) const { return claimant && claimant != user; }
+
     // Identify the HP 8751A on the bus
     void identify();
 
     // Init basic measurement functions
     void init_function(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2);
 
+    // Like init_function(), but the complete instrument setup of the profile is kept in an instrument
+    // register after the first use and restored with a single recall afterwards
+    void init_profile(profile_t profile, input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2);
+
+    // Settings that are already active on the instrument are not sent again
     void set_instrument_parameters(instrument_parameters_t param);
 
     // Start single sweep
     void request_sweep();
 
+    // Like request_sweep(), for sweeps which are only a part of a measurement (e.g. a zoom chunk).
+    // The data is marked partial and is not published to remote clients.
+    void request_partial_sweep();
+
     // Cancel current sweep
     void request_cancel();
 
@@ -112,18 +181,57 @@ public:
     // Get stimulus and channel data from local buffer
     void get_data(HP8751A::instrument_data_t &data);
 
+    // Also read the raw data array after every sweep, needed for the host-side correction
+    void set_raw_data(bool enable);
+
+    // Overlapped acquisition for continuous sweeps: the finished sweep is copied to the memory trace,
+    // the next sweep is started at once and the memory trace is read out while it runs.
+    // Only used without raw data and refinement and for formats that can be computed from the memory trace.
+    void set_pipelined(bool enable);
+
+    // Free-running acquisition: the pipelined sweep of set_pipelined() repeated by the driver itself,
+    // without waiting for the next request. Scale and reference are fitted on the first sweep only.
+    // Emits new_data() per sweep until request_cancel(). Returns false if the settings need the regular
+    // sweep (raw data, refinement or formats that can't be computed from the memory trace).
+    bool start_stream();
+
+    // True while the free-running acquisition is active
+    bool streaming();
+
+    // Adaptive refinement of log sweeps: after the sweep, the spans returned by finder are swept again
+    // with the given number of points and merged into the trace before new_data() is emitted.
+    // An empty finder turns the refinement off.
+    void set_refinement(refine_fn_t finder, quint16 points);
+
+    // Get the parameters of the last call to set_instrument_parameters()
+    void get_parameters(HP8751A::instrument_parameters_t &param);
+
     // Init calibration
     void init_cal();
 
-    // Measure cal standard
-    void measure_cal_std(cal_std_t cal);
+    // Measure cal standard. Standards requested while another one is measured are queued.
+    void measure_cal_std(cal_std_t cal, quint16 averages = 1);
+
+    // Queue a sequence of standards, measured one after another. Emits cal_std_done() per standard
+    // and cal_plan_done() when the queue is empty.
+    void run_cal_plan(const QVector<HP8751A::cal_step_t> &plan);
+
+    // True while standards are measured or queued
+    bool cal_busy();
 
     // Compute cal parameters
     void set_cal_done();
 
+    // Read the coefficient arrays of the active calibration. Emits cal_coefficients().
+    void read_cal_coefficients();
+
+    // Upload coefficient arrays and turn correction on without measuring standards. Emits cal_restored().
+    void write_cal_coefficients(const HP8751A::cal_coefficients_t &coefficients);
+
 private:
     PrologixGPIB *gpib = nullptr;
     quint16 gpibId;
+    const void *claimant = nullptr;
     void gpib_response(QByteArray resp);
     QTimer *respTimer = nullptr;
     void resp_timeout();
@@ -134,27 +242,90 @@ private:
     void send_timer_timeout();
 
     void init_statemachine_sweep();
+    void init_statemachine_cal();
+
+    // Hashes of the function and parameter commands the instrument is known to be set to.
+    // Empty if unknown, e.g. after a timeout.
+    QByteArray functionHash;
+    QByteArray paramHash;
+    QByteArray pendingFunctionHash;
+    QByteArray pendingParamHash;
+    profile_t currentProfile;
+    struct profile_state_t {
+        bool saved;
+        QByteArray functionHash;
+        QByteArray paramHash;
+    };
+    profile_state_t profiles[PROFILE_COUNT];
+    static QByteArray state_hash(const QString &commands);
+    static int profile_register(profile_t profile);
+    QString function_commands(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2);
+    void send_function(const QString &commands);
+    void save_profile();
+
+    bool partialSweep;
+
+    QVector<cal_step_t> calQueue;
+    bool calBusy;
+    bool calAveraged; // A step set the averaging, restore the window's averaging at the end of the plan
+    QElapsedTimer calTimer;
+    void start_cal_step();
+    void finish_cal_step();
 
     void start_sweep();
     void cancel_sweep();
 
+    // Function of both channels, needed to format the memory trace on the host
+    input_port_t channelPort[2];
+    conversion_t channelConv[2];
+    format_t channelFmt[2];
+    void set_channel_functions(input_port_t portCh1, conversion_t convCh1, format_t fmtCh1, input_port_t portCh2, conversion_t convCh2, format_t fmtCh2);
+
+    bool pipelined;
+    bool pipelineRunning; // The pipeline already started the next sweep
+    bool memorySweep; // The current sweep is read from the memory trace
+    bool stimulusValid; // Stimulus of the last sweep still matches the instrument settings
+    bool pipeline_possible();
+    bool memory_readout_possible(); // Formats the host can compute from the memory trace
+    QString sweep_command() const; // SING, or NUMG with averaging
+
+    bool stream; // Free-running acquisition is active
+    bool streamScaled; // Scale and reference were fetched for the free-running acquisition
+    bool shared_memory(); // Both channels measure the same, one memory trace holds the data of both
+    void store_and_restart();
+    void get_memory_data(quint8 channel);
+    void unpack_memory(const QByteArray &resp, quint8 channel);
+
+    refine_fn_t refineFinder;
+    quint16 refinePoints;
+    QVector<span_t> refineSpans;
+    int refineIndex; // Span of the current sweep, -1 for the regular sweep
+    instrument_data_t refineData; // Merged trace of the sweeps so far
+    void refine_step();
+    void merge_span(const instrument_data_t &span);
+
     void poll_hold();
 
     void fit_trace();
     void get_stimulus();
     void get_channel_data(quint8 channel);
+    void get_raw_data();
 
     instrument_parameters_t params;
     instrument_data_t data;
+    cal_coefficients_t calCoefficients;
 
     void unpack_stimulus(const QByteArray &resp);
     void unpack_channel(const QByteArray &resp, quint8 channel);
+    void unpack_raw(const QByteArray &resp);
 
     bool sweepDone;
+    bool rawData;
 
     enum cmd_type_t {
         CMD_TYPE_COMMAND,
-        CMD_TYPE_QUERY
+        CMD_TYPE_QUERY,
+        CMD_TYPE_BINARY // Command with binary block, completion is checked with *OPC?
     };
 
     enum command_t {
@@ -167,9 +338,22 @@ private:
         CMD_FIT_TRACE,
         CMD_GET_STIMULUS,
         CMD_GET_DATA,
+        CMD_GET_RAW,
+        CMD_SET_SPAN,
+        CMD_STORE_RESTART,
+        CMD_GET_MEMORY,
+        CMD_STOP_PIPELINE,
+        CMD_RESTORE_SPAN,
         CMD_INIT_CAL,
         CMD_MEAS_CAL_STD,
-        CMD_SET_CAL_DONE
+        CMD_CAL_POLL_HOLD,
+        CMD_CAL_RESTORE_AVERAGING,
+        CMD_SET_CAL_DONE,
+        CMD_GET_CAL_COEF,
+        CMD_PUT_CAL_COEF,
+        CMD_RESTORE_CAL,
+        CMD_SAVE_PROFILE,
+        CMD_RECALL_PROFILE
     };
 
     enum cal_type_t {
@@ -187,6 +371,7 @@ private:
         QString cmdString;
         qint8 channel;
         cmd_type_t type;
+        QByteArray block; // Binary data of CMD_TYPE_BINARY
     };
 
     QString port_to_string(input_port_t port);
@@ -198,6 +383,7 @@ private:
     QString cal_std_to_class(cal_std_t cal);
 
     void enqueue_cmd(command_t cmd, QString cmdString, qint8 channel, cmd_type_t type);
+    void enqueue_binary(command_t cmd, QString cmdString, const QByteArray &block);
     bool nextCmd;
 
     void instrument_response(command_t cmd, QByteArray resp, qint8 channel); // Channel parameter contains 0 or 1 for a channel specific command, -1 otherwise
@@ -213,13 +399,26 @@ signals:
     void new_data(HP8751A::instrument_data_t);
     void sweep_cancelled();
     void response_timeout();
-    void cal_done();
+    void cal_std_done(HP8751A::cal_std_t, qint64); // Standard and measurement time in ms
+    void cal_plan_done();
+    void cal_coefficients(HP8751A::cal_coefficients_t);
+    void cal_restored();
+    void claim_changed();
 
     // Private signals
     void responseOK(QPrivateSignal);
     void responseNOK(QPrivateSignal);
     void sig_start_sweep(QPrivateSignal);
     void sig_cancel_sweep(QPrivateSignal);
+    void sig_refine_done(QPrivateSignal);
+    void sig_next_sweep(QPrivateSignal);
+    void sig_sweep_finished(QPrivateSignal);
+
+    // Private signals of the calibration sequencer, separate from the sweep so both never react to the same response
+    void calOK(QPrivateSignal);
+    void calNOK(QPrivateSignal);
+    void sig_cal_next(QPrivateSignal);
+    void sig_cal_finished(QPrivateSignal);
 
 };
 
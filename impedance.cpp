@@ -1,5 +1,13 @@
 #include "impedance.h"
 #include "ui_impedance.h"
+#include "tracestore.h"
+#include "segmenteditor.h"
+#include "plannerdialog.h"
+#include "refinement.h"
+#include <QElapsedTimer>
+#include "callibrary.h"
+
+static const double REFINE_WIDTH = 0.2; // Decades around each region of interest
 
 Impedance::Impedance(HP8751A *hp, QWidget *parent) :
     QMainWindow(parent),
@@ -16,12 +24,66 @@ Impedance::Impedance(HP8751A *hp, QWidget *parent) :
     QObject::connect(hp, &HP8751A::response_timeout, this, &Impedance::response_timeout);
     QObject::connect(hp, &HP8751A::instrument_initialized, this, &Impedance::instrument_initialized);
     QObject::connect(hp, &HP8751A::set_parameters_finished, this, &Impedance::set_parameters_finished);
+    QObject::connect(hp, &HP8751A::claim_changed, this, &Impedance::claim_changed);
+    QObject::connect(hp, &HP8751A::cal_coefficients, this, &Impedance::store_cal_coefficients);
+
+    fit.valid = false;
+    fitSequence = 0;
+    fit.topology = CircuitFit::TOPO_SERIES_RLC;
+    fitRefined.valid = false;
+    fitQueued = false;
+    fitQueuedIncremental = false;
+    fitWatcher = new QFutureWatcher<CircuitFit::result_t>(this);
+    QObject::connect(fitWatcher, &QFutureWatcher<CircuitFit::result_t>::finished, this, &Impedance::fit_finished);
+    for (int i = 0; i < CircuitFit::TOPO_COUNT; i++) {
+        ui->fitTopology->addItem(CircuitFit::name(static_cast<CircuitFit::topology_t>(i)));
+    }
+    ui->fitTopology->setCurrentIndex(CircuitFit::TOPO_SERIES_RLC);
+
+    hostCalActive = false;
+    envelope = false;
+    calStatus = new QLabel(this);
+    ui->statusbar->addPermanentWidget(calStatus);
+    memoryStatus = new QLabel(this);
+    ui->statusbar->addPermanentWidget(memoryStatus);
+    limitStatus = new QLabel(this);
+    ui->statusbar->addPermanentWidget(limitStatus);
+    update_memory_list(QString());
+
+    zoomStart = 0;
+    zoomStop = 0;
+    zoom = new ZoomSweep(hp, this);
+    QObject::connect(zoom, &ZoomSweep::progress, this, [=] (int done, int total) {
+        ui->statusbar->showMessage(QString("Zoom sweep %1 of %2...").arg(done).arg(total));
+        // The merged snapshot keeps the sequence number of the full span sweep
+        views.set_data(zoom->merged(lastData));
+        views.invalidate();
+        plot_data();
+    });
+    QObject::connect(zoom, &ZoomSweep::finished, this, &Impedance::ui_stop_sweep);
+    QObject::connect(ui->btnHold, &QPushButton::clicked, zoom, &ZoomSweep::cancel);
+
+    plotTimer = new QTimer(this);
+    plotTimer->setSingleShot(true);
+    QObject::connect(plotTimer, &QTimer::timeout, this, [=] {
+        plot_data();
+        // Counted from the end of the plot, so a slow chart leaves time for the readout
+        plotElapsed.start();
+    });
 
+    initializing = false;
+    initPending = false;
+    remoteControl = false;
     init();
 }
 
 Impedance::~Impedance()
 {
+    if (fitWatcher) {
+        fitWatcher->cancel();
+        fitWatcher->waitForFinished();
+    }
+    hp->release(this);
     delete ui;
 }
 
@@ -35,9 +97,39 @@ void Impedance::closeEvent(QCloseEvent *event)
 void Impedance::init()
 {
     disable_ui();
-    ui->statusbar->showMessage("Initializing instrument...");
-    hp->init_function(HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_PHAS);
     init_plot();
+    init_instrument();
+}
+
+void Impedance::init_instrument()
+{
+    // A remote client may be using the instrument, the initialization waits until it is released
+    initPending = !hp->claim(this);
+    if (initPending) {
+        ui->statusbar->showMessage("Waiting for remote client...");
+        return;
+    }
+    initializing = true;
+    ui->statusbar->showMessage("Initializing instrument...");
+    hp->init_profile(HP8751A::PROFILE_IMPEDANCE, HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_Z_REFL, HP8751A::FMT_PHAS);
+}
+
+void Impedance::claim_changed()
+{
+    const bool remote = hp->claimed_by_other(this);
+    if (remote == remoteControl) {
+        return;
+    }
+    remoteControl = remote;
+    if (remote) {
+        ui->centralwidget->setEnabled(false);
+        ui->statusbar->showMessage("Instrument in use by remote client...");
+    } else if (initPending) {
+        init_instrument();
+    } else {
+        enable_ui();
+        ui->statusbar->showMessage("Ready.");
+    }
 }
 
 void Impedance::init_statemachine_sweep()
@@ -46,6 +138,7 @@ void Impedance::init_statemachine_sweep()
      *  Hold button is disabled by default. It is only enabled when the instrument is currently sweeping (HOLD? returns 0)
      *  When continous sweep is selected, the single button is disabled. Hold button is enabled. Cont. button is checked.
      *      When cont. button is clicked again, it will finish the current sweep and will hold afterwards.
+     *      If the settings allow the free run, the driver repeats the sweeps itself and the cont. button holds at once.
      *      Clicking the hold button during a sweep cancels the current sweep.
      *  When single sweep is selected, cont. button is disabled while the instrument is sweeping. Hold button is enabled.
      *  Enable export button only when data has been received and instrument is in hold mode.
@@ -59,6 +152,7 @@ void Impedance::init_statemachine_sweep()
     QState *sStartSweep = new QState();
     QState *sWaitForData = new QState();
     QState *sPlotData = new QState();
+    QState *sStream = new QState();
     QState *sHold = new QState();
 
     QObject::connect(sIdle, &QState::entered, this, &Impedance::ui_stop_sweep);
@@ -67,15 +161,17 @@ void Impedance::init_statemachine_sweep()
 
     QObject::connect(sUpdateParameters, &QState::entered, this, &Impedance::ui_start_sweep);
     QObject::connect(sUpdateParameters, &QState::entered, this, &Impedance::update_parameters);
+    QObject::connect(sUpdateParameters, &QState::entered, this, &Impedance::clear_envelope);
     sUpdateParameters->addTransition(hp, &HP8751A::set_parameters_finished, sStartSweep);
     sUpdateParameters->addTransition(ui->btnHold, &QPushButton::clicked, sHold);
     sUpdateParameters->addTransition(hp, &HP8751A::response_timeout, sIdle);
 
-    QObject::connect(sStartSweep, &QState::entered, hp, &HP8751A::request_sweep);
     QObject::connect(sStartSweep, &QState::entered, this, [=] {
         ui->statusbar->showMessage("Sweeping...");
     });
+    QObject::connect(sStartSweep, &QState::entered, this, &Impedance::start_sweep);
     sStartSweep->addTransition(hp, &HP8751A::retrieving_data, sWaitForData);
+    sStartSweep->addTransition(this, &Impedance::streamStarted, sStream);
     sStartSweep->addTransition(ui->btnHold, &QPushButton::clicked, sHold);
     sStartSweep->addTransition(hp, &HP8751A::response_timeout, sIdle);
 
@@ -97,6 +193,14 @@ void Impedance::init_statemachine_sweep()
     sPlotData->addTransition(this, &Impedance::goIdle, sIdle);
     sPlotData->addTransition(this, &Impedance::continueSweep, sStartSweep);
 
+    // Clicking the cont. button again stops the free run at once, there is no sweep end to wait for
+    QObject::connect(sStream, &QState::entered, this, [=] {
+        ui->statusbar->showMessage("Free running...");
+    });
+    sStream->addTransition(ui->btnContinuous, &QPushButton::clicked, sHold);
+    sStream->addTransition(ui->btnHold, &QPushButton::clicked, sHold);
+    sStream->addTransition(hp, &HP8751A::response_timeout, sIdle);
+
     QObject::connect(sHold, &QState::entered, this, [=] {
         ui->statusbar->showMessage("Cancelling sweep...");
     });
@@ -108,11 +212,21 @@ void Impedance::init_statemachine_sweep()
     smSweep->addState(sStartSweep);
     smSweep->addState(sWaitForData);
     smSweep->addState(sPlotData);
+    smSweep->addState(sStream);
     smSweep->addState(sHold);
     smSweep->setInitialState(sIdle);
     smSweep->start();
 }
 
+void Impedance::start_sweep()
+{
+    if (ui->btnContinuous->isChecked() && hp->start_stream()) {
+        emit streamStarted(QPrivateSignal());
+        return;
+    }
+    hp->request_sweep();
+}
+
 void Impedance::init_plot()
 {
     axisXTop = new QLogValueAxis();
@@ -122,7 +236,7 @@ void Impedance::init_plot()
     axisXTop->setMinorTickCount(8);
 
     QChart *chartTop = nullptr;
-    QChartView *chartViewTop = nullptr;
+    ZoomChartView *chartViewTop = nullptr;
     QVBoxLayout *layoutTop = nullptr;
     axisYTop = new QValueAxis();
     top = new QLineSeries();
@@ -137,8 +251,17 @@ void Impedance::init_plot()
     top->attachAxis(axisYTop);
     top->setName(ui->view_top->currentText());
 
-    chartViewTop = new QChartView(chartTop);
+    topFit = new QLineSeries();
+    topFit->setName("Fit");
+    topFit->setPen(QPen(Qt::red, 1, Qt::DashLine));
+    chartTop->addSeries(topFit);
+    topFit->attachAxis(axisXTop);
+    topFit->attachAxis(axisYTop);
+
+    chartViewTop = new ZoomChartView(chartTop);
     chartViewTop->setRenderHint(QPainter::Antialiasing);
+    QObject::connect(chartViewTop, &ZoomChartView::span_selected, this, &Impedance::zoom_to);
+    QObject::connect(chartViewTop, &ZoomChartView::full_span_requested, this, &Impedance::full_span);
     layoutTop = new QVBoxLayout(ui->chart_top);
     layoutTop->addWidget(chartViewTop);
 
@@ -149,7 +272,7 @@ void Impedance::init_plot()
     axisXBot->setMinorTickCount(8);
 
     QChart *chartBot = nullptr;
-    QChartView *chartViewBot = nullptr;
+    ZoomChartView *chartViewBot = nullptr;
     QVBoxLayout *layoutBot = nullptr;
     axisYBot = new QValueAxis();
     bot = new QLineSeries();
@@ -164,12 +287,62 @@ void Impedance::init_plot()
     bot->attachAxis(axisYBot);
     bot->setName(ui->view_bot->currentText());
 
-    chartViewBot = new QChartView(chartBot);
+    botFit = new QLineSeries();
+    botFit->setName("Fit");
+    botFit->setPen(QPen(Qt::red, 1, Qt::DashLine));
+    chartBot->addSeries(botFit);
+    botFit->attachAxis(axisXBot);
+    botFit->attachAxis(axisYBot);
+
+    QChart *limitCharts[2] = {chartTop, chartBot};
+    QAbstractAxis *limitAxesX[2] = {axisXTop, axisXBot};
+    QAbstractAxis *limitAxesY[2] = {axisYTop, axisYBot};
+    QLineSeries *limitTraces[2] = {top, bot};
+    for (int c = 0; c < 2; c++) {
+        for (int bound = 0; bound < 2; bound++) {
+            QLineSeries *line = new QLineSeries();
+            QPen pen(limitTraces[c]->color());
+            pen.setStyle(Qt::DashLine);
+            line->setPen(pen);
+            limitCharts[c]->addSeries(line);
+            line->attachAxis(limitAxesX[c]);
+            line->attachAxis(limitAxesY[c]);
+            for (QLegendMarker *marker : limitCharts[c]->legend()->markers(line)) {
+                marker->setVisible(false);
+            }
+            limitLines[c][bound] = line;
+        }
+    }
+
+    topRange = add_band(chartTop, top, axisXTop, axisYTop, 30);
+    topSigma = add_band(chartTop, top, axisXTop, axisYTop, 60);
+    botRange = add_band(chartBot, bot, axisXBot, axisYBot, 30);
+    botSigma = add_band(chartBot, bot, axisXBot, axisYBot, 60);
+
+    chartViewBot = new ZoomChartView(chartBot);
     chartViewBot->setRenderHint(QPainter::Antialiasing);
+    QObject::connect(chartViewBot, &ZoomChartView::span_selected, this, &Impedance::zoom_to);
+    QObject::connect(chartViewBot, &ZoomChartView::full_span_requested, this, &Impedance::full_span);
     layoutBot = new QVBoxLayout(ui->chart_bot);
     layoutBot->addWidget(chartViewBot);
 }
 
+QAreaSeries *Impedance::add_band(QChart *chart, QLineSeries *trace, QAbstractAxis *axisX, QAbstractAxis *axisY, int alpha)
+{
+    QAreaSeries *band = new QAreaSeries(new QLineSeries(), new QLineSeries());
+    chart->addSeries(band);
+    band->attachAxis(axisX);
+    band->attachAxis(axisY);
+    QColor color = trace->color();
+    color.setAlpha(alpha);
+    band->setColor(color);
+    band->setBorderColor(Qt::transparent);
+    for (QLegendMarker *marker : chart->legend()->markers(band)) {
+        marker->setVisible(false);
+    }
+    return band;
+}
+
 void Impedance::disable_ui()
 {
     ui->btnHold->setEnabled(false);
@@ -188,6 +361,7 @@ void Impedance::enable_ui()
 
 void Impedance::ui_start_sweep()
 {
+    hp->claim(this);
     ui->statusbar->showMessage("Updating parameters...");
     if (!ui->btnContinuous->isChecked()) {
         // Single sweep mode selected
@@ -212,6 +386,13 @@ void Impedance::ui_start_sweep()
 
 void Impedance::ui_stop_sweep()
 {
+    hp->release(this);
+    hp->set_pipelined(false);
+    if (plotTimer->isActive()) {
+        // Show the last snapshot of the free run
+        plotTimer->stop();
+        plot_data();
+    }
     ui->statusbar->showMessage("Ready.");
     ui->btnSingle->setEnabled(true);
     ui->btnContinuous->setEnabled(true);
@@ -234,76 +415,54 @@ void Impedance::ui_stop_sweep()
 
 void Impedance::plot_data()
 {
-    // Prepare data for plot
-
-    QList<QPointF> pointsTop;
-
-    pointsTop.clear();
-
-    switch (ui->view_top->currentIndex()) {
-    case 0:
-        pointsTop = magnitude;
-        break;
-    case 1:
-        pointsTop = impedance;
-        break;
-    case 2:
-        pointsTop = inductance;
-        break;
-    case 3:
-        pointsTop =capacitance;
-        break;
-    case 4:
-        pointsTop =resistance;
-        break;
-    case 5:
-        pointsTop = phase;
-        break;
-    }
-
-    top->clear();
-    top->append(pointsTop);
+    if (!views.has_data()) {
+        return;
+    }
+
+    // Only the two selected views are computed, the others stay untouched
+    const ImpedanceViews::trace_t &traceTop = views.view(static_cast<ImpedanceViews::view_t>(ui->view_top->currentIndex()));
+    top->replace(traceTop.points);
     top->setName(ui->view_top->currentText());
 
-    QList<QPointF> pointsBot;
-    pointsBot.clear();
-
-
-    switch (ui->view_bot->currentIndex()) {
-    case 0:
-        pointsBot = magnitude;
-        break;
-    case 1:
-        pointsBot = impedance;
-        break;
-    case 2:
-        pointsBot = inductance;
-        break;
-    case 3:
-        pointsBot = capacitance;
-        break;
-    case 4:
-        pointsBot = resistance;
-        break;
-    case 5:
-        pointsBot = phase;
-        break;
-    }
-
-    bot->clear();
-    bot->append(pointsBot);
+    const ImpedanceViews::trace_t &traceBot = views.view(static_cast<ImpedanceViews::view_t>(ui->view_bot->currentIndex()));
+    bot->replace(traceBot.points);
     bot->setName(ui->view_bot->currentText());
 
-    axisXTop->setMin(pointsTop.first().x());
-    axisXTop->setMax(pointsTop.last().x());
+    if (fit.valid && fitViews.has_data()) {
+        topFit->replace(fitViews.view(static_cast<ImpedanceViews::view_t>(ui->view_top->currentIndex())).points);
+        botFit->replace(fitViews.view(static_cast<ImpedanceViews::view_t>(ui->view_bot->currentIndex())).points);
+    } else {
+        topFit->clear();
+        botFit->clear();
+    }
+
+    plot_envelope(topEnvelope, topRange, topSigma);
+    plot_envelope(botEnvelope, botRange, botSigma);
+    plot_limits();
+
+    if (traceTop.points.isEmpty() || traceBot.points.isEmpty()) {
+        return;
+    }
+
+    const QVector<QPointF> &pointsTop = traceTop.points;
+    const QVector<QPointF> &pointsBot = traceBot.points;
+
+    if (zoomStop > 0) {
+        axisXTop->setRange(zoomStart, zoomStop);
+        axisXBot->setRange(zoomStart, zoomStop);
+    } else {
+        axisXTop->setMin(pointsTop.first().x());
+        axisXTop->setMax(pointsTop.last().x());
 
-    axisXBot->setMin(pointsBot.first().x());
-    axisXBot->setMax(pointsBot.last().x());
+        axisXBot->setMin(pointsBot.first().x());
+        axisXBot->setMax(pointsBot.last().x());
+    }
 
 
     // Scale y-axis
 
-    auto [minPoint, maxPoint] = find_min_max(pointsTop);
+    float minPoint = traceTop.min;
+    float maxPoint = traceTop.max;
 
     float referencePoint = (minPoint + maxPoint) / 2.0;
     double range = maxPoint - minPoint;
@@ -363,7 +522,7 @@ void Impedance::plot_data()
     axisYBot->setLabelFormat("%.2f");
 }
 
-void Impedance::update_parameters()
+HP8751A::instrument_parameters_t Impedance::parameters()
 {
     HP8751A::instrument_parameters_t param;
     param.fStart = ui->startFreq->text().toUInt();
@@ -375,22 +534,68 @@ void Impedance::update_parameters()
     param.attenA = ui->attenA->currentIndex();
     param.ifbw = static_cast<HP8751A::ifbw_t>(ui->ifBw->currentIndex());
     param.unwrapPhase = ui->unwrapPhase->isChecked();
+    if (ui->ListmodeEn->isChecked() && !segments.isEmpty()) {
+        param.sweepType = HP8751A::SWEEP_LIST;
+        param.segments = segments;
+    }
     param.averFact = 1;
     param.avgEn = false;
+    return param;
+}
+
+void Impedance::update_parameters()
+{
+    HP8751A::instrument_parameters_t param = parameters();
     hp->set_instrument_parameters(param);
+    envelope = ui->envelopeEn->isChecked();
+    update_refinement();
+    // Continuous sweeps read the previous sweep while the next one runs
+    hp->set_pipelined(ui->btnContinuous->isChecked());
+    recall_cal(param);
 }
 
-std::tuple<float, float> Impedance::find_min_max(QList<QPointF> &points)
+void Impedance::update_refinement()
 {
-    float minY = std::numeric_limits<float>::max();
-    float maxY = std::numeric_limits<float>::lowest();
+    // The refined spans move from sweep to sweep, which would restart the envelope every time
+    if (!ui->refineEn->isChecked() || envelope) {
+        hp->set_refinement(nullptr, 0);
+        return;
+    }
+    hp->set_refinement([] (const HP8751A::instrument_data_t &data) {
+        return Refinement::resonances(data, REFINE_WIDTH);
+    }, ui->refinePoints->currentText().toUInt());
+}
 
-    for (const QPointF &point : points) {
-        if (point.y() < minY) minY = point.y();
-        if (point.y() > maxY) maxY = point.y();
+void Impedance::recall_cal(const HP8751A::instrument_parameters_t &param)
+{
+    if (hostCalActive || instrumentCalFixture.isEmpty()) {
+        return;
     }
+    QString key = CalLibrary::key(instrumentCalFixture, param);
+    if (key == instrumentCalKey) {
+        return; // Calibration for this setup is already active
+    }
+
+    // Queued behind the parameters, so the upload is finished before the next sweep starts
+    HP8751A::cal_coefficients_t coefficients;
+    if (CalLibrary::find(instrumentCalFixture, param, coefficients)) {
+        hp->write_cal_coefficients(coefficients);
+        instrumentCalKey = key;
+        calStatus->setText(QString("Calibration: %1").arg(instrumentCalFixture));
+    } else {
+        instrumentCalKey.clear();
+        calStatus->setText(QString("No calibration of %1 for this sweep").arg(instrumentCalFixture));
+    }
+}
 
-    return {minY, maxY};
+void Impedance::store_cal_coefficients(HP8751A::cal_coefficients_t coefficients)
+{
+    HP8751A::instrument_parameters_t param;
+    hp->get_parameters(param);
+    if (CalLibrary::store(instrumentCalFixture, param, coefficients)) {
+        instrumentCalKey = CalLibrary::key(instrumentCalFixture, param);
+        ui->statusbar->showMessage("Calibration stored.");
+    }
 }
 
 float Impedance::round_one_decimal(float value)
@@ -400,15 +605,18 @@ float Impedance::round_one_decimal(float value)
 
 void Impedance::instrument_initialized()
 {
-    update_parameters();
+    // Also emitted for the initialization of a remote client
+    if (initializing) {
+        update_parameters();
+    }
 }
 
 void Impedance::set_parameters_finished()
 {
-    static bool initialized = false;
-    if (!initialized) {
+    if (initializing) {
+        initializing = false;
+        hp->release(this);
         enable_ui();
-        initialized = true;
         init_statemachine_sweep();
     }
 
@@ -419,30 +627,216 @@ void Impedance::set_parameters_finished()
 
 void Impedance::new_data(HP8751A::instrument_data_t data)
 {
+    // Sweeps of remote clients are not for this window
+    if (!hp->claimed_by(this)) {
+        return;
+    }
+    if (hostCalActive) {
+        apply_host_cal(data);
+    }
+    if (zoom->busy()) {
+        // Zoom sweeps get the same math, their points replace those of the full span sweep
+        HP8751A::instrument_data_t zoomData = data;
+        apply_memory(zoomData);
+        if (zoom->consume(zoomData)) {
+            return;
+        }
+    }
+    lastMeasured = data;
+    apply_memory(data);
+
+    // A new full span sweep ends the zoom
+    lastData = data;
+    zoomStart = 0;
+    zoomStop = 0;
+
     topScale = data.channel1Scale;
     topRefVal = data.channel1RefVal;
     botScale = data.channel2Scale;
     botRefVal = data.channel2RefVal;
 
-    magnitude.clear();
-    impedance.clear();
-    phase.clear();
-    inductance.clear();
-    capacitance.clear();
-    resistance.clear();
+    // Derived quantities are computed on demand in plot_data()
+    views.set_data(data);
+
+    if (envelope) {
+        add_envelope(topEnvelope, static_cast<ImpedanceViews::view_t>(ui->view_top->currentIndex()));
+        add_envelope(botEnvelope, static_cast<ImpedanceViews::view_t>(ui->view_bot->currentIndex()));
+    }
+
+    check_limits(data);
+
+    if (ui->fitEachSweep->isChecked()) {
+        run_fit(true);
+    }
+
+    if (hp->streaming()) {
+        // Not plotted by the state machine
+        schedule_plot();
+    }
+}
+
+void Impedance::clear_envelope()
+{
+    topEnvelope.set_window(ui->envelopeWindow->value());
+    botEnvelope.set_window(ui->envelopeWindow->value());
+}
+
+void Impedance::add_envelope(SweepEnvelope &statistics, ImpedanceViews::view_t view)
+{
+    const QVector<QPointF> &points = views.view(view).points;
+    QVector<float> values(points.size());
+    for (int i = 0; i < points.size(); i++) {
+        values[i] = points.at(i).y();
+    }
+    if (view == ImpedanceViews::VIEW_PHASE) {
+        statistics.add_phase(views.frequency(), values);
+    } else {
+        statistics.add(views.frequency(), values);
+    }
+}
+
+void Impedance::plot_envelope(const SweepEnvelope &statistics, QAreaSeries *range, QAreaSeries *sigma)
+{
+    QVector<float> min, max, sigmaLower, sigmaUpper;
+    statistics.bands(min, max, sigmaLower, sigmaUpper);
+    QList<QPointF> points[4];
+    // Hidden while zoomed, the zoom sweeps are not part of the statistics
+    if (zoomStop == 0 && envelope) {
+        const QVector<float> &frequency = statistics.frequency();
+        for (int i = 0; i < min.size(); i++) {
+            points[0].push_back({frequency.at(i), min.at(i)});
+            points[1].push_back({frequency.at(i), max.at(i)});
+            points[2].push_back({frequency.at(i), sigmaLower.at(i)});
+            points[3].push_back({frequency.at(i), sigmaUpper.at(i)});
+        }
+    }
+    range->lowerSeries()->replace(points[0]);
+    range->upperSeries()->replace(points[1]);
+    sigma->lowerSeries()->replace(points[2]);
+    sigma->upperSeries()->replace(points[3]);
+}
 
-    for (int i = 0; i < data.stimulus.length(); i++) {
-        magnitude.push_back({data.stimulus.at(i), data.channel1.at(i)});
-        float lin = std::pow(10, (data.channel1.at(i) / 20));
-        impedance.push_back({data.stimulus.at(i), lin});
-        phase.push_back({data.stimulus.at(i), data.channel2.at(i)});
-        inductance.push_back({data.stimulus.at(i), lin / (2 * M_PI * data.stimulus.at(i))});
-        capacitance.push_back({data.stimulus.at(i), 1 / (lin * (2 * M_PI * data.stimulus.at(i)))});
-        std::complex<float> cmplx(lin * std::exp(data.channel2.at(i)));
-        resistance.push_back({data.stimulus.at(i), cmplx.real()});
+void Impedance::schedule_plot()
+{
+    if (plotTimer->isActive()) {
+        // The plot pending takes the latest data
+        return;
     }
+    qint64 wait = plotElapsed.isValid() ? PLOT_INTERVAL_MS - plotElapsed.elapsed() : 0;
+    plotTimer->start(qMax<qint64>(0, wait));
+}
 
-    qDebug() << capacitance;
+void Impedance::apply_host_cal(HP8751A::instrument_data_t &data)
+{
+    // The error terms are interpolated once per frequency grid, the correction itself runs on every sweep
+    if (!hostCal.prepare(data.stimulus)) {
+        calStatus->setText(QString("Correction off: sweep exceeds calibrated range %1 Hz to %2 Hz")
+                           .arg(hostCal.min_frequency(), 0, 'g', 4).arg(hostCal.max_frequency(), 0, 'g', 4));
+        return;
+    }
+    if (!hostCal.correct(data.raw, data.channel1, data.channel2)) {
+        calStatus->setText("Correction off: no raw data");
+        return;
+    }
+    calStatus->setText(QString("Host correction: %1").arg(hostCal.fixture_name()));
+}
+
+void Impedance::run_fit(bool incremental)
+{
+    if (!views.has_data()) {
+        return;
+    }
+
+    if (fitWatcher->isRunning()) {
+        // Only the latest request runs, a full fit wins over a refinement
+        fitQueuedIncremental = fitQueued ? fitQueuedIncremental && incremental : incremental;
+        fitQueued = true;
+        return;
+    }
+
+    const QVector<float> &frequency = views.frequency();
+    const QVector<float> &re = views.real();
+    const QVector<float> &im = views.imag();
+    const int points = qMin(frequency.size(), re.size());
+    if (points == 0) {
+        return;
+    }
+
+    fitData = CircuitFit::make_data(frequency.constData(), re.constData(), im.constData(), points);
+    fitFrequency = frequency.mid(0, points);
+    CircuitFit::topology_t topology = static_cast<CircuitFit::topology_t>(ui->fitTopology->currentIndex());
+
+    fitTimer.start();
+    fitRefined.valid = false;
+    if (incremental && fit.valid && fit.topology == topology) {
+        // A single LM run is cheap enough for the GUI thread
+        if (CircuitFit::refit(fit, fitData, fitRefined)) {
+            set_fit(fitRefined);
+            return;
+        }
+    }
+    fitWatcher->setFuture(CircuitFit::fit_multistart(topology, fitData));
+    ui->statusbar->showMessage("Fitting...");
+}
+
+void Impedance::fit_finished()
+{
+    CircuitFit::result_t result = CircuitFit::best(fitWatcher->future());
+    if (fitRefined.valid && (!result.valid || fitRefined.rmsError < result.rmsError)) {
+        result = fitRefined;
+    }
+    // The topology may have changed while the fit ran
+    if (!fitWatcher->isCanceled() && result.topology == ui->fitTopology->currentIndex()) {
+        set_fit(result);
+        schedule_plot();
+    }
+
+    if (fitQueued) {
+        fitQueued = false;
+        run_fit(fitQueuedIncremental);
+    }
+}
+
+void Impedance::set_fit(const CircuitFit::result_t &result)
+{
+    fit = result;
+    qint64 elapsed = fitTimer.nsecsElapsed() / 1000;
+
+    if (fit.valid) {
+        // Evaluate the model on the measured frequencies, in the same format the instrument delivers
+        const int points = fitFrequency.size();
+        HP8751A::instrument_data_t model;
+        model.stimulus = fitFrequency;
+        model.channel1.resize(points);
+        model.channel2.resize(points);
+        for (int i = 0; i < points; i++) {
+            std::complex<double> z = CircuitFit::evaluate(fit.topology, fit.params, fitData.omega.at(i));
+            model.channel1[i] = 20 * std::log10(std::abs(z));
+            model.channel2[i] = std::arg(z) * 180 / M_PI;
+        }
+        model.sequence = ++fitSequence;
+        fitViews.set_data(model);
+    }
+
+    show_fit();
+    ui->statusbar->showMessage(QString("Fit finished in %1 ms").arg(elapsed / 1000.0, 0, 'f', 1));
+}
+
+void Impedance::show_fit()
+{
+    if (!fit.valid) {
+        ui->fitResult->setText("-");
+        return;
+    }
+
+    QStringList lines;
+    for (int i = 0; i < CircuitFit::param_count(fit.topology); i++) {
+        QString name = CircuitFit::param_name(fit.topology, i);
+        QString unit = name == "R" ? "Ω" : (name == "L" ? "H" : "F");
+        lines << QString("%1 = %2 %3").arg(name).arg(fit.params[i], 0, 'g', 5).arg(unit);
+    }
+    lines << QString("RMS error = %1 %").arg(fit.rmsError * 100, 0, 'f', 3);
+    ui->fitResult->setText(lines.join("\n"));
 }
 
 void Impedance::response_timeout()
@@ -509,64 +903,47 @@ void Impedance::on_botScale_valueChanged(double arg1)
 
 void Impedance::on_view_top_currentIndexChanged(int index)
 {
-    switch (index) {
-    case 0:
-        ui->unitTopRef->setText("dB");
-        ui->unitTopScale->setText("dB");
-        break;
-    case 1:
-        ui->unitTopRef->setText("Ω");
-        ui->unitTopScale->setText("Ω");
-        break;
-    case 2:
-        ui->unitTopRef->setText("H");
-        ui->unitTopScale->setText("H");
-        break;
-    case 3:
-        ui->unitTopRef->setText("F");
-        ui->unitTopScale->setText("F");
-        break;
-    case 4:
-        ui->unitTopRef->setText("Ω");
-        ui->unitTopScale->setText("Ω");
-        break;
-    case 5:
-        ui->unitTopRef->setText("°");
-        ui->unitTopScale->setText("°");
-        break;
-    }
+    QString unit = ImpedanceViews::unit(static_cast<ImpedanceViews::view_t>(index));
+    ui->unitTopRef->setText(unit);
+    ui->unitTopScale->setText(unit);
+    // The statistics belong to the previous view
+    topEnvelope.set_window(ui->envelopeWindow->value());
     plot_data();
 }
 
 
 void Impedance::on_view_bot_currentIndexChanged(int index)
 {
-    switch (index) {
-    case 0:
-        ui->unitBotRef->setText("dB");
-        ui->unitBotScale->setText("dB");
-        break;
-    case 1:
-        ui->unitBotRef->setText("Ω");
-        ui->unitBotScale->setText("Ω");
-        break;
-    case 2:
-        ui->unitBotRef->setText("H");
-        ui->unitBotScale->setText("H");
-        break;
-    case 3:
-        ui->unitBotRef->setText("F");
-        ui->unitBotScale->setText("F");
-        break;
-    case 4:
-        ui->unitBotRef->setText("Ω");
-        ui->unitBotScale->setText("Ω");
-        break;
-    case 5:
-        ui->unitBotRef->setText("°");
-        ui->unitBotScale->setText("°");
-        break;
-    }
+    QString unit = ImpedanceViews::unit(static_cast<ImpedanceViews::view_t>(index));
+    ui->unitBotRef->setText(unit);
+    ui->unitBotScale->setText(unit);
+    // The statistics belong to the previous view
+    botEnvelope.set_window(ui->envelopeWindow->value());
+    plot_data();
+}
+
+
+void Impedance::on_equivalentModel_currentIndexChanged(int index)
+{
+    views.set_model(index == 0 ? zkernels::MODEL_SERIES : zkernels::MODEL_PARALLEL);
+    fitViews.set_model(index == 0 ? zkernels::MODEL_SERIES : zkernels::MODEL_PARALLEL);
+    plot_data();
+}
+
+
+void Impedance::on_btnFit_clicked()
+{
+    run_fit(false);
+    plot_data();
+}
+
+
+void Impedance::on_fitTopology_currentIndexChanged(int index)
+{
+    (void) index;
+    // The old solution belongs to a different topology
+    fit.valid = false;
+    show_fit();
     plot_data();
 }
 
@@ -583,8 +960,8 @@ void Impedance::on_btnExport_clicked()
 
     QVector<QString> complex;
 
-    HP8751A::instrument_data_t data;
-    hp->get_data(data);
+    // Export what is displayed, including the host-side correction
+    const HP8751A::instrument_data_t &data = lastData;
 
     // Calculate complex number from magnitude and phase
     for (int i = 0; i < data.stimulus.size(); i++) {
@@ -610,16 +987,44 @@ void Impedance::on_btnExport_clicked()
 
 void Impedance::on_btnCalibrate_clicked()
 {
+    // Released when the dialog is closed
+    if (!hp->claim(this)) {
+        return;
+    }
     update_parameters();
 
     cal = new CalibrateDialog(hp, this);
     cal->setModal(true);
     QObject::connect(cal, &CalibrateDialog::rejected, this, [=] {
+        hp->set_raw_data(hostCalActive);
+        hp->release(this);
         cal->deleteLater();
     });
 
     QObject::connect(cal, &CalibrateDialog::accepted, this, [=] {
-        hp->set_cal_done();
+        if (cal->host_correction()) {
+            hostCal = cal->calibration();
+            hostCalActive = true;
+            calStatus->setText(QString("Host correction: %1").arg(hostCal.fixture_name()));
+        } else {
+            hostCalActive = false;
+            instrumentCalFixture = cal->fixture_name();
+            HP8751A::instrument_parameters_t param;
+            hp->get_parameters(param);
+            if (cal->restored()) {
+                instrumentCalKey = CalLibrary::key(instrumentCalFixture, param);
+            } else {
+                hp->set_cal_done();
+                instrumentCalKey.clear();
+                if (!instrumentCalFixture.isEmpty()) {
+                    // Keep the coefficients so this setup never has to be calibrated again
+                    hp->read_cal_coefficients();
+                }
+            }
+            calStatus->setText(instrumentCalFixture.isEmpty() ? "" : QString("Calibration: %1").arg(instrumentCalFixture));
+        }
+        hp->set_raw_data(hostCalActive);
+        hp->release(this);
         cal->deleteLater();
     });
 
@@ -630,3 +1035,235 @@ void Impedance::on_btnCalibrate_clicked()
     cal->exec();
 }
 
+
+void Impedance::on_btnEditList_clicked()
+{
+    SegmentEditor editor(this);
+    if (segments.isEmpty()) {
+        // Start with the current log sweep split into decades
+        editor.set_segments(SegmentEditor::decades(ui->startFreq->text().toUInt(), ui->stopFreq->text().toUInt(),
+                                                   ui->numberOfPoints->currentText().toUInt(),
+                                                   static_cast<HP8751A::ifbw_t>(ui->ifBw->currentIndex())));
+    } else {
+        editor.set_segments(segments);
+    }
+    if (editor.exec() == QDialog::Accepted) {
+        segments = editor.segments();
+        ui->ListmodeEn->setChecked(true);
+    }
+}
+
+void Impedance::on_btnOptimize_clicked()
+{
+    if (!hp->claim(this)) {
+        return;
+    }
+    PlannerDialog planner(hp, parameters(), this);
+    if (planner.exec() == QDialog::Accepted) {
+        segments = planner.segments();
+        ui->ListmodeEn->setChecked(true);
+    }
+    // The probes changed the instrument settings
+    update_parameters();
+    hp->release(this);
+}
+
+bool Impedance::apply_memory(HP8751A::instrument_data_t &data)
+{
+    TraceMath::operation_t operation = static_cast<TraceMath::operation_t>(ui->memoryMath->currentIndex());
+    if (operation == TraceMath::OP_OFF) {
+        memoryStatus->clear();
+        return false;
+    }
+    if (!memory.is_valid()) {
+        memoryStatus->setText("Trace math off: no reference");
+        return false;
+    }
+    HP8751A::instrument_parameters_t param;
+    hp->get_parameters(param);
+    if (!memory.apply(operation, data, param.unwrapPhase)) {
+        memoryStatus->setText(QString("Trace math off: sweep exceeds reference range %1 Hz to %2 Hz")
+                              .arg(memory.min_frequency(), 0, 'g', 4).arg(memory.max_frequency(), 0, 'g', 4));
+        return false;
+    }
+    memoryStatus->setText(QString("%1: %2").arg(ui->memoryMath->currentText(), memory.reference_name()));
+    return true;
+}
+
+void Impedance::update_memory_list(const QString &select)
+{
+    const QSignalBlocker blocker(ui->memoryTrace);
+    ui->memoryTrace->clear();
+    ui->memoryTrace->addItems(TraceMath::stored_references());
+    int index = ui->memoryTrace->findText(select);
+    ui->memoryTrace->setCurrentIndex(index >= 0 ? index : 0);
+    if (ui->memoryTrace->currentIndex() < 0 || !memory.load(ui->memoryTrace->currentText())) {
+        memory.clear();
+    }
+}
+
+void Impedance::on_memoryMath_currentIndexChanged(int index)
+{
+    Q_UNUSED(index)
+    if (lastMeasured.stimulus.isEmpty()) {
+        return;
+    }
+    // Show the last sweep with the new math right away
+    lastData = lastMeasured;
+    apply_memory(lastData);
+    topScale = lastData.channel1Scale;
+    topRefVal = lastData.channel1RefVal;
+    botScale = lastData.channel2Scale;
+    botRefVal = lastData.channel2RefVal;
+    views.set_data(lastData);
+    views.invalidate();
+    plot_data();
+}
+
+void Impedance::on_memoryTrace_currentIndexChanged(int index)
+{
+    if (index < 0 || !memory.load(ui->memoryTrace->currentText())) {
+        memory.clear();
+    }
+    on_memoryMath_currentIndexChanged(ui->memoryMath->currentIndex());
+}
+
+void Impedance::on_btnStoreMemory_clicked()
+{
+    if (lastMeasured.stimulus.isEmpty()) {
+        ui->statusbar->showMessage("No sweep to store!");
+        return;
+    }
+    bool ok;
+    QString name = QInputDialog::getText(this, "Store reference", "Name of the reference trace:", QLineEdit::Normal,
+                                         memory.reference_name(), &ok).trimmed();
+    // The name is the file name in the reference store, the list shows it the same way
+    name = TraceStore::valid_name(name);
+    if (!ok || name.isEmpty()) {
+        return;
+    }
+    if (TraceMath::stored_references().contains(name)
+            && QMessageBox::question(this, "Store reference", QString("Replace reference %1?").arg(name)) != QMessageBox::Yes) {
+        return;
+    }
+    if (!memory.capture(name, lastMeasured)) {
+        QMessageBox::warning(this, "Store reference", "Could not store the reference trace!");
+        return;
+    }
+    update_memory_list(name);
+    on_memoryMath_currentIndexChanged(ui->memoryMath->currentIndex());
+}
+
+void Impedance::check_limits(const HP8751A::instrument_data_t &data)
+{
+    if (!limits.active()) {
+        return;
+    }
+    LimitEngine::verdict_t verdict = limits.evaluate(data);
+    const LimitEngine::statistics_t &stats = limits.statistics();
+
+    QString text = verdict.pass ? "PASS" : "FAIL";
+    if (verdict.firstIndex >= 0) {
+        text += QString(" at %1 Hz (%2)").arg(verdict.firstFrequency, 0, 'g', 6)
+                .arg(verdict.firstTrace == LimitEngine::TRACE_CHANNEL1 ? "|Z|" : "phase");
+    } else if (verdict.marginFail) {
+        text += " (margin)";
+    }
+    if (std::isfinite(verdict.worstDeviation)) {
+        text += QString(", worst %1").arg(verdict.worstDeviation, 0, 'f', 2);
+    }
+    text += QString(" | yield %1/%2").arg(stats.passed).arg(stats.tested);
+    limitStatus->setText(text);
+    limitStatus->setStyleSheet(verdict.pass ? "color: green" : "color: red");
+}
+
+void Impedance::plot_limits()
+{
+    const HP8751A::instrument_data_t &data = lastData;
+    const int chartViews[2] = {ui->view_top->currentIndex(), ui->view_bot->currentIndex()};
+    for (int c = 0; c < 2; c++) {
+        // Only the views the mask checks get bounds: |Z| in dB or ohms and the phase
+        LimitEngine::trace_t trace = LimitEngine::TRACE_CHANNEL1;
+        bool linear = false;
+        bool shown = limits.active();
+        switch (chartViews[c]) {
+        case ImpedanceViews::VIEW_MAGNITUDE:
+            break;
+        case ImpedanceViews::VIEW_IMPEDANCE:
+            linear = true;
+            break;
+        case ImpedanceViews::VIEW_PHASE:
+            trace = LimitEngine::TRACE_CHANNEL2;
+            break;
+        default:
+            shown = false;
+            break;
+        }
+        const QVector<float> *bounds[2] = {&limits.lower(trace), &limits.upper(trace)};
+        for (int bound = 0; bound < 2; bound++) {
+            QVector<QPointF> points;
+            // The bounds belong to the last evaluated sweep, which is the one plotted
+            if (shown && bounds[bound]->size() == data.stimulus.size()) {
+                for (int i = 0; i < data.stimulus.size(); i++) {
+                    float value = bounds[bound]->at(i);
+                    if (std::isfinite(value)) {
+                        points.append({data.stimulus.at(i), linear ? std::pow(10.0f, value / 20) : value});
+                    }
+                }
+            }
+            limitLines[c][bound]->replace(points);
+        }
+    }
+}
+
+void Impedance::on_btnLimits_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Load limit mask"), "", tr("Mask files (*.json)"));
+    if (fileName.isEmpty()) {
+        limits.clear();
+        limitStatus->clear();
+        plot_limits();
+        return;
+    }
+    QString errorString;
+    if (!limits.load(fileName, errorString)) {
+        QMessageBox::warning(this, "Limit mask", errorString);
+        return;
+    }
+    limitStatus->setText(QString("Mask %1 loaded").arg(QFileInfo(fileName).fileName()));
+    limitStatus->setStyleSheet("");
+    if (!lastData.stimulus.isEmpty()) {
+        // Check the sweep on screen right away
+        check_limits(lastData);
+        plot_limits();
+    }
+}
+
+void Impedance::zoom_to(double fStart, double fStop)
+{
+    if (lastData.stimulus.isEmpty() || zoom->busy()) {
+        return;
+    }
+    zoomStart = fStart;
+    zoomStop = fStop;
+    axisXTop->setRange(zoomStart, zoomStop);
+    axisXBot->setRange(zoomStart, zoomStop);
+
+    // Only while no regular sweep is running
+    if (ui->zoomMeasure->isChecked() && ui->btnSingle->isEnabled()) {
+        ui_start_sweep();
+        zoom->start(parameters(), std::floor(fStart), std::ceil(fStop), ui->numberOfPoints->currentText().toUInt());
+    }
+}
+
+void Impedance::full_span()
+{
+    if (zoom->busy()) {
+        return;
+    }
+    zoomStart = 0;
+    zoomStop = 0;
+    views.set_data(lastData);
+    views.invalidate();
+    plot_data();
+}
@@ -5,9 +5,20 @@
 #include <QCloseEvent>
 #include <hp8751a.h>
 #include <QMessageBox>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <QtCharts>
 #include <complex.h>
 #include "calibratedialog.h"
+#include "impedanceviews.h"
+#include "circuitfit.h"
+#include "oneportcal.h"
+#include "zoomchartview.h"
+#include "zoomsweep.h"
+#include "sweepenvelope.h"
+#include "tracemath.h"
+#include "limitengine.h"
 
 namespace Ui {
 class Impedance;
@@ -26,14 +37,37 @@ public:
 private:
     Ui::Impedance *ui;
     void init();
+    void init_instrument();
+
+    // The instrument is claimed while this window initializes it or sweeps. A remote client locks the window.
+    bool initializing; // Own initialization in progress
+    bool initPending; // Waits for a remote client to release the instrument
+    bool remoteControl;
+    void claim_changed();
     void init_statemachine_sweep();
+    void start_sweep();
     void init_plot();
     void disable_ui();
     void enable_ui();
     void ui_start_sweep();
     void ui_stop_sweep();
     void plot_data();
+
+    // Free-running sweeps are plotted at most every PLOT_INTERVAL_MS, snapshots in between are skipped
+    static constexpr int PLOT_INTERVAL_MS = 50;
+    QTimer *plotTimer = nullptr;
+    QElapsedTimer plotElapsed;
+    void schedule_plot();
+
+    HP8751A::instrument_parameters_t parameters(); // Settings of the controls
     void update_parameters();
+    void update_refinement();
+
+    // Segments of the list sweep, used when list mode is checked
+    QVector<HP8751A::segment_t> segments;
+    void run_fit(bool incremental);
+    void fit_finished();
+    void show_fit();
 
     QLogValueAxis *axisXTop = nullptr;
     QLogValueAxis *axisXBot = nullptr;
@@ -41,24 +75,85 @@ private:
     QValueAxis *axisYBot = nullptr;
     QLineSeries *top = nullptr;
     QLineSeries *bot = nullptr;
+    QLineSeries *topFit = nullptr;
+    QLineSeries *botFit = nullptr;
 
     float topScale;
     float topRefVal;
     float botScale;
     float botRefVal;
 
-    QList<QPointF> magnitude;
-    QList<QPointF> impedance;
-    QList<QPointF> phase;
-    QList<QPointF> inductance;
-    QList<QPointF> capacitance;
-    QList<QPointF> resistance;
+    ImpedanceViews views;
+
+    // Fitted model, evaluated on the stimulus of the last sweep and displayed like a measurement
+    ImpedanceViews fitViews;
+    CircuitFit::result_t fit;
+    quint32 fitSequence;
+
+    // The multi-start fit runs on the thread pool. A fit requested meanwhile runs afterwards on the latest sweep.
+    QFutureWatcher<CircuitFit::result_t> *fitWatcher = nullptr;
+    CircuitFit::data_t fitData;
+    QVector<float> fitFrequency;
+    CircuitFit::result_t fitRefined; // Local refinement, kept if the multi-start fit is not better
+    QElapsedTimer fitTimer;
+    bool fitQueued;
+    bool fitQueuedIncremental;
+    void set_fit(const CircuitFit::result_t &result);
 
-    std::tuple<float, float> find_min_max(QList<QPointF> &points);
     float round_one_decimal(float value);
 
+    // Per-point statistics of the two selected views over the sweeps of a run, shown as min/max and +-sigma bands
+    bool envelope;
+    SweepEnvelope topEnvelope;
+    SweepEnvelope botEnvelope;
+    QAreaSeries *topRange = nullptr;
+    QAreaSeries *topSigma = nullptr;
+    QAreaSeries *botRange = nullptr;
+    QAreaSeries *botSigma = nullptr;
+    QAreaSeries *add_band(QChart *chart, QLineSeries *trace, QAbstractAxis *axisX, QAbstractAxis *axisY, int alpha);
+    void clear_envelope();
+    void add_envelope(SweepEnvelope &statistics, ImpedanceViews::view_t view);
+    void plot_envelope(const SweepEnvelope &statistics, QAreaSeries *range, QAreaSeries *sigma);
+
     CalibrateDialog *cal = nullptr;
 
+    // Host-side one-port correction, applied to every sweep while active
+    OnePortCal hostCal;
+    bool hostCalActive;
+    QLabel *calStatus = nullptr;
+    void apply_host_cal(HP8751A::instrument_data_t &data);
+
+    // Fixture of the active instrument calibration. Its coefficients are stored per sweep setup and
+    // uploaded again when a setup with a stored calibration is selected.
+    QString instrumentCalFixture;
+    QString instrumentCalKey;
+    void store_cal_coefficients(HP8751A::cal_coefficients_t coefficients);
+    void recall_cal(const HP8751A::instrument_parameters_t &param);
+
+    // Trace math against a stored reference, applied to every sweep before plot, metrics and export
+    TraceMath memory;
+    HP8751A::instrument_data_t lastMeasured; // Last full span sweep before the trace math
+    QLabel *memoryStatus = nullptr;
+    bool apply_memory(HP8751A::instrument_data_t &data);
+    void update_memory_list(const QString &select);
+
+    // Pass/fail check of |Z| (dB) and phase of every full span sweep, the yield counts all sweeps since the mask was loaded
+    LimitEngine limits;
+    QLabel *limitStatus = nullptr;
+    QLineSeries *limitLines[2][2] = {}; // Lower and upper bound on the top and bottom chart
+    void check_limits(const HP8751A::instrument_data_t &data);
+    void plot_limits();
+
+    // Last sweep as displayed, used for the export
+    HP8751A::instrument_data_t lastData;
+
+    // Zoomed frequency span, zero if the full span is shown
+    double zoomStart;
+    double zoomStop;
+    ZoomSweep *zoom = nullptr;
+    void zoom_to(double fStart, double fStop);
+    void full_span();
+
 
 public slots:
     void instrument_initialized();
@@ -69,6 +164,7 @@ public slots:
 
 signals:
     void continueSweep(QPrivateSignal);
+    void streamStarted(QPrivateSignal);
     void goIdle(QPrivateSignal);
 private slots:
     void on_autoscale_top_stateChanged(int arg1);
@@ -79,8 +175,20 @@ private slots:
     void on_botScale_valueChanged(double arg1);
     void on_view_top_currentIndexChanged(int index);
     void on_view_bot_currentIndexChanged(int index);
+    void on_equivalentModel_currentIndexChanged(int index);
     void on_btnExport_clicked();
+
+    void on_btnEditList_clicked();
+
+    void on_btnOptimize_clicked();
     void on_btnCalibrate_clicked();
+    void on_btnFit_clicked();
+    void on_fitTopology_currentIndexChanged(int index);
+
+    void on_memoryMath_currentIndexChanged(int index);
+    void on_memoryTrace_currentIndexChanged(int index);
+    void on_btnStoreMemory_clicked();
+    void on_btnLimits_clicked();
 };
 
 #endif // IMPEDANCE_H
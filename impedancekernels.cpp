@@ -0,0 +1,538 @@
+#include "impedancekernels.h"
+#include <cmath>
+
+#ifdef ZKERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+namespace zkernels {
+
+static constexpr float TWO_PI = 6.283185307179586f;
+static constexpr float DB_TO_LN = 0.11512925464970229f; // ln(10) / 20
+static constexpr float DEG_TO_RAD = 0.017453292519943295f;
+static constexpr float RAD_TO_DEG = 57.29577951308232f;
+
+void polar_to_rect_scalar(const float *magnitudeDb, const float *phaseDeg, float *re, float *im, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        float lin = std::exp(magnitudeDb[i] * DB_TO_LN);
+        float phi = phaseDeg[i] * DEG_TO_RAD;
+        re[i] = lin * std::cos(phi);
+        im[i] = lin * std::sin(phi);
+    }
+}
+
+void rect_to_polar_scalar(const float *re, const float *im, float *magnitudeDb, float *phaseDeg, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        // 20 * log10(|z|) = 10 * log10(|z|^2), saves the square root
+        magnitudeDb[i] = 10.0f * std::log10(re[i] * re[i] + im[i] * im[i]);
+        phaseDeg[i] = std::atan2(im[i], re[i]) * RAD_TO_DEG;
+    }
+}
+
+void complex_divide_scalar(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        float invMag2 = 1.0f / (bRe[i] * bRe[i] + bIm[i] * bIm[i]);
+        float r = (aRe[i] * bRe[i] + aIm[i] * bIm[i]) * invMag2;
+        float x = (aIm[i] * bRe[i] - aRe[i] * bIm[i]) * invMag2;
+        re[i] = r;
+        im[i] = x;
+    }
+}
+
+void complex_subtract_scalar(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        re[i] = aRe[i] - bRe[i];
+        im[i] = aIm[i] - bIm[i];
+    }
+}
+
+void complex_multiply_scalar(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        float r = aRe[i] * bRe[i] - aIm[i] * bIm[i];
+        float x = aRe[i] * bIm[i] + aIm[i] * bRe[i];
+        re[i] = r;
+        im[i] = x;
+    }
+}
+
+void one_port_correct_scalar(const float *measuredRe, const float *measuredIm, const error_terms_t &terms,
+                             float *re, float *im, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        float dRe = measuredRe[i] - terms.e00Re[i];
+        float dIm = measuredIm[i] - terms.e00Im[i];
+        float denRe = terms.e10e01Re[i] + terms.e11Re[i] * dRe - terms.e11Im[i] * dIm;
+        float denIm = terms.e10e01Im[i] + terms.e11Re[i] * dIm + terms.e11Im[i] * dRe;
+        float invMag2 = 1.0f / (denRe * denRe + denIm * denIm);
+        re[i] = (dRe * denRe + dIm * denIm) * invMag2;
+        im[i] = (dIm * denRe - dRe * denIm) * invMag2;
+    }
+}
+
+#ifdef ZKERNELS_AVX2
+ZKERNELS_TARGET_AVX2
+static void one_port_correct_avx2(const float *measuredRe, const float *measuredIm, const error_terms_t &terms,
+                                  float *re, float *im, std::size_t n)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 e11Re = _mm256_loadu_ps(terms.e11Re + i);
+        __m256 e11Im = _mm256_loadu_ps(terms.e11Im + i);
+        __m256 dRe = _mm256_sub_ps(_mm256_loadu_ps(measuredRe + i), _mm256_loadu_ps(terms.e00Re + i));
+        __m256 dIm = _mm256_sub_ps(_mm256_loadu_ps(measuredIm + i), _mm256_loadu_ps(terms.e00Im + i));
+        __m256 denRe = _mm256_fmadd_ps(e11Re, dRe, _mm256_fnmadd_ps(e11Im, dIm, _mm256_loadu_ps(terms.e10e01Re + i)));
+        __m256 denIm = _mm256_fmadd_ps(e11Re, dIm, _mm256_fmadd_ps(e11Im, dRe, _mm256_loadu_ps(terms.e10e01Im + i)));
+        __m256 invMag2 = _mm256_div_ps(one, _mm256_fmadd_ps(denRe, denRe, _mm256_mul_ps(denIm, denIm)));
+        _mm256_storeu_ps(re + i, _mm256_mul_ps(_mm256_fmadd_ps(dRe, denRe, _mm256_mul_ps(dIm, denIm)), invMag2));
+        _mm256_storeu_ps(im + i, _mm256_mul_ps(_mm256_fmsub_ps(dIm, denRe, _mm256_mul_ps(dRe, denIm)), invMag2));
+    }
+    one_port_correct_scalar(measuredRe + i, measuredIm + i,
+                            {terms.e00Re + i, terms.e00Im + i, terms.e11Re + i, terms.e11Im + i,
+                             terms.e10e01Re + i, terms.e10e01Im + i},
+                            re + i, im + i, n - i);
+}
+#endif
+
+void one_port_correct(const float *measuredRe, const float *measuredIm, const error_terms_t &terms,
+                      float *re, float *im, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        one_port_correct_avx2(measuredRe, measuredIm, terms, re, im, n);
+        return;
+    }
+#endif
+    one_port_correct_scalar(measuredRe, measuredIm, terms, re, im, n);
+}
+
+void reflection_to_impedance_scalar(const float *gammaRe, const float *gammaIm, float z0, float *re, float *im, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        float numRe = 1.0f + gammaRe[i];
+        float numIm = gammaIm[i];
+        float denRe = 1.0f - gammaRe[i];
+        float denIm = -gammaIm[i];
+        float scale = z0 / (denRe * denRe + denIm * denIm);
+        re[i] = (numRe * denRe + numIm * denIm) * scale;
+        im[i] = (numIm * denRe - numRe * denIm) * scale;
+    }
+}
+
+#ifdef ZKERNELS_AVX2
+/* Vector versions of exp, sin/cos, log and atan2 for the polar conversions, Cephes single precision
+ * polynomials. They are accurate to a few ulp for the values a sweep can contain: magnitudes within
+ * +-700 dB and phases of any branch. Zero, infinite and NaN magnitudes give the results of the C library.
+ */
+ZKERNELS_TARGET_AVX2
+static inline __m256 exp_avx2(__m256 x)
+{
+    const __m256 log2e = _mm256_set1_ps(1.44269504088896341f);
+    // ln(2) split in two parts, so n * ln(2) is subtracted without rounding
+    const __m256 ln2Hi = _mm256_set1_ps(0.693359375f);
+    const __m256 ln2Lo = _mm256_set1_ps(-2.12194440e-4f);
+
+    // The clamp keeps 2^n a normal float, beyond it the result is 0 or infinite anyway
+    __m256 xc = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(xc, log2e), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, ln2Hi, xc);
+    r = _mm256_fnmadd_ps(n, ln2Lo, r);
+
+    __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    y = _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+
+    y = _mm256_blendv_ps(y, _mm256_setzero_ps(), _mm256_cmp_ps(x, _mm256_set1_ps(-87.0f), _CMP_LT_OQ));
+    y = _mm256_blendv_ps(y, _mm256_set1_ps(INFINITY), _mm256_cmp_ps(x, _mm256_set1_ps(88.5f), _CMP_GT_OQ));
+    return _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, x, _CMP_UNORD_Q));
+}
+
+// sin and cos of an angle in degrees. The reduction to +-45 degrees is exact in degrees, so large unwrapped
+// phases keep their accuracy.
+ZKERNELS_TARGET_AVX2
+static inline void sincos_deg_avx2(__m256 deg, __m256 &sine, __m256 &cosine)
+{
+    __m256 q = _mm256_round_ps(_mm256_mul_ps(deg, _mm256_set1_ps(1.0f / 90.0f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 x = _mm256_mul_ps(_mm256_fnmadd_ps(q, _mm256_set1_ps(90.0f), deg), _mm256_set1_ps(DEG_TO_RAD));
+    __m256 z = _mm256_mul_ps(x, x);
+
+    __m256 s = _mm256_set1_ps(-1.9515295891e-4f);
+    s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(8.3321608736e-3f));
+    s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(-1.6666654611e-1f));
+    s = _mm256_fmadd_ps(_mm256_mul_ps(s, z), x, x);
+
+    __m256 c = _mm256_set1_ps(2.443315711809948e-5f);
+    c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(-1.388731625493765e-3f));
+    c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(4.166664568298827e-2f));
+    c = _mm256_fmadd_ps(_mm256_mul_ps(c, z), z, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, _mm256_set1_ps(1.0f)));
+
+    // Quadrant q: odd swaps sin and cos, bit 1 of q negates the sine, bit 1 of q + 1 the cosine
+    __m256i quadrant = _mm256_cvtps_epi32(q);
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(quadrant, 30));
+    __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), 30));
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    sine = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), _mm256_and_ps(sinSign, signMask));
+    cosine = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), _mm256_and_ps(cosSign, signMask));
+}
+
+// Natural logarithm of x >= 0
+ZKERNELS_TARGET_AVX2
+static inline __m256 log_avx2(__m256 x)
+{
+    // Subnormals are scaled into the normal range first
+    __m256 subnormal = _mm256_cmp_ps(x, _mm256_set1_ps(1.17549435e-38f), _CMP_LT_OQ);
+    __m256 xs = _mm256_blendv_ps(x, _mm256_mul_ps(x, _mm256_set1_ps(16777216.0f)), subnormal);
+    __m256 e = _mm256_blendv_ps(_mm256_setzero_ps(), _mm256_set1_ps(-24.0f), subnormal);
+
+    // x = m * 2^e with m in [sqrt(0.5), sqrt(2))
+    __m256i bits = _mm256_castps_si256(xs);
+    e = _mm256_add_ps(e, _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126))));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                                   _mm256_set1_epi32(0x3f000000)));
+    __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.0f)));
+    m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), _mm256_set1_ps(1.0f));
+
+    __m256 z = _mm256_mul_ps(m, m);
+    __m256 y = _mm256_set1_ps(7.0376836292e-2f);
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.1514610310e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(1.1676998740e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.2420140846e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(1.4249322787e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-1.6668057665e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(2.0000714765e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(-2.4999993993e-1f));
+    y = _mm256_fmadd_ps(y, m, _mm256_set1_ps(3.3333331174e-1f));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+    y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, y);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), _mm256_add_ps(m, y));
+
+    y = _mm256_blendv_ps(y, _mm256_set1_ps(-INFINITY), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ));
+    y = _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, _mm256_set1_ps(INFINITY), _CMP_EQ_OQ));
+    return _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, x, _CMP_UNORD_Q));
+}
+
+// atan2 in radians, including the signed zeros of the C library
+ZKERNELS_TARGET_AVX2
+static inline __m256 atan2_avx2(__m256 y, __m256 x)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 absX = _mm256_andnot_ps(signMask, x);
+    __m256 absY = _mm256_andnot_ps(signMask, y);
+    __m256 high = _mm256_max_ps(absX, absY);
+    __m256 low = _mm256_min_ps(absX, absY);
+    // 0 / 0 for the origin, the angle is then 0 or pi like atan2(+-0, +-0)
+    __m256 t = _mm256_div_ps(low, high);
+    t = _mm256_andnot_ps(_mm256_cmp_ps(high, _mm256_setzero_ps(), _CMP_EQ_OQ), t);
+
+    // atan(t) = pi/4 + atan((t - 1) / (t + 1)) above tan(pi/8)
+    __m256 upper = _mm256_cmp_ps(t, _mm256_set1_ps(0.414213562373095f), _CMP_GT_OQ);
+    __m256 tr = _mm256_blendv_ps(t, _mm256_div_ps(_mm256_sub_ps(t, _mm256_set1_ps(1.0f)), _mm256_add_ps(t, _mm256_set1_ps(1.0f))), upper);
+    __m256 z = _mm256_mul_ps(tr, tr);
+    __m256 a = _mm256_set1_ps(8.05374449538e-2f);
+    a = _mm256_fmadd_ps(a, z, _mm256_set1_ps(-1.38776856032e-1f));
+    a = _mm256_fmadd_ps(a, z, _mm256_set1_ps(1.99777106478e-1f));
+    a = _mm256_fmadd_ps(a, z, _mm256_set1_ps(-3.33329491539e-1f));
+    a = _mm256_fmadd_ps(_mm256_mul_ps(a, z), tr, tr);
+    a = _mm256_add_ps(a, _mm256_and_ps(upper, _mm256_set1_ps(0.785398163397448f)));
+
+    a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(1.57079632679490f), a), _mm256_cmp_ps(absY, absX, _CMP_GT_OQ));
+    // Negative x, also -0, mirrors the angle
+    a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(3.14159265358979f), a), x);
+    return _mm256_or_ps(a, _mm256_and_ps(signMask, y));
+}
+
+ZKERNELS_TARGET_AVX2
+static void polar_to_rect_avx2(const float *magnitudeDb, const float *phaseDeg, float *re, float *im, std::size_t n)
+{
+    const __m256 dbToLn = _mm256_set1_ps(DB_TO_LN);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 lin = exp_avx2(_mm256_mul_ps(_mm256_loadu_ps(magnitudeDb + i), dbToLn));
+        __m256 sine;
+        __m256 cosine;
+        sincos_deg_avx2(_mm256_loadu_ps(phaseDeg + i), sine, cosine);
+        _mm256_storeu_ps(re + i, _mm256_mul_ps(lin, cosine));
+        _mm256_storeu_ps(im + i, _mm256_mul_ps(lin, sine));
+    }
+    polar_to_rect_scalar(magnitudeDb + i, phaseDeg + i, re + i, im + i, n - i);
+}
+
+ZKERNELS_TARGET_AVX2
+static void rect_to_polar_avx2(const float *re, const float *im, float *magnitudeDb, float *phaseDeg, std::size_t n)
+{
+    const __m256 lnToDb = _mm256_set1_ps(4.342944819032518f); // 10 / ln(10), of |z|^2
+    const __m256 radToDeg = _mm256_set1_ps(RAD_TO_DEG);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 r = _mm256_loadu_ps(re + i);
+        __m256 x = _mm256_loadu_ps(im + i);
+        _mm256_storeu_ps(magnitudeDb + i, _mm256_mul_ps(log_avx2(_mm256_fmadd_ps(r, r, _mm256_mul_ps(x, x))), lnToDb));
+        _mm256_storeu_ps(phaseDeg + i, _mm256_mul_ps(atan2_avx2(x, r), radToDeg));
+    }
+    rect_to_polar_scalar(re + i, im + i, magnitudeDb + i, phaseDeg + i, n - i);
+}
+
+ZKERNELS_TARGET_AVX2
+static void complex_divide_avx2(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 ar = _mm256_loadu_ps(aRe + i);
+        __m256 ai = _mm256_loadu_ps(aIm + i);
+        __m256 br = _mm256_loadu_ps(bRe + i);
+        __m256 bi = _mm256_loadu_ps(bIm + i);
+        __m256 invMag2 = _mm256_div_ps(one, _mm256_fmadd_ps(br, br, _mm256_mul_ps(bi, bi)));
+        _mm256_storeu_ps(re + i, _mm256_mul_ps(_mm256_fmadd_ps(ar, br, _mm256_mul_ps(ai, bi)), invMag2));
+        _mm256_storeu_ps(im + i, _mm256_mul_ps(_mm256_fmsub_ps(ai, br, _mm256_mul_ps(ar, bi)), invMag2));
+    }
+    complex_divide_scalar(aRe + i, aIm + i, bRe + i, bIm + i, re + i, im + i, n - i);
+}
+
+ZKERNELS_TARGET_AVX2
+static void complex_subtract_avx2(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(re + i, _mm256_sub_ps(_mm256_loadu_ps(aRe + i), _mm256_loadu_ps(bRe + i)));
+        _mm256_storeu_ps(im + i, _mm256_sub_ps(_mm256_loadu_ps(aIm + i), _mm256_loadu_ps(bIm + i)));
+    }
+    complex_subtract_scalar(aRe + i, aIm + i, bRe + i, bIm + i, re + i, im + i, n - i);
+}
+
+ZKERNELS_TARGET_AVX2
+static void complex_multiply_avx2(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 ar = _mm256_loadu_ps(aRe + i);
+        __m256 ai = _mm256_loadu_ps(aIm + i);
+        __m256 br = _mm256_loadu_ps(bRe + i);
+        __m256 bi = _mm256_loadu_ps(bIm + i);
+        // Both results are computed before the stores, the output may be one of the inputs
+        __m256 r = _mm256_fmsub_ps(ar, br, _mm256_mul_ps(ai, bi));
+        __m256 x = _mm256_fmadd_ps(ar, bi, _mm256_mul_ps(ai, br));
+        _mm256_storeu_ps(re + i, r);
+        _mm256_storeu_ps(im + i, x);
+    }
+    complex_multiply_scalar(aRe + i, aIm + i, bRe + i, bIm + i, re + i, im + i, n - i);
+}
+
+ZKERNELS_TARGET_AVX2
+static void reflection_to_impedance_avx2(const float *gammaRe, const float *gammaIm, float z0, float *re, float *im, std::size_t n)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 z0v = _mm256_set1_ps(z0);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 gr = _mm256_loadu_ps(gammaRe + i);
+        __m256 gi = _mm256_loadu_ps(gammaIm + i);
+        __m256 numRe = _mm256_add_ps(one, gr);
+        __m256 denRe = _mm256_sub_ps(one, gr);
+        // (numRe + j gi) / (denRe - j gi)
+        __m256 scale = _mm256_div_ps(z0v, _mm256_fmadd_ps(denRe, denRe, _mm256_mul_ps(gi, gi)));
+        _mm256_storeu_ps(re + i, _mm256_mul_ps(_mm256_fnmadd_ps(gi, gi, _mm256_mul_ps(numRe, denRe)), scale));
+        _mm256_storeu_ps(im + i, _mm256_mul_ps(_mm256_fmadd_ps(gi, denRe, _mm256_mul_ps(numRe, gi)), scale));
+    }
+    reflection_to_impedance_scalar(gammaRe + i, gammaIm + i, z0, re + i, im + i, n - i);
+}
+#endif
+
+void polar_to_rect(const float *magnitudeDb, const float *phaseDeg, float *re, float *im, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        polar_to_rect_avx2(magnitudeDb, phaseDeg, re, im, n);
+        return;
+    }
+#endif
+    polar_to_rect_scalar(magnitudeDb, phaseDeg, re, im, n);
+}
+
+void rect_to_polar(const float *re, const float *im, float *magnitudeDb, float *phaseDeg, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        rect_to_polar_avx2(re, im, magnitudeDb, phaseDeg, n);
+        return;
+    }
+#endif
+    rect_to_polar_scalar(re, im, magnitudeDb, phaseDeg, n);
+}
+
+void complex_divide(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        complex_divide_avx2(aRe, aIm, bRe, bIm, re, im, n);
+        return;
+    }
+#endif
+    complex_divide_scalar(aRe, aIm, bRe, bIm, re, im, n);
+}
+
+void complex_subtract(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        complex_subtract_avx2(aRe, aIm, bRe, bIm, re, im, n);
+        return;
+    }
+#endif
+    complex_subtract_scalar(aRe, aIm, bRe, bIm, re, im, n);
+}
+
+void complex_multiply(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        complex_multiply_avx2(aRe, aIm, bRe, bIm, re, im, n);
+        return;
+    }
+#endif
+    complex_multiply_scalar(aRe, aIm, bRe, bIm, re, im, n);
+}
+
+void reflection_to_impedance(const float *gammaRe, const float *gammaIm, float z0, float *re, float *im, std::size_t n)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        reflection_to_impedance_avx2(gammaRe, gammaIm, z0, re, im, n);
+        return;
+    }
+#endif
+    reflection_to_impedance_scalar(gammaRe, gammaIm, z0, re, im, n);
+}
+
+// A purely reactive or resistive point has no finite Q, D, C or parallel R. The divisors are kept at least
+// MIN_RELATIVE * |Z| (and MIN_OHMS for a short) away from zero, far below the resolution of the instrument,
+// so these views stay finite (Q and D at most 1e6) and the autoscale keeps working.
+static constexpr float MIN_RELATIVE = 1e-6f;
+static constexpr float MIN_OHMS = 1e-9f;
+
+static inline void derive_point(float f, float r, float x, model_t model, const outputs_t &out, std::size_t i)
+{
+    float w = TWO_PI * f;
+    float mag2 = r * r + x * x;
+    float floor = std::fmax(MIN_RELATIVE * std::sqrt(mag2), MIN_OHMS);
+    float rSafe = std::copysign(std::fmax(std::fabs(r), floor), r);
+    float xSafe = std::copysign(std::fmax(std::fabs(x), floor), x);
+    float mag2Safe = std::fmax(mag2, MIN_OHMS * MIN_OHMS);
+    float g = r / mag2Safe;
+    float b = -x / mag2Safe;
+    float absX = std::fabs(x);
+
+    if (model == MODEL_SERIES) {
+        out.resistance[i] = r;
+        out.inductance[i] = x / w;
+        out.capacitance[i] = -1.0f / (w * xSafe);
+    } else {
+        out.resistance[i] = mag2 / rSafe;
+        out.inductance[i] = mag2 / (w * xSafe);
+        out.capacitance[i] = b / w;
+    }
+    out.reactance[i] = x;
+    out.quality[i] = absX / rSafe;
+    out.dissipation[i] = r / std::fabs(xSafe);
+    out.esr[i] = r;
+    out.conductance[i] = g;
+    out.susceptance[i] = b;
+}
+
+void derive_scalar(const float *frequency, const float *re, const float *im, std::size_t n, model_t model, const outputs_t &out)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        derive_point(frequency[i], re[i], im[i], model, out, i);
+    }
+}
+
+#ifdef ZKERNELS_AVX2
+ZKERNELS_TARGET_AVX2
+static void derive_avx2(const float *frequency, const float *re, const float *im, std::size_t n, model_t model, const outputs_t &out)
+{
+    const __m256 twoPi = _mm256_set1_ps(TWO_PI);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 minRelative = _mm256_set1_ps(MIN_RELATIVE);
+    const __m256 minOhms = _mm256_set1_ps(MIN_OHMS);
+    const __m256 minMag2 = _mm256_set1_ps(MIN_OHMS * MIN_OHMS);
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_loadu_ps(frequency + i);
+        __m256 r = _mm256_loadu_ps(re + i);
+        __m256 x = _mm256_loadu_ps(im + i);
+
+        __m256 w = _mm256_mul_ps(twoPi, f);
+        __m256 mag2 = _mm256_fmadd_ps(r, r, _mm256_mul_ps(x, x));
+        __m256 floor = _mm256_max_ps(_mm256_mul_ps(minRelative, _mm256_sqrt_ps(mag2)), minOhms);
+        __m256 absR = _mm256_andnot_ps(signMask, r);
+        __m256 absX = _mm256_andnot_ps(signMask, x);
+        __m256 absRSafe = _mm256_max_ps(absR, floor);
+        __m256 absXSafe = _mm256_max_ps(absX, floor);
+        __m256 rSafe = _mm256_or_ps(absRSafe, _mm256_and_ps(signMask, r));
+        __m256 xSafe = _mm256_or_ps(absXSafe, _mm256_and_ps(signMask, x));
+        __m256 invMag2 = _mm256_div_ps(one, _mm256_max_ps(mag2, minMag2));
+        __m256 g = _mm256_mul_ps(r, invMag2);
+        __m256 b = _mm256_xor_ps(_mm256_mul_ps(x, invMag2), signMask);
+
+        if (model == MODEL_SERIES) {
+            _mm256_storeu_ps(out.resistance + i, r);
+            _mm256_storeu_ps(out.inductance + i, _mm256_div_ps(x, w));
+            _mm256_storeu_ps(out.capacitance + i, _mm256_xor_ps(_mm256_div_ps(one, _mm256_mul_ps(w, xSafe)), signMask));
+        } else {
+            _mm256_storeu_ps(out.resistance + i, _mm256_div_ps(mag2, rSafe));
+            _mm256_storeu_ps(out.inductance + i, _mm256_div_ps(mag2, _mm256_mul_ps(w, xSafe)));
+            _mm256_storeu_ps(out.capacitance + i, _mm256_div_ps(b, w));
+        }
+        _mm256_storeu_ps(out.reactance + i, x);
+        _mm256_storeu_ps(out.quality + i, _mm256_div_ps(absX, rSafe));
+        _mm256_storeu_ps(out.dissipation + i, _mm256_div_ps(r, absXSafe));
+        _mm256_storeu_ps(out.esr + i, r);
+        _mm256_storeu_ps(out.conductance + i, g);
+        _mm256_storeu_ps(out.susceptance + i, b);
+    }
+
+    for (; i < n; i++) {
+        derive_point(frequency[i], re[i], im[i], model, out, i);
+    }
+}
+#endif
+
+bool has_avx2()
+{
+#ifdef ZKERNELS_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+void derive(const float *frequency, const float *re, const float *im, std::size_t n, model_t model, const outputs_t &out)
+{
+#ifdef ZKERNELS_AVX2
+    if (has_avx2()) {
+        derive_avx2(frequency, re, im, n, model, out);
+        return;
+    }
+#endif
+    derive_scalar(frequency, re, im, n, model, out);
+}
+
+} // namespace zkernels
@@ -0,0 +1,88 @@
+#ifndef IMPEDANCEKERNELS_H
+#define IMPEDANCEKERNELS_H
+
+/* Impedance math on structure-of-arrays traces.
+ * The kernels are plain C++ and don't depend on Qt. On x86 with GCC or Clang every kernel has an AVX2
+ * implementation that is selected at runtime if the CPU supports it, otherwise the scalar implementation
+ * is used. The scalar implementations stay available as <kernel>_scalar for comparison. The polar
+ * conversions use polynomial approximations of exp, sin, cos, log and atan2 in the AVX2 path, they agree
+ * with the C library to a few ulp.
+ */
+
+#include <cstddef>
+
+// Defined where AVX2 code can be compiled (x86 with GCC or Clang). Functions marked ZKERNELS_TARGET_AVX2 are
+// compiled for AVX2 and FMA and may only be called if zkernels::has_avx2() returns true.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ZKERNELS_AVX2
+#define ZKERNELS_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace zkernels {
+
+enum model_t {
+    MODEL_SERIES,   // Z = R + jX, L and C in series with R
+    MODEL_PARALLEL  // Y = G + jB, L and C in parallel with R
+};
+
+// Output arrays, each with space for n values. Null pointers are not allowed.
+struct outputs_t {
+    float *resistance;  // Series: Rs = Re(Z); parallel: Rp = 1 / G
+    float *reactance;   // X = Im(Z)
+    float *inductance;  // Series: X / w; parallel: -1 / (w B)
+    float *capacitance; // Series: -1 / (w X); parallel: B / w
+    float *quality;     // Q = |X| / R (identical for both models)
+    float *dissipation; // D = 1 / Q
+    float *esr;         // Re(Z) regardless of the model
+    float *conductance; // G = Re(1 / Z)
+    float *susceptance; // B = Im(1 / Z)
+};
+
+// One-port error terms on a frequency grid, real and imaginary parts as separate arrays
+struct error_terms_t {
+    const float *e00Re;     // Directivity
+    const float *e00Im;
+    const float *e11Re;     // Source match
+    const float *e11Im;
+    const float *e10e01Re;  // Reflection tracking
+    const float *e10e01Im;
+};
+
+// Convert magnitude in dB and phase in degrees to real and imaginary part
+void polar_to_rect(const float *magnitudeDb, const float *phaseDeg, float *re, float *im, std::size_t n);
+void polar_to_rect_scalar(const float *magnitudeDb, const float *phaseDeg, float *re, float *im, std::size_t n);
+
+// Convert real and imaginary part to magnitude in dB and phase in degrees (-180..180)
+void rect_to_polar(const float *re, const float *im, float *magnitudeDb, float *phaseDeg, std::size_t n);
+void rect_to_polar_scalar(const float *re, const float *im, float *magnitudeDb, float *phaseDeg, std::size_t n);
+
+// Trace math: re + j im = a / b, a - b and a * b
+void complex_divide(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n);
+void complex_subtract(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n);
+void complex_multiply(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n);
+void complex_divide_scalar(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n);
+void complex_subtract_scalar(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n);
+void complex_multiply_scalar(const float *aRe, const float *aIm, const float *bRe, const float *bIm, float *re, float *im, std::size_t n);
+
+// Remove the one-port error model from the measured reflection coefficient:
+// G = (Gm - e00) / (e10e01 + e11 (Gm - e00))
+void one_port_correct(const float *measuredRe, const float *measuredIm, const error_terms_t &terms,
+                      float *re, float *im, std::size_t n);
+void one_port_correct_scalar(const float *measuredRe, const float *measuredIm, const error_terms_t &terms,
+                             float *re, float *im, std::size_t n);
+
+// Z = z0 (1 + G) / (1 - G)
+void reflection_to_impedance(const float *gammaRe, const float *gammaIm, float z0, float *re, float *im, std::size_t n);
+void reflection_to_impedance_scalar(const float *gammaRe, const float *gammaIm, float z0, float *re, float *im, std::size_t n);
+
+// Fill all outputs from the complex impedance re + j im at the given frequencies in Hz.
+// All outputs are finite for finite input, also for X = 0, R = 0 and Z = 0.
+void derive(const float *frequency, const float *re, const float *im, std::size_t n, model_t model, const outputs_t &out);
+void derive_scalar(const float *frequency, const float *re, const float *im, std::size_t n, model_t model, const outputs_t &out);
+
+// True if the CPU supports AVX2 and FMA, the AVX2 paths are used then
+bool has_avx2();
+
+} // namespace zkernels
+
+#endif // IMPEDANCEKERNELS_H
@@ -0,0 +1,208 @@
+#include "impedanceviews.h"
+#include <QtMath>
+#include <limits>
+
+// 10^(dB/20) = exp(dB * ln(10)/20), exp() is considerably cheaper than pow()
+static constexpr float DB_TO_LN = M_LN10 / 20.0;
+
+ImpedanceViews::ImpedanceViews()
+{
+    valid = false;
+    model = zkernels::MODEL_SERIES;
+    derivedSequence = 0;
+    derivedValid = false;
+    for (cache_t &c : cache) {
+        c.sequence = 0;
+        c.valid = false;
+        c.trace.min = 0;
+        c.trace.max = 0;
+    }
+}
+
+void ImpedanceViews::set_data(const HP8751A::instrument_data_t &data)
+{
+    this->data = data;
+    valid = true;
+}
+
+void ImpedanceViews::invalidate()
+{
+    derivedValid = false;
+    for (cache_t &c : cache) {
+        c.valid = false;
+    }
+}
+
+void ImpedanceViews::set_model(zkernels::model_t model)
+{
+    if (model == this->model) {
+        return;
+    }
+    this->model = model;
+    invalidate();
+}
+
+const ImpedanceViews::trace_t &ImpedanceViews::view(view_t view)
+{
+    cache_t &c = cache[view];
+    if (valid && (!c.valid || c.sequence != data.sequence)) {
+        compute(view, c.trace);
+        c.sequence = data.sequence;
+        c.valid = true;
+    }
+    return c.trace;
+}
+
+const QVector<float> &ImpedanceViews::real()
+{
+    if (valid) {
+        update_derived(point_count());
+    }
+    return re;
+}
+
+const QVector<float> &ImpedanceViews::imag()
+{
+    if (valid) {
+        update_derived(point_count());
+    }
+    return im;
+}
+
+QString ImpedanceViews::unit(view_t view)
+{
+    switch (view) {
+    case VIEW_MAGNITUDE:
+        return "dB";
+    case VIEW_IMPEDANCE:
+    case VIEW_RESISTANCE:
+    case VIEW_REACTANCE:
+    case VIEW_ESR:
+        return "Ω";
+    case VIEW_INDUCTANCE:
+        return "H";
+    case VIEW_CAPACITANCE:
+        return "F";
+    case VIEW_PHASE:
+        return "°";
+    case VIEW_CONDUCTANCE:
+    case VIEW_SUSCEPTANCE:
+        return "S";
+    default:
+        return "";
+    }
+}
+
+int ImpedanceViews::point_count() const
+{
+    return qMin(data.stimulus.size(), qMin(data.channel1.size(), data.channel2.size()));
+}
+
+void ImpedanceViews::update_derived(int points)
+{
+    if (derivedValid && derivedSequence == data.sequence) {
+        return;
+    }
+
+    // Buffers keep their allocation as long as the number of points does not change
+    re.resize(points);
+    im.resize(points);
+    for (QVector<float> &d : derived) {
+        d.resize(points);
+    }
+
+    zkernels::polar_to_rect(data.channel1.constData(), data.channel2.constData(), re.data(), im.data(), points);
+
+    zkernels::outputs_t out;
+    out.resistance = derived[DERIVED_RESISTANCE].data();
+    out.reactance = derived[DERIVED_REACTANCE].data();
+    out.inductance = derived[DERIVED_INDUCTANCE].data();
+    out.capacitance = derived[DERIVED_CAPACITANCE].data();
+    out.quality = derived[DERIVED_QUALITY].data();
+    out.dissipation = derived[DERIVED_DISSIPATION].data();
+    out.esr = derived[DERIVED_ESR].data();
+    out.conductance = derived[DERIVED_CONDUCTANCE].data();
+    out.susceptance = derived[DERIVED_SUSCEPTANCE].data();
+    zkernels::derive(data.stimulus.constData(), re.constData(), im.constData(), points, model, out);
+
+    derivedSequence = data.sequence;
+    derivedValid = true;
+}
+
+void ImpedanceViews::compute(view_t view, trace_t &trace)
+{
+    const int points = point_count();
+    const float *frequency = data.stimulus.constData();
+
+    // Select the source array. Magnitude and phase come straight from the instrument,
+    // everything else goes through the complex kernel once per sweep.
+    const float *source = nullptr;
+    bool linear = false;
+    switch (view) {
+    case VIEW_MAGNITUDE:
+        source = data.channel1.constData();
+        break;
+    case VIEW_IMPEDANCE:
+        source = data.channel1.constData();
+        linear = true;
+        break;
+    case VIEW_PHASE:
+        source = data.channel2.constData();
+        break;
+    default:
+        update_derived(points);
+        break;
+    }
+
+    switch (view) {
+    case VIEW_INDUCTANCE:
+        source = derived[DERIVED_INDUCTANCE].constData();
+        break;
+    case VIEW_CAPACITANCE:
+        source = derived[DERIVED_CAPACITANCE].constData();
+        break;
+    case VIEW_RESISTANCE:
+        source = derived[DERIVED_RESISTANCE].constData();
+        break;
+    case VIEW_REACTANCE:
+        source = derived[DERIVED_REACTANCE].constData();
+        break;
+    case VIEW_QUALITY:
+        source = derived[DERIVED_QUALITY].constData();
+        break;
+    case VIEW_DISSIPATION:
+        source = derived[DERIVED_DISSIPATION].constData();
+        break;
+    case VIEW_ESR:
+        source = derived[DERIVED_ESR].constData();
+        break;
+    case VIEW_CONDUCTANCE:
+        source = derived[DERIVED_CONDUCTANCE].constData();
+        break;
+    case VIEW_SUSCEPTANCE:
+        source = derived[DERIVED_SUSCEPTANCE].constData();
+        break;
+    default:
+        break;
+    }
+
+    // Reuse the buffer of the previous sweep, it only reallocates if the number of points changes
+    if (trace.points.size() != points) {
+        trace.points.resize(points);
+    }
+    QPointF *out = trace.points.data();
+
+    float min = std::numeric_limits<float>::max();
+    float max = std::numeric_limits<float>::lowest();
+
+    for (int i = 0; i < points; i++) {
+        float y = linear ? std::exp(source[i] * DB_TO_LN) : source[i];
+        out[i] = QPointF(frequency[i], y);
+        // Min/max for autoscaling come out of the same pass
+        if (y < min) min = y;
+        if (y > max) max = y;
+    }
+
+    trace.min = points ? min : 0;
+    trace.max = points ? max : 0;
+}
@@ -0,0 +1,99 @@
+#ifndef IMPEDANCEVIEWS_H
+#define IMPEDANCEVIEWS_H
+
+#include <QVector>
+#include <QPointF>
+#include <QString>
+#include "hp8751a.h"
+#include "impedancekernels.h"
+
+// Derived quantities of an impedance sweep. A view is only computed when it is requested
+// and is cached until a sweep with a different sequence number arrives.
+class ImpedanceViews
+{
+public:
+    // Same order as the entries of the view_top/view_bot combo boxes
+    enum view_t {
+        VIEW_MAGNITUDE,
+        VIEW_IMPEDANCE,
+        VIEW_INDUCTANCE,
+        VIEW_CAPACITANCE,
+        VIEW_RESISTANCE,
+        VIEW_PHASE,
+        VIEW_REACTANCE,
+        VIEW_QUALITY,
+        VIEW_DISSIPATION,
+        VIEW_ESR,
+        VIEW_CONDUCTANCE,
+        VIEW_SUSCEPTANCE,
+        VIEW_COUNT
+    };
+
+    struct trace_t {
+        QVector<QPointF> points;
+        float min;
+        float max;
+    };
+
+    ImpedanceViews();
+
+    // Take a new snapshot. The channel data is implicitly shared, nothing is computed here.
+    void set_data(const HP8751A::instrument_data_t &data);
+
+    bool has_data() const { return valid; }
+
+    // Drop the cached views, for a snapshot that changed without a new sequence number
+    void invalidate();
+
+    // Series or parallel equivalent circuit for R, L and C
+    void set_model(zkernels::model_t model);
+
+    // Compute the view if it is not cached for the current snapshot yet
+    const trace_t &view(view_t view);
+
+    // Real and imaginary part of the current snapshot, computed once per sweep
+    const QVector<float> &real();
+    const QVector<float> &imag();
+
+    const QVector<float> &frequency() const { return data.stimulus; }
+
+    // Unit of a view for axis and spin box labels
+    static QString unit(view_t view);
+
+private:
+    HP8751A::instrument_data_t data;
+    bool valid;
+    zkernels::model_t model;
+
+    struct cache_t {
+        trace_t trace;
+        quint32 sequence;
+        bool valid;
+    };
+    cache_t cache[VIEW_COUNT];
+
+    // Complex impedance and all derived quantities of the current snapshot (structure of arrays)
+    enum derived_t {
+        DERIVED_RESISTANCE,
+        DERIVED_REACTANCE,
+        DERIVED_INDUCTANCE,
+        DERIVED_CAPACITANCE,
+        DERIVED_QUALITY,
+        DERIVED_DISSIPATION,
+        DERIVED_ESR,
+        DERIVED_CONDUCTANCE,
+        DERIVED_SUSCEPTANCE,
+        DERIVED_COUNT
+    };
+    QVector<float> re;
+    QVector<float> im;
+    QVector<float> derived[DERIVED_COUNT];
+    quint32 derivedSequence;
+    bool derivedValid;
+
+    int point_count() const;
+    void update_derived(int points);
+    void compute(view_t view, trace_t &trace);
+};
+
+#endif // IMPEDANCEVIEWS_H
@@ -0,0 +1,419 @@
+#include "limitengine.h"
+#include "loopgainmetrics.h"
+#include "impedancekernels.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef ZKERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+static const float INF = std::numeric_limits<float>::infinity();
+
+float LimitEngine::phase_center(float lower, float upper)
+{
+    if (std::isfinite(lower) && std::isfinite(upper)) {
+        return (lower + upper) / 2;
+    }
+    if (std::isfinite(lower)) {
+        return lower;
+    }
+    if (std::isfinite(upper)) {
+        return upper;
+    }
+    return NAN;
+}
+
+float LimitEngine::wrap_phase(float phase, float center)
+{
+    // Rounded through int, std::round() is a library call
+    float turns = (center - phase) / 360.0f;
+    return phase + 360.0f * static_cast<int>(turns + (turns < 0 ? -0.5f : 0.5f));
+}
+
+LimitEngine::LimitEngine()
+{
+    clear();
+    reset_statistics();
+}
+
+void LimitEngine::clear()
+{
+    mask = mask_t();
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        mask.tolerance[t] = 0;
+    }
+    mask.phaseMarginLimit = false;
+    mask.phaseMarginMin = 0;
+    mask.gainMarginLimit = false;
+    mask.gainMarginMin = 0;
+    hasMask = false;
+    gridFrequency.clear();
+    gridPhaseBounded = false;
+}
+
+void LimitEngine::set_mask(const mask_t &mask)
+{
+    this->mask = mask;
+    hasMask = true;
+    gridFrequency.clear();
+    reset_statistics();
+}
+
+void LimitEngine::reset_statistics()
+{
+    stats = statistics_t();
+    stats.tested = 0;
+    stats.passed = 0;
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        stats.traceFails[t] = 0;
+    }
+    stats.marginFails = 0;
+    stats.worstMean = 0;
+    stats.worstMax = -INF;
+}
+
+bool LimitEngine::parse_bounds(const QJsonValue &value, QVector<vertex_t> &bounds)
+{
+    bounds.clear();
+    if (value.isUndefined()) {
+        return true;
+    }
+    for (const QJsonValue &v : value.toArray()) {
+        QJsonArray pair = v.toArray();
+        if (pair.size() != 2 || pair.at(0).toDouble() <= 0) {
+            return false;
+        }
+        bounds.append({pair.at(0).toDouble(), pair.at(1).toDouble()});
+    }
+    std::sort(bounds.begin(), bounds.end(), [](const vertex_t &a, const vertex_t &b) {
+        return a.frequency < b.frequency;
+    });
+    return true;
+}
+
+bool LimitEngine::load_golden(const QString &fileName, mask_t &mask)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream in(&file);
+    mask.goldenFrequency.clear();
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        mask.golden[t].clear();
+    }
+    // Frequency, magnitude and phase are the first three columns of the export, the header is skipped
+    while (!in.atEnd()) {
+        QStringList columns = in.readLine().split(",");
+        bool ok[3] = {false, false, false};
+        if (columns.size() < 3) {
+            continue;
+        }
+        float f = columns.at(0).toFloat(&ok[0]);
+        float c1 = columns.at(1).toFloat(&ok[1]);
+        float c2 = columns.at(2).toFloat(&ok[2]);
+        if (ok[0] && ok[1] && ok[2]) {
+            mask.goldenFrequency.append(f);
+            mask.golden[TRACE_CHANNEL1].append(c1);
+            mask.golden[TRACE_CHANNEL2].append(c2);
+        }
+    }
+    // Unwrapped, so the interpolation between two points never runs across a ±180° jump
+    QVector<float> &phase = mask.golden[TRACE_CHANNEL2];
+    for (int i = 1; i < phase.size(); i++) {
+        phase[i] = wrap_phase(phase.at(i), phase.at(i - 1));
+    }
+    return mask.goldenFrequency.size() >= 2;
+}
+
+bool LimitEngine::load(const QString &fileName, QString &errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        errorString = QString("Could not open mask file %1").arg(fileName);
+        return false;
+    }
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (doc.isNull()) {
+        errorString = QString("Mask file: %1").arg(parseError.errorString());
+        return false;
+    }
+    QJsonObject root = doc.object();
+
+    LimitEngine empty;
+    mask_t m = empty.mask;
+    const char *names[TRACE_COUNT] = {"magnitude", "phase"};
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        QJsonObject obj = root.value(names[t]).toObject();
+        if (!parse_bounds(obj.value("upper"), m.upper[t]) || !parse_bounds(obj.value("lower"), m.lower[t])) {
+            errorString = QString("Mask file: %1 bounds must be [frequency, value] pairs").arg(names[t]);
+            return false;
+        }
+    }
+
+    if (root.contains("golden")) {
+        QJsonObject golden = root.value("golden").toObject();
+        QString goldenFile = golden.value("file").toString();
+        if (QFileInfo(goldenFile).isRelative()) {
+            goldenFile = QFileInfo(fileName).dir().filePath(goldenFile);
+        }
+        if (!load_golden(goldenFile, m)) {
+            errorString = QString("Mask file: could not read golden trace %1").arg(goldenFile);
+            return false;
+        }
+        for (int t = 0; t < TRACE_COUNT; t++) {
+            m.tolerance[t] = golden.value(names[t]).toDouble(0);
+        }
+    }
+
+    m.phaseMarginLimit = root.contains("phase_margin");
+    m.phaseMarginMin = root.value("phase_margin").toDouble();
+    m.gainMarginLimit = root.contains("gain_margin");
+    m.gainMarginMin = root.value("gain_margin").toDouble();
+
+    set_mask(m);
+    return true;
+}
+
+void LimitEngine::interpolate(const QVector<vertex_t> &vertices, const QVector<float> &frequency, float outside, QVector<float> &out)
+{
+    const int points = frequency.size();
+    out.fill(outside, points);
+    if (vertices.isEmpty()) {
+        return;
+    }
+    // Both are ascending, walk through them together
+    int k = 0;
+    for (int i = 0; i < points; i++) {
+        const double f = frequency.at(i);
+        if (f < vertices.first().frequency || f > vertices.last().frequency) {
+            continue;
+        }
+        while (k < vertices.size() - 2 && f > vertices.at(k + 1).frequency) {
+            k++;
+        }
+        if (vertices.size() == 1) {
+            out[i] = vertices.first().value;
+            continue;
+        }
+        const vertex_t &a = vertices.at(k);
+        const vertex_t &b = vertices.at(k + 1);
+        double x = b.frequency > a.frequency ? std::log(f / a.frequency) / std::log(b.frequency / a.frequency) : 0;
+        out[i] = a.value + x * (b.value - a.value);
+    }
+}
+
+void LimitEngine::update_grid(const QVector<float> &frequency)
+{
+    gridFrequency = frequency;
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        interpolate(mask.lower[t], frequency, -INF, gridLower[t]);
+        interpolate(mask.upper[t], frequency, INF, gridUpper[t]);
+        if (mask.goldenFrequency.isEmpty() || mask.tolerance[t] <= 0) {
+            continue;
+        }
+
+        // The tolerance band around the golden trace narrows the mask
+        QVector<vertex_t> golden(mask.goldenFrequency.size());
+        for (int i = 0; i < golden.size(); i++) {
+            golden[i] = {mask.goldenFrequency.at(i), mask.golden[t].at(i)};
+        }
+        QVector<float> reference;
+        interpolate(golden, frequency, NAN, reference);
+        for (int i = 0; i < frequency.size(); i++) {
+            float ref = reference.at(i);
+            if (std::isnan(ref)) {
+                continue;
+            }
+            if (t == TRACE_CHANNEL2) {
+                // Golden phase on the branch of the piecewise bounds
+                float center = phase_center(gridLower[t].at(i), gridUpper[t].at(i));
+                if (!std::isnan(center)) {
+                    ref = wrap_phase(ref, center);
+                }
+            }
+            gridLower[t][i] = std::max<float>(gridLower[t].at(i), ref - mask.tolerance[t]);
+            gridUpper[t][i] = std::min<float>(gridUpper[t].at(i), ref + mask.tolerance[t]);
+        }
+    }
+
+    const int points = frequency.size();
+    gridPhaseCenter.resize(points);
+    gridPhaseBounded = false;
+    for (int i = 0; i < points; i++) {
+        float center = phase_center(gridLower[TRACE_CHANNEL2].at(i), gridUpper[TRACE_CHANNEL2].at(i));
+        // Without bounds the branch does not matter
+        gridPhaseCenter[i] = std::isnan(center) ? 0 : center;
+        gridPhaseBounded |= !std::isnan(center);
+    }
+}
+
+int LimitEngine::check_scalar(const float *y, const float *lower, const float *upper, std::size_t n, float &worst, int &worstIndex)
+{
+    int first = -1;
+    worst = -INF;
+    worstIndex = -1;
+    for (std::size_t i = 0; i < n; i++) {
+        float deviation = std::max(lower[i] - y[i], y[i] - upper[i]);
+        if (deviation > 0 && first < 0) {
+            first = i;
+        }
+        if (deviation > worst) {
+            worst = deviation;
+            worstIndex = i;
+        }
+    }
+    return first;
+}
+
+#ifdef ZKERNELS_AVX2
+ZKERNELS_TARGET_AVX2
+static int check_avx2(const float *y, const float *lower, const float *upper, std::size_t n, float &worst, int &worstIndex)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 worstVec = _mm256_set1_ps(-INF);
+    __m256i worstIdx = _mm256_set1_epi32(-1);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+    int first = -1;
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(y + i);
+        __m256 deviation = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(lower + i), v),
+                                         _mm256_sub_ps(v, _mm256_loadu_ps(upper + i)));
+        if (first < 0) {
+            int fails = _mm256_movemask_ps(_mm256_cmp_ps(deviation, zero, _CMP_GT_OQ));
+            if (fails) {
+                first = i + __builtin_ctz(fails);
+            }
+        }
+        // Lanes keep their own maximum and where it was, first occurrence wins
+        __m256 greater = _mm256_cmp_ps(deviation, worstVec, _CMP_GT_OQ);
+        worstVec = _mm256_blendv_ps(worstVec, deviation, greater);
+        worstIdx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(worstIdx), _mm256_castsi256_ps(idx), greater));
+        idx = _mm256_add_epi32(idx, step);
+    }
+
+    float lanes[8];
+    int lanesIdx[8];
+    _mm256_storeu_ps(lanes, worstVec);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanesIdx), worstIdx);
+    worst = -INF;
+    worstIndex = -1;
+    for (int k = 0; k < 8; k++) {
+        if (lanes[k] > worst || (lanes[k] == worst && lanesIdx[k] < worstIndex)) {
+            worst = lanes[k];
+            worstIndex = lanesIdx[k];
+        }
+    }
+
+    float tailWorst;
+    int tailIndex;
+    int tailFirst = LimitEngine::check_scalar(y + i, lower + i, upper + i, n - i, tailWorst, tailIndex);
+    if (first < 0 && tailFirst >= 0) {
+        first = i + tailFirst;
+    }
+    if (tailWorst > worst) {
+        worst = tailWorst;
+        worstIndex = i + tailIndex;
+    }
+    return first;
+}
+#endif
+
+int LimitEngine::check(const float *y, const float *lower, const float *upper, std::size_t n, float &worst, int &worstIndex)
+{
+#ifdef ZKERNELS_AVX2
+    if (zkernels::has_avx2()) {
+        return check_avx2(y, lower, upper, n, worst, worstIndex);
+    }
+#endif
+    return check_scalar(y, lower, upper, n, worst, worstIndex);
+}
+
+LimitEngine::verdict_t LimitEngine::evaluate(const HP8751A::instrument_data_t &data)
+{
+    verdict_t verdict;
+    verdict.pass = true;
+    verdict.firstIndex = -1;
+    verdict.firstTrace = TRACE_CHANNEL1;
+    verdict.firstFrequency = 0;
+    verdict.worstDeviation = -INF;
+    verdict.worstTrace = TRACE_CHANNEL1;
+    verdict.worstFrequency = 0;
+    verdict.marginFail = false;
+
+    const int points = data.stimulus.size();
+    if (!hasMask || points == 0 || data.channel1.size() != points || data.channel2.size() != points) {
+        return verdict;
+    }
+    if (data.stimulus != gridFrequency) {
+        update_grid(data.stimulus);
+    }
+
+    const QVector<float> *traces[TRACE_COUNT] = {&data.channel1, &data.channel2};
+    if (gridPhaseBounded) {
+        wrappedPhase.resize(points);
+        for (int i = 0; i < points; i++) {
+            wrappedPhase[i] = wrap_phase(data.channel2.at(i), gridPhaseCenter.at(i));
+        }
+        traces[TRACE_CHANNEL2] = &wrappedPhase;
+    }
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        float worst;
+        int worstIndex;
+        int first = check(traces[t]->constData(), gridLower[t].constData(), gridUpper[t].constData(), points, worst, worstIndex);
+        if (first >= 0) {
+            stats.traceFails[t]++;
+            // The lowest frequency decides which trace failed first
+            if (verdict.firstIndex < 0 || first < verdict.firstIndex) {
+                verdict.firstIndex = first;
+                verdict.firstTrace = static_cast<trace_t>(t);
+                verdict.firstFrequency = data.stimulus.at(first);
+            }
+        }
+        if (worstIndex >= 0 && worst > verdict.worstDeviation) {
+            verdict.worstDeviation = worst;
+            verdict.worstTrace = static_cast<trace_t>(t);
+            verdict.worstFrequency = data.stimulus.at(worstIndex);
+        }
+    }
+
+    if (mask.phaseMarginLimit || mask.gainMarginLimit) {
+        LoopgainMetrics::metrics_t m = LoopgainMetrics::compute(data.stimulus.constData(), data.channel1.constData(),
+                                                                data.channel2.constData(), points);
+        // Without a 0 dB crossing the phase margin can't be verified, without a -180° crossing the gain margin is infinite
+        if (mask.phaseMarginLimit && (!m.crossoverValid || m.phaseMargin < mask.phaseMarginMin)) {
+            verdict.marginFail = true;
+        }
+        if (mask.gainMarginLimit && m.phaseCrossoverValid && m.gainMargin < mask.gainMarginMin) {
+            verdict.marginFail = true;
+        }
+    }
+
+    verdict.pass = verdict.firstIndex < 0 && !verdict.marginFail;
+
+    stats.tested++;
+    if (verdict.pass) {
+        stats.passed++;
+    }
+    if (verdict.marginFail) {
+        stats.marginFails++;
+    }
+    if (std::isfinite(verdict.worstDeviation)) {
+        stats.worstMean += (verdict.worstDeviation - stats.worstMean) / stats.tested;
+        stats.worstMax = std::max<double>(stats.worstMax, verdict.worstDeviation);
+    }
+    return verdict;
+}
@@ -0,0 +1,119 @@
+#ifndef LIMITENGINE_H
+#define LIMITENGINE_H
+
+#include <QString>
+#include <QVector>
+#include <QJsonValue>
+#include "hp8751a.h"
+
+/* Pass/fail check of sweeps against a limit mask.
+ * The mask has piecewise upper and lower bounds per trace, linear over log frequency, and optionally a golden
+ * trace with a tolerance band. Both are merged into one lower and one upper bound per point of the sweep grid,
+ * which is only done again when the grid changes. A sweep is then checked in one pass per trace, with AVX2
+ * if the CPU supports it. Loop gain masks can also require a minimum phase and gain margin.
+ *
+ * Mask file (JSON), frequencies in Hz, magnitude in dB, phase in degrees:
+ * {
+ *     "magnitude": {"upper": [[10, 40], [100000, -10]], "lower": [[10, 20], [1000, 20]]},
+ *     "phase": {"lower": [[100, -150], [1000000, -150]]},
+ *     "golden": {"file": "golden.csv", "magnitude": 1.0, "phase": 5.0},
+ *     "phase_margin": 45,
+ *     "gain_margin": 6
+ * }
+ * Every entry is optional. A bound only applies between its first and last frequency. The golden trace is a
+ * CSV export of the GUI, a relative path is taken relative to the mask file.
+ * Phase is compared on the 360° branch next to its bounds (within ±180° of the middle of the band, or of the
+ * bound if there is only one), so wrapped and unwrapped sweeps, masks and golden traces can be mixed.
+ */
+class LimitEngine
+{
+public:
+    LimitEngine();
+
+    enum trace_t {
+        TRACE_CHANNEL1, // Magnitude or |Z|
+        TRACE_CHANNEL2, // Phase
+        TRACE_COUNT
+    };
+
+    struct vertex_t {
+        double frequency;
+        double value;
+    };
+
+    struct mask_t {
+        QVector<vertex_t> upper[TRACE_COUNT];
+        QVector<vertex_t> lower[TRACE_COUNT];
+        QVector<float> goldenFrequency; // Empty if there is no golden trace
+        QVector<float> golden[TRACE_COUNT];
+        double tolerance[TRACE_COUNT]; // Allowed deviation from the golden trace, 0 = not checked
+        bool phaseMarginLimit;
+        double phaseMarginMin;
+        bool gainMarginLimit;
+        double gainMarginMin;
+    };
+
+    struct verdict_t {
+        bool pass;
+        int firstIndex; // First failing point, -1 if all points pass
+        trace_t firstTrace;
+        double firstFrequency;
+        double worstDeviation; // Largest distance outside the bounds, negative is the smallest margin to them
+        trace_t worstTrace;
+        double worstFrequency;
+        bool marginFail; // Phase or gain margin below the limit or not measurable
+    };
+
+    struct statistics_t {
+        quint32 tested;
+        quint32 passed;
+        quint32 traceFails[TRACE_COUNT];
+        quint32 marginFails;
+        double worstMean; // Mean of the worst deviation per sweep
+        double worstMax;
+    };
+
+    bool load(const QString &fileName, QString &errorString);
+    void set_mask(const mask_t &mask);
+    void clear();
+    bool active() const { return hasMask; }
+
+    // Check a sweep with magnitude (or |Z|) and phase and add the verdict to the statistics
+    verdict_t evaluate(const HP8751A::instrument_data_t &data);
+
+    // Bounds of the last evaluated grid, +-infinity where there is none
+    const QVector<float> &lower(trace_t trace) const { return gridLower[trace]; }
+    const QVector<float> &upper(trace_t trace) const { return gridUpper[trace]; }
+
+    const statistics_t &statistics() const { return stats; }
+    void reset_statistics();
+
+    // One pass over n points: returns the first index outside [lower, upper] or -1.
+    // worst is the largest max(lower - y, y - upper) and worstIndex its position.
+    static int check(const float *y, const float *lower, const float *upper, std::size_t n, float &worst, int &worstIndex);
+    static int check_scalar(const float *y, const float *lower, const float *upper, std::size_t n, float &worst, int &worstIndex);
+
+    // Middle of the phase band, or its only bound
+    static float phase_center(float lower, float upper);
+    // Same phase on the 360° branch within ±180° of center
+    static float wrap_phase(float phase, float center);
+
+private:
+    mask_t mask;
+    bool hasMask;
+    statistics_t stats;
+
+    QVector<float> gridFrequency;
+    QVector<float> gridLower[TRACE_COUNT];
+    QVector<float> gridUpper[TRACE_COUNT];
+    QVector<float> gridPhaseCenter; // The phase is wrapped to within ±180° of it
+    bool gridPhaseBounded; // Any phase bound on the grid
+    QVector<float> wrappedPhase; // Keeps its allocation between sweeps
+    void update_grid(const QVector<float> &frequency);
+
+    static void interpolate(const QVector<vertex_t> &vertices, const QVector<float> &frequency, float outside, QVector<float> &out);
+    static bool parse_bounds(const QJsonValue &value, QVector<vertex_t> &bounds);
+    static bool load_golden(const QString &fileName, mask_t &mask);
+};
+
+#endif // LIMITENGINE_H
@@ -1,5 +1,14 @@
 #include "loopgain.h"
 #include "ui_loopgain.h"
+#include "tracestore.h"
+#include "segmenteditor.h"
+#include "plannerdialog.h"
+#include "refinement.h"
+#include "cwmonitordialog.h"
+#include "fixturedialog.h"
+#include <QSettings>
+
+static const double REFINE_WIDTH = 0.2; // Decades around each region of interest
 
 Loopgain::Loopgain(HP8751A *hp, QWidget *parent) :
     QMainWindow(parent),
@@ -16,12 +25,46 @@ Loopgain::Loopgain(HP8751A *hp, QWidget *parent) :
     QObject::connect(hp, &HP8751A::response_timeout, this, &Loopgain::response_timeout);
     QObject::connect(hp, &HP8751A::instrument_initialized, this, &Loopgain::instrument_initialized);
     QObject::connect(hp, &HP8751A::set_parameters_finished, this, &Loopgain::set_parameters_finished);
+    QObject::connect(hp, &HP8751A::claim_changed, this, &Loopgain::claim_changed);
+
+    hostAveraging = false;
+    envelope = false;
+    cwMonitor = false;
+    limitStatus = new QLabel(this);
+    ui->statusbar->addPermanentWidget(limitStatus);
+    memoryStatus = new QLabel(this);
+    ui->statusbar->addPermanentWidget(memoryStatus);
+    update_memory_list(QString());
+    deembedStatus = new QLabel(this);
+    ui->statusbar->addPermanentWidget(deembedStatus);
+    read_deembedding_settings();
+    zoomStart = 0;
+    zoomStop = 0;
+    zoom = new ZoomSweep(hp, this);
+    QObject::connect(zoom, &ZoomSweep::progress, this, [=] (int done, int total) {
+        ui->statusbar->showMessage(QString("Zoom sweep %1 of %2...").arg(done).arg(total));
+        plot_data();
+    });
+    QObject::connect(zoom, &ZoomSweep::finished, this, &Loopgain::ui_stop_sweep);
+    QObject::connect(ui->btnHold, &QPushButton::clicked, zoom, &ZoomSweep::cancel);
+
+    plotTimer = new QTimer(this);
+    plotTimer->setSingleShot(true);
+    QObject::connect(plotTimer, &QTimer::timeout, this, [=] {
+        plot_data();
+        // Counted from the end of the plot, so a slow chart leaves time for the readout
+        plotElapsed.start();
+    });
 
+    initializing = false;
+    initPending = false;
+    remoteControl = false;
     init();
 }
 
 Loopgain::~Loopgain()
 {
+    hp->release(this);
     delete ui;
 }
 
@@ -35,9 +78,39 @@ void Loopgain::closeEvent(QCloseEvent *event)
 void Loopgain::init()
 {
     disable_ui();
-    ui->statusbar->showMessage("Initializing instrument...");
-    hp->init_function(HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_PHAS);
     init_plot();
+    init_instrument();
+}
+
+void Loopgain::init_instrument()
+{
+    // A remote client may be using the instrument, the initialization waits until it is released
+    initPending = !hp->claim(this);
+    if (initPending) {
+        ui->statusbar->showMessage("Waiting for remote client...");
+        return;
+    }
+    initializing = true;
+    ui->statusbar->showMessage("Initializing instrument...");
+    hp->init_profile(HP8751A::PROFILE_LOOPGAIN, HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_LOGM, HP8751A::PORT_AR, HP8751A::CONV_OFF, HP8751A::FMT_PHAS);
+}
+
+void Loopgain::claim_changed()
+{
+    const bool remote = hp->claimed_by_other(this);
+    if (remote == remoteControl) {
+        return;
+    }
+    remoteControl = remote;
+    if (remote) {
+        ui->centralwidget->setEnabled(false);
+        ui->statusbar->showMessage("Instrument in use by remote client...");
+    } else if (initPending) {
+        init_instrument();
+    } else {
+        enable_ui();
+        ui->statusbar->showMessage("Ready.");
+    }
 }
 
 void Loopgain::init_statemachine_sweep()
@@ -46,6 +119,7 @@ void Loopgain::init_statemachine_sweep()
      *  Hold button is disabled by default. It is only enabled when the instrument is currently sweeping (HOLD? returns 0)
      *  When continous sweep is selected, the single button is disabled. Hold button is enabled. Cont. button is checked.
      *      When cont. button is clicked again, it will finish the current sweep and will hold afterwards.
+     *      If the settings allow the free run, the driver repeats the sweeps itself and the cont. button holds at once.
      *      Clicking the hold button during a sweep cancels the current sweep.
      *  When single sweep is selected, cont. button is disabled while the instrument is sweeping. Hold button is enabled.
      *  Enable export button only when data has been received and instrument is in hold mode.
@@ -59,6 +133,7 @@ void Loopgain::init_statemachine_sweep()
     QState *sStartSweep = new QState();
     QState *sWaitForData = new QState();
     QState *sPlotData = new QState();
+    QState *sStream = new QState();
     QState *sHold = new QState();
 
     QObject::connect(sIdle, &QState::entered, this, &Loopgain::ui_stop_sweep);
@@ -67,15 +142,23 @@ void Loopgain::init_statemachine_sweep()
 
     QObject::connect(sUpdateParameters, &QState::entered, this, &Loopgain::ui_start_sweep);
     QObject::connect(sUpdateParameters, &QState::entered, this, &Loopgain::update_parameters);
+    QObject::connect(sUpdateParameters, &QState::entered, this, &Loopgain::clear_metrics);
+    QObject::connect(sUpdateParameters, &QState::entered, this, &Loopgain::clear_averaging);
+    QObject::connect(sUpdateParameters, &QState::entered, this, &Loopgain::clear_envelope);
     sUpdateParameters->addTransition(hp, &HP8751A::set_parameters_finished, sStartSweep);
     sUpdateParameters->addTransition(ui->btnHold, &QPushButton::clicked, sHold);
     sUpdateParameters->addTransition(hp, &HP8751A::response_timeout, sIdle);
 
-    QObject::connect(sStartSweep, &QState::entered, hp, &HP8751A::request_sweep);
     QObject::connect(sStartSweep, &QState::entered, this, [=] {
-        ui->statusbar->showMessage("Sweeping...");
+        if (hostAveraging && averager.count() >= SweepAverager::MIN_SWEEPS) {
+            ui->statusbar->showMessage(QString("Sweeping... %1 averaged, ±%2 dB").arg(averager.count()).arg(averager.confidence(), 0, 'f', 3));
+        } else {
+            ui->statusbar->showMessage("Sweeping...");
+        }
     });
+    QObject::connect(sStartSweep, &QState::entered, this, &Loopgain::start_sweep);
     sStartSweep->addTransition(hp, &HP8751A::retrieving_data, sWaitForData);
+    sStartSweep->addTransition(this, &Loopgain::streamStarted, sStream);
     sStartSweep->addTransition(ui->btnHold, &QPushButton::clicked, sHold);
     sStartSweep->addTransition(hp, &HP8751A::response_timeout, sIdle);
 
@@ -88,7 +171,7 @@ void Loopgain::init_statemachine_sweep()
 
     QObject::connect(sPlotData, &QState::entered, this, &Loopgain::plot_data);
     QObject::connect(sPlotData, &QState::entered, this, [=] {
-        if (ui->btnContinuous->isChecked()) {
+        if (ui->btnContinuous->isChecked() || averaging_pending()) {
             emit continueSweep(QPrivateSignal());
         } else {
             emit goIdle(QPrivateSignal());
@@ -97,6 +180,14 @@ void Loopgain::init_statemachine_sweep()
     sPlotData->addTransition(this, &Loopgain::goIdle, sIdle);
     sPlotData->addTransition(this, &Loopgain::continueSweep, sStartSweep);
 
+    // Clicking the cont. button again stops the free run at once, there is no sweep end to wait for
+    QObject::connect(sStream, &QState::entered, this, [=] {
+        ui->statusbar->showMessage("Free running...");
+    });
+    sStream->addTransition(ui->btnContinuous, &QPushButton::clicked, sHold);
+    sStream->addTransition(ui->btnHold, &QPushButton::clicked, sHold);
+    sStream->addTransition(hp, &HP8751A::response_timeout, sIdle);
+
     QObject::connect(sHold, &QState::entered, this, [=] {
         ui->statusbar->showMessage("Cancelling sweep...");
     });
@@ -108,6 +199,7 @@ void Loopgain::init_statemachine_sweep()
     smSweep->addState(sStartSweep);
     smSweep->addState(sWaitForData);
     smSweep->addState(sPlotData);
+    smSweep->addState(sStream);
     smSweep->addState(sHold);
     smSweep->setInitialState(sIdle);
     smSweep->start();
@@ -115,6 +207,10 @@ void Loopgain::init_statemachine_sweep()
 
 void Loopgain::start_sweep()
 {
+    if (ui->btnContinuous->isChecked() && hp->start_stream()) {
+        emit streamStarted(QPrivateSignal());
+        return;
+    }
     hp->request_sweep();
 }
 
@@ -167,8 +263,41 @@ void Loopgain::init_plot()
     chart->addAxis(axisYPhase, Qt::AlignRight);
     phase->attachAxis(axisYPhase);
 
-    chartView = new QChartView(chart);
+    magnitudeBand = add_band(magnitude, axisY);
+    phaseBand = add_band(phase, axisYPhase);
+    magnitudeRange = add_band(magnitude, axisY);
+    magnitudeSigma = add_band(magnitude, axisY);
+    phaseRange = add_band(phase, axisYPhase);
+    phaseSigma = add_band(phase, axisYPhase);
+    // Min/max lighter than +-sigma
+    for (QAreaSeries *range : {magnitudeRange, phaseRange}) {
+        QColor color = range->color();
+        color.setAlpha(30);
+        range->setColor(color);
+    }
+
+    QAbstractAxis *limitAxes[LimitEngine::TRACE_COUNT] = {axisY, axisYPhase};
+    QLineSeries *traces[LimitEngine::TRACE_COUNT] = {magnitude, phase};
+    for (int t = 0; t < LimitEngine::TRACE_COUNT; t++) {
+        for (int bound = 0; bound < 2; bound++) {
+            QLineSeries *line = new QLineSeries();
+            QPen pen(traces[t]->color());
+            pen.setStyle(Qt::DashLine);
+            line->setPen(pen);
+            chart->addSeries(line);
+            line->attachAxis(axisX);
+            line->attachAxis(limitAxes[t]);
+            for (QLegendMarker *marker : chart->legend()->markers(line)) {
+                marker->setVisible(false);
+            }
+            limitLines[t][bound] = line;
+        }
+    }
+
+    chartView = new ZoomChartView(chart);
     chartView->setRenderHint(QPainter::Antialiasing);
+    QObject::connect(chartView, &ZoomChartView::span_selected, this, &Loopgain::zoom_to);
+    QObject::connect(chartView, &ZoomChartView::full_span_requested, this, &Loopgain::full_span);
     layout = new QVBoxLayout(ui->chart);
     layout->addWidget(chartView);
 }
@@ -180,8 +309,11 @@ void Loopgain::plot_data()
     QList<QPointF> magnitudePoints;
     QList<QPointF> phasePoints;
 
-    HP8751A::instrument_data_t data;
-    hp->get_data(data);
+    if (lastData.stimulus.isEmpty()) {
+        return;
+    }
+    // The zoom sweeps are shown in place of the full span points they cover
+    HP8751A::instrument_data_t data = zoomStop > 0 ? zoom->merged(lastData) : lastData;
 
     for (int i = 0; i < data.stimulus.length(); i++) {
         magnitudePoints.push_back({data.stimulus.at(i), data.channel1.at(i)});
@@ -196,8 +328,18 @@ void Loopgain::plot_data()
     phase->append(phasePoints);
     phase->setName("Phase");
 
-    axisX->setMin(data.stimulus.first());
-    axisX->setMax(data.stimulus.last());
+    plot_band(magnitudeBand, data, data.channel1, magnitudeCi);
+    plot_band(phaseBand, data, data.channel2, phaseCi);
+    plot_envelope(magnitudeEnvelope, magnitudeRange, magnitudeSigma);
+    plot_envelope(phaseEnvelope, phaseRange, phaseSigma);
+    plot_limits();
+
+    if (zoomStop > 0) {
+        axisX->setRange(zoomStart, zoomStop);
+    } else {
+        axisX->setMin(data.stimulus.first());
+        axisX->setMax(data.stimulus.last());
+    }
 
     double magnitudeScale;
     double magnitudeRef;
@@ -242,7 +384,38 @@ void Loopgain::plot_data()
     axisYPhase->setLabelFormat("%.2f");
 }
 
-void Loopgain::update_parameters()
+QAreaSeries *Loopgain::add_band(QLineSeries *trace, QAbstractAxis *axisY)
+{
+    QAreaSeries *band = new QAreaSeries(new QLineSeries(), new QLineSeries());
+    chart->addSeries(band);
+    band->attachAxis(axisX);
+    band->attachAxis(axisY);
+    QColor color = trace->color();
+    color.setAlpha(60);
+    band->setColor(color);
+    band->setBorderColor(Qt::transparent);
+    for (QLegendMarker *marker : chart->legend()->markers(band)) {
+        marker->setVisible(false);
+    }
+    return band;
+}
+
+void Loopgain::plot_band(QAreaSeries *band, const HP8751A::instrument_data_t &data, const QVector<float> &trace, const QVector<float> &ci)
+{
+    QList<QPointF> upper;
+    QList<QPointF> lower;
+    // Zoom sweeps have no interval, their merged trace doesn't match it
+    if (zoomStop == 0 && ci.size() == data.stimulus.size()) {
+        for (int i = 0; i < ci.size(); i++) {
+            upper.push_back({data.stimulus.at(i), trace.at(i) + ci.at(i)});
+            lower.push_back({data.stimulus.at(i), trace.at(i) - ci.at(i)});
+        }
+    }
+    band->upperSeries()->replace(upper);
+    band->lowerSeries()->replace(lower);
+}
+
+HP8751A::instrument_parameters_t Loopgain::parameters()
 {
     HP8751A::instrument_parameters_t param;
     param.fStart = ui->startFreq->text().toUInt();
@@ -254,13 +427,41 @@ void Loopgain::update_parameters()
     param.attenA = ui->attenA->currentIndex();
     param.ifbw = static_cast<HP8751A::ifbw_t>(ui->ifBw->currentIndex());
     param.unwrapPhase = ui->unwrapPhase->isChecked();
-    param.avgEn = ui->avgEn->isChecked();
+    if (ui->ListmodeEn->isChecked() && !segments.isEmpty()) {
+        param.sweepType = HP8751A::SWEEP_LIST;
+        param.segments = segments;
+    }
+    // Host averaging needs the single sweeps
+    param.avgEn = ui->avgEn->isChecked() && !ui->hostAvgEn->isChecked();
     param.averFact = ui->avgSweeps->currentText().toUInt();
-    hp->set_instrument_parameters(param);
+    return param;
+}
+
+void Loopgain::update_parameters()
+{
+    hp->set_instrument_parameters(parameters());
+    hostAveraging = ui->hostAvgEn->isChecked();
+    envelope = ui->envelopeEn->isChecked();
+    update_refinement();
+    // Continuous sweeps and averaging runs read the previous sweep while the next one runs
+    hp->set_pipelined(ui->btnContinuous->isChecked() || hostAveraging);
+}
+
+void Loopgain::update_refinement()
+{
+    // The refined spans move from sweep to sweep, which would restart the host averaging and the envelope every time
+    if (!ui->refineEn->isChecked() || hostAveraging || envelope) {
+        hp->set_refinement(nullptr, 0);
+        return;
+    }
+    hp->set_refinement([] (const HP8751A::instrument_data_t &data) {
+        return Refinement::loopgain(data, REFINE_WIDTH);
+    }, ui->refinePoints->currentText().toUInt());
 }
 
 void Loopgain::ui_start_sweep()
 {
+    hp->claim(this);
     ui->statusbar->showMessage("Updating parameters...");
     if (!ui->btnContinuous->isChecked()) {
         // Single sweep mode selected
@@ -281,10 +482,20 @@ void Loopgain::ui_start_sweep()
     foreach (QWidget* w, grpReceive) {
         w->setEnabled(false);
     }
+    // The de-embedding can be toggled while sweeping
+    ui->deembedEn->setEnabled(true);
+    ui->portExtension->setEnabled(true);
 }
 
 void Loopgain::ui_stop_sweep()
 {
+    hp->release(this);
+    hp->set_pipelined(false);
+    if (plotTimer->isActive()) {
+        // Show the last snapshot of the free run
+        plotTimer->stop();
+        plot_data();
+    }
     ui->statusbar->showMessage("Ready.");
     ui->btnSingle->setEnabled(true);
     ui->btnContinuous->setEnabled(true);
@@ -307,25 +518,220 @@ void Loopgain::ui_stop_sweep()
 
 void Loopgain::instrument_initialized()
 {
-    update_parameters();
+    // Also emitted for the initialization of a remote client
+    if (initializing) {
+        update_parameters();
+    }
 }
 
 void Loopgain::set_parameters_finished()
 {
-    static bool initialized = false;
-    if (!initialized) {
+    if (initializing) {
+        initializing = false;
+        hp->release(this);
         enable_ui();
-        initialized = true;
         init_statemachine_sweep();
     }
 }
 
 void Loopgain::new_data(HP8751A::instrument_data_t data)
 {
+    // Sweeps of remote clients are not for this window
+    if (cwMonitor || !hp->claimed_by(this)) {
+        return;
+    }
+    if (zoom->busy()) {
+        // Zoom sweeps get the same math, their points replace those of the full span sweep
+        HP8751A::instrument_data_t zoomData = data;
+        apply_deembedding(zoomData);
+        apply_memory(zoomData);
+        if (zoom->consume(zoomData)) {
+            return;
+        }
+    }
+    if (hostAveraging) {
+        HP8751A::instrument_parameters_t param;
+        hp->get_parameters(param);
+        averager.add(data.stimulus, data.channel1, data.channel2);
+        averager.mean(data.channel1, data.channel2, param.unwrapPhase);
+        averager.uncertainty(magnitudeCi, phaseCi);
+    } else {
+        magnitudeCi.clear();
+        phaseCi.clear();
+    }
+
+    // The fixture adds the same dB and degrees to every sweep, so it is removed from the mean as well
+    lastRaw = data;
+    apply_deembedding(data);
+
+    // Averaging is linear, so the math on the mean equals the mean of the math
+    lastMeasured = data;
+    if (apply_memory(data) && ui->memoryMath->currentIndex() == TraceMath::OP_SUBTRACT) {
+        // The interval in dB belongs to the magnitude before the subtraction
+        magnitudeCi.clear();
+        phaseCi.clear();
+    }
+
+    // A new full span sweep ends the zoom
+    lastData = data;
+    zoomStart = 0;
+    zoomStop = 0;
+
+    if (envelope) {
+        magnitudeEnvelope.add(data.stimulus, data.channel1);
+        phaseEnvelope.add_phase(data.stimulus, data.channel2);
+    }
+
     magnitudeScale = data.channel1Scale;
     magnitudeRef = data.channel1RefVal;
     phaseScale = data.channel2Scale;
     phaseRef = data.channel2RefVal;
+
+    update_metrics(data);
+    check_limits(data);
+
+    if (hp->streaming()) {
+        // Not plotted by the state machine
+        schedule_plot();
+    }
+}
+
+void Loopgain::schedule_plot()
+{
+    if (plotTimer->isActive()) {
+        // The plot pending takes the latest data
+        return;
+    }
+    qint64 wait = plotElapsed.isValid() ? PLOT_INTERVAL_MS - plotElapsed.elapsed() : 0;
+    plotTimer->start(qMax<qint64>(0, wait));
+}
+
+void Loopgain::update_metrics(const HP8751A::instrument_data_t &data)
+{
+    std::size_t points = qMin(data.stimulus.size(), qMin(data.channel1.size(), data.channel2.size()));
+    LoopgainMetrics::metrics_t m = metrics.update(data.stimulus.constData(), data.channel1.constData(),
+                                                  data.channel2.constData(), points);
+
+    auto setRange = [](QLabel *min, QLabel *max, LoopgainMetrics::range_t range, auto format) {
+        min->setText(range.valid ? format(range.min) : "-");
+        max->setText(range.valid ? format(range.max) : "-");
+    };
+    auto formatFrequency = [=](double value) {return format_frequency(value);};
+    auto formatDegree = [](double value) {return QString("%1 °").arg(value, 0, 'f', 1);};
+    auto formatDecibel = [](double value) {return QString("%1 dB").arg(value, 0, 'f', 1);};
+
+    ui->metricFc->setText(m.crossoverValid ? formatFrequency(m.crossoverFrequency) : "-");
+    ui->metricPm->setText(m.crossoverValid ? formatDegree(m.phaseMargin) : "-");
+    ui->metricF180->setText(m.phaseCrossoverValid ? formatFrequency(m.phaseCrossoverFrequency) : "-");
+    ui->metricGm->setText(m.phaseCrossoverValid ? formatDecibel(m.gainMargin) : "-");
+
+    setRange(ui->metricFcMin, ui->metricFcMax, metrics.crossover_frequency(), formatFrequency);
+    setRange(ui->metricPmMin, ui->metricPmMax, metrics.phase_margin(), formatDegree);
+    setRange(ui->metricF180Min, ui->metricF180Max, metrics.phase_crossover_frequency(), formatFrequency);
+    setRange(ui->metricGmMin, ui->metricGmMax, metrics.gain_margin(), formatDecibel);
+}
+
+void Loopgain::clear_averaging()
+{
+    averager.reset();
+    magnitudeCi.clear();
+    phaseCi.clear();
+}
+
+bool Loopgain::averaging_pending()
+{
+    if (!hostAveraging) {
+        return false;
+    }
+    return averager.count() < ui->hostAvgMax->value() && !averager.converged(ui->hostAvgTarget->value());
+}
+
+void Loopgain::check_limits(const HP8751A::instrument_data_t &data)
+{
+    // Host averaging is checked once the average is complete
+    if (!limits.active() || averaging_pending()) {
+        return;
+    }
+    LimitEngine::verdict_t verdict = limits.evaluate(data);
+    const LimitEngine::statistics_t &stats = limits.statistics();
+
+    QString text = verdict.pass ? "PASS" : "FAIL";
+    if (verdict.firstIndex >= 0) {
+        text += QString(" at %1 (%2)").arg(format_frequency(verdict.firstFrequency))
+                .arg(verdict.firstTrace == LimitEngine::TRACE_CHANNEL1 ? "magnitude" : "phase");
+    } else if (verdict.marginFail) {
+        text += " (margin)";
+    }
+    if (std::isfinite(verdict.worstDeviation)) {
+        text += QString(", worst %1").arg(verdict.worstDeviation, 0, 'f', 2);
+    }
+    text += QString(" | yield %1/%2").arg(stats.passed).arg(stats.tested);
+    limitStatus->setText(text);
+    limitStatus->setStyleSheet(verdict.pass ? "color: green" : "color: red");
+}
+
+void Loopgain::plot_limits()
+{
+    const HP8751A::instrument_data_t &data = lastData;
+    for (int t = 0; t < LimitEngine::TRACE_COUNT; t++) {
+        const QVector<float> *bounds[2] = {&limits.lower(static_cast<LimitEngine::trace_t>(t)),
+                                           &limits.upper(static_cast<LimitEngine::trace_t>(t))};
+        for (int bound = 0; bound < 2; bound++) {
+            QVector<QPointF> points;
+            // The bounds belong to the last evaluated sweep, which is the one plotted
+            if (limits.active() && bounds[bound]->size() == data.stimulus.size()) {
+                for (int i = 0; i < data.stimulus.size(); i++) {
+                    if (std::isfinite(bounds[bound]->at(i))) {
+                        points.append({data.stimulus.at(i), bounds[bound]->at(i)});
+                    }
+                }
+            }
+            limitLines[t][bound]->replace(points);
+        }
+    }
+}
+
+void Loopgain::clear_envelope()
+{
+    magnitudeEnvelope.set_window(ui->envelopeWindow->value());
+    phaseEnvelope.set_window(ui->envelopeWindow->value());
+}
+
+void Loopgain::plot_envelope(const SweepEnvelope &statistics, QAreaSeries *range, QAreaSeries *sigma)
+{
+    QVector<float> min, max, sigmaLower, sigmaUpper;
+    statistics.bands(min, max, sigmaLower, sigmaUpper);
+    QList<QPointF> points[4];
+    // Hidden while zoomed, the zoom sweeps are not part of the statistics
+    if (zoomStop == 0 && envelope) {
+        const QVector<float> &frequency = statistics.frequency();
+        for (int i = 0; i < min.size(); i++) {
+            points[0].push_back({frequency.at(i), min.at(i)});
+            points[1].push_back({frequency.at(i), max.at(i)});
+            points[2].push_back({frequency.at(i), sigmaLower.at(i)});
+            points[3].push_back({frequency.at(i), sigmaUpper.at(i)});
+        }
+    }
+    range->lowerSeries()->replace(points[0]);
+    range->upperSeries()->replace(points[1]);
+    sigma->lowerSeries()->replace(points[2]);
+    sigma->upperSeries()->replace(points[3]);
+}
+
+void Loopgain::clear_metrics()
+{
+    // Min/max are tracked over one run (single sweep or continuous sweeps)
+    metrics.reset();
+}
+
+QString Loopgain::format_frequency(double frequency)
+{
+    if (frequency >= 1e6) {
+        return QString("%1 MHz").arg(frequency / 1e6, 0, 'f', 3);
+    } else if (frequency >= 1e3) {
+        return QString("%1 kHz").arg(frequency / 1e3, 0, 'f', 3);
+    }
+    return QString("%1 Hz").arg(frequency, 0, 'f', 2);
 }
 
 void Loopgain::response_timeout()
@@ -372,8 +778,7 @@ void Loopgain::on_btnExport_clicked()
 
     QVector<QString> complex;
 
-    HP8751A::instrument_data_t data;
-    hp->get_data(data);
+    const HP8751A::instrument_data_t &data = lastData;
 
     // Calculate complex number from magnitude and phase
     for (int i = 0; i < data.stimulus.size(); i++) {
@@ -440,4 +845,303 @@ void Loopgain::on_chart_customContextMenuRequested(const QPoint &pos)
 }
 
 
+void Loopgain::on_btnEditList_clicked()
+{
+    SegmentEditor editor(this);
+    if (segments.isEmpty()) {
+        // Start with the current log sweep split into decades
+        editor.set_segments(SegmentEditor::decades(ui->startFreq->text().toUInt(), ui->stopFreq->text().toUInt(),
+                                                   ui->numberOfPoints->currentText().toUInt(),
+                                                   static_cast<HP8751A::ifbw_t>(ui->ifBw->currentIndex())));
+    } else {
+        editor.set_segments(segments);
+    }
+    if (editor.exec() == QDialog::Accepted) {
+        segments = editor.segments();
+        ui->ListmodeEn->setChecked(true);
+    }
+}
+
+void Loopgain::on_btnOptimize_clicked()
+{
+    if (!hp->claim(this)) {
+        return;
+    }
+    PlannerDialog planner(hp, parameters(), this);
+    if (planner.exec() == QDialog::Accepted) {
+        segments = planner.segments();
+        ui->ListmodeEn->setChecked(true);
+    }
+    // The probes changed the instrument settings
+    update_parameters();
+    hp->release(this);
+}
+
+void Loopgain::on_btnCwMonitor_clicked()
+{
+    if (!hp->claim(this)) {
+        return;
+    }
+    CwMonitorDialog monitor(hp, parameters(), this);
+    cwMonitor = true;
+    monitor.exec();
+    cwMonitor = false;
+    // The monitor changed the instrument settings
+    update_parameters();
+    hp->release(this);
+}
+
+void Loopgain::on_btnLimits_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Load limit mask"), "", tr("Mask files (*.json)"));
+    if (fileName.isEmpty()) {
+        limits.clear();
+        limitStatus->clear();
+        plot_limits();
+        return;
+    }
+    QString errorString;
+    if (!limits.load(fileName, errorString)) {
+        QMessageBox::warning(this, "Limit mask", errorString);
+        return;
+    }
+    limitStatus->setText(QString("Mask %1 loaded").arg(QFileInfo(fileName).fileName()));
+    limitStatus->setStyleSheet("");
+    if (!lastData.stimulus.isEmpty()) {
+        // Check the sweep on screen right away
+        check_limits(lastData);
+        plot_limits();
+    }
+}
+
+bool Loopgain::apply_memory(HP8751A::instrument_data_t &data)
+{
+    TraceMath::operation_t operation = static_cast<TraceMath::operation_t>(ui->memoryMath->currentIndex());
+    if (operation == TraceMath::OP_OFF) {
+        memoryStatus->clear();
+        return false;
+    }
+    if (!memory.is_valid()) {
+        memoryStatus->setText("Trace math off: no reference");
+        return false;
+    }
+    HP8751A::instrument_parameters_t param;
+    hp->get_parameters(param);
+    if (!memory.apply(operation, data, param.unwrapPhase)) {
+        memoryStatus->setText(QString("Trace math off: sweep exceeds reference range %1 Hz to %2 Hz")
+                              .arg(memory.min_frequency(), 0, 'g', 4).arg(memory.max_frequency(), 0, 'g', 4));
+        return false;
+    }
+    memoryStatus->setText(QString("%1: %2").arg(ui->memoryMath->currentText(), memory.reference_name()));
+    return true;
+}
+
+void Loopgain::update_memory_list(const QString &select)
+{
+    const QSignalBlocker blocker(ui->memoryTrace);
+    ui->memoryTrace->clear();
+    ui->memoryTrace->addItems(TraceMath::stored_references());
+    int index = ui->memoryTrace->findText(select);
+    ui->memoryTrace->setCurrentIndex(index >= 0 ? index : 0);
+    if (ui->memoryTrace->currentIndex() < 0 || !memory.load(ui->memoryTrace->currentText())) {
+        memory.clear();
+    }
+}
+
+void Loopgain::on_memoryMath_currentIndexChanged(int index)
+{
+    Q_UNUSED(index)
+    if (lastMeasured.stimulus.isEmpty()) {
+        return;
+    }
+    // Show the last sweep with the new math right away
+    lastData = lastMeasured;
+    apply_memory(lastData);
+    magnitudeScale = lastData.channel1Scale;
+    magnitudeRef = lastData.channel1RefVal;
+    phaseScale = lastData.channel2Scale;
+    phaseRef = lastData.channel2RefVal;
+    plot_data();
+}
+
+void Loopgain::on_memoryTrace_currentIndexChanged(int index)
+{
+    if (index < 0 || !memory.load(ui->memoryTrace->currentText())) {
+        memory.clear();
+    }
+    on_memoryMath_currentIndexChanged(ui->memoryMath->currentIndex());
+}
+
+void Loopgain::on_btnStoreMemory_clicked()
+{
+    if (lastMeasured.stimulus.isEmpty()) {
+        ui->statusbar->showMessage("No sweep to store!");
+        return;
+    }
+    bool ok;
+    QString name = QInputDialog::getText(this, "Store reference", "Name of the reference trace:", QLineEdit::Normal,
+                                         memory.reference_name(), &ok).trimmed();
+    // The name is the file name in the reference store, the list shows it the same way
+    name = TraceStore::valid_name(name);
+    if (!ok || name.isEmpty()) {
+        return;
+    }
+    if (TraceMath::stored_references().contains(name)
+            && QMessageBox::question(this, "Store reference", QString("Replace reference %1?").arg(name)) != QMessageBox::Yes) {
+        return;
+    }
+    if (!memory.capture(name, lastMeasured)) {
+        QMessageBox::warning(this, "Store reference", "Could not store the reference trace!");
+        return;
+    }
+    update_memory_list(name);
+    on_memoryMath_currentIndexChanged(ui->memoryMath->currentIndex());
+}
+
+bool Loopgain::apply_deembedding(HP8751A::instrument_data_t &data)
+{
+    if (!ui->deembedEn->isChecked()) {
+        deembedStatus->clear();
+        return false;
+    }
+    if (!deembedding.is_active()) {
+        deembedStatus->setText("De-embedding off: no fixture selected");
+        return false;
+    }
+    HP8751A::instrument_parameters_t param;
+    hp->get_parameters(param);
+    if (!deembedding.apply(data, param.unwrapPhase)) {
+        deembedStatus->setText(QString("De-embedding off: sweep exceeds fixture range %1 Hz to %2 Hz")
+                               .arg(deembedding.min_frequency(), 0, 'g', 4).arg(deembedding.max_frequency(), 0, 'g', 4));
+        return false;
+    }
+    QStringList stages;
+    for (const FixtureDeembedding::stage_t &stage : deembedding.stages()) {
+        stages.append(QString("%1 (%2)").arg(stage.name, stage.path == FixtureDeembedding::PATH_TEST ? "A" : "R"));
+    }
+    if (deembedding.delay() != 0) {
+        stages.append(QString("ext. %1 ns").arg(deembedding.delay() * 1e9, 0, 'g', 4));
+    }
+    deembedStatus->setText("De-embedded: " + stages.join(", "));
+    return true;
+}
+
+void Loopgain::update_deembedding()
+{
+    // Statistics of the run don't mix sweeps with and without de-embedding
+    clear_metrics();
+    clear_envelope();
+    if (lastRaw.stimulus.isEmpty()) {
+        return;
+    }
+    // Show the last sweep with the new de-embedding right away
+    lastMeasured = lastRaw;
+    apply_deembedding(lastMeasured);
+    on_memoryMath_currentIndexChanged(ui->memoryMath->currentIndex());
+    update_metrics(lastData);
+}
+
+void Loopgain::read_deembedding_settings()
+{
+    QSettings settings("config.ini", QSettings::IniFormat);
+    settings.beginGroup("Deembedding");
+    // Fixtures deleted from the store are dropped
+    const QStringList stored = FixtureDeembedding::stored_fixtures();
+    QVector<FixtureDeembedding::stage_t> stages;
+    for (const QString &name : settings.value("Test").toStringList()) {
+        if (stored.contains(name)) {
+            stages.append({name, FixtureDeembedding::PATH_TEST});
+        }
+    }
+    for (const QString &name : settings.value("Reference").toStringList()) {
+        if (stored.contains(name)) {
+            stages.append({name, FixtureDeembedding::PATH_REFERENCE});
+        }
+    }
+    const QSignalBlocker blockEnable(ui->deembedEn);
+    const QSignalBlocker blockExtension(ui->portExtension);
+    ui->deembedEn->setChecked(settings.value("Enabled", false).toBool());
+    ui->portExtension->setValue(settings.value("PortExtension", 0).toDouble());
+    settings.endGroup();
+
+    QString errorString;
+    if (!deembedding.set_stages(stages, errorString)) {
+        deembedding.set_stages({}, errorString);
+    }
+    deembedding.set_delay(ui->portExtension->value() * 1e-9);
+}
+
+void Loopgain::write_deembedding_settings()
+{
+    QStringList test;
+    QStringList reference;
+    for (const FixtureDeembedding::stage_t &stage : deembedding.stages()) {
+        (stage.path == FixtureDeembedding::PATH_TEST ? test : reference).append(stage.name);
+    }
+    QSettings settings("config.ini", QSettings::IniFormat);
+    settings.beginGroup("Deembedding");
+    settings.setValue("Enabled", ui->deembedEn->isChecked());
+    settings.setValue("PortExtension", ui->portExtension->value());
+    settings.setValue("Test", test);
+    settings.setValue("Reference", reference);
+    settings.endGroup();
+    settings.sync();
+}
+
+void Loopgain::on_deembedEn_toggled(bool checked)
+{
+    Q_UNUSED(checked)
+    write_deembedding_settings();
+    update_deembedding();
+}
+
+void Loopgain::on_portExtension_valueChanged(double arg1)
+{
+    deembedding.set_delay(arg1 * 1e-9);
+    write_deembedding_settings();
+    if (ui->deembedEn->isChecked()) {
+        update_deembedding();
+    }
+}
+
+void Loopgain::on_btnFixtures_clicked()
+{
+    // Fixtures are measured without the de-embedding and the trace math
+    FixtureDialog dialog(lastRaw, this);
+    dialog.set_stages(deembedding.stages());
+    if (dialog.exec() != QDialog::Accepted) {
+        return;
+    }
+    QString errorString;
+    if (!deembedding.set_stages(dialog.stages(), errorString)) {
+        QMessageBox::warning(this, "De-embedding", errorString);
+    }
+    write_deembedding_settings();
+    update_deembedding();
+}
+
+void Loopgain::zoom_to(double fStart, double fStop)
+{
+    if (lastData.stimulus.isEmpty() || zoom->busy()) {
+        return;
+    }
+    zoomStart = fStart;
+    zoomStop = fStop;
+    axisX->setRange(zoomStart, zoomStop);
+
+    // Only while no regular sweep is running
+    if (ui->zoomMeasure->isChecked() && ui->btnSingle->isEnabled()) {
+        ui_start_sweep();
+        zoom->start(parameters(), std::floor(fStart), std::ceil(fStop), ui->numberOfPoints->currentText().toUInt());
+    }
+}
 
+void Loopgain::full_span()
+{
+    if (zoom->busy()) {
+        return;
+    }
+    zoomStart = 0;
+    zoomStop = 0;
+    plot_data();
+}
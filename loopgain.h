@@ -8,6 +8,16 @@
 #include <QStateMachine>
 #include <QState>
 #include <QMessageBox>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "loopgainmetrics.h"
+#include "zoomchartview.h"
+#include "zoomsweep.h"
+#include "sweepaverager.h"
+#include "limitengine.h"
+#include "sweepenvelope.h"
+#include "tracemath.h"
+#include "fixturedeembedding.h"
 
 
 namespace Ui {
@@ -34,6 +44,13 @@ private:
     };
 
     void init();
+    void init_instrument();
+
+    // The instrument is claimed while this window initializes it or sweeps. A remote client locks the window.
+    bool initializing; // Own initialization in progress
+    bool initPending; // Waits for a remote client to release the instrument
+    bool remoteControl;
+    void claim_changed();
     void init_statemachine_sweep();
 
     void start_sweep();
@@ -43,7 +60,18 @@ private:
     void init_plot();
     void plot_data();
 
+    // Free-running sweeps are plotted at most every PLOT_INTERVAL_MS, snapshots in between are skipped
+    static constexpr int PLOT_INTERVAL_MS = 50;
+    QTimer *plotTimer = nullptr;
+    QElapsedTimer plotElapsed;
+    void schedule_plot();
+
+    HP8751A::instrument_parameters_t parameters(); // Settings of the controls
     void update_parameters();
+    void update_refinement();
+
+    // Segments of the list sweep, used when list mode is checked
+    QVector<HP8751A::segment_t> segments;
 
 
     void ui_start_sweep();
@@ -51,10 +79,12 @@ private:
 
 
     QChart *chart = nullptr;
-    QChartView *chartView = nullptr;
+    ZoomChartView *chartView = nullptr;
     QVBoxLayout *layout = nullptr;
     QLineSeries *magnitude = nullptr;
     QLineSeries *phase = nullptr;
+    QAreaSeries *magnitudeBand = nullptr; // Confidence interval of the host averaging
+    QAreaSeries *phaseBand = nullptr;
     QLogValueAxis *axisX = nullptr;
     QValueAxis *axisY = nullptr;
     QValueAxis *axisYPhase = nullptr;
@@ -63,6 +93,66 @@ private:
     float phaseScale;
     float phaseRef;
 
+    HP8751A::instrument_data_t lastData; // Last full span sweep
+
+    // Zoomed frequency span, zero if the full span is shown
+    double zoomStart;
+    double zoomStop;
+    ZoomSweep *zoom = nullptr;
+    void zoom_to(double fStart, double fStop);
+    void full_span();
+
+    bool cwMonitor; // The CW monitor owns the instrument, its sweeps are not for this window
+
+    // Host averaging of single sweeps, enabled for the current run
+    bool hostAveraging;
+    SweepAverager averager;
+    QVector<float> magnitudeCi; // Confidence interval of lastData, empty without host averaging
+    QVector<float> phaseCi;
+    void clear_averaging();
+    bool averaging_pending(); // Another sweep is needed to meet the target
+    QAreaSeries *add_band(QLineSeries *trace, QAbstractAxis *axisY);
+    void plot_band(QAreaSeries *band, const HP8751A::instrument_data_t &data, const QVector<float> &trace, const QVector<float> &ci);
+
+    // Per-point statistics over the sweeps of a run, shown as min/max and +-sigma bands
+    bool envelope;
+    SweepEnvelope magnitudeEnvelope;
+    SweepEnvelope phaseEnvelope;
+    QAreaSeries *magnitudeRange = nullptr;
+    QAreaSeries *magnitudeSigma = nullptr;
+    QAreaSeries *phaseRange = nullptr;
+    QAreaSeries *phaseSigma = nullptr;
+    void clear_envelope();
+    void plot_envelope(const SweepEnvelope &statistics, QAreaSeries *range, QAreaSeries *sigma);
+
+    // Trace math against a stored reference, applied to every sweep before plot, metrics and export
+    TraceMath memory;
+    HP8751A::instrument_data_t lastMeasured; // Last full span sweep before the trace math
+    QLabel *memoryStatus = nullptr;
+    bool apply_memory(HP8751A::instrument_data_t &data);
+    void update_memory_list(const QString &select);
+
+    // Fixtures and port extension removed from every sweep before the trace math, kept in config.ini
+    FixtureDeembedding deembedding;
+    HP8751A::instrument_data_t lastRaw; // Last full span sweep before the de-embedding
+    QLabel *deembedStatus = nullptr;
+    bool apply_deembedding(HP8751A::instrument_data_t &data);
+    void update_deembedding();
+    void read_deembedding_settings();
+    void write_deembedding_settings();
+
+    LoopgainMetrics metrics;
+    void update_metrics(const HP8751A::instrument_data_t &data);
+    void clear_metrics();
+    QString format_frequency(double frequency);
+
+    // Pass/fail check of every full span sweep, the yield counts all sweeps since the mask was loaded
+    LimitEngine limits;
+    QLabel *limitStatus = nullptr;
+    QLineSeries *limitLines[LimitEngine::TRACE_COUNT][2] = {}; // Lower and upper bound per trace
+    void check_limits(const HP8751A::instrument_data_t &data);
+    void plot_limits();
+
 public slots:
     void instrument_initialized();
     void set_parameters_finished();
@@ -75,6 +165,22 @@ private slots:
 
     void on_btnExport_clicked();
 
+    void on_btnEditList_clicked();
+
+    void on_btnOptimize_clicked();
+
+    void on_btnCwMonitor_clicked();
+
+    void on_btnLimits_clicked();
+
+    void on_memoryMath_currentIndexChanged(int index);
+    void on_memoryTrace_currentIndexChanged(int index);
+    void on_btnStoreMemory_clicked();
+
+    void on_deembedEn_toggled(bool checked);
+    void on_portExtension_valueChanged(double arg1);
+    void on_btnFixtures_clicked();
+
     void on_aAutoscale_stateChanged(int arg1);
 
     void on_phiAutoscale_stateChanged(int arg1);
@@ -92,6 +198,7 @@ signals:
     void responseOK(QPrivateSignal);
     void responseNOK(QPrivateSignal);
     void continueSweep(QPrivateSignal);
+    void streamStarted(QPrivateSignal);
     void goIdle(QPrivateSignal);
 
 };
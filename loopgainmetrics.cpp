@@ -0,0 +1,121 @@
+#include "loopgainmetrics.h"
+#include <cmath>
+#include <limits>
+
+// Wrap an angle in degrees to [-180, 180]
+static inline double wrap_phase(double phase)
+{
+    return std::remainder(phase, 360.0);
+}
+
+// Interpolate on a logarithmic frequency axis, t = 0 returns f0 and t = 1 returns f1
+static inline double interpolate_log(double f0, double f1, double t)
+{
+    if (f0 <= 0 || f1 <= 0) {
+        return f0 + t * (f1 - f0);
+    }
+    return f0 * std::pow(f1 / f0, t);
+}
+
+LoopgainMetrics::LoopgainMetrics()
+{
+    reset();
+}
+
+LoopgainMetrics::metrics_t LoopgainMetrics::compute(const float *frequency, const float *magnitude, const float *phase, std::size_t points)
+{
+    metrics_t metrics = {false, 0, 0, false, 0, 0};
+    if (points < 2) {
+        return metrics;
+    }
+
+    metrics.phaseMargin = std::numeric_limits<double>::max();
+    metrics.gainMargin = std::numeric_limits<double>::max();
+
+    /* Single pass over the trace:
+     * Gain crossover: the magnitude changes sign between two points.
+     * Phase crossover: the distance to -180° (wrapped to ±180°) changes sign without jumping by
+     * more than 180°. A jump means the phase went through 0° (mod 360°) and is not a crossover.
+     * This works for both wrapped and unwrapped phase data.
+     */
+    double mag0 = magnitude[0];
+    double dist0 = wrap_phase(phase[0] + 180.0);
+
+    for (std::size_t i = 1; i < points; i++) {
+        double mag1 = magnitude[i];
+        double dist1 = wrap_phase(phase[i] + 180.0);
+
+        if ((mag0 >= 0) != (mag1 >= 0)) {
+            double t = mag0 / (mag0 - mag1);
+            double phaseStep = wrap_phase(phase[i] - phase[i - 1]);
+            double margin = wrap_phase(phase[i - 1] + t * phaseStep + 180.0);
+            if (margin < metrics.phaseMargin) {
+                metrics.crossoverValid = true;
+                metrics.phaseMargin = margin;
+                metrics.crossoverFrequency = interpolate_log(frequency[i - 1], frequency[i], t);
+            }
+        }
+
+        if ((dist0 >= 0) != (dist1 >= 0) && std::fabs(dist1 - dist0) < 180.0) {
+            double t = dist0 / (dist0 - dist1);
+            double margin = -(mag0 + t * (mag1 - mag0));
+            if (margin < metrics.gainMargin) {
+                metrics.phaseCrossoverValid = true;
+                metrics.gainMargin = margin;
+                metrics.phaseCrossoverFrequency = interpolate_log(frequency[i - 1], frequency[i], t);
+            }
+        }
+
+        mag0 = mag1;
+        dist0 = dist1;
+    }
+
+    if (!metrics.crossoverValid) {
+        metrics.phaseMargin = 0;
+    }
+    if (!metrics.phaseCrossoverValid) {
+        metrics.gainMargin = 0;
+    }
+
+    return metrics;
+}
+
+LoopgainMetrics::metrics_t LoopgainMetrics::update(const float *frequency, const float *magnitude, const float *phase, std::size_t points)
+{
+    metrics_t metrics = compute(frequency, magnitude, phase, points);
+    sweepCount++;
+
+    if (metrics.crossoverValid) {
+        accumulate(crossoverRange, metrics.crossoverFrequency);
+        accumulate(phaseMarginRange, metrics.phaseMargin);
+    }
+    if (metrics.phaseCrossoverValid) {
+        accumulate(phaseCrossoverRange, metrics.phaseCrossoverFrequency);
+        accumulate(gainMarginRange, metrics.gainMargin);
+    }
+
+    return metrics;
+}
+
+void LoopgainMetrics::reset()
+{
+    crossoverRange = {false, 0, 0};
+    phaseMarginRange = {false, 0, 0};
+    phaseCrossoverRange = {false, 0, 0};
+    gainMarginRange = {false, 0, 0};
+    sweepCount = 0;
+}
+
+void LoopgainMetrics::accumulate(range_t &range, double value)
+{
+    if (!range.valid) {
+        range = {true, value, value};
+        return;
+    }
+    if (value < range.min) {
+        range.min = value;
+    }
+    if (value > range.max) {
+        range.max = value;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef LOOPGAINMETRICS_H
+#define LOOPGAINMETRICS_H
+
+#include <cstddef>
+
+class LoopgainMetrics
+{
+public:
+    struct metrics_t {
+        bool crossoverValid; // Magnitude crosses 0 dB within the sweep
+        double crossoverFrequency;
+        double phaseMargin;
+        bool phaseCrossoverValid; // Phase crosses -180° within the sweep
+        double phaseCrossoverFrequency;
+        double gainMargin;
+    };
+
+    struct range_t {
+        bool valid;
+        double min;
+        double max;
+    };
+
+    LoopgainMetrics();
+
+    // Compute the stability metrics of one sweep. Phase may be wrapped or unwrapped.
+    // If there are several crossings, the one with the smallest margin is reported.
+    static metrics_t compute(const float *frequency, const float *magnitude, const float *phase, std::size_t points);
+
+    // Compute the metrics and add them to the run statistics
+    metrics_t update(const float *frequency, const float *magnitude, const float *phase, std::size_t points);
+
+    // Clear the run statistics
+    void reset();
+
+    range_t crossover_frequency() const { return crossoverRange; }
+    range_t phase_margin() const { return phaseMarginRange; }
+    range_t phase_crossover_frequency() const { return phaseCrossoverRange; }
+    range_t gain_margin() const { return gainMarginRange; }
+    unsigned int sweeps() const { return sweepCount; }
+
+private:
+    range_t crossoverRange;
+    range_t phaseMarginRange;
+    range_t phaseCrossoverRange;
+    range_t gainMarginRange;
+    unsigned int sweepCount;
+
+    static void accumulate(range_t &range, double value);
+};
+
+#endif // LOOPGAINMETRICS_H
@@ -0,0 +1,189 @@
+#include "oneportcal.h"
+#include "impedancekernels.h"
+#include "tracestore.h"
+#include <QDateTime>
+#include <QJsonArray>
+#include <cmath>
+
+typedef std::complex<double> cplx;
+
+static const char *CAL_DIR = "calibrations";
+static const float Z0 = 50.0f;
+
+OnePortCal::OnePortCal()
+{
+    gridValid = false;
+}
+
+bool OnePortCal::compute(const QString &fixture, const QVector<float> &frequency,
+                         const QVector<float> &open, const QVector<float> &shortStd, const QVector<float> &load)
+{
+    const int points = frequency.size();
+    if (points == 0 || open.size() != 2 * points || shortStd.size() != 2 * points || load.size() != 2 * points) {
+        return false;
+    }
+
+    this->fixture = fixture;
+    this->frequency.resize(points);
+    e00.resize(points);
+    e11.resize(points);
+    e10e01.resize(points);
+
+    /* Ideal standards: open = +1, short = -1, load = 0.
+     * Gm = e00 + e10e01 * G / (1 - e11 * G)
+     * Load:  e00 = Gm_load
+     * Open and short: e11 = (Gm_open + Gm_short - 2 e00) / (Gm_open - Gm_short)
+     *                 e10e01 = (Gm_open - e00) * (1 - e11)
+     */
+    for (int i = 0; i < points; i++) {
+        cplx mOpen(open.at(2 * i), open.at(2 * i + 1));
+        cplx mShort(shortStd.at(2 * i), shortStd.at(2 * i + 1));
+        cplx mLoad(load.at(2 * i), load.at(2 * i + 1));
+
+        this->frequency[i] = frequency.at(i);
+        e00[i] = mLoad;
+        e11[i] = (mOpen + mShort - 2.0 * mLoad) / (mOpen - mShort);
+        e10e01[i] = (mOpen - mLoad) * (1.0 - e11[i]);
+    }
+
+    gridValid = false;
+    return true;
+}
+
+double OnePortCal::min_frequency() const
+{
+    return frequency.isEmpty() ? 0 : frequency.first();
+}
+
+double OnePortCal::max_frequency() const
+{
+    return frequency.isEmpty() ? 0 : frequency.last();
+}
+
+bool OnePortCal::save() const
+{
+    if (!is_valid()) {
+        return false;
+    }
+
+    QJsonArray freq;
+    QJsonArray terms[6];
+    for (int i = 0; i < frequency.size(); i++) {
+        freq.append(frequency.at(i));
+        terms[0].append(e00.at(i).real());
+        terms[1].append(e00.at(i).imag());
+        terms[2].append(e11.at(i).real());
+        terms[3].append(e11.at(i).imag());
+        terms[4].append(e10e01.at(i).real());
+        terms[5].append(e10e01.at(i).imag());
+    }
+
+    QJsonObject root;
+    root["fixture"] = fixture;
+    root["created"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    root["frequency"] = freq;
+    root["e00_re"] = terms[0];
+    root["e00_im"] = terms[1];
+    root["e11_re"] = terms[2];
+    root["e11_im"] = terms[3];
+    root["e10e01_re"] = terms[4];
+    root["e10e01_im"] = terms[5];
+    return TraceStore::write(CAL_DIR, fixture, root);
+}
+
+bool OnePortCal::load(const QString &fixture)
+{
+    QJsonObject root;
+    if (!TraceStore::read(CAL_DIR, fixture, root)) {
+        return false;
+    }
+
+    QJsonArray freq = root["frequency"].toArray();
+    const char *keys[6] = {"e00_re", "e00_im", "e11_re", "e11_im", "e10e01_re", "e10e01_im"};
+    QJsonArray terms[6];
+    for (int k = 0; k < 6; k++) {
+        terms[k] = root[keys[k]].toArray();
+        if (terms[k].size() != freq.size()) {
+            return false;
+        }
+    }
+    if (freq.isEmpty()) {
+        return false;
+    }
+
+    this->fixture = root["fixture"].toString(fixture);
+    const int points = freq.size();
+    frequency.resize(points);
+    e00.resize(points);
+    e11.resize(points);
+    e10e01.resize(points);
+    for (int i = 0; i < points; i++) {
+        frequency[i] = freq.at(i).toDouble();
+        e00[i] = cplx(terms[0].at(i).toDouble(), terms[1].at(i).toDouble());
+        e11[i] = cplx(terms[2].at(i).toDouble(), terms[3].at(i).toDouble());
+        e10e01[i] = cplx(terms[4].at(i).toDouble(), terms[5].at(i).toDouble());
+    }
+
+    gridValid = false;
+    return true;
+}
+
+QStringList OnePortCal::stored_fixtures()
+{
+    return TraceStore::stored(CAL_DIR);
+}
+
+bool OnePortCal::prepare(const QVector<float> &grid)
+{
+    if (!is_valid()) {
+        return false;
+    }
+    if (gridValid && grid == this->grid) {
+        return true;
+    }
+
+    gridValid = false;
+    if (!TraceStore::covers(frequency, grid)) {
+        return false;
+    }
+    TraceStore::interpolate(frequency, e00, grid, gridE00Re, gridE00Im);
+    TraceStore::interpolate(frequency, e11, grid, gridE11Re, gridE11Im);
+    TraceStore::interpolate(frequency, e10e01, grid, gridE10e01Re, gridE10e01Im);
+
+    this->grid = grid;
+    gridValid = true;
+    return true;
+}
+
+bool OnePortCal::correct(const QVector<float> &raw, QVector<float> &magnitudeDb, QVector<float> &phaseDeg)
+{
+    const int points = grid.size();
+    if (!gridValid || raw.size() != 2 * points) {
+        return false;
+    }
+
+    rawRe.resize(points);
+    rawIm.resize(points);
+    re.resize(points);
+    im.resize(points);
+    for (int i = 0; i < points; i++) {
+        rawRe[i] = raw.at(2 * i);
+        rawIm[i] = raw.at(2 * i + 1);
+    }
+
+    zkernels::error_terms_t terms;
+    terms.e00Re = gridE00Re.constData();
+    terms.e00Im = gridE00Im.constData();
+    terms.e11Re = gridE11Re.constData();
+    terms.e11Im = gridE11Im.constData();
+    terms.e10e01Re = gridE10e01Re.constData();
+    terms.e10e01Im = gridE10e01Im.constData();
+
+    zkernels::one_port_correct(rawRe.constData(), rawIm.constData(), terms, re.data(), im.data(), points);
+    zkernels::reflection_to_impedance(re.constData(), im.constData(), Z0, re.data(), im.data(), points);
+
+    magnitudeDb.resize(points);
+    phaseDeg.resize(points);
+    zkernels::rect_to_polar(re.constData(), im.constData(), magnitudeDb.data(), phaseDeg.data(), points);
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef ONEPORTCAL_H
+#define ONEPORTCAL_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <complex>
+
+/* Open/short/load calibration computed and applied on the host.
+ * The error terms are stored per fixture in the calibrations directory next to config.ini and can be
+ * interpolated onto any frequency grid inside the calibrated range, so changing start, stop or the
+ * number of points does not require a new calibration.
+ */
+class OnePortCal
+{
+public:
+    OnePortCal();
+
+    // Compute the error terms from the raw reflection coefficients of the three standards.
+    // The raw arrays contain interleaved real and imaginary parts like the instrument sends them.
+    bool compute(const QString &fixture, const QVector<float> &frequency,
+                 const QVector<float> &open, const QVector<float> &shortStd, const QVector<float> &load);
+
+    bool is_valid() const { return !frequency.isEmpty(); }
+    QString fixture_name() const { return fixture; }
+    double min_frequency() const;
+    double max_frequency() const;
+
+    // Store in / read from calibrations/<fixture>.json
+    bool save() const;
+    bool load(const QString &fixture);
+    static QStringList stored_fixtures();
+
+    // Interpolate the error terms onto the given grid. Returns false if the grid exceeds the
+    // calibrated range. The result is cached until the grid changes.
+    bool prepare(const QVector<float> &grid);
+
+    // Correct raw reflection data (interleaved) on the prepared grid and convert it to impedance
+    // in dB and degrees, the same format the instrument delivers with CONVZREF.
+    bool correct(const QVector<float> &raw, QVector<float> &magnitudeDb, QVector<float> &phaseDeg);
+
+private:
+    QString fixture;
+    QVector<double> frequency;
+    QVector<std::complex<double>> e00;    // Directivity
+    QVector<std::complex<double>> e11;    // Source match
+    QVector<std::complex<double>> e10e01; // Reflection tracking
+
+    // Error terms on the current grid, structure of arrays for the correction kernel
+    QVector<float> grid;
+    QVector<float> gridE00Re;
+    QVector<float> gridE00Im;
+    QVector<float> gridE11Re;
+    QVector<float> gridE11Im;
+    QVector<float> gridE10e01Re;
+    QVector<float> gridE10e01Im;
+    bool gridValid;
+
+    // Scratch buffers, keep their allocation between sweeps
+    QVector<float> rawRe;
+    QVector<float> rawIm;
+    QVector<float> re;
+    QVector<float> im;
+};
+
+#endif // ONEPORTCAL_H
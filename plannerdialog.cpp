@@ -0,0 +1,178 @@
+#include "plannerdialog.h"
+#include "ui_plannerdialog.h"
+#include <QPushButton>
+
+enum column_t {
+    COL_START,
+    COL_STOP,
+    COL_POINTS,
+    COL_IFBW,
+    COL_MAG_NOISE,
+    COL_PHASE_NOISE
+};
+
+PlannerDialog::PlannerDialog(HP8751A *hp, const HP8751A::instrument_parameters_t &param, QWidget *parent)
+    : QDialog(parent)
+    , ui(new Ui::PlannerDialog)
+{
+    ui->setupUi(this);
+    ui->table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    this->hp = hp;
+    current = param;
+    probing = false;
+    probesLeft = 0;
+
+    // The probes use a fixed bandwidth, the noise of the others is scaled from it
+    ui->probeIfbw->setCurrentIndex(param.ifbw == HP8751A::IFBW_AUTO ? HP8751A::IFBW_200HZ : param.ifbw);
+    ui->lCurrent->setText("Current settings: not probed yet");
+    ui->lProposed->setText("Proposed plan: -");
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(false);
+
+    QObject::connect(hp, &HP8751A::set_parameters_finished, this, &PlannerDialog::set_parameters_finished);
+    QObject::connect(hp, &HP8751A::new_data, this, &PlannerDialog::new_data);
+    QObject::connect(hp, &HP8751A::response_timeout, this, &PlannerDialog::response_timeout);
+    QObject::connect(ui->targetMagnitude, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &PlannerDialog::update_plan);
+    QObject::connect(ui->targetPhase, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &PlannerDialog::update_plan);
+}
+
+PlannerDialog::~PlannerDialog()
+{
+    delete ui;
+}
+
+void PlannerDialog::on_btnProbe_clicked()
+{
+    if (probing) {
+        return;
+    }
+
+    // Plain log sweep over the span of the window, no averaging
+    HP8751A::instrument_parameters_t probe = current;
+    probe.sweepType = HP8751A::SWEEP_LOG;
+    probe.segments.clear();
+    probe.points = ui->probePoints->currentText().toUInt();
+    probe.ifbw = static_cast<HP8751A::ifbw_t>(ui->probeIfbw->currentIndex());
+    probe.avgEn = false;
+    probe.averFact = 1;
+    probe.clearPowerTrip = false;
+
+    // All probes need the same grid, the window sets its refinement again before the next sweep
+    hp->set_refinement(nullptr, 0);
+    planner.clear();
+    probing = true;
+    probesLeft = ui->probeSweeps->value();
+    ui->btnProbe->setEnabled(false);
+    ui->buttonBox->setEnabled(false);
+    ui->lStatus->setText("Updating parameters...");
+    hp->set_instrument_parameters(probe);
+}
+
+void PlannerDialog::set_parameters_finished()
+{
+    if (!probing || planner.probe_count() > 0) {
+        return;
+    }
+    ui->lStatus->setText(QString("Probe sweep 1 of %1...").arg(ui->probeSweeps->value()));
+    probeTimer.start();
+    hp->request_sweep();
+}
+
+void PlannerDialog::new_data(HP8751A::instrument_data_t data)
+{
+    if (!probing) {
+        return;
+    }
+    if (!planner.add_probe(data.stimulus, data.channel1, data.channel2, probeTimer.elapsed())) {
+        stop_probing("Probe sweep returned unexpected data!");
+        return;
+    }
+
+    probesLeft--;
+    if (probesLeft > 0) {
+        ui->lStatus->setText(QString("Probe sweep %1 of %2...").arg(planner.probe_count() + 1).arg(ui->probeSweeps->value()));
+        probeTimer.start();
+        hp->request_sweep();
+        return;
+    }
+
+    if (!planner.analyse(static_cast<HP8751A::ifbw_t>(ui->probeIfbw->currentIndex()))) {
+        stop_probing("Not enough data for a plan!");
+        return;
+    }
+    stop_probing("Ready.");
+    update_plan();
+}
+
+void PlannerDialog::response_timeout()
+{
+    if (probing) {
+        stop_probing("Instrument does not respond!");
+    }
+}
+
+void PlannerDialog::stop_probing(const QString &status)
+{
+    // The window sends its own parameters again before the next sweep
+    probing = false;
+    ui->btnProbe->setEnabled(true);
+    ui->buttonBox->setEnabled(true);
+    ui->lStatus->setText(status);
+}
+
+void PlannerDialog::update_plan()
+{
+    if (planner.regions().isEmpty()) {
+        return;
+    }
+
+    FrequencyPlanner::target_t target;
+    target.magnitudeDb = ui->targetMagnitude->value();
+    target.phaseDeg = ui->targetPhase->value();
+    proposal = planner.plan(target);
+
+    const QVector<FrequencyPlanner::region_t> &regions = planner.regions();
+    ui->table->setRowCount(proposal.size());
+    int total = 0;
+    int region = 0; // A region is split into several segments
+    for (int row = 0; row < proposal.size(); row++) {
+        const HP8751A::segment_t &segment = proposal.at(row);
+        while (region < regions.size() - 1 && segment.fStart >= regions.at(region).fStop) {
+            region++;
+        }
+        ui->table->setItem(row, COL_START, new QTableWidgetItem(QString::number(segment.fStart)));
+        ui->table->setItem(row, COL_STOP, new QTableWidgetItem(QString::number(segment.fStop)));
+        ui->table->setItem(row, COL_POINTS, new QTableWidgetItem(QString::number(segment.points)));
+        ui->table->setItem(row, COL_IFBW, new QTableWidgetItem(ui->probeIfbw->itemText(segment.ifbw)));
+        ui->table->setItem(row, COL_MAG_NOISE, new QTableWidgetItem(QString("%1 dB").arg(regions.at(region).magnitudeNoise, 0, 'g', 2)));
+        ui->table->setItem(row, COL_PHASE_NOISE, new QTableWidgetItem(QString("%1 °").arg(regions.at(region).phaseNoise, 0, 'g', 2)));
+        total += segment.points;
+    }
+
+    int currentPoints = current.points;
+    if (current.sweepType == HP8751A::SWEEP_LIST && !current.segments.isEmpty()) {
+        currentPoints = 0;
+        for (const HP8751A::segment_t &segment : current.segments) {
+            currentPoints += segment.points;
+        }
+    }
+    double currentTime = planner.sweep_time(current);
+    double proposedTime = planner.sweep_time(proposal);
+    ui->lCurrent->setText(QString("Current settings: %1 points, %2").arg(currentPoints).arg(format_time(currentTime)));
+    QString proposed = QString("Proposed plan: %1 points, %2").arg(total).arg(format_time(proposedTime));
+    if (proposedTime > 0) {
+        proposed.append(QString(" (%1x)").arg(currentTime / proposedTime, 0, 'f', 1));
+    }
+    if (planner.unmet_regions() > 0) {
+        proposed.append(QString(", target missed in %1 decade(s)").arg(planner.unmet_regions()));
+    }
+    ui->lProposed->setText(proposed);
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(!proposal.isEmpty());
+}
+
+QString PlannerDialog::format_time(double seconds)
+{
+    if (seconds < 60) {
+        return QString("%1 s").arg(seconds, 0, 'f', 1);
+    }
+    return QString("%1 min").arg(seconds / 60, 0, 'f', 1);
+}
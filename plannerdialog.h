@@ -0,0 +1,48 @@
+#ifndef PLANNERDIALOG_H
+#define PLANNERDIALOG_H
+
+#include <QDialog>
+#include <QElapsedTimer>
+#include "hp8751a.h"
+#include "frequencyplanner.h"
+
+namespace Ui {
+class PlannerDialog;
+}
+
+// Runs probe sweeps and proposes a list sweep which meets the target uncertainty
+class PlannerDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    // param are the current settings of the window, used for the span and the source of the probes
+    explicit PlannerDialog(HP8751A *hp, const HP8751A::instrument_parameters_t &param, QWidget *parent = nullptr);
+    ~PlannerDialog();
+
+    // Proposed segments, valid when the dialog was accepted
+    QVector<HP8751A::segment_t> segments() const { return proposal; }
+
+private slots:
+    void on_btnProbe_clicked();
+    void update_plan();
+
+private:
+    Ui::PlannerDialog *ui;
+    HP8751A *hp = nullptr;
+    HP8751A::instrument_parameters_t current;
+    FrequencyPlanner planner;
+    QVector<HP8751A::segment_t> proposal;
+
+    bool probing;
+    int probesLeft;
+    QElapsedTimer probeTimer;
+
+    void set_parameters_finished();
+    void new_data(HP8751A::instrument_data_t data);
+    void response_timeout();
+    void stop_probing(const QString &status);
+    QString format_time(double seconds);
+};
+
+#endif // PLANNERDIALOG_H
@@ -45,6 +45,30 @@ void PrologixGPIB::send_command(quint16 gpibAddr, const QString command)
     socket->write(cmd.toLocal8Bit());
 }
 
+void PrologixGPIB::send_binary(quint16 gpibAddr, const QString prefix, const QByteArray &block, const QString suffix)
+{
+    if (!socket) {
+        return;
+    }
+    if (!socket->isOpen()) {
+        return;
+    }
+    QString addr = QString("++addr %1\r").arg(gpibAddr);
+    socket->write(addr.toLocal8Bit());
+
+    QByteArray payload = prefix.toLocal8Bit();
+    payload.reserve(payload.size() + 2 * block.size() + suffix.size() + 2);
+    for (char c : block) {
+        if (c == '\r' || c == '\n' || c == 27 || c == '+') {
+            payload.append(char(27));
+        }
+        payload.append(c);
+    }
+    payload.append(suffix.toLocal8Bit());
+    payload.append("\r\n");
+    socket->write(payload);
+}
+
 void PrologixGPIB::socket_connected()
 {
     //Send init commands to Prologix GPIB-Ethernet adapter
@@ -13,6 +13,9 @@ public:
     void init(QHostAddress &ip, quint16 port);
     void deinit();
     void send_command(quint16 gpibAddr, const QString command);
+    // Send a command with an arbitrary binary block. CR, LF, ESC and '+' in the block are escaped
+    // so the adapter passes them to the instrument instead of interpreting them.
+    void send_binary(quint16 gpibAddr, const QString prefix, const QByteArray &block, const QString suffix);
 
 private:
     QTcpSocket *socket = nullptr;
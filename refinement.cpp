@@ -0,0 +1,114 @@
+#include "refinement.h"
+#include <algorithm>
+#include <cmath>
+
+static const double PEAK_PROMINENCE_DB = 3.0;
+static const int PEAK_WINDOW = 3;
+
+static double wrap_phase(double deg)
+{
+    return deg - 360.0 * std::round(deg / 360.0);
+}
+
+double Refinement::crossing(const QVector<float> &frequency, const QVector<float> &trace, int i, double level)
+{
+    // Crossing between point i and i + 1, interpolated over log frequency
+    double y0 = trace.at(i) - level;
+    double y1 = trace.at(i + 1) - level;
+    double a = y0 / (y0 - y1);
+    double x0 = std::log10(frequency.at(i));
+    double x1 = std::log10(frequency.at(i + 1));
+    return std::pow(10, x0 + a * (x1 - x0));
+}
+
+QVector<HP8751A::span_t> Refinement::spans(const QVector<float> &frequency, QVector<double> centers, double widthDecades)
+{
+    QVector<HP8751A::span_t> list;
+    if (frequency.isEmpty() || centers.isEmpty()) {
+        return list;
+    }
+    std::sort(centers.begin(), centers.end());
+
+    const double factor = std::pow(10, widthDecades / 2);
+    const double fMin = frequency.first();
+    const double fMax = frequency.last();
+    for (double center : centers) {
+        HP8751A::span_t span;
+        span.fStart = std::floor(qMax(fMin, center / factor));
+        span.fStop = std::ceil(qMin(fMax, center * factor));
+        if (span.fStop <= span.fStart) {
+            continue;
+        }
+        // Features close to each other share one span
+        if (!list.isEmpty() && span.fStart <= list.last().fStop) {
+            list.last().fStop = qMax(list.last().fStop, span.fStop);
+        } else if (list.size() < MAX_SPANS) {
+            list.append(span);
+        }
+    }
+    return list;
+}
+
+QVector<HP8751A::span_t> Refinement::loopgain(const HP8751A::instrument_data_t &data, double widthDecades)
+{
+    const QVector<float> &f = data.stimulus;
+    const int points = f.size();
+    QVector<double> centers;
+    if (points < 2 || data.channel1.size() != points || data.channel2.size() != points) {
+        return {};
+    }
+
+    for (int i = 0; i < points - 1; i++) {
+        if ((data.channel1.at(i) > 0) != (data.channel1.at(i + 1) > 0)) {
+            centers.append(crossing(f, data.channel1, i, 0));
+        }
+
+        // Distance to -180° modulo 360, a sign change by more than 180° is the wrap of the trace
+        double d0 = wrap_phase(data.channel2.at(i) + 180);
+        double d1 = wrap_phase(data.channel2.at(i + 1) + 180);
+        if ((d0 > 0) != (d1 > 0) && std::fabs(d1 - d0) < 180) {
+            QVector<float> distance = {(float)d0, (float)d1};
+            QVector<float> span = {f.at(i), f.at(i + 1)};
+            centers.append(crossing(span, distance, 0, 0));
+        }
+    }
+    return spans(f, centers, widthDecades);
+}
+
+QVector<HP8751A::span_t> Refinement::resonances(const HP8751A::instrument_data_t &data, double widthDecades)
+{
+    const QVector<float> &f = data.stimulus;
+    const int points = f.size();
+    QVector<double> centers;
+    if (points < 2 || data.channel1.size() != points || data.channel2.size() != points) {
+        return {};
+    }
+
+    for (int i = 0; i < points - 1; i++) {
+        // Series and parallel resonances: the phase changes sign without wrapping
+        double p0 = wrap_phase(data.channel2.at(i));
+        double p1 = wrap_phase(data.channel2.at(i + 1));
+        if ((p0 > 0) != (p1 > 0) && std::fabs(p1 - p0) < 180) {
+            QVector<float> phase = {(float)p0, (float)p1};
+            QVector<float> span = {f.at(i), f.at(i + 1)};
+            centers.append(crossing(span, phase, 0, 0));
+        }
+    }
+
+    // Peaks and dips of the magnitude which stand out from their neighbourhood
+    for (int i = PEAK_WINDOW; i < points - PEAK_WINDOW; i++) {
+        float value = data.channel1.at(i);
+        bool peak = true;
+        bool dip = true;
+        for (int k = i - PEAK_WINDOW; k <= i + PEAK_WINDOW; k++) {
+            peak &= data.channel1.at(k) <= value;
+            dip &= data.channel1.at(k) >= value;
+        }
+        float left = data.channel1.at(i - PEAK_WINDOW);
+        float right = data.channel1.at(i + PEAK_WINDOW);
+        if ((peak && value - qMax(left, right) >= PEAK_PROMINENCE_DB) || (dip && qMin(left, right) - value >= PEAK_PROMINENCE_DB)) {
+            centers.append(f.at(i));
+        }
+    }
+    return spans(f, centers, widthDecades);
+}
@@ -0,0 +1,25 @@
+#ifndef REFINEMENT_H
+#define REFINEMENT_H
+
+#include <QVector>
+#include "hp8751a.h"
+
+// Finders for HP8751A::set_refinement(). Each returns narrow, non-overlapping spans
+// around the features of a coarse sweep, clipped to the span of the sweep.
+class Refinement
+{
+public:
+    // Loop gain: 0 dB crossings of the magnitude (channel 1) and -180° crossings of the phase (channel 2)
+    static QVector<HP8751A::span_t> loopgain(const HP8751A::instrument_data_t &data, double widthDecades);
+
+    // Impedance: zero crossings of the phase (channel 2) and pronounced peaks or dips of the magnitude (channel 1)
+    static QVector<HP8751A::span_t> resonances(const HP8751A::instrument_data_t &data, double widthDecades);
+
+    static constexpr int MAX_SPANS = 6;
+
+private:
+    static double crossing(const QVector<float> &frequency, const QVector<float> &trace, int i, double level);
+    static QVector<HP8751A::span_t> spans(const QVector<float> &frequency, QVector<double> centers, double widthDecades);
+};
+
+#endif // REFINEMENT_H
@@ -0,0 +1,297 @@
+#include "resultstore.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QFileInfo>
+#include <QDir>
+#include <QUuid>
+#include <algorithm>
+#include <cmath>
+
+static const int SCHEMA_VERSION = 1;
+static const double SPOT_TOLERANCE = 1e-6; // Relative, the list sweep returns the stimulus as float
+
+ResultStore::ResultStore()
+{
+    // Every store needs its own connection
+    connection = QString("resultstore_%1").arg(QUuid::createUuid().toString());
+}
+
+ResultStore::~ResultStore()
+{
+    close();
+}
+
+bool ResultStore::open(const QString &fileName, QString &errorString)
+{
+    close();
+    db = QSqlDatabase::addDatabase("QSQLITE", connection);
+    db.setDatabaseName(fileName);
+    if (!db.open()) {
+        errorString = QString("Could not open database %1: %2").arg(fileName, db.lastError().text());
+        close();
+        return false;
+    }
+    baseDir = QFileInfo(fileName).absolutePath();
+
+    // WAL lets a query run while the batch tool adds rows
+    QSqlQuery query(db);
+    query.exec("PRAGMA journal_mode=WAL");
+    query.exec("PRAGMA synchronous=NORMAL");
+
+    if (!create_schema(errorString)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ResultStore::close()
+{
+    if (!QSqlDatabase::contains(connection)) {
+        return;
+    }
+    if (db.isOpen()) {
+        // Keeps the statistics of the query planner up to date
+        QSqlQuery(db).exec("PRAGMA optimize");
+    }
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(connection);
+}
+
+bool ResultStore::is_open() const
+{
+    return db.isOpen();
+}
+
+bool ResultStore::create_schema(QString &errorString)
+{
+    QSqlQuery query(db);
+    query.exec("PRAGMA user_version");
+    int version = query.next() ? query.value(0).toInt() : 0;
+    if (version == SCHEMA_VERSION) {
+        return true;
+    }
+    if (version != 0) {
+        errorString = QString("Database has unknown version %1").arg(version);
+        return false;
+    }
+
+    // Time in ms since epoch (UTC), metrics are NULL if they could not be measured
+    const char *statements[] = {
+        "CREATE TABLE measurements ("
+        "id INTEGER PRIMARY KEY, serial TEXT, lot TEXT, station TEXT, profile TEXT, job TEXT, timestamp INTEGER, "
+        "pass INTEGER, crossover REAL, phase_margin REAL, phase_crossover REAL, gain_margin REAL, trace TEXT)",
+        "CREATE TABLE spots ("
+        "measurement INTEGER REFERENCES measurements(id), frequency REAL, magnitude REAL, phase REAL)",
+        "CREATE INDEX measurements_lot ON measurements(lot, profile)",
+        "CREATE INDEX measurements_serial ON measurements(serial)",
+        "CREATE INDEX measurements_station ON measurements(station, timestamp)",
+        "CREATE INDEX measurements_timestamp ON measurements(timestamp)",
+        "CREATE INDEX spots_measurement ON spots(measurement, frequency)",
+        "PRAGMA user_version = 1"
+    };
+
+    db.transaction();
+    for (const char *statement : statements) {
+        if (!query.exec(statement)) {
+            errorString = QString("Could not create database: %1").arg(query.lastError().text());
+            db.rollback();
+            return false;
+        }
+    }
+    db.commit();
+    return true;
+}
+
+bool ResultStore::add(const record_t &record, QString &errorString)
+{
+    auto optional = [](bool valid, double value) {
+        return valid ? QVariant(value) : QVariant(QVariant::Double);
+    };
+
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO measurements (serial, lot, station, profile, job, timestamp, pass, "
+                  "crossover, phase_margin, phase_crossover, gain_margin, trace) "
+                  "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    query.addBindValue(record.serial);
+    query.addBindValue(record.lot);
+    query.addBindValue(record.station);
+    query.addBindValue(record.profile);
+    query.addBindValue(record.job);
+    query.addBindValue(record.timestamp.toMSecsSinceEpoch());
+    query.addBindValue(record.hasVerdict ? QVariant(record.pass ? 1 : 0) : QVariant(QVariant::Int));
+    const LoopgainMetrics::metrics_t &m = record.metrics;
+    query.addBindValue(optional(record.hasMetrics && m.crossoverValid, m.crossoverFrequency));
+    query.addBindValue(optional(record.hasMetrics && m.crossoverValid, m.phaseMargin));
+    query.addBindValue(optional(record.hasMetrics && m.phaseCrossoverValid, m.phaseCrossoverFrequency));
+    query.addBindValue(optional(record.hasMetrics && m.phaseCrossoverValid, m.gainMargin));
+    query.addBindValue(record.trace.isEmpty() ? QString() : QDir(baseDir).relativeFilePath(record.trace));
+    if (!query.exec()) {
+        errorString = QString("Could not store result: %1").arg(query.lastError().text());
+        db.rollback();
+        return false;
+    }
+
+    const qint64 id = query.lastInsertId().toLongLong();
+    if (!record.spots.isEmpty()) {
+        QSqlQuery spots(db);
+        spots.prepare("INSERT INTO spots (measurement, frequency, magnitude, phase) VALUES (?, ?, ?, ?)");
+        for (const spot_value_t &spot : record.spots) {
+            spots.addBindValue(id);
+            spots.addBindValue(spot.frequency);
+            spots.addBindValue(spot.magnitude);
+            spots.addBindValue(spot.phase);
+            if (!spots.exec()) {
+                errorString = QString("Could not store result: %1").arg(spots.lastError().text());
+                db.rollback();
+                return false;
+            }
+        }
+    }
+    db.commit();
+    return true;
+}
+
+QString ResultStore::where(const filter_t &filter, QVariantList &bindings)
+{
+    QStringList conditions;
+    auto match = [&](const char *column, const QString &value) {
+        if (!value.isEmpty()) {
+            conditions.append(QString("m.%1 = ?").arg(column));
+            bindings.append(value);
+        }
+    };
+    match("serial", filter.serial);
+    match("lot", filter.lot);
+    match("station", filter.station);
+    match("profile", filter.profile);
+    match("job", filter.job);
+    if (filter.from.isValid()) {
+        conditions.append("m.timestamp >= ?");
+        bindings.append(filter.from.toMSecsSinceEpoch());
+    }
+    if (filter.to.isValid()) {
+        conditions.append("m.timestamp <= ?");
+        bindings.append(filter.to.toMSecsSinceEpoch());
+    }
+    return conditions.isEmpty() ? QString() : " AND " + conditions.join(" AND ");
+}
+
+bool ResultStore::values(metric_t metric, double frequency, const filter_t &filter, QVector<double> &out, QString &errorString)
+{
+    out.clear();
+    QVariantList bindings;
+    QString sql;
+    switch (metric) {
+    case METRIC_CROSSOVER:
+    case METRIC_PHASE_MARGIN:
+    case METRIC_PHASE_CROSSOVER:
+    case METRIC_GAIN_MARGIN: {
+        const char *columns[] = {"crossover", "phase_margin", "phase_crossover", "gain_margin"};
+        sql = QString("SELECT m.%1 FROM measurements m WHERE m.%1 IS NOT NULL").arg(columns[metric]);
+        break;
+    }
+    case METRIC_SPOT_MAGNITUDE:
+    case METRIC_SPOT_PHASE:
+        sql = QString("SELECT s.%1 FROM spots s JOIN measurements m ON m.id = s.measurement "
+                      "WHERE s.frequency BETWEEN ? AND ?").arg(metric == METRIC_SPOT_MAGNITUDE ? "magnitude" : "phase");
+        bindings.append(frequency * (1 - SPOT_TOLERANCE));
+        bindings.append(frequency * (1 + SPOT_TOLERANCE));
+        break;
+    }
+    sql += where(filter, bindings);
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(sql);
+    for (const QVariant &value : bindings) {
+        query.addBindValue(value);
+    }
+    if (!query.exec()) {
+        errorString = QString("Query failed: %1").arg(query.lastError().text());
+        return false;
+    }
+    while (query.next()) {
+        out.append(query.value(0).toDouble());
+    }
+    return true;
+}
+
+bool ResultStore::yield(const filter_t &filter, int &passed, int &checked, QString &errorString)
+{
+    QVariantList bindings;
+    QString sql = "SELECT COUNT(*), TOTAL(m.pass) FROM measurements m WHERE m.pass IS NOT NULL" + where(filter, bindings);
+    QSqlQuery query(db);
+    query.prepare(sql);
+    for (const QVariant &value : bindings) {
+        query.addBindValue(value);
+    }
+    if (!query.exec() || !query.next()) {
+        errorString = QString("Query failed: %1").arg(query.lastError().text());
+        return false;
+    }
+    checked = query.value(0).toInt();
+    passed = query.value(1).toInt();
+    return true;
+}
+
+ResultStore::summary_t ResultStore::summarize(QVector<double> values)
+{
+    summary_t summary = {};
+    summary.count = values.size();
+    if (values.isEmpty()) {
+        return summary;
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for (double value : values) {
+        sum += value;
+    }
+    summary.mean = sum / values.size();
+    double squares = 0;
+    for (double value : values) {
+        squares += (value - summary.mean) * (value - summary.mean);
+    }
+    summary.stddev = values.size() > 1 ? std::sqrt(squares / (values.size() - 1)) : 0;
+
+    // Linear interpolation between the closest ranks
+    auto percentile = [&](double p) {
+        double rank = p * (values.size() - 1);
+        int low = std::floor(rank);
+        int high = std::min<int>(low + 1, values.size() - 1);
+        return values.at(low) + (rank - low) * (values.at(high) - values.at(low));
+    };
+    summary.min = values.first();
+    summary.p5 = percentile(0.05);
+    summary.median = percentile(0.5);
+    summary.p95 = percentile(0.95);
+    summary.max = values.last();
+    return summary;
+}
+
+bool ResultStore::parse_metric(const QString &name, metric_t &metric, double &frequency)
+{
+    frequency = 0;
+    const QString lower = name.toLower();
+    if (lower == "crossover") {
+        metric = METRIC_CROSSOVER;
+    } else if (lower == "phase_margin") {
+        metric = METRIC_PHASE_MARGIN;
+    } else if (lower == "phase_crossover") {
+        metric = METRIC_PHASE_CROSSOVER;
+    } else if (lower == "gain_margin") {
+        metric = METRIC_GAIN_MARGIN;
+    } else if (lower.startsWith("magnitude@") || lower.startsWith("phase@")) {
+        bool ok;
+        frequency = lower.section('@', 1).toDouble(&ok);
+        if (!ok || frequency <= 0) {
+            return false;
+        }
+        metric = lower.startsWith("magnitude@") ? METRIC_SPOT_MAGNITUDE : METRIC_SPOT_PHASE;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef RESULTSTORE_H
+#define RESULTSTORE_H
+
+#include <QString>
+#include <QVector>
+#include <QDateTime>
+#include <QSqlDatabase>
+#include "loopgainmetrics.h"
+
+/* Local result database (SQLite, no server) with one row per measurement.
+ * A row is indexed by DUT serial, lot, station, time and profile. It holds the summary metrics in columns
+ * and the path of the trace file, stored relative to the database. Spot values (magnitude or |Z| and
+ * phase at single frequencies) go to their own table. Queries return a metric of all rows that match a
+ * filter, e.g. the phase margin of one lot.
+ */
+class ResultStore
+{
+public:
+    ResultStore();
+    ~ResultStore();
+
+    enum metric_t {
+        METRIC_CROSSOVER,
+        METRIC_PHASE_MARGIN,
+        METRIC_PHASE_CROSSOVER,
+        METRIC_GAIN_MARGIN,
+        METRIC_SPOT_MAGNITUDE, // At the frequency of the query
+        METRIC_SPOT_PHASE
+    };
+
+    struct spot_value_t {
+        double frequency;
+        double magnitude; // dB, for impedance |Z|
+        double phase;
+    };
+
+    struct record_t {
+        QString serial;
+        QString lot;
+        QString station;
+        QString profile; // "loopgain" or "impedance"
+        QString job;
+        QDateTime timestamp;
+        bool hasVerdict; // Checked against limits
+        bool pass;
+        bool hasMetrics;
+        LoopgainMetrics::metrics_t metrics;
+        QString trace; // Trace file, empty if there is none
+        QVector<spot_value_t> spots;
+    };
+
+    // Empty fields and invalid times match everything
+    struct filter_t {
+        QString serial;
+        QString lot;
+        QString station;
+        QString profile;
+        QString job;
+        QDateTime from;
+        QDateTime to;
+    };
+
+    struct summary_t {
+        int count;
+        double mean;
+        double stddev;
+        double min;
+        double p5;
+        double median;
+        double p95;
+        double max;
+    };
+
+    // Open or create the database
+    bool open(const QString &fileName, QString &errorString);
+    void close();
+    bool is_open() const;
+
+    bool add(const record_t &record, QString &errorString);
+
+    // Values of one metric over all matching rows, rows without a valid value are skipped
+    bool values(metric_t metric, double frequency, const filter_t &filter, QVector<double> &out, QString &errorString);
+    // Rows with verdict PASS among the matching rows that have a verdict
+    bool yield(const filter_t &filter, int &passed, int &checked, QString &errorString);
+    static summary_t summarize(QVector<double> values);
+
+    // "phase_margin", "gain_margin", "crossover", "phase_crossover", "magnitude@<Hz>" or "phase@<Hz>"
+    static bool parse_metric(const QString &name, metric_t &metric, double &frequency);
+
+private:
+    QSqlDatabase db;
+    QString connection;
+    QString baseDir; // Trace paths are relative to the database
+
+    bool create_schema(QString &errorString);
+    static QString where(const filter_t &filter, QVariantList &bindings);
+};
+
+#endif // RESULTSTORE_H
@@ -0,0 +1,175 @@
+#include "segmenteditor.h"
+#include "ui_segmenteditor.h"
+#include <QComboBox>
+#include <QSpinBox>
+#include <algorithm>
+#include <cmath>
+
+enum column_t {
+    COL_START,
+    COL_STOP,
+    COL_POINTS,
+    COL_IFBW
+};
+
+SegmentEditor::SegmentEditor(QWidget *parent)
+    : QDialog(parent)
+    , ui(new Ui::SegmentEditor)
+{
+    ui->setupUi(this);
+    ui->table->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    update_total();
+}
+
+SegmentEditor::~SegmentEditor()
+{
+    delete ui;
+}
+
+void SegmentEditor::set_segments(const QVector<HP8751A::segment_t> &segments)
+{
+    ui->table->setRowCount(0);
+    for (const HP8751A::segment_t &segment : segments) {
+        add_row(segment);
+    }
+    update_total();
+}
+
+QVector<HP8751A::segment_t> SegmentEditor::segments() const
+{
+    QVector<HP8751A::segment_t> segments;
+    for (int row = 0; row < ui->table->rowCount(); row++) {
+        HP8751A::segment_t segment;
+        segment.fStart = static_cast<QSpinBox*>(ui->table->cellWidget(row, COL_START))->value();
+        segment.fStop = static_cast<QSpinBox*>(ui->table->cellWidget(row, COL_STOP))->value();
+        segment.points = static_cast<QSpinBox*>(ui->table->cellWidget(row, COL_POINTS))->value();
+        segment.ifbw = static_cast<HP8751A::ifbw_t>(static_cast<QComboBox*>(ui->table->cellWidget(row, COL_IFBW))->currentIndex());
+        segments.push_back(segment);
+    }
+    std::sort(segments.begin(), segments.end(), [] (const HP8751A::segment_t &a, const HP8751A::segment_t &b) {
+        return a.fStart < b.fStart;
+    });
+    return segments;
+}
+
+QVector<HP8751A::segment_t> SegmentEditor::decades(quint32 fStart, quint32 fStop, quint16 points, HP8751A::ifbw_t ifbw)
+{
+    QVector<HP8751A::segment_t> list;
+    if (fStart == 0 || fStop <= fStart) {
+        return list;
+    }
+    double totalDecades = std::log10((double)fStop / fStart);
+    quint32 start = fStart;
+    while (start < fStop) {
+        quint32 stop = qMin<quint64>((quint64)start * 10, fStop);
+        double share = std::log10((double)stop / start) / totalDecades;
+        quint16 segmentPoints = qMax(2, (int)std::round(points * share));
+        list.push_back({start, stop, segmentPoints, ifbw});
+        start = stop;
+    }
+    return list;
+}
+
+void SegmentEditor::accept()
+{
+    QString error;
+    if (!validate(error)) {
+        ui->lTotal->setText(error);
+        ui->lTotal->setStyleSheet("color: red;");
+        return;
+    }
+    QDialog::accept();
+}
+
+void SegmentEditor::add_row(const HP8751A::segment_t &segment)
+{
+    int row = ui->table->rowCount();
+    ui->table->insertRow(row);
+
+    QSpinBox *start = new QSpinBox();
+    start->setRange(5, 500000000);
+    start->setSuffix(" Hz");
+    start->setValue(segment.fStart);
+    ui->table->setCellWidget(row, COL_START, start);
+
+    QSpinBox *stop = new QSpinBox();
+    stop->setRange(5, 500000000);
+    stop->setSuffix(" Hz");
+    stop->setValue(segment.fStop);
+    ui->table->setCellWidget(row, COL_STOP, stop);
+
+    QSpinBox *points = new QSpinBox();
+    points->setRange(2, HP8751A::MAX_POINTS);
+    points->setValue(segment.points);
+    ui->table->setCellWidget(row, COL_POINTS, points);
+    QObject::connect(points, QOverload<int>::of(&QSpinBox::valueChanged), this, &SegmentEditor::update_total);
+
+    // Same entries as the IFBW combo box of the main windows
+    QComboBox *ifbw = new QComboBox();
+    ifbw->addItems({"2 Hz", "20 Hz", "200 Hz", "1 kHz", "4 kHz", "Auto"});
+    ifbw->setCurrentIndex(segment.ifbw);
+    ui->table->setCellWidget(row, COL_IFBW, ifbw);
+}
+
+void SegmentEditor::update_total()
+{
+    int total = 0;
+    for (int row = 0; row < ui->table->rowCount(); row++) {
+        total += static_cast<QSpinBox*>(ui->table->cellWidget(row, COL_POINTS))->value();
+    }
+    ui->lTotal->setText(QString("%1 of %2 points").arg(total).arg(HP8751A::MAX_POINTS));
+    ui->lTotal->setStyleSheet(total > HP8751A::MAX_POINTS ? "color: red;" : "");
+}
+
+bool SegmentEditor::validate(QString &error) const
+{
+    QVector<HP8751A::segment_t> list = segments();
+    if (list.isEmpty()) {
+        error = "Add at least one segment!";
+        return false;
+    }
+
+    int total = 0;
+    for (int i = 0; i < list.size(); i++) {
+        if (list.at(i).fStop <= list.at(i).fStart) {
+            error = QString("Segment %1: stop must be above start!").arg(i + 1);
+            return false;
+        }
+        if (i > 0 && list.at(i).fStart < list.at(i - 1).fStop) {
+            error = QString("Segments %1 and %2 overlap!").arg(i).arg(i + 1);
+            return false;
+        }
+        total += list.at(i).points;
+    }
+    if (total > HP8751A::MAX_POINTS) {
+        error = QString("More than %1 points!").arg(HP8751A::MAX_POINTS);
+        return false;
+    }
+    return true;
+}
+
+void SegmentEditor::on_btnAdd_clicked()
+{
+    // Continue after the last segment with one decade
+    HP8751A::segment_t segment = {1000, 10000, 51, HP8751A::IFBW_200HZ};
+    QVector<HP8751A::segment_t> list = segments();
+    if (!list.isEmpty()) {
+        segment = list.last();
+        segment.fStart = list.last().fStop;
+        segment.fStop = qMin<quint32>(segment.fStart * 10, 500000000);
+    }
+    add_row(segment);
+    update_total();
+}
+
+void SegmentEditor::on_btnRemove_clicked()
+{
+    int row = ui->table->currentRow();
+    if (row < 0) {
+        row = ui->table->rowCount() - 1;
+    }
+    if (row >= 0) {
+        ui->table->removeRow(row);
+    }
+    update_total();
+}
@@ -0,0 +1,40 @@
+#ifndef SEGMENTEDITOR_H
+#define SEGMENTEDITOR_H
+
+#include <QDialog>
+#include <QVector>
+#include "hp8751a.h"
+
+namespace Ui {
+class SegmentEditor;
+}
+
+// Editor for the segments of a list sweep
+class SegmentEditor : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit SegmentEditor(QWidget *parent = nullptr);
+    ~SegmentEditor();
+    void set_segments(const QVector<HP8751A::segment_t> &segments);
+    QVector<HP8751A::segment_t> segments() const;
+
+    // One segment per decade between start and stop, the points are distributed evenly
+    static QVector<HP8751A::segment_t> decades(quint32 fStart, quint32 fStop, quint16 points, HP8751A::ifbw_t ifbw);
+
+public slots:
+    void accept() override;
+
+private slots:
+    void on_btnAdd_clicked();
+    void on_btnRemove_clicked();
+
+private:
+    Ui::SegmentEditor *ui;
+    void add_row(const HP8751A::segment_t &segment);
+    void update_total();
+    bool validate(QString &error) const;
+};
+
+#endif // SEGMENTEDITOR_H
@@ -29,6 +29,9 @@ StartDialog::StartDialog(QWidget *parent)
     hp = new HP8751A(gpib, gpibId, this);
     QObject::connect(hp, &HP8751A::instrument_identification, this, &StartDialog::instrument_identification);
     QObject::connect(hp, &HP8751A::response_timeout, this, &StartDialog::instrument_response_timeout);
+
+    start_server();
+    start_shared_memory();
 }
 
 StartDialog::~StartDialog()
@@ -100,6 +103,19 @@ void StartDialog::write_default_settings()
     settings.setValue("Port", port);
     settings.setValue("GPIB-ID", id);
     settings.endGroup();
+
+    settings.beginGroup("Server");
+    settings.setValue("Enabled", false);
+    settings.setValue("Name", "hp8751a");
+    settings.setValue("QueueDepth", 4);
+    settings.endGroup();
+
+    settings.beginGroup("SharedMemory");
+    settings.setValue("Enabled", false);
+    settings.setValue("Name", "/hp8751a_sweeps");
+    settings.setValue("Slots", 8);
+    settings.setValue("MaxPoints", 1601);
+    settings.endGroup();
     settings.sync();
 }
 
@@ -127,6 +143,66 @@ void StartDialog::read_settings()
     gpib->init(this->addr, this->port);
 }
 
+void StartDialog::start_server()
+{
+    // Remote control server for other tools. Disabled unless enabled in config.ini
+    QSettings settings("config.ini", QSettings::IniFormat);
+    if (!settings.value("Server/Enabled", false).toBool()) {
+        return;
+    }
+
+    server = new ControlServer(hp, this);
+    server->set_queue_depth(settings.value("Server/QueueDepth", 4).toInt());
+    QString name = settings.value("Server/Name", "hp8751a").toString();
+    if (!server->listen(name)) {
+        QMessageBox::warning(this, "Control server", QString("Could not listen on %1!").arg(name));
+    }
+}
+
+void StartDialog::start_shared_memory()
+{
+    // Publish every sweep for local consumer processes. Disabled unless enabled in config.ini
+    QSettings settings("config.ini", QSettings::IniFormat);
+    if (!settings.value("SharedMemory/Enabled", false).toBool()) {
+        return;
+    }
+
+    QString name = settings.value("SharedMemory/Name", "/hp8751a_sweeps").toString();
+    quint32 slots = settings.value("SharedMemory/Slots", 8).toUInt();
+    quint32 maxPoints = settings.value("SharedMemory/MaxPoints", 1601).toUInt();
+    if (!shmWriter.open(name.toStdString(), slots, maxPoints)) {
+        QMessageBox::warning(this, "Shared memory", QString("Could not create %1!").arg(name));
+        return;
+    }
+    QObject::connect(hp, &HP8751A::new_data, this, &StartDialog::publish_sweep);
+}
+
+void StartDialog::publish_sweep(HP8751A::instrument_data_t data)
+{
+    if (data.partial) {
+        return;
+    }
+    HP8751A::instrument_parameters_t param;
+    hp->get_parameters(param);
+
+    sweepshm::parameters_t shmParam;
+    shmParam.fStart = param.fStart;
+    shmParam.fStop = param.fStop;
+    shmParam.points = param.points;
+    shmParam.power = param.power;
+    shmParam.ifbw = param.ifbw;
+    shmParam.averFact = param.avgEn ? param.averFact : 1;
+    shmParam.attenR = param.attenR;
+    shmParam.attenA = param.attenA;
+    shmParam.unwrapPhase = param.unwrapPhase;
+    shmParam.reserved = 0;
+
+    float scaleRef[4] = {data.channel1Scale, data.channel1RefVal, data.channel2Scale, data.channel2RefVal};
+    quint32 points = qMin(data.stimulus.size(), qMin(data.channel1.size(), data.channel2.size()));
+    shmWriter.publish(data.stimulus.constData(), data.channel1.constData(), data.channel2.constData(),
+                      points, scaleRef, shmParam);
+}
+
 void StartDialog::on_btnRetry_clicked()
 {
     gpib->init(this->addr, this->port);
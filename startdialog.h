@@ -10,6 +10,8 @@
 #include "loopgain.h"
 #include "impedance.h"
 #include "hp8751a.h"
+#include "controlserver.h"
+#include "sweepshm.h"
 
 namespace Ui {
 class StartDialog;
@@ -37,6 +39,11 @@ private:
     void write_default_settings();
     void write_settings();
     void read_settings();
+    void start_server();
+    ControlServer *server = nullptr;
+    void start_shared_memory();
+    void publish_sweep(HP8751A::instrument_data_t data);
+    sweepshm::Writer shmWriter;
     Loopgain *loopgain = nullptr;
     Impedance *impedance = nullptr;
 
@@ -0,0 +1,110 @@
+#include "stripbuffer.h"
+
+StripBuffer::StripBuffer(int capacity)
+{
+    ring.resize(capacity > 0 ? capacity : DEFAULT_CAPACITY);
+    clear();
+}
+
+void StripBuffer::clear()
+{
+    head = 0;
+    count = 0;
+}
+
+void StripBuffer::append(double time, float magnitude, float phase)
+{
+    if (count < ring.size()) {
+        ring[(head + count) % ring.size()] = {time, magnitude, phase};
+        count++;
+        return;
+    }
+    // Full, the newest sample takes the place of the oldest
+    ring[head] = {time, magnitude, phase};
+    head = (head + 1) % ring.size();
+}
+
+double StripBuffer::first_time() const
+{
+    return count ? at(0).time : 0;
+}
+
+double StripBuffer::last_time() const
+{
+    return count ? at(count - 1).time : 0;
+}
+
+int StripBuffer::lower_bound(double time) const
+{
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (at(mid).time < time) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void add_extremes(QVector<QPointF> &out, const QPointF &min, const QPointF &max)
+{
+    // Keep the order in time so the line doesn't run backwards
+    if (min.x() <= max.x()) {
+        out.append(min);
+        if (max.x() != min.x()) {
+            out.append(max);
+        }
+    } else {
+        out.append(max);
+        out.append(min);
+    }
+}
+
+void StripBuffer::decimate(double tStart, double tStop, int buckets, QVector<QPointF> &magnitude, QVector<QPointF> &phase) const
+{
+    magnitude.clear();
+    phase.clear();
+    if (count == 0 || buckets <= 0 || tStop <= tStart) {
+        return;
+    }
+
+    const int first = lower_bound(tStart);
+    const int last = lower_bound(tStop);
+    if (last - first <= 2 * buckets) {
+        // Few enough to plot every sample
+        for (int i = first; i < last; i++) {
+            const sample_t &s = at(i);
+            magnitude.append({s.time, s.magnitude});
+            phase.append({s.time, s.phase});
+        }
+        return;
+    }
+
+    const double width = (tStop - tStart) / buckets;
+    int i = first;
+    while (i < last) {
+        const int bucket = (at(i).time - tStart) / width;
+        const double end = tStart + (bucket + 1) * width;
+        const sample_t &s = at(i);
+        QPointF magMin(s.time, s.magnitude), magMax = magMin;
+        QPointF phaseMin(s.time, s.phase), phaseMax = phaseMin;
+        for (i++; i < last && at(i).time < end; i++) {
+            const sample_t &n = at(i);
+            if (n.magnitude < magMin.y()) {
+                magMin = {n.time, n.magnitude};
+            } else if (n.magnitude > magMax.y()) {
+                magMax = {n.time, n.magnitude};
+            }
+            if (n.phase < phaseMin.y()) {
+                phaseMin = {n.time, n.phase};
+            } else if (n.phase > phaseMax.y()) {
+                phaseMax = {n.time, n.phase};
+            }
+        }
+        add_extremes(magnitude, magMin, magMax);
+        add_extremes(phase, phaseMin, phaseMax);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef STRIPBUFFER_H
+#define STRIPBUFFER_H
+
+#include <QVector>
+#include <QPointF>
+
+// Rolling history of a CW time sweep. The samples are kept in a ring of fixed size, the oldest ones are
+// overwritten. For display, the history is reduced to the minimum and maximum per bucket, so the number
+// of plotted points depends on the chart width and not on the sample rate.
+class StripBuffer
+{
+public:
+    explicit StripBuffer(int capacity = DEFAULT_CAPACITY);
+
+    static constexpr int DEFAULT_CAPACITY = 1 << 18;
+
+    void clear();
+
+    // Samples have to be added in ascending time
+    void append(double time, float magnitude, float phase);
+
+    int size() const { return count; }
+    double first_time() const;
+    double last_time() const;
+
+    // Min and max of every bucket between tStart and tStop in the order they occur, at most 2 * buckets points each
+    void decimate(double tStart, double tStop, int buckets, QVector<QPointF> &magnitude, QVector<QPointF> &phase) const;
+
+private:
+    struct sample_t {
+        double time;
+        float magnitude;
+        float phase;
+    };
+    QVector<sample_t> ring;
+    int head; // Index of the oldest sample
+    int count;
+
+    const sample_t &at(int i) const { return ring.at((head + i) % ring.size()); }
+    int lower_bound(double time) const; // First sample at or after time
+};
+
+#endif // STRIPBUFFER_H
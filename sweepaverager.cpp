@@ -0,0 +1,179 @@
+#include "sweepaverager.h"
+#include "impedancekernels.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef ZKERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+static constexpr float RAD_TO_DEG = 57.29577951308232f;
+
+static void welford_scalar(float n, const float *re, const float *im, float *meanRe, float *meanIm, float *m2, std::size_t points)
+{
+    const float invN = 1.0f / n;
+    for (std::size_t i = 0; i < points; i++) {
+        float dRe = re[i] - meanRe[i];
+        float dIm = im[i] - meanIm[i];
+        meanRe[i] += dRe * invN;
+        meanIm[i] += dIm * invN;
+        // Re(d * conj(x - new mean)), the complex form of delta * delta2
+        m2[i] += dRe * (re[i] - meanRe[i]) + dIm * (im[i] - meanIm[i]);
+    }
+}
+
+#ifdef ZKERNELS_AVX2
+ZKERNELS_TARGET_AVX2
+static void welford_avx2(float n, const float *re, const float *im, float *meanRe, float *meanIm, float *m2, std::size_t points)
+{
+    const __m256 invN = _mm256_set1_ps(1.0f / n);
+
+    std::size_t i = 0;
+    for (; i + 8 <= points; i += 8) {
+        __m256 xRe = _mm256_loadu_ps(re + i);
+        __m256 xIm = _mm256_loadu_ps(im + i);
+        __m256 mRe = _mm256_loadu_ps(meanRe + i);
+        __m256 mIm = _mm256_loadu_ps(meanIm + i);
+
+        __m256 dRe = _mm256_sub_ps(xRe, mRe);
+        __m256 dIm = _mm256_sub_ps(xIm, mIm);
+        mRe = _mm256_fmadd_ps(dRe, invN, mRe);
+        mIm = _mm256_fmadd_ps(dIm, invN, mIm);
+        __m256 s = _mm256_mul_ps(dRe, _mm256_sub_ps(xRe, mRe));
+        s = _mm256_fmadd_ps(dIm, _mm256_sub_ps(xIm, mIm), s);
+
+        _mm256_storeu_ps(meanRe + i, mRe);
+        _mm256_storeu_ps(meanIm + i, mIm);
+        _mm256_storeu_ps(m2 + i, _mm256_add_ps(_mm256_loadu_ps(m2 + i), s));
+    }
+
+    welford_scalar(n, re + i, im + i, meanRe + i, meanIm + i, m2 + i, points - i);
+}
+#endif
+
+SweepAverager::SweepAverager()
+{
+    reset();
+}
+
+void SweepAverager::reset()
+{
+    sweeps = 0;
+    phaseReference = 0;
+    frequency.clear();
+    meanRe.clear();
+    meanIm.clear();
+    m2.clear();
+}
+
+void SweepAverager::add(const QVector<float> &stimulus, const QVector<float> &magnitudeDb, const QVector<float> &phaseDeg)
+{
+    const int points = stimulus.size();
+    if (magnitudeDb.size() != points || phaseDeg.size() != points) {
+        return;
+    }
+    if (stimulus != frequency) {
+        reset();
+        frequency = stimulus;
+        meanRe.fill(0, points);
+        meanIm.fill(0, points);
+        m2.fill(0, points);
+    }
+
+    QVector<float> re(points);
+    QVector<float> im(points);
+    zkernels::polar_to_rect(magnitudeDb.constData(), phaseDeg.constData(), re.data(), im.data(), points);
+
+    sweeps++;
+#ifdef ZKERNELS_AVX2
+    if (zkernels::has_avx2()) {
+        welford_avx2(sweeps, re.constData(), im.constData(), meanRe.data(), meanIm.data(), m2.data(), points);
+    } else {
+        welford_scalar(sweeps, re.constData(), im.constData(), meanRe.data(), meanIm.data(), m2.data(), points);
+    }
+#else
+    welford_scalar(sweeps, re.constData(), im.constData(), meanRe.data(), meanIm.data(), m2.data(), points);
+#endif
+    if (points > 0) {
+        phaseReference = phaseDeg.first();
+    }
+}
+
+void SweepAverager::mean(QVector<float> &magnitudeDb, QVector<float> &phaseDeg, bool unwrap) const
+{
+    const int points = meanRe.size();
+    magnitudeDb.resize(points);
+    phaseDeg.resize(points);
+    zkernels::rect_to_polar(meanRe.constData(), meanIm.constData(), magnitudeDb.data(), phaseDeg.data(), points);
+    if (!unwrap || points == 0) {
+        return;
+    }
+    phaseDeg[0] += 360.0f * std::round((phaseReference - phaseDeg.at(0)) / 360.0f);
+    for (int i = 1; i < points; i++) {
+        phaseDeg[i] = phaseDeg.at(i - 1) + std::remainder(phaseDeg.at(i) - phaseDeg.at(i - 1), 360.0f);
+    }
+}
+
+double SweepAverager::t_quantile(int degreesOfFreedom)
+{
+    // Two-sided 95 % quantiles of the t-distribution
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    const int size = sizeof(table) / sizeof(table[0]);
+    if (degreesOfFreedom < 1) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return degreesOfFreedom <= size ? table[degreesOfFreedom - 1] : 1.96;
+}
+
+QVector<float> SweepAverager::relative_error() const
+{
+    const int points = meanRe.size();
+    QVector<float> error(points);
+    // m2 holds the variance of both components, the noise is assumed to be circular
+    const float scale = 1.0f / (2.0f * (sweeps - 1) * sweeps);
+    for (int i = 0; i < points; i++) {
+        float magnitude = std::sqrt(meanRe.at(i) * meanRe.at(i) + meanIm.at(i) * meanIm.at(i));
+        error[i] = magnitude > 0 ? std::sqrt(m2.at(i) * scale) / magnitude : std::numeric_limits<float>::infinity();
+    }
+    return error;
+}
+
+void SweepAverager::uncertainty(QVector<float> &magnitudeDb, QVector<float> &phaseDeg) const
+{
+    magnitudeDb.clear();
+    phaseDeg.clear();
+    if (sweeps < MIN_SWEEPS) {
+        return;
+    }
+    const float t = t_quantile(sweeps - 1);
+    const QVector<float> error = relative_error();
+    magnitudeDb.resize(error.size());
+    phaseDeg.resize(error.size());
+    for (int i = 0; i < error.size(); i++) {
+        float e = t * error.at(i);
+        magnitudeDb[i] = 20.0f * std::log10(1.0f + e);
+        phaseDeg[i] = std::asin(std::min(1.0f, e)) * RAD_TO_DEG;
+    }
+}
+
+double SweepAverager::confidence() const
+{
+    QVector<float> magnitude;
+    QVector<float> phase;
+    uncertainty(magnitude, phase);
+    if (magnitude.isEmpty()) {
+        return std::numeric_limits<double>::infinity();
+    }
+    // Deep notches never settle, a few points are allowed to miss the target
+    int k = std::min<int>(magnitude.size() - 1, std::ceil(QUANTILE * magnitude.size()) - 1);
+    std::nth_element(magnitude.begin(), magnitude.begin() + k, magnitude.end());
+    return magnitude.at(k);
+}
+
+bool SweepAverager::converged(double targetDb) const
+{
+    return sweeps >= MIN_SWEEPS && confidence() <= targetDb;
+}
@@ -0,0 +1,48 @@
+#ifndef SWEEPAVERAGER_H
+#define SWEEPAVERAGER_H
+
+#include <QVector>
+
+// Host-side averaging of single sweeps. Every sweep is added as complex value per point with a Welford
+// update, so mean and variance are known after each sweep and the averaging can stop as soon as the
+// confidence interval is narrow enough.
+class SweepAverager
+{
+public:
+    SweepAverager();
+
+    static constexpr int MIN_SWEEPS = 3; // The variance of fewer sweeps is no useful estimate
+    static constexpr double QUANTILE = 0.95; // Share of the points that have to meet the target
+
+    void reset();
+
+    // Add a sweep with magnitude in dB and phase in degrees. A sweep with different stimulus starts the averaging again.
+    void add(const QVector<float> &stimulus, const QVector<float> &magnitudeDb, const QVector<float> &phaseDeg);
+
+    int count() const { return sweeps; }
+
+    // Averaged trace. The phase is unwrapped and aligned to the last sweep if unwrap is set.
+    void mean(QVector<float> &magnitudeDb, QVector<float> &phaseDeg, bool unwrap) const;
+
+    // Half width of the 95 % confidence interval of the mean per point, in dB and degrees. Empty before MIN_SWEEPS.
+    void uncertainty(QVector<float> &magnitudeDb, QVector<float> &phaseDeg) const;
+
+    // Magnitude confidence interval in dB met by QUANTILE of the points, infinite before MIN_SWEEPS
+    double confidence() const;
+
+    // True when the confidence interval meets target (dB)
+    bool converged(double targetDb) const;
+
+private:
+    int sweeps;
+    QVector<float> frequency;
+    QVector<float> meanRe;
+    QVector<float> meanIm;
+    QVector<float> m2; // Sum of squared distances to the mean, real and imaginary part together
+    float phaseReference; // First phase point of the last sweep
+
+    QVector<float> relative_error() const; // Standard error of one component relative to the magnitude of the mean
+    static double t_quantile(int degreesOfFreedom);
+};
+
+#endif // SWEEPAVERAGER_H
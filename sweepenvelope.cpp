@@ -0,0 +1,184 @@
+#include "sweepenvelope.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const float INF = std::numeric_limits<float>::infinity();
+
+SweepEnvelope::SweepEnvelope()
+{
+    windowSize = 0;
+    reset();
+}
+
+void SweepEnvelope::set_window(int sweeps)
+{
+    windowSize = qBound(0, sweeps, MAX_WINDOW);
+    reset();
+}
+
+void SweepEnvelope::reset()
+{
+    sweeps = 0;
+    points = 0;
+    head = 0;
+    olderCount = 0;
+    stimulus.clear();
+    mean.clear();
+    m2.clear();
+    runMin.clear();
+    runMax.clear();
+    ring.clear();
+    suffixMin.clear();
+    suffixMax.clear();
+}
+
+void SweepEnvelope::add(const QVector<float> &stimulus, const QVector<float> &values)
+{
+    if (stimulus.isEmpty() || values.size() != stimulus.size()) {
+        return;
+    }
+    if (stimulus != this->stimulus) {
+        reset();
+        this->stimulus = stimulus;
+        points = stimulus.size();
+        mean.fill(0, points);
+        m2.fill(0, points);
+        runMin.fill(INF, points);
+        runMax.fill(-INF, points);
+        if (windowSize) {
+            ring.resize(windowSize * points);
+            suffixMin.resize(windowSize * points);
+            suffixMax.resize(windowSize * points);
+        }
+    }
+
+    if (windowSize && sweeps == windowSize) {
+        pop();
+    }
+    push(values.constData());
+}
+
+void SweepEnvelope::add_phase(const QVector<float> &stimulus, const QVector<float> &values)
+{
+    if (sweeps == 0 || stimulus != this->stimulus || values.size() != points) {
+        // Starts over, the first sweep sets the branch
+        add(stimulus, values);
+        return;
+    }
+    QVector<float> unwrapped(points);
+    for (int i = 0; i < points; i++) {
+        const double delta = values[i] - mean[i];
+        unwrapped[i] = mean[i] + delta - 360.0 * std::round(delta / 360.0);
+    }
+    add(stimulus, unwrapped);
+}
+
+void SweepEnvelope::push(const float *values)
+{
+    sweeps++;
+    const double n = sweeps;
+    for (int i = 0; i < points; i++) {
+        const double delta = values[i] - mean[i];
+        mean[i] += delta / n;
+        m2[i] += delta * (values[i] - mean[i]);
+        runMin[i] = std::min(runMin[i], values[i]);
+        runMax[i] = std::max(runMax[i], values[i]);
+    }
+    if (windowSize) {
+        const int slot = (head + sweeps - 1) % windowSize;
+        std::copy(values, values + points, ring.begin() + slot * points);
+    }
+}
+
+void SweepEnvelope::pop()
+{
+    if (olderCount == 0) {
+        flip();
+    }
+    const float *values = ring.constData() + head * points;
+    head = (head + 1) % windowSize;
+    olderCount--;
+    sweeps--;
+    if (sweeps == 0) {
+        // Only happens with a window of one sweep, the reverse update would divide by zero
+        std::fill(mean.begin(), mean.end(), 0.0);
+        std::fill(m2.begin(), m2.end(), 0.0);
+        return;
+    }
+    const double n = sweeps;
+    for (int i = 0; i < points; i++) {
+        // Welford in reverse, exact again after the next flip
+        const double delta = values[i] - mean[i];
+        mean[i] -= delta / n;
+        m2[i] = std::max(0.0, m2[i] - delta * (values[i] - mean[i]));
+    }
+}
+
+void SweepEnvelope::flip()
+{
+    // All sweeps in the window become the older stack, newest first
+    float *sMin = suffixMin.data();
+    float *sMax = suffixMax.data();
+    const float *values = ring.constData();
+    int next = -1;
+    for (int k = sweeps - 1; k >= 0; k--) {
+        const int slot = (head + k) % windowSize;
+        float *curMin = sMin + slot * points;
+        float *curMax = sMax + slot * points;
+        const float *cur = values + slot * points;
+        if (next < 0) {
+            std::copy(cur, cur + points, curMin);
+            std::copy(cur, cur + points, curMax);
+        } else {
+            const float *nextMin = sMin + next * points;
+            const float *nextMax = sMax + next * points;
+            for (int i = 0; i < points; i++) {
+                curMin[i] = std::min(cur[i], nextMin[i]);
+                curMax[i] = std::max(cur[i], nextMax[i]);
+            }
+        }
+        next = slot;
+    }
+    olderCount = sweeps;
+    std::fill(runMin.begin(), runMin.end(), INF);
+    std::fill(runMax.begin(), runMax.end(), -INF);
+
+    // The window is traversed anyway, recompute mean and variance to drop the rounding of the removals
+    std::fill(mean.begin(), mean.end(), 0.0);
+    std::fill(m2.begin(), m2.end(), 0.0);
+    for (int k = 0; k < sweeps; k++) {
+        const float *cur = values + ((head + k) % windowSize) * points;
+        const double n = k + 1;
+        for (int i = 0; i < points; i++) {
+            const double delta = cur[i] - mean[i];
+            mean[i] += delta / n;
+            m2[i] += delta * (cur[i] - mean[i]);
+        }
+    }
+}
+
+void SweepEnvelope::bands(QVector<float> &min, QVector<float> &max, QVector<float> &sigmaLower, QVector<float> &sigmaUpper) const
+{
+    min.clear();
+    max.clear();
+    sigmaLower.clear();
+    sigmaUpper.clear();
+    if (sweeps == 0) {
+        return;
+    }
+    min.resize(points);
+    max.resize(points);
+    sigmaLower.resize(points);
+    sigmaUpper.resize(points);
+    const bool older = windowSize && olderCount > 0;
+    const float *olderMin = older ? suffixMin.constData() + head * points : nullptr;
+    const float *olderMax = older ? suffixMax.constData() + head * points : nullptr;
+    for (int i = 0; i < points; i++) {
+        min[i] = older ? std::min(olderMin[i], runMin[i]) : runMin[i];
+        max[i] = older ? std::max(olderMax[i], runMax[i]) : runMax[i];
+        const double sigma = sweeps > 1 ? std::sqrt(m2[i] / (sweeps - 1)) : 0;
+        sigmaLower[i] = mean[i] - sigma;
+        sigmaUpper[i] = mean[i] + sigma;
+    }
+}
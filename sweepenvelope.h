@@ -0,0 +1,62 @@
+#ifndef SWEEPENVELOPE_H
+#define SWEEPENVELOPE_H
+
+#include <QVector>
+
+// Running per-point statistics of one trace over the sweeps of a run: mean, standard deviation, min and max.
+// Over the whole run, mean and variance are a Welford update and min/max a running comparison, so each point
+// keeps four values no matter how many sweeps were added.
+// With a window, the last sweeps are kept in a ring. The oldest sweep is removed from mean and variance
+// again, min and max come from a queue made of two stacks: the older part holds min/max from each sweep to
+// the end of that part, the newer part a running min/max. When the older part is used up, the newer one is
+// converted in one pass. Every sweep costs O(1) per point, amortized, independent of the window.
+class SweepEnvelope
+{
+public:
+    SweepEnvelope();
+
+    // Number of sweeps in the window, 0 for the whole run. Starts over. The ring takes window * points floats
+    // three times, so the window is limited to MAX_WINDOW sweeps.
+    static constexpr int MAX_WINDOW = 1000;
+    void set_window(int sweeps);
+    int window() const { return windowSize; }
+
+    void reset();
+
+    // Add a sweep. A sweep with different stimulus starts over.
+    void add(const QVector<float> &stimulus, const QVector<float> &values);
+    // Add a phase sweep in degrees. Each point is moved to the 360° branch nearest its mean first, so jitter
+    // around ±180° doesn't spread over the whole circle.
+    void add_phase(const QVector<float> &stimulus, const QVector<float> &values);
+
+    int count() const { return sweeps; }
+    const QVector<float> &frequency() const { return stimulus; }
+
+    // Bounds per point: min/max and mean +- one standard deviation. Empty before the first sweep.
+    void bands(QVector<float> &min, QVector<float> &max, QVector<float> &sigmaLower, QVector<float> &sigmaUpper) const;
+
+private:
+    int windowSize;
+    int sweeps; // In the window
+    int points;
+    QVector<float> stimulus;
+    QVector<double> mean;
+    QVector<double> m2; // Sum of squared distances to the mean
+
+    // Whole run: running min/max. Window: min/max of the newer stack.
+    QVector<float> runMin;
+    QVector<float> runMax;
+
+    // Window only, one row of points per sweep slot
+    QVector<float> ring;
+    QVector<float> suffixMin; // Min from this slot to the end of the older stack
+    QVector<float> suffixMax;
+    int head; // Slot of the oldest sweep
+    int olderCount; // Sweeps in the older stack, they start at head
+
+    void push(const float *values);
+    void pop();
+    void flip();
+};
+
+#endif // SWEEPENVELOPE_H
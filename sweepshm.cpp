@@ -0,0 +1,255 @@
+#include "sweepshm.h"
+
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SWEEPSHM_POSIX
+#endif
+
+namespace sweepshm {
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory needs lock free 64 bit atomics");
+
+// The header gets its own cache lines, see the layout in sweepshm.h
+static std::size_t header_size()
+{
+    return (sizeof(header_t) + 63) & ~std::size_t(63);
+}
+
+std::size_t slot_size(uint32_t maxPoints)
+{
+    std::size_t size = sizeof(slot_header_t) + 3 * std::size_t(maxPoints) * sizeof(float);
+    // Keep every slot on its own cache lines
+    return (size + 63) & ~std::size_t(63);
+}
+
+std::size_t total_size(uint32_t slotCount, uint32_t maxPoints)
+{
+    return header_size() + std::size_t(slotCount) * slot_size(maxPoints);
+}
+
+static unsigned char *slot_base(const void *base, uint64_t index, std::size_t slotSize)
+{
+    return const_cast<unsigned char*>(static_cast<const unsigned char*>(base)) + header_size() + index * slotSize;
+}
+
+Writer::~Writer()
+{
+    close();
+}
+
+bool Writer::open(const std::string &name, uint32_t slotCount, uint32_t maxPoints)
+{
+#ifdef SWEEPSHM_POSIX
+    close();
+    if (slotCount < 2 || maxPoints == 0) {
+        return false;
+    }
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    size = total_size(slotCount, maxPoints);
+    if (ftruncate(fd, size) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        base = nullptr;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    shmName = name;
+    seq = 0;
+
+    // ftruncate() zero fills, so all slot locks start out even and empty
+    header_t *hdr = static_cast<header_t*>(base);
+    hdr->magic = MAGIC;
+    hdr->version = VERSION;
+    hdr->slotCount = slotCount;
+    hdr->maxPoints = maxPoints;
+    hdr->slotSize = slot_size(maxPoints);
+    hdr->latest.store(0, std::memory_order_release);
+    return true;
+#else
+    (void) name;
+    (void) slotCount;
+    (void) maxPoints;
+    return false;
+#endif
+}
+
+void Writer::close()
+{
+#ifdef SWEEPSHM_POSIX
+    if (base) {
+        munmap(base, size);
+        shm_unlink(shmName.c_str());
+    }
+#endif
+    base = nullptr;
+    size = 0;
+}
+
+bool Writer::publish(const float *stimulus, const float *channel1, const float *channel2, uint32_t points,
+                     const float scaleRef[4], const parameters_t &params)
+{
+    if (!base) {
+        return false;
+    }
+
+    header_t *hdr = static_cast<header_t*>(base);
+    if (points > hdr->maxPoints) {
+        points = hdr->maxPoints;
+    }
+
+    uint64_t next = seq + 1;
+    unsigned char *slot = slot_base(base, next % hdr->slotCount, hdr->slotSize);
+    slot_header_t *sh = reinterpret_cast<slot_header_t*>(slot);
+    float *data = reinterpret_cast<float*>(slot + sizeof(slot_header_t));
+
+    uint64_t lock = sh->lock.load(std::memory_order_relaxed);
+    sh->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    sh->sequence = next;
+    sh->points = points;
+    sh->channel1Scale = scaleRef[0];
+    sh->channel1RefVal = scaleRef[1];
+    sh->channel2Scale = scaleRef[2];
+    sh->channel2RefVal = scaleRef[3];
+    sh->params = params;
+    std::memcpy(data, stimulus, points * sizeof(float));
+    std::memcpy(data + hdr->maxPoints, channel1, points * sizeof(float));
+    std::memcpy(data + 2 * std::size_t(hdr->maxPoints), channel2, points * sizeof(float));
+
+    sh->lock.store(lock + 2, std::memory_order_release);
+    hdr->latest.store(next, std::memory_order_release);
+    seq = next;
+    return true;
+}
+
+Reader::~Reader()
+{
+    close();
+}
+
+bool Reader::open(const std::string &name)
+{
+#ifdef SWEEPSHM_POSIX
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(header_t)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    base = mapped;
+    size = st.st_size;
+
+    const header_t *hdr = header();
+    // Same limits as Writer::open(), the slot index is taken modulo slotCount
+    if (hdr->magic != MAGIC || hdr->version != VERSION || hdr->slotCount < 2 || hdr->maxPoints == 0
+        || hdr->slotSize != slot_size(hdr->maxPoints) || total_size(hdr->slotCount, hdr->maxPoints) > size) {
+        close();
+        return false;
+    }
+    return true;
+#else
+    (void) name;
+    return false;
+#endif
+}
+
+void Reader::close()
+{
+#ifdef SWEEPSHM_POSIX
+    if (base) {
+        munmap(const_cast<void*>(base), size);
+    }
+#endif
+    base = nullptr;
+    size = 0;
+}
+
+uint64_t Reader::latest() const
+{
+    if (!base) {
+        return 0;
+    }
+    return header()->latest.load(std::memory_order_acquire);
+}
+
+bool Reader::acquire_latest(view_t &view) const
+{
+    uint64_t sequence = latest();
+    if (sequence == 0) {
+        return false;
+    }
+    return acquire(sequence, view);
+}
+
+bool Reader::acquire(uint64_t sequence, view_t &view) const
+{
+    if (!base || sequence == 0) {
+        return false;
+    }
+
+    const header_t *hdr = header();
+    const unsigned char *slot = slot_base(base, sequence % hdr->slotCount, hdr->slotSize);
+    const slot_header_t *sh = reinterpret_cast<const slot_header_t*>(slot);
+
+    uint64_t lock = sh->lock.load(std::memory_order_acquire);
+    if (lock & 1) {
+        return false; // Writer is busy with this slot
+    }
+
+    view.sequence = sh->sequence;
+    view.points = sh->points;
+    view.header = sh;
+    view.stimulus = reinterpret_cast<const float*>(slot + sizeof(slot_header_t));
+    view.channel1 = view.stimulus + hdr->maxPoints;
+    view.channel2 = view.channel1 + hdr->maxPoints;
+    view.lock = lock;
+
+    if (view.sequence != sequence || view.points > hdr->maxPoints) {
+        return false;
+    }
+    return valid(view);
+}
+
+bool Reader::valid(const view_t &view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.header->lock.load(std::memory_order_relaxed) == view.lock;
+}
+
+uint32_t Reader::max_points() const
+{
+    return base ? header()->maxPoints : 0;
+}
+
+} // namespace sweepshm
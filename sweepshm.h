@@ -0,0 +1,139 @@
+#ifndef SWEEPSHM_H
+#define SWEEPSHM_H
+
+/* Shared memory publication of completed sweeps.
+ *
+ * The writer (the GUI) owns a POSIX shared memory object which holds a small header and a ring of slots.
+ * Every slot is protected by a sequence lock: the writer makes the lock odd, copies the sweep into the slot
+ * and makes it even again. Readers take a snapshot of the lock, use the data in place and check afterwards
+ * that the lock did not change. Because the writer cycles through the ring, a reader has (slots - 1) sweeps
+ * worth of time to use a slot before it is overwritten.
+ *
+ * This file does not depend on Qt so that external consumers can use the reader on its own.
+ *
+ * Memory layout (native byte order, all offsets in bytes):
+ *   header_t                       at 0, padded to a multiple of 64 bytes (headerSize)
+ *   slot i                         at headerSize + i * slotSize, slotSize = slot_size(maxPoints)
+ *     slot_header_t                at slot + 0
+ *     float stimulus[maxPoints]    at slot + sizeof(slot_header_t)
+ *     float channel1[maxPoints]    following stimulus
+ *     float channel2[maxPoints]    following channel1
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace sweepshm {
+
+constexpr uint32_t MAGIC = 0x31353738; // "8751"
+constexpr uint32_t VERSION = 1;
+
+struct parameters_t {
+    double fStart;
+    double fStop;
+    uint32_t points;
+    int32_t power;
+    uint32_t ifbw; // HP8751A::ifbw_t
+    uint32_t averFact; // 1 if averaging is disabled
+    uint8_t attenR;
+    uint8_t attenA;
+    uint8_t unwrapPhase;
+    uint8_t reserved;
+};
+
+struct header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t maxPoints;
+    uint64_t slotSize;
+    std::atomic<uint64_t> latest; // Sequence number of the newest complete sweep, 0 if none yet
+};
+
+struct alignas(64) slot_header_t {
+    std::atomic<uint64_t> lock; // Odd while the writer updates the slot
+    uint64_t sequence;
+    uint32_t points;
+    float channel1Scale;
+    float channel1RefVal;
+    float channel2Scale;
+    float channel2RefVal;
+    parameters_t params;
+};
+
+// Pointers into a slot. Only valid while Reader::valid() returns true for it.
+struct view_t {
+    uint64_t sequence;
+    uint32_t points;
+    const slot_header_t *header;
+    const float *stimulus;
+    const float *channel1;
+    const float *channel2;
+    uint64_t lock;
+};
+
+std::size_t slot_size(uint32_t maxPoints);
+std::size_t total_size(uint32_t slotCount, uint32_t maxPoints);
+
+class Writer
+{
+public:
+    Writer() = default;
+    ~Writer();
+    Writer(const Writer&) = delete;
+    Writer &operator=(const Writer&) = delete;
+
+    // Create (or recreate) the shared memory object, e.g. name = "/hp8751a_sweeps"
+    bool open(const std::string &name, uint32_t slotCount, uint32_t maxPoints);
+    void close();
+
+    // Copy one sweep into the next slot. Sweeps with more than maxPoints points are truncated.
+    bool publish(const float *stimulus, const float *channel1, const float *channel2, uint32_t points,
+                 const float scaleRef[4], const parameters_t &params);
+
+    uint64_t sequence() const { return seq; }
+
+private:
+    std::string shmName;
+    void *base = nullptr;
+    std::size_t size = 0;
+    uint64_t seq = 0;
+};
+
+class Reader
+{
+public:
+    Reader() = default;
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader &operator=(const Reader&) = delete;
+
+    bool open(const std::string &name);
+    void close();
+
+    // Sequence number of the newest sweep, 0 if nothing has been published yet
+    uint64_t latest() const;
+
+    // Map the newest sweep without copying. Returns false if there is none or the writer is busy with it.
+    bool acquire_latest(view_t &view) const;
+
+    // Map a specific sweep. Returns false if it has already been overwritten or is not written yet.
+    bool acquire(uint64_t sequence, view_t &view) const;
+
+    // True if the slot behind view has not been touched by the writer since acquire().
+    // Check this after reading the data; if it fails, the data read may be torn.
+    bool valid(const view_t &view) const;
+
+    uint32_t max_points() const;
+
+private:
+    const void *base = nullptr;
+    std::size_t size = 0;
+    const header_t *header() const { return static_cast<const header_t*>(base); }
+};
+
+} // namespace sweepshm
+
+#endif // SWEEPSHM_H
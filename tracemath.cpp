@@ -0,0 +1,142 @@
+#include "tracemath.h"
+#include "impedancekernels.h"
+#include "tracestore.h"
+#include <algorithm>
+#include <cmath>
+
+static const char *REFERENCE_DIR = "references";
+static const double DEG_TO_RAD = M_PI / 180.0;
+
+TraceMath::TraceMath()
+{
+    gridValid = false;
+}
+
+bool TraceMath::capture(const QString &name, const HP8751A::instrument_data_t &data)
+{
+    const int points = data.stimulus.size();
+    if (name.isEmpty() || points == 0 || data.channel1.size() != points || data.channel2.size() != points) {
+        return false;
+    }
+
+    this->name = name;
+    frequency.resize(points);
+    reference.resize(points);
+    for (int i = 0; i < points; i++) {
+        frequency[i] = data.stimulus.at(i);
+        reference[i] = std::polar(std::pow(10.0, data.channel1.at(i) / 20.0), data.channel2.at(i) * DEG_TO_RAD);
+    }
+
+    gridValid = false;
+    return save();
+}
+
+void TraceMath::clear()
+{
+    name.clear();
+    frequency.clear();
+    reference.clear();
+    gridValid = false;
+}
+
+double TraceMath::min_frequency() const
+{
+    return frequency.isEmpty() ? 0 : frequency.first();
+}
+
+double TraceMath::max_frequency() const
+{
+    return frequency.isEmpty() ? 0 : frequency.last();
+}
+
+bool TraceMath::save() const
+{
+    return is_valid() && TraceStore::save_trace(REFERENCE_DIR, name, QJsonObject(), frequency, reference);
+}
+
+bool TraceMath::load(const QString &name)
+{
+    QJsonObject root;
+    if (!TraceStore::load_trace(REFERENCE_DIR, name, frequency, reference, &root)) {
+        return false;
+    }
+    this->name = root["name"].toString(name);
+    gridValid = false;
+    return true;
+}
+
+QStringList TraceMath::stored_references()
+{
+    return TraceStore::stored(REFERENCE_DIR);
+}
+
+bool TraceMath::prepare(const QVector<float> &grid)
+{
+    if (!is_valid()) {
+        return false;
+    }
+    if (gridValid && grid == this->grid) {
+        return true;
+    }
+
+    gridValid = false;
+    if (!TraceStore::covers(frequency, grid)) {
+        return false;
+    }
+    TraceStore::interpolate(frequency, reference, grid, gridRe, gridIm);
+
+    this->grid = grid;
+    gridValid = true;
+    return true;
+}
+
+bool TraceMath::apply(operation_t operation, HP8751A::instrument_data_t &data, bool unwrap)
+{
+    const int points = data.stimulus.size();
+    if (operation == OP_OFF || data.channel1.size() != points || data.channel2.size() != points || !prepare(data.stimulus)) {
+        return false;
+    }
+
+    const float phaseStart = points ? data.channel2.first() : 0;
+    re.resize(points);
+    im.resize(points);
+    zkernels::polar_to_rect(data.channel1.constData(), data.channel2.constData(), re.data(), im.data(), points);
+    if (operation == OP_DIVIDE) {
+        zkernels::complex_divide(re.constData(), im.constData(), gridRe.constData(), gridIm.constData(), re.data(), im.data(), points);
+    } else {
+        zkernels::complex_subtract(re.constData(), im.constData(), gridRe.constData(), gridIm.constData(), re.data(), im.data(), points);
+    }
+    zkernels::rect_to_polar(re.constData(), im.constData(), data.channel1.data(), data.channel2.data(), points);
+
+    if (unwrap) {
+        unwrap_phase(data.channel2, phaseStart - (operation == OP_DIVIDE ? std::atan2(gridIm.first(), gridRe.first()) / DEG_TO_RAD : 0));
+    }
+    // The autoscale values of the instrument belong to the data before the math
+    autoscale(data.channel1, data.channel1Scale, data.channel1RefVal);
+    autoscale(data.channel2, data.channel2Scale, data.channel2RefVal);
+    return true;
+}
+
+void TraceMath::unwrap_phase(QVector<float> &phase, float phaseReference)
+{
+    // Continue from the phase of the sweep, a division also removes the phase of the reference
+    const int points = phase.size();
+    if (points == 0) {
+        return;
+    }
+    phase[0] += 360.0f * std::round((phaseReference - phase.at(0)) / 360.0f);
+    for (int i = 1; i < points; i++) {
+        phase[i] = phase.at(i - 1) + std::remainder(phase.at(i) - phase.at(i - 1), 360.0f);
+    }
+}
+
+void TraceMath::autoscale(const QVector<float> &trace, float &scale, float &refVal)
+{
+    if (trace.isEmpty()) {
+        return;
+    }
+    auto range = std::minmax_element(trace.constBegin(), trace.constEnd());
+    // Ten divisions like the instrument, with some room above and below
+    refVal = (*range.first + *range.second) / 2;
+    scale = qMax(1.2f * (*range.second - *range.first) / 10, 0.01f);
+}
@@ -0,0 +1,69 @@
+#ifndef TRACEMATH_H
+#define TRACEMATH_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <complex>
+#include "hp8751a.h"
+
+/* Host-side trace math against a stored reference trace (data / memory, data - memory).
+ * References are captured from any sweep and stored by name in the references directory next to
+ * config.ini. Like the one-port calibration they are interpolated onto the grid of the sweep, so the
+ * reference doesn't have to be measured again after start, stop or the number of points changed.
+ * Data / memory with a fixture-only reference normalizes the sweep to the fixture.
+ */
+class TraceMath
+{
+public:
+    TraceMath();
+
+    // Same order as the entries of the memoryMath combo boxes
+    enum operation_t {
+        OP_OFF,
+        OP_DIVIDE,
+        OP_SUBTRACT
+    };
+
+    // Take magnitude (dB) and phase (degrees) of a sweep as reference and store it
+    bool capture(const QString &name, const HP8751A::instrument_data_t &data);
+
+    bool load(const QString &name);
+    void clear();
+    static QStringList stored_references();
+
+    bool is_valid() const { return !frequency.isEmpty(); }
+    QString reference_name() const { return name; }
+    double min_frequency() const;
+    double max_frequency() const;
+
+    // Apply the operation to channel1 (dB) and channel2 (degrees) of the sweep. The reference is
+    // interpolated once per grid. Returns false and leaves the data untouched if the grid exceeds the
+    // range of the reference. With unwrap, the phase continues from the phase of the sweep.
+    bool apply(operation_t operation, HP8751A::instrument_data_t &data, bool unwrap);
+
+    // Unwrap the phase in place, starting at the multiple of 360 degrees closest to phaseReference
+    static void unwrap_phase(QVector<float> &phase, float phaseReference);
+    // Channel scale and reference value that fit the trace, for data changed on the host
+    static void autoscale(const QVector<float> &trace, float &scale, float &refVal);
+
+private:
+    QString name;
+    QVector<double> frequency;
+    QVector<std::complex<double>> reference;
+
+    // Reference on the current grid
+    QVector<float> grid;
+    QVector<float> gridRe;
+    QVector<float> gridIm;
+    bool gridValid;
+    bool prepare(const QVector<float> &grid);
+
+    // Scratch buffers, keep their allocation between sweeps
+    QVector<float> re;
+    QVector<float> im;
+
+    bool save() const;
+};
+
+#endif // TRACEMATH_H
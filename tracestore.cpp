@@ -0,0 +1,158 @@
+#include "tracestore.h"
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <cmath>
+
+typedef std::complex<double> cplx;
+
+QString TraceStore::valid_name(const QString &name)
+{
+    QString fileName = name;
+    return fileName.replace(QRegularExpression("[^A-Za-z0-9_.-]"), "_");
+}
+
+QString TraceStore::file_name(const QString &directory, const QString &name)
+{
+    return QString("%1/%2.json").arg(directory, valid_name(name));
+}
+
+QStringList TraceStore::stored(const QString &directory)
+{
+    QStringList names;
+    QDir dir(directory);
+    for (const QString &entry : dir.entryList({"*.json"}, QDir::Files, QDir::Name)) {
+        names.append(entry.chopped(5));
+    }
+    return names;
+}
+
+bool TraceStore::remove(const QString &directory, const QString &name)
+{
+    return QFile::remove(file_name(directory, name));
+}
+
+bool TraceStore::write(const QString &directory, const QString &name, const QJsonObject &root)
+{
+    if (!QDir().mkpath(directory)) {
+        return false;
+    }
+    QFile file(file_name(directory, name));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+bool TraceStore::read(const QString &directory, const QString &name, QJsonObject &root)
+{
+    QFile file(file_name(directory, name));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    root = QJsonDocument::fromJson(file.readAll()).object();
+    return true;
+}
+
+bool TraceStore::save_trace(const QString &directory, const QString &name, QJsonObject root,
+                            const QVector<double> &frequency, const QVector<cplx> &values)
+{
+    if (frequency.isEmpty() || values.size() != frequency.size()) {
+        return false;
+    }
+
+    QJsonArray freq;
+    QJsonArray re;
+    QJsonArray im;
+    for (int i = 0; i < frequency.size(); i++) {
+        freq.append(frequency.at(i));
+        re.append(values.at(i).real());
+        im.append(values.at(i).imag());
+    }
+
+    root["name"] = name;
+    root["created"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    root["frequency"] = freq;
+    root["re"] = re;
+    root["im"] = im;
+    return write(directory, name, root);
+}
+
+bool TraceStore::load_trace(const QString &directory, const QString &name, QVector<double> &frequency,
+                            QVector<cplx> &values, QJsonObject *root)
+{
+    QJsonObject object;
+    if (!read(directory, name, object)) {
+        return false;
+    }
+
+    QJsonArray freq = object["frequency"].toArray();
+    QJsonArray re = object["re"].toArray();
+    QJsonArray im = object["im"].toArray();
+    if (freq.isEmpty() || re.size() != freq.size() || im.size() != freq.size()) {
+        return false;
+    }
+
+    const int points = freq.size();
+    frequency.resize(points);
+    values.resize(points);
+    for (int i = 0; i < points; i++) {
+        frequency[i] = freq.at(i).toDouble();
+        values[i] = cplx(re.at(i).toDouble(), im.at(i).toDouble());
+    }
+    if (root) {
+        *root = object;
+    }
+    return true;
+}
+
+bool TraceStore::covers(const QVector<double> &frequency, const QVector<float> &grid)
+{
+    if (frequency.isEmpty()) {
+        return false;
+    }
+    const double fMin = frequency.first() * (1 - 1e-6);
+    const double fMax = frequency.last() * (1 + 1e-6);
+    for (float f : grid) {
+        if (f < fMin || f > fMax) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TraceStore::interpolate(const QVector<double> &frequency, const QVector<cplx> &values,
+                             const QVector<float> &grid, QVector<float> &re, QVector<float> &im)
+{
+    const int points = grid.size();
+    re.resize(points);
+    im.resize(points);
+
+    // The grid is ascending, so the search position only moves forward
+    const int n = frequency.size();
+    int k = 0;
+    for (int i = 0; i < points; i++) {
+        double f = grid.at(i);
+        while (k < n - 2 && frequency.at(k + 1) < f) {
+            k++;
+        }
+
+        cplx value;
+        if (n == 1) {
+            value = values.first();
+        } else {
+            double x0 = std::log(frequency.at(k));
+            double x1 = std::log(frequency.at(k + 1));
+            // List sweeps can repeat a frequency where segments meet
+            double a = x1 > x0 ? (std::log(qMax(f, 1e-3)) - x0) / (x1 - x0) : 0;
+            a = qBound(0.0, a, 1.0);
+            value = values.at(k) + a * (values.at(k + 1) - values.at(k));
+        }
+        re[i] = value.real();
+        im[i] = value.imag();
+    }
+}
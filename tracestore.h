@@ -0,0 +1,39 @@
+#ifndef TRACESTORE_H
+#define TRACESTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QJsonObject>
+#include <complex>
+
+/* Store of the host-side corrections: reference traces, fixtures and one-port error terms.
+ * Each entry is a JSON file <directory>/<name>.json in a directory next to config.ini. A complex trace is
+ * kept as ascending frequencies with real and imaginary parts and interpolated onto the grid of a sweep.
+ */
+class TraceStore
+{
+public:
+    // Name as stored: everything but letters, digits, '_', '.' and '-' becomes '_'
+    static QString valid_name(const QString &name);
+    static QString file_name(const QString &directory, const QString &name);
+    static QStringList stored(const QString &directory);
+    static bool remove(const QString &directory, const QString &name);
+
+    static bool write(const QString &directory, const QString &name, const QJsonObject &root);
+    static bool read(const QString &directory, const QString &name, QJsonObject &root);
+
+    // Complex trace in "frequency", "re" and "im", next to "name", "created" and the entries of root
+    static bool save_trace(const QString &directory, const QString &name, QJsonObject root,
+                           const QVector<double> &frequency, const QVector<std::complex<double>> &values);
+    static bool load_trace(const QString &directory, const QString &name, QVector<double> &frequency,
+                           QVector<std::complex<double>> &values, QJsonObject *root = nullptr);
+
+    // True if the grid lies inside the frequency range, allowing for the float rounding of the stimulus values
+    static bool covers(const QVector<double> &frequency, const QVector<float> &grid);
+    // Linear interpolation of real and imaginary part over log frequency onto an ascending grid inside the range
+    static void interpolate(const QVector<double> &frequency, const QVector<std::complex<double>> &values,
+                            const QVector<float> &grid, QVector<float> &re, QVector<float> &im);
+};
+
+#endif // TRACESTORE_H
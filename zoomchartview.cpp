@@ -0,0 +1,72 @@
+#include "zoomchartview.h"
+
+ZoomChartView::ZoomChartView(QChart *chart, QWidget *parent) : QChartView(chart, parent)
+{
+    band = new QRubberBand(QRubberBand::Rectangle, this);
+}
+
+double ZoomChartView::frequency_at(int x)
+{
+    QList<QAbstractSeries*> series = chart()->series();
+    if (series.isEmpty()) {
+        return 0;
+    }
+    return chart()->mapToValue(QPointF(x, chart()->plotArea().center().y()), series.first()).x();
+}
+
+void ZoomChartView::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton || !chart()->plotArea().contains(event->pos())) {
+        QChartView::mousePressEvent(event);
+        return;
+    }
+    // The band always covers the full height of the plot area
+    QRectF area = chart()->plotArea();
+    origin = event->pos();
+    band->setGeometry(QRect(origin.x(), area.top(), 0, area.height()));
+    band->show();
+    event->accept();
+}
+
+void ZoomChartView::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!band->isVisible()) {
+        QChartView::mouseMoveEvent(event);
+        return;
+    }
+    QRectF area = chart()->plotArea();
+    int x = qBound((int)area.left(), event->pos().x(), (int)area.right());
+    band->setGeometry(QRect(qMin(origin.x(), x), area.top(), qAbs(x - origin.x()), area.height()));
+    event->accept();
+}
+
+void ZoomChartView::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton || !band->isVisible()) {
+        QChartView::mouseReleaseEvent(event);
+        return;
+    }
+    band->hide();
+    QRect rect = band->geometry();
+    event->accept();
+
+    // Ignore plain clicks
+    if (rect.width() < 5) {
+        return;
+    }
+    double fStart = frequency_at(rect.left());
+    double fStop = frequency_at(rect.right());
+    if (fStart > 0 && fStop > fStart) {
+        emit span_selected(fStart, fStop);
+    }
+}
+
+void ZoomChartView::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        emit full_span_requested();
+        event->accept();
+        return;
+    }
+    QChartView::mouseDoubleClickEvent(event);
+}
@@ -0,0 +1,31 @@
+#ifndef ZOOMCHARTVIEW_H
+#define ZOOMCHARTVIEW_H
+
+#include <QtCharts>
+
+// Chart view with a horizontal rubber band. The chart itself is not zoomed,
+// the owner decides what to do with the selected frequency span.
+class ZoomChartView : public QChartView
+{
+    Q_OBJECT
+public:
+    explicit ZoomChartView(QChart *chart, QWidget *parent = nullptr);
+
+protected:
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    QRubberBand *band = nullptr;
+    QPoint origin;
+
+    double frequency_at(int x);
+
+signals:
+    void span_selected(double fStart, double fStop);
+    void full_span_requested();
+};
+
+#endif // ZOOMCHARTVIEW_H
@@ -0,0 +1,149 @@
+#include "zoomsweep.h"
+#include <cmath>
+
+ZoomSweep::ZoomSweep(HP8751A *hp, QObject *parent) : QObject(parent)
+{
+    this->hp = hp;
+    state = STATE_IDLE;
+    chunk = 0;
+    cancelled = false;
+    QObject::connect(hp, &HP8751A::set_parameters_finished, this, &ZoomSweep::set_parameters_finished);
+    QObject::connect(hp, &HP8751A::sweep_cancelled, this, [=] {
+        if (state == STATE_SWEEP) {
+            stop();
+        }
+    });
+    QObject::connect(hp, &HP8751A::response_timeout, this, [=] {
+        if (busy()) {
+            stop();
+        }
+    });
+}
+
+void ZoomSweep::start(HP8751A::instrument_parameters_t param, quint32 fStart, quint32 fStop, quint16 points)
+{
+    if (busy() || fStop <= fStart) {
+        return;
+    }
+
+    // Equal parts on the log axis, each sweep gets its share of the points
+    chunks.clear();
+    double step = std::log10((double)fStop / fStart) / CHUNKS;
+    quint32 start = fStart;
+    for (int i = 1; i <= CHUNKS; i++) {
+        quint32 stop = i == CHUNKS ? fStop : (quint32)std::round(fStart * std::pow(10, i * step));
+        if (stop > start) {
+            chunks.append({start, stop});
+            start = stop;
+        }
+    }
+
+    param.sweepType = HP8751A::SWEEP_LOG;
+    param.segments.clear();
+    param.points = qMax(2, points / (int)chunks.size());
+    param.clearPowerTrip = false;
+    this->param = param;
+
+    zoomData = HP8751A::instrument_data_t();
+    chunk = 0;
+    cancelled = false;
+    // The chunks need plain sweeps, the window sets its refinement again before the next regular sweep
+    hp->set_refinement(nullptr, 0);
+    next_chunk();
+}
+
+void ZoomSweep::cancel()
+{
+    if (state == STATE_SWEEP) {
+        hp->request_cancel();
+    }
+    cancelled = true;
+}
+
+void ZoomSweep::next_chunk()
+{
+    param.fStart = chunks.at(chunk).fStart;
+    param.fStop = chunks.at(chunk).fStop;
+    state = STATE_PARAMETERS;
+    hp->set_instrument_parameters(param);
+}
+
+void ZoomSweep::set_parameters_finished()
+{
+    if (state != STATE_PARAMETERS) {
+        return;
+    }
+    if (cancelled) {
+        stop();
+        return;
+    }
+    state = STATE_SWEEP;
+    hp->request_partial_sweep();
+}
+
+bool ZoomSweep::consume(const HP8751A::instrument_data_t &data)
+{
+    if (state != STATE_SWEEP) {
+        return false;
+    }
+
+    // Neighbouring chunks share their boundary frequency
+    int first = 0;
+    if (!zoomData.stimulus.isEmpty() && !data.stimulus.isEmpty() && data.stimulus.first() <= zoomData.stimulus.last()) {
+        first = 1;
+    }
+    for (int i = first; i < data.stimulus.size(); i++) {
+        zoomData.stimulus.append(data.stimulus.at(i));
+        zoomData.channel1.append(data.channel1.at(i));
+        zoomData.channel2.append(data.channel2.at(i));
+    }
+    chunk++;
+    emit progress(chunk, chunks.size());
+
+    if (cancelled || chunk >= chunks.size()) {
+        stop();
+    } else {
+        next_chunk();
+    }
+    return true;
+}
+
+HP8751A::instrument_data_t ZoomSweep::merged(const HP8751A::instrument_data_t &full) const
+{
+    if (zoomData.stimulus.isEmpty()) {
+        return full;
+    }
+    const float fStart = zoomData.stimulus.first();
+    const float fStop = zoomData.stimulus.last();
+
+    HP8751A::instrument_data_t data = full;
+    data.stimulus.clear();
+    data.channel1.clear();
+    data.channel2.clear();
+    data.raw.clear();
+
+    int i = 0;
+    const int n = full.stimulus.size();
+    for (; i < n && full.stimulus.at(i) < fStart; i++) {
+        data.stimulus.append(full.stimulus.at(i));
+        data.channel1.append(full.channel1.at(i));
+        data.channel2.append(full.channel2.at(i));
+    }
+    data.stimulus.append(zoomData.stimulus);
+    data.channel1.append(zoomData.channel1);
+    data.channel2.append(zoomData.channel2);
+    for (; i < n; i++) {
+        if (full.stimulus.at(i) > fStop) {
+            data.stimulus.append(full.stimulus.at(i));
+            data.channel1.append(full.channel1.at(i));
+            data.channel2.append(full.channel2.at(i));
+        }
+    }
+    return data;
+}
+
+void ZoomSweep::stop()
+{
+    state = STATE_IDLE;
+    emit finished();
+}
@@ -0,0 +1,53 @@
+#ifndef ZOOMSWEEP_H
+#define ZOOMSWEEP_H
+
+#include <QObject>
+#include "hp8751a.h"
+
+// Sweeps a narrow span in a few consecutive log sweeps, so the chart can be updated after each of them.
+// The data of the sweeps is handed in by the window through consume(), the window's regular
+// new_data() handling is skipped for them.
+class ZoomSweep : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ZoomSweep(HP8751A *hp, QObject *parent = nullptr);
+
+    static constexpr int CHUNKS = 4;
+
+    // Sweep fStart to fStop with points in total. The other settings are taken from param.
+    void start(HP8751A::instrument_parameters_t param, quint32 fStart, quint32 fStop, quint16 points);
+    void cancel();
+    bool busy() const { return state != STATE_IDLE; }
+
+    // Returns false if the data does not belong to a zoom sweep
+    bool consume(const HP8751A::instrument_data_t &data);
+
+    // Full span trace with the points of the zoom sweeps so far in place of the ones they cover
+    HP8751A::instrument_data_t merged(const HP8751A::instrument_data_t &full) const;
+
+private:
+    HP8751A *hp = nullptr;
+    HP8751A::instrument_parameters_t param;
+    QVector<HP8751A::span_t> chunks;
+    int chunk;
+    HP8751A::instrument_data_t zoomData;
+
+    enum state_t {
+        STATE_IDLE,
+        STATE_PARAMETERS,
+        STATE_SWEEP
+    };
+    state_t state;
+    bool cancelled;
+
+    void next_chunk();
+    void set_parameters_finished();
+    void stop();
+
+signals:
+    void progress(int done, int total);
+    void finished();
+};
+
+#endif // ZOOMSWEEP_H